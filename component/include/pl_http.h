@@ -1,5 +1,21 @@
 #pragma once
 #include "pl_http_types.h"
+#include "pl_http_arena.h"
+#include "pl_http_request.h"
 #include "pl_http_client.h"
+#include "pl_http_scheduler.h"
+#include "pl_http_async_client.h"
+#include "pl_http_rate_limiter.h"
 #include "pl_http_server_transaction.h"
-#include "pl_http_server.h"
\ No newline at end of file
+#include "pl_http_server.h"
+#include "pl_http_middleware.h"
+#include "pl_http_payload.h"
+#include "pl_http_head_parser.h"
+#include "pl_http_request_parser.h"
+#include "pl_http_epoll_server.h"
+#include "pl_http_proxy.h"
+#include "pl_http_upload_queue.h"
+#include "pl_http_latency_histogram.h"
+#include "pl_http_load_generator.h"
+#include "pl_http_link_emulator.h"
+#include "pl_http_tracer.h"
\ No newline at end of file
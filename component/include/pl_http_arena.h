@@ -0,0 +1,95 @@
+#pragma once
+#include "pl_common.h"
+#include "esp_heap_caps.h"
+#include <cstddef>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Bump allocator for request-scoped data. Allocations are not freed one by one: they are all released by Reset.
+class HttpArena {
+public:
+  /// @brief Creates an arena
+  /// @param size arena size
+  /// @param caps heap capabilities of the arena memory (e.g. MALLOC_CAP_SPIRAM)
+  HttpArena(size_t size, uint32_t caps = MALLOC_CAP_DEFAULT);
+  ~HttpArena();
+  HttpArena(const HttpArena&) = delete;
+  HttpArena& operator=(const HttpArena&) = delete;
+
+  /// @brief Allocates memory in the arena
+  /// @param size number of bytes
+  /// @param alignment alignment (power of 2)
+  /// @return allocated memory (NULL if the arena does not have enough free space)
+  void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+  /// @brief Releases all allocations
+  void Reset();
+
+  /// @brief Checks if the memory belongs to the arena
+  /// @param ptr memory
+  /// @return true if the memory has been allocated in the arena
+  bool Contains(const void* ptr);
+
+  /// @brief Gets the arena size
+  /// @return size in bytes
+  size_t GetSize();
+
+  /// @brief Gets the allocated size
+  /// @return size in bytes
+  size_t GetUsedSize();
+
+private:
+  uint8_t* data;
+  size_t size;
+  size_t usedSize = 0;
+};
+
+//==============================================================================
+
+/// @brief Standard library allocator using the arena. When the arena is full, the memory is allocated from the heap.
+/// Deallocating arena memory does nothing: it is released by HttpArena::Reset.
+template <class T>
+class HttpArenaAllocator {
+public:
+  using value_type = T;
+
+  /// @brief Creates an allocator
+  /// @param arena arena
+  HttpArenaAllocator(HttpArena& arena) : arena(&arena) {}
+
+  template <class U>
+  HttpArenaAllocator(const HttpArenaAllocator<U>& other) : arena(other.arena) {}
+
+  /// @brief Allocates memory for the objects
+  /// @param n number of objects
+  /// @return allocated memory
+  T* allocate(size_t n) {
+    void* ptr = arena->Allocate(n * sizeof(T), alignof(T));
+    return (T*)(ptr ? ptr : ::operator new(n * sizeof(T)));
+  }
+
+  /// @brief Deallocates the memory
+  /// @param ptr memory
+  /// @param n number of objects
+  void deallocate(T* ptr, size_t n) {
+    if (!arena->Contains(ptr))
+      ::operator delete(ptr);
+  }
+
+  template <class U>
+  bool operator==(const HttpArenaAllocator<U>& other) const { return arena == other.arena; }
+  template <class U>
+  bool operator!=(const HttpArenaAllocator<U>& other) const { return arena != other.arena; }
+
+private:
+  template <class U> friend class HttpArenaAllocator;
+  HttpArena* arena;
+};
+
+//==============================================================================
+
+}
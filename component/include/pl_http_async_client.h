@@ -0,0 +1,160 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_http_types.h"
+#include "pl_http_scheduler.h"
+#include "pl_http_head_parser.h"
+#include "esp_tls.h"
+#ifdef __cpp_impl_coroutine
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Coroutine HTTP/HTTPS client class. Its operations are awaited by the coroutines run by the scheduler and suspend them
+/// while the non-blocking connection socket is not ready, so one scheduler task serves any number of concurrent requests.
+/// The client is not lockable: it should only be used by the coroutines of one scheduler.
+class HttpAsyncClient {
+public:
+  /// @brief Default HTTP port
+  static constexpr uint16_t defaultHttpPort = 80;
+  /// @brief Default HTTPS port
+  static constexpr uint16_t defaultHttpsPort = 443;
+  /// @brief Default operation timeout in FreeRTOS ticks
+  static constexpr TickType_t defaultTimeout = 5000 / portTICK_PERIOD_MS;
+  /// @brief Default buffer size. A response head is parsed in place if it fits in the buffer, otherwise it is read line by line
+  /// and each line should fit in the buffer.
+  static constexpr size_t defaultBufferSize = 1024;
+
+  /// @brief Creates an HTTP client
+  /// @param scheduler scheduler running the coroutines
+  /// @param hostname hostname
+  /// @param bufferSize buffer size
+  HttpAsyncClient(HttpScheduler& scheduler, const std::string& hostname, size_t bufferSize = defaultBufferSize);
+
+  /// @brief Creates an HTTPS client
+  /// @param scheduler scheduler running the coroutines
+  /// @param hostname hostname
+  /// @param serverCertificate server certificate
+  /// @param bufferSize buffer size
+  HttpAsyncClient(HttpScheduler& scheduler, const std::string& hostname, const char* serverCertificate, size_t bufferSize = defaultBufferSize);
+
+  /// @brief Creates an HTTPS client
+  /// @param scheduler scheduler running the coroutines
+  /// @param hostname hostname
+  /// @param crt_bundle_attach function pointer to esp_crt_bundle_attach
+  /// @param bufferSize buffer size
+  HttpAsyncClient(HttpScheduler& scheduler, const std::string& hostname, esp_err_t (*crt_bundle_attach)(void *conf), size_t bufferSize = defaultBufferSize);
+
+  ~HttpAsyncClient();
+  HttpAsyncClient(const HttpAsyncClient&) = delete;
+  HttpAsyncClient& operator=(const HttpAsyncClient&) = delete;
+
+  /// @brief Sends the request and receives the response headers. The connection is opened if needed and kept alive.
+  /// If the previous response body has not been read to the end, the connection is reopened.
+  /// An idempotent request (GET, HEAD, OPTIONS, PUT, DELETE) is sent once more over a new connection
+  /// if the server has closed the kept-alive connection without a response.
+  /// The coroutine starts when it is awaited or spawned, so the URI and the body are copied into it, while the status code
+  /// should outlive it.
+  /// @param method HTTP method
+  /// @param uri URI
+  /// @param body body
+  /// @param statusCode status code
+  /// @return coroutine
+  HttpTask Send(HttpMethod method, std::string uri, std::string body, ushort& statusCode);
+
+  /// @brief Reads the next part of the response body
+  /// @param dest destination
+  /// @param maxSize maximum number of bytes to read
+  /// @param size number of bytes read (0 at the end of the body)
+  /// @return coroutine
+  HttpTask ReadResponseBody(void* dest, size_t maxSize, size_t& size);
+
+  /// @brief Closes the connection
+  /// @return error code
+  esp_err_t Disconnect();
+
+  /// @brief Gets the remote port
+  /// @return port
+  uint16_t GetPort();
+
+  /// @brief Sets the remote port. The open connection is closed.
+  /// @param port port
+  /// @return error code
+  esp_err_t SetPort(uint16_t port);
+
+  /// @brief Gets the operation timeout
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetTimeout();
+
+  /// @brief Sets the timeout of each connect, send and receive wait
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetTimeout(TickType_t timeout);
+
+  /// @brief Sets the request header
+  /// @param name header name
+  /// @param value header value
+  /// @return error code
+  esp_err_t SetRequestHeader(const std::string& name, const std::string& value);
+
+  /// @brief Deletes the request header
+  /// @param name header name
+  /// @return error code
+  esp_err_t DeleteRequestHeader(const std::string& name);
+
+  /// @brief Gets the response header value
+  /// @param name header name
+  /// @param value header value
+  /// @return error code
+  esp_err_t GetResponseHeader(const std::string& name, std::string& value);
+
+  /// @brief Gets the response body size
+  /// @return body size (SIZE_MAX if unknown)
+  size_t GetResponseBodySize();
+
+private:
+  enum class BodyState {
+    none,
+    contentLength,
+    chunkSize,
+    chunkData,
+    chunkEnd,
+    trailer,
+    untilClose
+  };
+
+  HttpScheduler& scheduler;
+  std::string hostname;
+  uint16_t port = defaultHttpPort;
+  bool https = false;
+  const char* serverCertificate = NULL;
+  esp_err_t (*crt_bundle_attach)(void *conf) = NULL;
+  TickType_t timeout = defaultTimeout;
+  std::vector<std::pair<std::string, std::string>> requestHeaders;
+  std::vector<std::pair<std::string, std::string>> responseHeaders;
+  esp_tls_t* tls = NULL;
+  int sockfd = -1;
+  std::unique_ptr<char[]> buffer;
+  size_t bufferSize;
+  size_t bufferStart = 0, bufferEnd = 0;
+  BodyState bodyState = BodyState::none;
+  size_t responseBodySize = 0;
+  size_t bodyRemainingSize = 0;
+  bool closeAfterResponse = false;
+  HttpResponseParser responseParser;
+
+  HttpTask Connect();
+  HttpTask Write(const void* src, size_t size);
+  HttpTask Fill();
+  HttpTask ReadResponseHead(ushort& statusCode);
+  HttpTask ReadLongResponseHead(ushort& statusCode);
+  HttpTask ReadLine(std::string& line);
+};
+
+//==============================================================================
+
+}
+
+#endif
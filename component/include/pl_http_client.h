@@ -2,6 +2,7 @@
 #include "pl_common.h"
 #include "pl_network.h"
 #include "pl_http_types.h"
+#include "pl_http_request.h"
 #include "esp_http_client.h"
 
 //==============================================================================
@@ -10,6 +11,10 @@ namespace PL {
 
 //==============================================================================
 
+class HttpTracer;
+
+//==============================================================================
+
 /// @brief HTTP/HTTPS client class
 class HttpClient : public Lockable {
 public:
@@ -21,8 +26,26 @@ public:
   static constexpr TickType_t defaultReadTimeout = 5000 / portTICK_PERIOD_MS;
   /// @brief Default write operation timeout in FreeRTOS ticks
   static constexpr TickType_t defaultWriteTimeout = 5000 / portTICK_PERIOD_MS;
+  /// @brief Default "100 Continue" interim response timeout in FreeRTOS ticks (0: "Expect: 100-continue" is not used)
+  static constexpr TickType_t defaultContinueTimeout = 0;
   /// @brief Default header buffer size
   static constexpr size_t defaultHeaderBufferSize = 1024;
+  /// @brief Request body chunk size used when the body is pulled from a source or a stream
+  static constexpr size_t requestBodyChunkSize = 512;
+  /// @brief Maximum number of hosts with a cached Digest authentication challenge
+  static constexpr size_t maxNumberOfCachedAuthChallenges = 8;
+  /// @brief Default request policy (no retries, no deadline, no hedging, no circuit breaker)
+  static const HttpRequestPolicy defaultRequestPolicy;
+  /// @brief Number of recent response times the hedging percentile is computed from
+  static constexpr size_t numberOfResponseTimeSamples = 20;
+  /// @brief Maximum number of hosts with a circuit breaker
+  static constexpr size_t maxNumberOfCircuitBreakers = 8;
+  /// @brief Maximum number of hosts with a cached address
+  static constexpr size_t maxNumberOfCachedAddresses = 8;
+  /// @brief Time the resolved host address is cached for in seconds (CONFIG_PL_HTTP_CLIENT_DNS_CACHE_TIME)
+  static constexpr uint32_t addressCacheTime = CONFIG_PL_HTTP_CLIENT_DNS_CACHE_TIME;
+  /// @brief Maximum hostname size
+  static constexpr size_t maxHostnameSize = 253;
 
   /// @brief Creates an HTTP client
   /// @param hostname hostname
@@ -59,11 +82,21 @@ public:
   /// @return error code
   esp_err_t WriteRequestHeaders(HttpMethod method, const std::string& uri, size_t bodySize);
 
-  /// @brief Writes the request body
+  /// @brief Writes the request headers for a body of unknown size (chunked transfer encoding)
+  /// @param method HTTP method
+  /// @param uri URI
+  /// @return error code
+  esp_err_t WriteRequestHeaders(HttpMethod method, const std::string& uri);
+
+  /// @brief Writes the request body (as a single chunk if the body size is unknown)
   /// @param src source
   /// @param size number of bytes to write
   /// @return error code
   esp_err_t WriteRequestBody(const void* src, size_t size);
+
+  /// @brief Ends the chunked request body (does nothing if the body size is known)
+  /// @return error code
+  esp_err_t EndRequestBody();
   
   /// @brief Writes the request
   /// @param method HTTP method
@@ -78,6 +111,66 @@ public:
   /// @return 
   esp_err_t WriteRequest(HttpMethod method, const std::string& uri);
 
+  /// @brief Writes the request with the body consisting of several fragments
+  /// @param method HTTP method
+  /// @param uri URI
+  /// @param fragments body fragments
+  /// @param numberOfFragments number of body fragments
+  /// @return error code
+  esp_err_t WriteRequest(HttpMethod method, const std::string& uri, const HttpBodyFragment* fragments, size_t numberOfFragments);
+
+  /// @brief Writes the request with the body of unknown size pulled from the source (chunked transfer encoding)
+  /// @param method HTTP method
+  /// @param uri URI
+  /// @param source body source
+  /// @return error code
+  esp_err_t WriteRequest(HttpMethod method, const std::string& uri, const HttpBodySource& source);
+
+  /// @brief Writes the request with the body read from the stream. A body of up to requestBodyChunkSize bytes is read before the request is opened
+  /// and written right after the head like a single body fragment (esp_http_client writes the head itself, so the head and the body are separate writes).
+  /// A larger body is read and written in requestBodyChunkSize chunks.
+  /// @param method HTTP method
+  /// @param uri URI
+  /// @param stream body stream
+  /// @param bodySize body size
+  /// @return error code
+  esp_err_t WriteRequest(HttpMethod method, const std::string& uri, Stream& stream, size_t bodySize);
+
+  /// @brief Writes the prepared request. If the request is sent again by the client, its URL and headers are not applied again.
+  /// An absolute URL switches the client to its host (HTTPS URLs require a client created with a server certificate or a certificate bundle),
+  /// a relative URL and the other WriteRequest methods use the host the client has been created with.
+  /// The client request headers are sent as well and should not be repeated in the request.
+  /// @param request request
+  /// @return error code
+  esp_err_t WriteRequest(const HttpRequest& request);
+
+  /// @brief Writes the request and reads the response headers applying the request policy: failed attempts are retried
+  /// with a backoff and a slow attempt is hedged within the request deadline. The response body is read with ReadResponseBody.
+  /// If the circuit breaker of the host is open, ESP_ERR_INVALID_STATE is returned without sending the request.
+  /// @param method HTTP method
+  /// @param uri URI
+  /// @param body body
+  /// @param statusCode status code
+  /// @param bodySize body size
+  /// @return error code
+  esp_err_t SendRequest(HttpMethod method, const std::string& uri, const std::string& body, ushort& statusCode, size_t* bodySize);
+
+  /// @brief Writes the request with an empty body and reads the response headers applying the request policy
+  /// @param method HTTP method
+  /// @param uri URI
+  /// @param statusCode status code
+  /// @param bodySize body size
+  /// @return error code
+  esp_err_t SendRequest(HttpMethod method, const std::string& uri, ushort& statusCode, size_t* bodySize);
+
+  /// @brief Writes the prepared request and reads the response headers applying the request policy.
+  /// A request with a body source is not retried.
+  /// @param request request
+  /// @param statusCode status code
+  /// @param bodySize body size
+  /// @return error code
+  esp_err_t SendRequest(const HttpRequest& request, ushort& statusCode, size_t* bodySize);
+
   /// @brief Reads the response headers
   /// @param statusCode status code
   /// @param bodySize body size
@@ -90,15 +183,22 @@ public:
   /// @return error code
   esp_err_t ReadResponseBody(void* dest, size_t size);
 
+  /// @brief Reads the next part of the response body (for a body of unknown size or a body relayed in parts)
+  /// @param dest destination
+  /// @param maxSize maximum number of bytes to read
+  /// @param size number of bytes read (0 at the end of the body)
+  /// @return error code
+  esp_err_t ReadResponseBody(void* dest, size_t maxSize, size_t& size);
+
   /// @brief Disconnects from the server
   /// @return error code
   esp_err_t Disconnect();
 
-  /// @brief Gets the remote port
+  /// @brief Gets the remote port of the host the client has been created with
   /// @return port
   uint16_t GetPort();
 
-  /// @brief Sets the remote port
+  /// @brief Sets the remote port of the host the client has been created with
   /// @param port port
   /// @return error code
   esp_err_t SetPort(uint16_t port);
@@ -121,7 +221,48 @@ public:
   /// @return error code
   esp_err_t SetWriteTimeout(TickType_t timeout);
 
-  /// @brief Sets the request authentication scheme
+  /// @brief Gets the "100 Continue" interim response timeout
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetContinueTimeout();
+
+  /// @brief Sets the "100 Continue" interim response timeout.
+  /// If not zero, requests with a body are sent with "Expect: 100-continue" and the body is only sent after the interim response
+  /// or the timeout. If the server responds with a final status code instead, the body is not sent.
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetContinueTimeout(TickType_t timeout);
+
+  /// @brief Gets the phase timings of the last request
+  /// @return timings
+  HttpClientTimings GetTimings();
+
+  /// @brief Clears the host address cache shared by all clients
+  /// @return error code
+  static esp_err_t ClearAddressCache();
+
+  /// @brief Gets the request policy
+  /// @return request policy
+  HttpRequestPolicy GetRequestPolicy();
+
+  /// @brief Sets the request policy used by SendRequest. The circuit breaker state is shared by all clients connected to the same host.
+  /// @param requestPolicy request policy
+  /// @return error code
+  esp_err_t SetRequestPolicy(const HttpRequestPolicy& requestPolicy);
+
+  /// @brief Gets the tracer
+  /// @return tracer (NULL if the request spans are not recorded)
+  HttpTracer* GetTracer();
+
+  /// @brief Sets the tracer the request spans are recorded to. The requests sent by a task handling a traced request
+  /// carry its trace context in the "traceparent" and "tracestate" headers with or without the tracer.
+  /// A client with the tracer starts a new trace for the requests sent without the trace context.
+  /// @param tracer tracer (NULL: the request spans are not recorded). The tracer should exist while it is set.
+  /// @return error code
+  esp_err_t SetTracer(HttpTracer* tracer);
+
+  /// @brief Sets the request authentication scheme.
+  /// Basic credentials are sent with every request. Digest challenges are cached per host and used to authorize the following requests
+  /// without a 401 round trip. The request is only challenged again if the server rejects the cached nonce.
   /// @param scheme authentication scheme
   /// @return error code
   esp_err_t SetAuthScheme(HttpAuthScheme scheme);
@@ -149,16 +290,81 @@ public:
   /// @return error code
   esp_err_t GetResponseHeader(const std::string& name, std::string& value);
 
+  /// @brief Gets all response headers in the received order
+  /// @param headers header names and values
+  /// @return error code
+  esp_err_t GetResponseHeaders(std::vector<std::pair<std::string, std::string>>& headers);
+
 private:
+  struct ResponseHeader {
+    const char* name;
+    size_t nameSize;
+    const char* value;
+    size_t valueSize;
+  };
+
   Mutex mutex;
+  // The host of the current connection: the host the client has been created with or the host of the last request with an absolute URL
   std::string hostname;
+  std::string defaultHostname;
+  // esp_http_client keeps the pointer to the name the server certificate is verified against, so it is stored in a fixed buffer
+  char commonName[maxHostnameSize + 1];
+  uint16_t defaultHostPort = defaultHttpPort;
+  bool defaultHostHttps = false;
   TickType_t readTimeout = defaultReadTimeout;
   TickType_t writeTimeout = defaultWriteTimeout;
+  TickType_t continueTimeout = defaultContinueTimeout;
+  HttpAuthScheme authScheme = HttpAuthScheme::none;
+  std::string username;
+  std::string password;
   std::shared_ptr<Buffer> headerBuffer;
   char* headerDataEnd;
+  // esp_http_client parses the response head itself and passes each header as C strings, so the headers are indexed
+  // when they are stored: the lookups compare the name sizes first and do not rescan the header buffer
+  std::vector<ResponseHeader> responseHeaders;
+  bool chunkedRequestBody = false;
+  bool earlyResponse = false;
+  int64_t earlyResponseBodySize = 0;
+  bool closeBeforeRequest = false;
   esp_http_client_config_t clientConfig = {};
   esp_http_client_handle_t clientHandle = NULL;
+  HttpRequestPolicy requestPolicy = defaultRequestPolicy;
+  TickType_t socketTimeout = portMAX_DELAY;
+  TickType_t attemptStartTime = 0;
+  TickType_t attemptTimeout = portMAX_DELAY;
+  bool connected = false;
+  std::string hostAddress;
+  HttpClientTimings timings = {};
+  int64_t connectionStartTime = 0;
+  TickType_t responseTimes[numberOfResponseTimeSamples];
+  size_t numberOfResponseTimes = 0;
+  uint32_t appliedRequestId = 0;
+  std::vector<std::string> appliedRequestHeaders;
+  HttpTracer* tracer = NULL;
+  bool traceHeadersSet = false;
+  bool traceSpanOpen = false;
+  HttpSpan traceSpan;
 
+  esp_err_t OpenRequest(HttpMethod method, const std::string& uri, int bodySize, const HttpBodyFragment* bodyFragments = NULL, size_t numberOfBodyFragments = 0,
+                        const HttpRequest* request = NULL);
+  esp_err_t WriteChunkedRequestBody(const HttpBodySource& source);
+  esp_err_t WriteRequestData(const void* src, size_t size);
+  esp_err_t SetTimeout(TickType_t timeout);
+  void ClearResponseHeaders();
+  const ResponseHeader* FindResponseHeader(const std::string& name, const ResponseHeader* previousHeader);
+  esp_err_t SetTraceHeaders(HttpMethod method, const std::string& uri);
+  void EndTraceSpan(uint16_t statusCode);
+  esp_err_t SetAuthHeader(HttpMethod method, const std::string& uri, int bodySize, const HttpBodyFragment* bodyFragments, size_t numberOfBodyFragments);
+  void UpdateDigestChallenge();
+  esp_err_t SelectHost(const HttpRequest* request);
+  void SetHostname(const std::string& hostname);
+  esp_err_t GetHostAddresses(std::vector<std::string>& addresses);
+  esp_err_t SetHostAddress(const std::string& address);
+  esp_err_t SendRequest(HttpMethod method, bool replayable, const std::function<esp_err_t()>& writeRequest, ushort& statusCode, size_t* bodySize);
+  esp_err_t SendRequestAttempt(const std::function<esp_err_t()>& writeRequest, ushort& statusCode, size_t* bodySize, TickType_t timeout);
+  TickType_t GetHedgingTime();
+  bool IsCircuitClosed();
+  void UpdateCircuitBreaker(bool success);
   static esp_err_t HandleResponse(esp_http_client_event_t* evt);
 };
 
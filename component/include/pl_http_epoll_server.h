@@ -0,0 +1,279 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_network.h"
+#include "pl_http_server_transaction.h"
+#include "pl_http_request_parser.h"
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <sys/uio.h>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief HTTP server class for the Linux target with a native HTTP/1.1 engine instead of httpd.
+/// Each worker thread runs an epoll event loop pinned to a CPU core and has its own listening socket bound to the port with SO_REUSEPORT,
+/// so the kernel spreads the connections among the workers. The request head is received without blocking and parsed in place
+/// in the connection buffer. The complete request is handed to a pool of handler threads, which receive the body and send the response:
+/// a slow client blocks one handler thread and not the other connections of its worker.
+/// The descendant class should override HandleRequest: a request handler written for HttpServer can be used as it is.
+class HttpEpollServer : public NetworkServer {
+public:
+  /// @brief Default server name
+  static const std::string defaultName;
+  /// @brief Default port
+  static constexpr uint16_t defaultPort = 80;
+  /// @brief Default maximum number of server clients
+  static constexpr size_t defaultMaxNumberOfClients = 1024;
+  /// @brief Default number of worker threads (0: one per CPU core)
+  static constexpr size_t defaultNumberOfWorkers = 0;
+  /// @brief Default number of request handler threads
+  static constexpr size_t defaultNumberOfHandlers = 16;
+  /// @brief Default connection buffer size (the request head should fit in it)
+  static constexpr size_t defaultBufferSize = 4096;
+  /// @brief Default read operation timeout in FreeRTOS ticks
+  static constexpr TickType_t defaultReadTimeout = 5000 / portTICK_PERIOD_MS;
+  /// @brief Default write operation timeout in FreeRTOS ticks
+  static constexpr TickType_t defaultWriteTimeout = 5000 / portTICK_PERIOD_MS;
+  /// @brief Default request timeout in FreeRTOS ticks
+  static constexpr TickType_t defaultRequestTimeout = portMAX_DELAY;
+  /// @brief Default idle connection timeout in FreeRTOS ticks
+  static constexpr TickType_t defaultIdleTimeout = 60000 / portTICK_PERIOD_MS;
+  /// @brief Connection arena size (CONFIG_PL_HTTP_SERVER_ARENA_SIZE)
+  static constexpr size_t arenaSize = CONFIG_PL_HTTP_SERVER_ARENA_SIZE;
+
+  /// @brief Creates an HTTP server
+  /// @param bufferSize connection buffer size
+  HttpEpollServer(size_t bufferSize = defaultBufferSize);
+  ~HttpEpollServer();
+  HttpEpollServer(const HttpEpollServer&) = delete;
+  HttpEpollServer& operator=(const HttpEpollServer&) = delete;
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  esp_err_t Enable() override;
+  esp_err_t Disable() override;
+  bool IsEnabled() override;
+
+  uint16_t GetPort() override;
+
+  /// @brief Sets the port. The running server is restarted.
+  /// @param port port
+  /// @return error code
+  esp_err_t SetPort(uint16_t port) override;
+
+  size_t GetMaxNumberOfClients() override;
+  esp_err_t SetMaxNumberOfClients(size_t maxNumberOfClients) override;
+
+  /// @brief Gets the number of worker threads
+  /// @return number of workers (0: one per CPU core)
+  size_t GetNumberOfWorkers();
+
+  /// @brief Sets the number of worker threads. The running server is restarted.
+  /// @param numberOfWorkers number of workers (0: one per CPU core)
+  /// @return error code
+  esp_err_t SetNumberOfWorkers(size_t numberOfWorkers);
+
+  /// @brief Gets the number of request handler threads
+  /// @return number of handlers
+  size_t GetNumberOfHandlers();
+
+  /// @brief Sets the number of request handler threads: the number of requests handled at once. The running server is restarted.
+  /// @param numberOfHandlers number of handlers
+  /// @return error code
+  esp_err_t SetNumberOfHandlers(size_t numberOfHandlers);
+
+  /// @brief Gets the read operation timeout
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetReadTimeout();
+
+  /// @brief Sets the read operation timeout. The request head should be received within it from its first byte,
+  /// otherwise the request is answered with 408 and the connection is closed.
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetReadTimeout(TickType_t timeout);
+
+  /// @brief Gets the write operation timeout
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetWriteTimeout();
+
+  /// @brief Sets the write operation timeout
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetWriteTimeout(TickType_t timeout);
+
+  /// @brief Gets the request timeout
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetRequestTimeout();
+
+  /// @brief Sets the request timeout: the deadline for the request body receive and the response send counted from the start of the request handling.
+  /// The body receive that exceeds it is answered with 408, the response written after it is replaced with 503.
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetRequestTimeout(TickType_t timeout);
+
+  /// @brief Gets the idle connection timeout
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetIdleTimeout();
+
+  /// @brief Sets the time after which a connection without requests is closed
+  /// @param timeout timeout in FreeRTOS ticks (portMAX_DELAY: idle connections are not closed)
+  /// @return error code
+  esp_err_t SetIdleTimeout(TickType_t timeout);
+
+  /// @brief Gets the number of open connections
+  /// @return number of connections
+  size_t GetNumberOfConnections();
+
+protected:
+  /// @brief Handles the HTTP request. The method is called by the handler threads, which are not FreeRTOS tasks:
+  /// it should lock the data it shares with the standard library synchronization primitives.
+  /// @param transaction transaction
+  /// @return error code
+  virtual esp_err_t HandleRequest(HttpServerTransaction& transaction) = 0;
+
+private:
+  static constexpr size_t maxNumberOfEvents = 64;
+  static constexpr int maintenancePeriodMs = 1000;
+
+  struct Worker;
+
+  // Connection contexts are reused by the following connections of the worker, so that the buffers are allocated once.
+  // While a request is handled, the connection is owned by the handler thread and is not polled by its worker.
+  struct Connection {
+    Worker* worker = NULL;
+    int socket = -1;
+    size_t index = 0;
+    std::unique_ptr<char[]> buffer;
+    size_t dataSize = 0;
+    HttpRequestParser parser;
+    HttpArena arena;
+    std::string responseHeaders;
+    std::string responseHead;
+    std::shared_ptr<NetworkStream> networkStream;
+    int64_t lastActivityTime = 0;
+    int64_t headStartTime = 0;
+    bool handled = false;
+    bool keptAlive = false;
+    Connection* nextFreeConnection = NULL;
+    Connection* nextQueuedConnection = NULL;
+
+    Connection(size_t bufferSize);
+  };
+
+  struct Worker {
+    size_t coreId = 0;
+    int listeningSocket = -1;
+    int epollSocket = -1;
+    int wakeupSocket = -1;
+    std::thread thread;
+    std::vector<Connection*> connections;
+    std::vector<Connection*> closedConnections;
+    Connection* freeConnections = NULL;
+    int64_t lastMaintenanceTime = 0;
+    // The handler threads return the handled connections to the worker through this list and the wakeup event
+    std::mutex handledMutex;
+    Connection* handledConnections = NULL;
+  };
+
+  class Transaction : public HttpServerTransaction {
+  public:
+    Transaction(HttpEpollServer& server, Connection& connection);
+    ~Transaction();
+
+    esp_err_t ReadRequestBody(void* dest, size_t size) override;
+    using HttpServerTransaction::WriteResponse;
+    esp_err_t WriteResponse(uint16_t statusCode, const void* body, size_t bodySize) override;
+    esp_err_t WriteResponseHeaders(uint16_t statusCode) override;
+    esp_err_t WriteResponseBody(const void* src, size_t size) override;
+    esp_err_t EndResponseBody() override;
+
+    std::shared_ptr<NetworkStream> GetNetworkStream() override;
+    HttpMethod GetRequestMethod() override;
+    esp_err_t GetRequestUri(std::string& uri) override;
+    esp_err_t GetRequestHeader(const std::string& name, std::string& value) override;
+    size_t GetRequestBodySize() override;
+    HttpArena& GetArena() override;
+    TickType_t GetRemainingTime() override;
+
+    esp_err_t SetResponseHeader(const std::string& name, const std::string& value) override;
+
+    esp_err_t Begin();
+    esp_err_t End(esp_err_t handlerError);
+    bool IsConnectionKeptAlive();
+
+  private:
+    HttpEpollServer& server;
+    Connection& connection;
+    HttpRequestParser& parser;
+    int64_t startTime;
+    TickType_t requestTimeout;
+    size_t bodySize = 0;
+    size_t bodyRemainingSize = 0;
+    size_t bufferedBodyEnd = 0;
+    size_t bufferedBodyPosition = 0;
+    bool keepAlive = true;
+    bool headRequest = false;
+    bool continueExpected = false;
+    bool continueSent = false;
+    bool contentTypeSet = false;
+    bool responseWritten = false;
+    bool responseHeadPending = false;
+    bool chunkedResponseBody = false;
+
+    void BuildResponseHead(uint16_t statusCode, const char* framingHeader);
+    esp_err_t WriteStatusResponse(uint16_t statusCode);
+    TickType_t GetSendTimeout();
+    esp_err_t Send(iovec* parts, size_t numberOfParts, TickType_t timeout);
+  };
+
+  Mutex mutex;
+  uint16_t port = defaultPort;
+  size_t maxNumberOfClients = defaultMaxNumberOfClients;
+  size_t numberOfWorkers = defaultNumberOfWorkers;
+  size_t numberOfHandlers = defaultNumberOfHandlers;
+  size_t bufferSize;
+  // Timeouts are read by the workers and the handlers as single words
+  TickType_t readTimeout = defaultReadTimeout;
+  TickType_t writeTimeout = defaultWriteTimeout;
+  TickType_t requestTimeout = defaultRequestTimeout;
+  TickType_t idleTimeout = defaultIdleTimeout;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> handlers;
+  // Requests waiting for a handler thread: a list of their connections in the arrival order
+  std::mutex handlerMutex;
+  std::condition_variable handlerCondition;
+  Connection* firstQueuedConnection = NULL;
+  Connection* lastQueuedConnection = NULL;
+  std::atomic<bool> stopRequested{false};
+  std::atomic<size_t> numberOfConnections{0};
+
+  esp_err_t StartWorkers();
+  void StopWorkers();
+  esp_err_t RestartIfEnabled();
+  void Run(Worker& worker);
+  void RunHandler();
+  void AcceptConnections(Worker& worker);
+  void HandleConnection(Worker& worker, Connection& connection);
+  void HandleReceivedRequest(Worker& worker, Connection& connection, bool clientClosed);
+  void ResumeHandledConnections(Worker& worker);
+  bool HandleConnectionRequest(Connection& connection);
+  void RejectRequest(Connection& connection, uint16_t statusCode);
+  void CloseConnection(Worker& worker, Connection& connection);
+  void CloseExpiredConnections(Worker& worker);
+  int GetMaintenancePeriodMs();
+  static int64_t GetTime();
+  static int GetTimeoutMs(TickType_t timeout);
+};
+
+//==============================================================================
+
+}
+
+#endif
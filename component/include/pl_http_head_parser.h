@@ -0,0 +1,153 @@
+#pragma once
+#include "pl_http_types.h"
+#include <string_view>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Zero-copy incremental HTTP/1.1 message head parser base class. The start line and the headers are parsed in place:
+/// the parser stores their offsets in the caller's buffer and does not allocate memory. Parse can be called each time
+/// more data has been received: the lines parsed by the previous calls are not scanned again.
+/// Line ends and header separators are searched for a word (SSE2/NEON vector on the Linux target) at a time.
+class HttpHeadParser {
+public:
+  /// @brief Maximum number of headers
+  static constexpr size_t maxNumberOfHeaders = 64;
+  /// @brief Default maximum head size
+  static constexpr size_t defaultMaxHeadSize = 8192;
+  /// @brief Maximum head size limit
+  static constexpr size_t maxMaxHeadSize = UINT16_MAX;
+
+  /// @brief Creates a parser
+  /// @param maxHeadSize maximum head size including the empty line (up to maxMaxHeadSize)
+  HttpHeadParser(size_t maxHeadSize = defaultMaxHeadSize);
+  virtual ~HttpHeadParser() {}
+
+  /// @brief Resets the parser for the next message
+  virtual void Reset();
+
+  /// @brief Parses the message head
+  /// @param data received data starting with the start line. The data parsed by the previous calls should stay at the start
+  /// (the received data can be moved).
+  /// @param size received data size
+  /// @return error code (ESP_ERR_NOT_FINISHED if the head is incomplete, ESP_ERR_INVALID_ARG if the message is invalid,
+  /// ESP_ERR_INVALID_SIZE if the head is too long or has too many headers)
+  esp_err_t Parse(const char* data, size_t size);
+
+  /// @brief Checks if the message head has been parsed
+  /// @return true if the head is complete
+  bool IsComplete();
+
+  /// @brief Gets the message head size including the empty line
+  /// @return size in bytes
+  size_t GetHeadSize();
+
+  /// @brief Gets the HTTP minor version
+  /// @return 0 for HTTP/1.0, 1 for HTTP/1.1
+  uint8_t GetMinorVersion();
+
+  /// @brief Gets the number of headers
+  /// @return number of headers
+  size_t GetNumberOfHeaders();
+
+  /// @brief Gets the header name
+  /// @param index header index
+  /// @return header name
+  std::string_view GetHeaderName(size_t index);
+
+  /// @brief Gets the header value
+  /// @param index header index
+  /// @return header value without the leading and trailing whitespace
+  std::string_view GetHeaderValue(size_t index);
+
+  /// @brief Finds the header (the name is case-insensitive)
+  /// @param name header name
+  /// @param value header value
+  /// @return true if the header has been found
+  bool FindHeader(std::string_view name, std::string_view& value);
+
+  /// @brief Finds the first occurrence of the character comparing a word or a vector of characters at a time
+  /// @param begin range start
+  /// @param end range end
+  /// @param c character
+  /// @return character pointer (NULL if not found)
+  static const char* FindChar(const char* begin, const char* end, char c);
+
+protected:
+  /// @brief Offset and size of a string in the parsed data
+  struct Span {
+    uint16_t offset;
+    uint16_t size;
+  };
+
+  /// @brief Parsed data
+  const char* data = NULL;
+  /// @brief HTTP minor version
+  uint8_t minorVersion = 1;
+
+  /// @brief Parses the start line
+  /// @param line line start
+  /// @param lineEnd line end without CRLF
+  /// @return error code
+  virtual esp_err_t ParseStartLine(const char* line, const char* lineEnd) = 0;
+
+  /// @brief Parses the HTTP version
+  /// @param version version start ("HTTP/1.x")
+  /// @return error code
+  esp_err_t ParseVersion(const char* version);
+
+  /// @brief Gets the span of the string
+  /// @param begin string start
+  /// @param end string end
+  /// @return span
+  Span GetSpan(const char* begin, const char* end);
+
+  /// @brief Gets the string of the span
+  /// @param span span
+  /// @return string
+  std::string_view GetString(const Span& span);
+
+private:
+  size_t maxHeadSize;
+  size_t parsedSize = 0;
+  size_t scannedSize = 0;
+  bool startLineParsed = false;
+  bool complete = false;
+  Span headerNames[maxNumberOfHeaders];
+  Span headerValues[maxNumberOfHeaders];
+  size_t numberOfHeaders = 0;
+
+  esp_err_t ParseHeader(const char* line, const char* lineEnd);
+};
+
+//==============================================================================
+
+/// @brief Zero-copy incremental HTTP/1.1 response head parser
+class HttpResponseParser : public HttpHeadParser {
+public:
+  using HttpHeadParser::HttpHeadParser;
+
+  void Reset() override;
+
+  /// @brief Gets the response status code
+  /// @return status code
+  uint16_t GetStatusCode();
+
+  /// @brief Gets the response reason phrase
+  /// @return reason phrase (can be empty)
+  std::string_view GetReasonPhrase();
+
+protected:
+  esp_err_t ParseStartLine(const char* line, const char* lineEnd) override;
+
+private:
+  uint16_t statusCode = 0;
+  Span reasonPhrase = {};
+};
+
+//==============================================================================
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Latency histogram with a fixed number of buckets. The values below 64 have their own buckets, each following power of two
+/// is split into 32 buckets, so a percentile is known to about 3% of its value at any scale and recording a value takes constant time.
+class HttpLatencyHistogram {
+public:
+  /// @brief Number of buckets
+  static constexpr size_t numberOfBuckets = 1024;
+  /// @brief Maximum value (larger values are recorded as the maximum one)
+  static constexpr int64_t maxValue = ((int64_t)1 << 36) - 1;
+
+  /// @brief Records the value
+  /// @param value value (e.g. latency in microseconds)
+  void Record(int64_t value);
+
+  /// @brief Adds the values recorded by another histogram
+  /// @param histogram histogram
+  void Merge(const HttpLatencyHistogram& histogram);
+
+  /// @brief Removes all values
+  void Reset();
+
+  /// @brief Gets the number of values
+  /// @return number of values
+  size_t GetCount() const;
+
+  /// @brief Gets the minimum value
+  /// @return minimum value (0 if there are no values)
+  int64_t GetMin() const;
+
+  /// @brief Gets the maximum value
+  /// @return maximum value (0 if there are no values)
+  int64_t GetMax() const;
+
+  /// @brief Gets the mean value
+  /// @return mean value (0 if there are no values)
+  int64_t GetMean() const;
+
+  /// @brief Gets the value below or equal to which the given percentage of the values is
+  /// @param percentile percentile (0-100)
+  /// @return maximum value of the bucket the percentile falls into (0 if there are no values)
+  int64_t GetPercentile(double percentile) const;
+
+  /// @brief Gets the number of values in the bucket
+  /// @param index bucket index
+  /// @return number of values
+  size_t GetBucketCount(size_t index) const;
+
+  /// @brief Gets the minimum value of the bucket
+  /// @param index bucket index
+  /// @return minimum value
+  static int64_t GetBucketMinValue(size_t index);
+
+  /// @brief Gets the maximum value of the bucket
+  /// @param index bucket index
+  /// @return maximum value
+  static int64_t GetBucketMaxValue(size_t index);
+
+  /// @brief Gets the index of the bucket the value is recorded in
+  /// @param value value
+  /// @return bucket index
+  static size_t GetBucketIndex(int64_t value);
+
+private:
+  uint32_t counts[numberOfBuckets] = {};
+  size_t count = 0;
+  int64_t min = 0;
+  int64_t max = 0;
+  int64_t sum = 0;
+};
+
+//==============================================================================
+
+}
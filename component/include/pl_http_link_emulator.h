@@ -0,0 +1,147 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_http_types.h"
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Network link emulator class for the Linux target. The emulator is a TCP relay: it accepts the client connections on its port,
+/// connects each of them to the target and delays, throttles, loses (delays by the retransmission timeout) and resets the relayed data
+/// according to the link profile, so that a client and a server on one host can be tested over a slow and lossy link.
+/// The relay thread is not a FreeRTOS task.
+class HttpLinkEmulator : public Lockable {
+public:
+  /// @brief Default link profile (no delay, no losses)
+  static const HttpLinkProfile defaultProfile;
+  /// @brief Segment size: the relayed data is split into segments that are delayed, lost and counted separately
+  static constexpr size_t segmentSize = 1460;
+  /// @brief Maximum number of bytes queued in each direction of a connection (the source is not read while the queue is full)
+  static constexpr size_t maxQueuedSize = 65536;
+  /// @brief Maximum number of successive losses of one segment
+  static constexpr int maxNumberOfRetransmissions = 6;
+
+  /// @brief Creates a link emulator
+  /// @param port emulator port the clients connect to
+  /// @param targetHost target hostname or address
+  /// @param targetPort target port
+  HttpLinkEmulator(uint16_t port, const std::string& targetHost, uint16_t targetPort);
+  ~HttpLinkEmulator();
+  HttpLinkEmulator(const HttpLinkEmulator&) = delete;
+  HttpLinkEmulator& operator=(const HttpLinkEmulator&) = delete;
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Starts the relay thread
+  /// @return error code
+  esp_err_t Enable();
+
+  /// @brief Stops the relay thread and closes the connections
+  /// @return error code
+  esp_err_t Disable();
+
+  /// @brief Checks if the relay thread is running
+  /// @return true if the emulator is enabled
+  bool IsEnabled();
+
+  /// @brief Gets the emulator port
+  /// @return port
+  uint16_t GetPort();
+
+  /// @brief Gets the link profile
+  /// @return profile
+  HttpLinkProfile GetProfile();
+
+  /// @brief Sets the link profile. The profile is applied to the data received after the call.
+  /// @param profile profile
+  /// @return error code
+  esp_err_t SetProfile(const HttpLinkProfile& profile);
+
+  /// @brief Resets all open connections
+  /// @return error code
+  esp_err_t ResetConnections();
+
+  /// @brief Gets the number of open connections
+  /// @return number of connections
+  size_t GetNumberOfConnections();
+
+  /// @brief Gets the link statistics
+  /// @return statistics
+  HttpLinkStatistics GetStatistics();
+
+  /// @brief Resets the link statistics
+  /// @return error code
+  esp_err_t ResetStatistics();
+
+private:
+  // A segment of zero size is the end of the stream
+  struct Segment {
+    int64_t deliveryTime;
+    size_t size;
+  };
+
+  struct Direction {
+    int* source;
+    int* destination;
+    std::string data;
+    size_t dataStart = 0;
+    std::deque<Segment> segments;
+    int64_t linkFreeTime = 0;
+    int64_t lastDeliveryTime = 0;
+    bool endOfStream = false;
+    bool closed = false;
+    bool blocked = false;
+  };
+
+  struct Connection {
+    int clientSocket = -1;
+    int serverSocket = -1;
+    Direction uplink;
+    Direction downlink;
+    uint64_t randomState;
+
+    Connection(int clientSocket, int serverSocket, uint64_t randomState);
+  };
+
+  Mutex mutex;
+  uint16_t port;
+  std::string targetHost;
+  uint16_t targetPort;
+  int listeningSocket = -1;
+  int wakeupSocket = -1;
+  std::thread thread;
+  std::vector<std::unique_ptr<Connection>> connections;
+  std::atomic<bool> stopRequested{false};
+  std::atomic<bool> resetRequested{false};
+  std::atomic<size_t> numberOfConnections{0};
+  // Profile and statistics shared with the relay thread
+  std::mutex linkMutex;
+  HttpLinkProfile profile = defaultProfile;
+  HttpLinkStatistics statistics = {};
+
+  void Run();
+  void AcceptConnection();
+  int ConnectToTarget();
+  bool Receive(Connection& connection, Direction& direction, const HttpLinkProfile& profile, int64_t time);
+  bool Deliver(Direction& direction, int64_t time);
+  void ResetConnection(Connection& connection);
+  void CloseConnection(Connection& connection);
+  void Wakeup();
+  static double GetRandom(uint64_t& state);
+  static int64_t GetTime();
+};
+
+//==============================================================================
+
+}
+
+#endif
@@ -0,0 +1,122 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_http_client.h"
+#include "pl_http_latency_histogram.h"
+#include "freertos/task.h"
+#include <atomic>
+#include <memory>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief HTTP load generator class. The client tasks send the requests of a weighted request mix to the host in a closed or an open loop
+/// and record the latency distribution. The request mix and the open-loop arrival times are drawn from a generator seeded with the profile seed,
+/// so a load can be repeated exactly (e.g. through HttpLinkEmulator) to tune or regression-test the client timeouts, retries and connection reuse.
+class HttpLoadGenerator : public Lockable {
+public:
+  /// @brief Default client task parameters
+  static const TaskParameters defaultTaskParameters;
+  /// @brief Default load profile
+  static const HttpLoadProfile defaultProfile;
+  /// @brief Size of the buffer the response bodies are read into and discarded
+  static constexpr size_t responseBodyBufferSize = 512;
+
+  /// @brief Creates a load generator
+  /// @param hostname hostname
+  /// @param port port
+  /// @param taskParameters client task parameters
+  HttpLoadGenerator(const std::string& hostname, uint16_t port = HttpClient::defaultHttpPort, const TaskParameters& taskParameters = defaultTaskParameters);
+  HttpLoadGenerator(const HttpLoadGenerator&) = delete;
+  HttpLoadGenerator& operator=(const HttpLoadGenerator&) = delete;
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Adds the request to the request mix
+  /// @param request request
+  /// @return error code
+  esp_err_t AddRequest(const HttpLoadRequest& request);
+
+  /// @brief Removes all requests from the request mix
+  /// @return error code
+  esp_err_t RemoveRequests();
+
+  /// @brief Gets the load profile
+  /// @return profile
+  HttpLoadProfile GetProfile();
+
+  /// @brief Sets the load profile
+  /// @param profile profile
+  /// @return error code
+  esp_err_t SetProfile(const HttpLoadProfile& profile);
+
+  /// @brief Gets the request policy of the clients
+  /// @return request policy
+  HttpRequestPolicy GetRequestPolicy();
+
+  /// @brief Sets the request policy of the clients (retries, deadline, hedging, circuit breaker)
+  /// @param requestPolicy request policy
+  /// @return error code
+  esp_err_t SetRequestPolicy(const HttpRequestPolicy& requestPolicy);
+
+  /// @brief Gets the read timeout of the clients
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetReadTimeout();
+
+  /// @brief Sets the read timeout of the clients
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetReadTimeout(TickType_t timeout);
+
+  /// @brief Runs the load: starts the client tasks and waits until the number of requests or the duration of the profile is reached
+  /// @param statistics load statistics
+  /// @return error code
+  esp_err_t Run(HttpLoadStatistics& statistics);
+
+  /// @brief Gets the latency distribution of the last run
+  /// @return latency histogram (microseconds)
+  HttpLatencyHistogram GetLatencyHistogram();
+
+private:
+  struct Client {
+    HttpLoadGenerator& generator;
+    HttpClient client;
+    HttpLatencyHistogram latencyHistogram;
+    HttpLoadStatistics statistics = {};
+    char responseBody[responseBodyBufferSize];
+
+    Client(HttpLoadGenerator& generator);
+  };
+
+  Mutex mutex;
+  std::string hostname;
+  uint16_t port;
+  TaskParameters taskParameters;
+  std::vector<HttpLoadRequest> requests;
+  uint64_t totalWeight = 0;
+  HttpLoadProfile profile = defaultProfile;
+  HttpRequestPolicy requestPolicy = HttpClient::defaultRequestPolicy;
+  TickType_t readTimeout = HttpClient::defaultReadTimeout;
+  HttpLatencyHistogram latencyHistogram;
+  // Run state shared by the client tasks. The requests are claimed one at a time under the schedule mutex.
+  Mutex scheduleMutex;
+  int64_t endTime = 0;
+  size_t nextRequestIndex = 0;
+  double nextScheduledTime = 0;
+  std::atomic<bool> stopRequested{false};
+  TaskHandle_t runTaskHandle = NULL;
+
+  static void TaskCode(void* parameters);
+  void RunClient(Client& client);
+  bool ClaimRequest(size_t& index, int64_t& scheduledTime);
+  esp_err_t SendRequest(Client& client, const HttpLoadRequest& request);
+  const HttpLoadRequest& SelectRequest(size_t index);
+  static uint64_t Hash(uint64_t value);
+};
+
+//==============================================================================
+
+}
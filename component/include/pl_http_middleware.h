@@ -0,0 +1,123 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_http_server_transaction.h"
+#include "pl_http_server.h"
+#include <tuple>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief HTTP/HTTPS server transaction filter class. It forwards all calls to the inner transaction.
+/// A middleware passes a descendant of the filter to the next stage to intercept the request body read or the response write.
+class HttpServerTransactionFilter : public HttpServerTransaction {
+public:
+  /// @brief Creates a transaction filter
+  /// @param transaction inner transaction
+  HttpServerTransactionFilter(HttpServerTransaction& transaction);
+
+  std::shared_ptr<NetworkStream> GetNetworkStream() override;
+  esp_err_t ReadRequestBody(void* dest, size_t size) override;
+  using HttpServerTransaction::WriteResponse;
+  esp_err_t WriteResponse(uint16_t statusCode, const void* body, size_t bodySize) override;
+  esp_err_t WriteResponseHeaders(uint16_t statusCode) override;
+  esp_err_t WriteResponseBody(const void* src, size_t size) override;
+  esp_err_t EndResponseBody() override;
+  HttpMethod GetRequestMethod() override;
+  esp_err_t GetRequestUri(std::string& uri) override;
+  esp_err_t GetRequestHeader(const std::string& name, std::string& value) override;
+  size_t GetRequestBodySize() override;
+  HttpArena& GetArena() override;
+  TickType_t GetRemainingTime() override;
+  esp_err_t SetResponseHeader(const std::string& name, const std::string& value) override;
+
+protected:
+  /// @brief Inner transaction
+  HttpServerTransaction& transaction;
+};
+
+//==============================================================================
+
+/// @brief Middleware chain composed at compile time. A middleware is a class with the method
+/// template <class Next> esp_err_t HandleRequest(HttpServerTransaction& transaction, const Next& next).
+/// The method can run code before and after the next(transaction) call, pass an HttpServerTransactionFilter to the next stage
+/// or write the response without calling the next stage. The stages are called directly (not virtually), so the compiler
+/// can inline the whole chain and a middleware without data takes no memory.
+/// @tparam Middlewares middlewares in the call order
+template <class... Middlewares>
+class HttpMiddlewareChain {
+public:
+  /// @brief Gets the middleware
+  /// @tparam Middleware middleware class
+  /// @return middleware
+  template <class Middleware>
+  Middleware& Get() {
+    return std::get<Middleware>(middlewares);
+  }
+
+  /// @brief Handles the request by the middlewares and the handler
+  /// @param transaction transaction
+  /// @param handler handler called by the last middleware with the signature esp_err_t(HttpServerTransaction&)
+  /// @return error code
+  template <class Handler>
+  esp_err_t HandleRequest(HttpServerTransaction& transaction, const Handler& handler) {
+    return HandleRequest<0>(transaction, handler);
+  }
+
+private:
+  std::tuple<Middlewares...> middlewares;
+
+  template <size_t index, class Handler>
+  esp_err_t HandleRequest(HttpServerTransaction& transaction, const Handler& handler) {
+    if constexpr (index == sizeof...(Middlewares))
+      return handler(transaction);
+    else
+      return std::get<index>(middlewares).HandleRequest(transaction, [this, &handler](HttpServerTransaction& transaction) {
+        return HandleRequest<index + 1>(transaction, handler);
+      });
+  }
+};
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+
+//==============================================================================
+
+/// @brief HTTP/HTTPS server with a middleware chain. The descendant class should override HandleEndpointRequest
+/// that is called after the middlewares.
+/// @tparam Middlewares middlewares in the call order
+template <class... Middlewares>
+class HttpMiddlewareServer : public HttpServer {
+public:
+  using HttpServer::HttpServer;
+
+  /// @brief Gets the middleware
+  /// @tparam Middleware middleware class
+  /// @return middleware
+  template <class Middleware>
+  Middleware& GetMiddleware() {
+    return middlewares.template Get<Middleware>();
+  }
+
+protected:
+  esp_err_t HandleRequest(HttpServerTransaction& transaction) final {
+    return middlewares.HandleRequest(transaction, [this](HttpServerTransaction& transaction) {
+      return HandleEndpointRequest(transaction);
+    });
+  }
+
+  /// @brief Handles the HTTP request that has passed the middlewares
+  /// @param transaction transaction (can be a filter of the server transaction)
+  /// @return error code
+  virtual esp_err_t HandleEndpointRequest(HttpServerTransaction& transaction) = 0;
+
+private:
+  HttpMiddlewareChain<Middlewares...> middlewares;
+};
+
+#endif
+
+//==============================================================================
+
+}
@@ -0,0 +1,228 @@
+#pragma once
+#include "pl_http_server_transaction.h"
+#include <memory>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Streaming HTTP response payload writer. The values are encoded as JSON, CBOR or MessagePack into a fixed-size buffer
+/// (taken from the transaction arena if possible) that is sent as a response body chunk when it is full, so the payload
+/// is never built in memory as a whole. A payload that fits in the buffer is sent as a response with a known body size.
+class HttpPayloadWriter {
+public:
+  /// @brief Default buffer size
+  static constexpr size_t defaultBufferSize = 512;
+  /// @brief Maximum map and array nesting depth
+  static constexpr size_t maxDepth = 32;
+
+  /// @brief Creates a writer with the format selected by the request "Accept" header
+  /// @param transaction transaction
+  /// @param bufferSize buffer size
+  HttpPayloadWriter(HttpServerTransaction& transaction, size_t bufferSize = defaultBufferSize);
+
+  /// @brief Creates a writer
+  /// @param transaction transaction
+  /// @param format payload format
+  /// @param bufferSize buffer size
+  HttpPayloadWriter(HttpServerTransaction& transaction, HttpPayloadFormat format, size_t bufferSize = defaultBufferSize);
+
+  HttpPayloadWriter(const HttpPayloadWriter&) = delete;
+  HttpPayloadWriter& operator=(const HttpPayloadWriter&) = delete;
+
+  /// @brief Selects the payload format preferred by the client
+  /// @param accept "Accept" header value
+  /// @return format with the highest quality (JSON if none of the formats is accepted)
+  static HttpPayloadFormat SelectFormat(std::string_view accept);
+
+  /// @brief Gets the payload format content type
+  /// @param format payload format
+  /// @return content type
+  static const char* GetContentType(HttpPayloadFormat format);
+
+  /// @brief Gets the payload format
+  /// @return format
+  HttpPayloadFormat GetFormat();
+
+  /// @brief Begins the response: sets the "Content-Type" and "Vary" headers
+  /// @param statusCode status code
+  /// @return error code
+  esp_err_t Begin(uint16_t statusCode = 200);
+
+  /// @brief Flushes the buffer and ends the response
+  /// @return error code
+  esp_err_t End();
+
+  /// @brief Begins a map. Each entry is written as a key followed by a value.
+  /// @param size number of entries (SIZE_MAX if unknown: not supported by MessagePack)
+  /// @return error code
+  esp_err_t BeginMap(size_t size = SIZE_MAX);
+
+  /// @brief Ends the map
+  /// @return error code
+  esp_err_t EndMap();
+
+  /// @brief Begins an array
+  /// @param size number of elements (SIZE_MAX if unknown: not supported by MessagePack)
+  /// @return error code
+  esp_err_t BeginArray(size_t size = SIZE_MAX);
+
+  /// @brief Ends the array
+  /// @return error code
+  esp_err_t EndArray();
+
+  /// @brief Writes the map key
+  /// @param key key
+  /// @return error code
+  esp_err_t WriteKey(std::string_view key);
+
+  /// @brief Writes null
+  /// @return error code
+  esp_err_t WriteNull();
+
+  /// @brief Writes a boolean
+  /// @param value value
+  /// @return error code
+  esp_err_t WriteBool(bool value);
+
+  /// @brief Writes a signed integer
+  /// @param value value
+  /// @return error code
+  esp_err_t WriteInt(int64_t value);
+
+  /// @brief Writes an unsigned integer
+  /// @param value value
+  /// @return error code
+  esp_err_t WriteUInt(uint64_t value);
+
+  /// @brief Writes a floating-point number (as a single-precision one if it is exact). JSON has no NaN and infinities: they are written as null.
+  /// @param value value
+  /// @return error code
+  esp_err_t WriteDouble(double value);
+
+  /// @brief Writes a text string
+  /// @param value value (UTF-8)
+  /// @return error code
+  esp_err_t WriteString(std::string_view value);
+
+  /// @brief Writes a byte string (as a base64 string in JSON)
+  /// @param data data
+  /// @param size data size
+  /// @return error code
+  esp_err_t WriteBinary(const void* data, size_t size);
+
+private:
+  HttpServerTransaction& transaction;
+  HttpPayloadFormat format;
+  bool formatNegotiated;
+  std::unique_ptr<uint8_t[]> heapBuffer;
+  uint8_t* buffer;
+  size_t bufferSize;
+  size_t dataSize = 0;
+  uint16_t statusCode = 200;
+  bool headersWritten = false;
+  // Nesting state bits: one bit per depth
+  size_t depth = 0;
+  uint32_t mapBits = 0;
+  uint32_t nonEmptyBits = 0;
+  uint32_t indefiniteBits = 0;
+  bool keyWritten = false;
+
+  esp_err_t BeginValue();
+  esp_err_t BeginContainer(bool map, size_t size);
+  esp_err_t EndContainer(bool map);
+  esp_err_t Write(const void* src, size_t size);
+  esp_err_t WriteByte(uint8_t value);
+  esp_err_t WriteHead(uint8_t majorType, uint64_t value);
+  esp_err_t WriteBigEndian(uint8_t type, uint64_t value, size_t size);
+  esp_err_t WriteJsonString(std::string_view value);
+  esp_err_t Flush();
+};
+
+//==============================================================================
+
+/// @brief Streaming HTTP request payload reader. The request body is read in parts into a fixed-size buffer
+/// (taken from the transaction arena if possible) and decoded from JSON, CBOR or MessagePack value by value.
+/// A string should fit in the buffer.
+class HttpPayloadReader {
+public:
+  /// @brief Default buffer size
+  static constexpr size_t defaultBufferSize = 512;
+  /// @brief Maximum map and array nesting depth
+  static constexpr size_t maxDepth = 32;
+
+  /// @brief Creates a reader with the format selected by the request "Content-Type" header (JSON if there is no such header).
+  /// A payload of another content type is not read: GetFormat and Read return ESP_ERR_NOT_SUPPORTED, so the handler can respond with 415.
+  /// @param transaction transaction
+  /// @param bufferSize buffer size
+  HttpPayloadReader(HttpServerTransaction& transaction, size_t bufferSize = defaultBufferSize);
+
+  /// @brief Creates a reader
+  /// @param transaction transaction
+  /// @param format payload format
+  /// @param bufferSize buffer size
+  HttpPayloadReader(HttpServerTransaction& transaction, HttpPayloadFormat format, size_t bufferSize = defaultBufferSize);
+
+  HttpPayloadReader(const HttpPayloadReader&) = delete;
+  HttpPayloadReader& operator=(const HttpPayloadReader&) = delete;
+
+  /// @brief Gets the payload format of the content type
+  /// @param contentType "Content-Type" header value
+  /// @param format payload format
+  /// @return error code (ESP_ERR_NOT_SUPPORTED for other content types)
+  static esp_err_t GetFormat(std::string_view contentType, HttpPayloadFormat& format);
+
+  /// @brief Gets the payload format
+  /// @param format payload format
+  /// @return error code (ESP_ERR_NOT_SUPPORTED if the request content type is not supported)
+  esp_err_t GetFormat(HttpPayloadFormat& format);
+
+  /// @brief Reads the next value. Map and array starts and ends are values too: a map has a key value before each entry value.
+  /// @param value value
+  /// @return error code (ESP_ERR_NOT_FOUND at the payload end, ESP_ERR_INVALID_RESPONSE if the payload is invalid,
+  /// ESP_ERR_INVALID_SIZE if a string does not fit in the buffer, ESP_ERR_NOT_SUPPORTED if the request content type is not supported)
+  esp_err_t Read(HttpPayloadValue& value);
+
+  /// @brief Skips the rest of the current map or array
+  /// @return error code
+  esp_err_t SkipContainer();
+
+private:
+  HttpServerTransaction& transaction;
+  HttpPayloadFormat format;
+  esp_err_t formatError = ESP_OK;
+  std::unique_ptr<uint8_t[]> heapBuffer;
+  uint8_t* buffer;
+  size_t bufferSize;
+  size_t dataStart = 0;
+  size_t dataEnd = 0;
+  size_t bodyRemainingSize;
+  // Remaining number of items of each open container (SIZE_MAX if unknown). Map entries are counted as two items.
+  size_t remainingItems[maxDepth];
+  size_t depth = 0;
+  // Nesting state bits: one bit per depth
+  uint32_t mapBits = 0;
+  uint32_t nonEmptyBits = 0;
+  uint32_t keyBits = 0;
+  bool valueRead = false;
+
+  esp_err_t Fill(size_t size);
+  esp_err_t ReadBytes(size_t size, const uint8_t*& data);
+  esp_err_t ReadBigEndian(size_t size, uint64_t& value);
+  esp_err_t ReadCbor(HttpPayloadValue& value);
+  esp_err_t ReadMessagePack(HttpPayloadValue& value);
+  esp_err_t ReadJson(HttpPayloadValue& value);
+  esp_err_t ReadJsonString(HttpPayloadValue& value);
+  esp_err_t ReadJsonNumber(HttpPayloadValue& value);
+  esp_err_t SkipJsonWhitespace(uint8_t& c);
+  esp_err_t BeginContainer(bool map, size_t size);
+  void EndContainer(HttpPayloadValue& value);
+  void SetInteger(HttpPayloadValue& value, int64_t integer);
+  void SetUnsignedInteger(HttpPayloadValue& value, uint64_t unsignedInteger);
+};
+
+//==============================================================================
+
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_http_client.h"
+#include "pl_http_server_transaction.h"
+#include <vector>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief HTTP/HTTPS reverse proxy class: forwards server transactions to an upstream server.
+/// Request and response bodies are relayed in parts through a fixed-size buffer, so the memory use does not depend on the body size
+/// and the response is sent to the client as soon as its first part is received.
+/// Upstream connections are taken from a pool and kept alive between requests.
+class HttpProxy : public Lockable {
+public:
+  /// @brief Default maximum number of upstream connections
+  static constexpr size_t defaultMaxNumberOfConnections = 1;
+  /// @brief Default relay buffer size
+  static constexpr size_t defaultBufferSize = 1024;
+  /// @brief Default forwarded request headers
+  static const std::vector<std::string> defaultForwardedRequestHeaders;
+
+  /// @brief Creates an HTTP proxy
+  /// @param hostname upstream server hostname
+  /// @param maxNumberOfConnections maximum number of upstream connections (the number of requests forwarded at once)
+  /// @param bufferSize relay buffer size of each connection
+  HttpProxy(const std::string& hostname, size_t maxNumberOfConnections = defaultMaxNumberOfConnections, size_t bufferSize = defaultBufferSize);
+
+  /// @brief Creates an HTTPS proxy
+  /// @param hostname upstream server hostname
+  /// @param serverCertificate upstream server certificate
+  /// @param maxNumberOfConnections maximum number of upstream connections (the number of requests forwarded at once)
+  /// @param bufferSize relay buffer size of each connection
+  HttpProxy(const std::string& hostname, const char* serverCertificate, size_t maxNumberOfConnections = defaultMaxNumberOfConnections,
+            size_t bufferSize = defaultBufferSize);
+
+  /// @brief Creates an HTTPS proxy
+  /// @param hostname upstream server hostname
+  /// @param crt_bundle_attach function pointer to esp_crt_bundle_attach
+  /// @param maxNumberOfConnections maximum number of upstream connections (the number of requests forwarded at once)
+  /// @param bufferSize relay buffer size of each connection
+  HttpProxy(const std::string& hostname, esp_err_t (*crt_bundle_attach)(void *conf), size_t maxNumberOfConnections = defaultMaxNumberOfConnections,
+            size_t bufferSize = defaultBufferSize);
+
+  HttpProxy(const HttpProxy&) = delete;
+  HttpProxy& operator=(const HttpProxy&) = delete;
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Forwards the request to the upstream server and relays the response.
+  /// If all upstream connections are in use, the request is rejected with 503 and "Retry-After".
+  /// If the upstream server cannot be reached or fails before the response, the request is answered with 502.
+  /// @param transaction server transaction
+  /// @param uri upstream URI
+  /// @return error code
+  esp_err_t ForwardRequest(HttpServerTransaction& transaction, const std::string& uri);
+
+  /// @brief Forwards the request to the upstream server with the same URI and relays the response
+  /// @param transaction server transaction
+  /// @return error code
+  esp_err_t ForwardRequest(HttpServerTransaction& transaction);
+
+  /// @brief Gets the upstream server port
+  /// @return port
+  uint16_t GetPort();
+
+  /// @brief Sets the upstream server port
+  /// @param port port
+  /// @return error code
+  esp_err_t SetPort(uint16_t port);
+
+  /// @brief Adds the request header forwarded to the upstream server.
+  /// Response headers are all forwarded except the hop-by-hop ones.
+  /// @param name header name
+  /// @return error code
+  esp_err_t AddForwardedRequestHeader(const std::string& name);
+
+  /// @brief Removes the forwarded request header
+  /// @param name header name
+  /// @return error code
+  esp_err_t RemoveForwardedRequestHeader(const std::string& name);
+
+private:
+  struct Connection {
+    std::unique_ptr<HttpClient> client;
+    std::unique_ptr<uint8_t[]> buffer;
+    bool busy = false;
+  };
+
+  Mutex mutex;
+  size_t bufferSize;
+  std::vector<Connection> connections;
+  std::vector<std::string> forwardedRequestHeaders = defaultForwardedRequestHeaders;
+
+  HttpProxy(size_t maxNumberOfConnections, size_t bufferSize, const std::function<HttpClient*()>& createClient);
+  Connection* TakeConnection();
+  void ReleaseConnection(Connection& connection);
+  esp_err_t ForwardRequest(Connection& connection, HttpServerTransaction& transaction, const std::string& uri);
+};
+
+//==============================================================================
+
+}
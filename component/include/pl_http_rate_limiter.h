@@ -0,0 +1,63 @@
+#pragma once
+#include "pl_common.h"
+#include <vector>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Token bucket rate limiter with a fixed-size table of buckets.
+/// Buckets are split into shards with separate locks, so that requests with different keys rarely wait for each other.
+class HttpRateLimiter {
+public:
+  /// @brief Number of bucket table shards
+  static constexpr size_t numberOfShards = 4;
+
+  /// @brief Creates a rate limiter
+  /// @param numberOfBuckets number of buckets (the least recently used bucket is reused for a new key when the table is full)
+  /// @param rate number of tokens added per second
+  /// @param burstSize bucket capacity in tokens
+  HttpRateLimiter(size_t numberOfBuckets, uint32_t rate, uint32_t burstSize);
+  HttpRateLimiter(const HttpRateLimiter&) = delete;
+  HttpRateLimiter& operator=(const HttpRateLimiter&) = delete;
+
+  /// @brief Takes a token from the bucket of the key
+  /// @param key bucket key
+  /// @param retryAfter time in seconds until the next token is available (set if no token is available)
+  /// @return true if the token has been taken
+  bool TakeToken(uint32_t key, uint32_t& retryAfter);
+
+  /// @brief Gets the number of tokens added per second
+  /// @return rate
+  uint32_t GetRate();
+
+  /// @brief Gets the bucket capacity
+  /// @return capacity in tokens
+  uint32_t GetBurstSize();
+
+private:
+  // Tokens are stored in thousandths so that a rate in tokens per second adds an integer amount per millisecond
+  static constexpr uint32_t tokenScale = 1000;
+
+  struct Bucket {
+    uint32_t key;
+    uint32_t tokens;
+    TickType_t refillTime;
+    bool used = false;
+  };
+
+  struct Shard {
+    Mutex mutex;
+    std::vector<Bucket> buckets;
+  };
+
+  const uint32_t rate;
+  const uint32_t burstSize;
+  Shard shards[numberOfShards];
+};
+
+//==============================================================================
+
+}
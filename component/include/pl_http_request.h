@@ -0,0 +1,93 @@
+#pragma once
+#include "pl_http_types.h"
+#include <string>
+#include <vector>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Reusable HTTP request class: the method, the URL, the headers and the body are prepared once and the request can be sent
+/// any number of times by any client. An absolute URL selects the host the client connects to.
+/// The request is immutable, so it is not lockable and can be shared by tasks.
+class HttpRequest {
+public:
+  /// @brief Creates a request
+  /// @param method HTTP method
+  /// @param url absolute URL ("http://host[:port]/path?query" or "https://...") or a path relative to the client host
+  /// @param headers header names and values
+  /// @param body body
+  HttpRequest(HttpMethod method, const std::string& url, const std::vector<std::pair<std::string, std::string>>& headers = {},
+              const std::string& body = "");
+
+  /// @brief Creates a request with the body of unknown size pulled from the source (chunked transfer encoding)
+  /// @param method HTTP method
+  /// @param url absolute URL ("http://host[:port]/path?query" or "https://...") or a path relative to the client host
+  /// @param headers header names and values
+  /// @param bodySource body source. It is called each time the request is sent, so a request with it is not retried.
+  HttpRequest(HttpMethod method, const std::string& url, const std::vector<std::pair<std::string, std::string>>& headers,
+              const HttpBodySource& bodySource);
+
+  /// @brief Checks if the method and the URL are valid
+  /// @return true if the request is valid
+  bool IsValid() const;
+
+  /// @brief Gets the method
+  /// @return method
+  HttpMethod GetMethod() const;
+
+  /// @brief Gets the URL
+  /// @return URL
+  const std::string& GetUrl() const;
+
+  /// @brief Gets the hostname of an absolute URL
+  /// @return hostname (empty for a relative URL)
+  const std::string& GetHostname() const;
+
+  /// @brief Gets the port of an absolute URL
+  /// @return port (0 for a relative URL)
+  uint16_t GetPort() const;
+
+  /// @brief Checks if the absolute URL has the https scheme
+  /// @return true for an HTTPS URL
+  bool IsHttps() const;
+
+  /// @brief Gets the request target: the path and the query of the URL
+  /// @return request target
+  const std::string& GetTarget() const;
+
+  /// @brief Gets the headers
+  /// @return header names and values
+  const std::vector<std::pair<std::string, std::string>>& GetHeaders() const;
+
+  /// @brief Gets the body
+  /// @return body
+  const std::string& GetBody() const;
+
+  /// @brief Gets the body source
+  /// @return body source (empty if the request has a body of known size)
+  const HttpBodySource& GetBodySource() const;
+
+private:
+  friend class HttpClient;
+  // Identifies the prepared request in the client, so that its URL and headers are only applied when another request has been sent
+  uint32_t id;
+  bool valid = false;
+  HttpMethod method;
+  std::string url;
+  std::string hostname;
+  uint16_t port = 0;
+  bool https = false;
+  std::string target;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+  HttpBodySource bodySource;
+
+  void ParseUrl();
+};
+
+//==============================================================================
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "pl_http_head_parser.h"
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Zero-copy incremental HTTP/1.1 request head parser
+class HttpRequestParser : public HttpHeadParser {
+public:
+  using HttpHeadParser::HttpHeadParser;
+
+  void Reset() override;
+
+  /// @brief Gets the request method
+  /// @return method (HttpMethod::unknown if the method is not supported)
+  HttpMethod GetMethod();
+
+  /// @brief Gets the request method name
+  /// @return method name
+  std::string_view GetMethodName();
+
+  /// @brief Gets the request target (URI)
+  /// @return target
+  std::string_view GetTarget();
+
+protected:
+  esp_err_t ParseStartLine(const char* line, const char* lineEnd) override;
+
+private:
+  Span method = {};
+  HttpMethod httpMethod = HttpMethod::unknown;
+  Span target = {};
+};
+
+//==============================================================================
+
+}
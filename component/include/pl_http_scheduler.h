@@ -0,0 +1,171 @@
+#pragma once
+#include "pl_common.h"
+#include "freertos/task.h"
+#include <list>
+#include <vector>
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief Coroutine returning an error code. The coroutine starts when it is awaited or spawned by the scheduler.
+class [[nodiscard]] HttpTask {
+public:
+  struct promise_type {
+    esp_err_t result = ESP_OK;
+    std::coroutine_handle<> continuation;
+
+    HttpTask get_return_object() { return HttpTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept {
+      struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+          auto continuation = handle.promise().continuation;
+          return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+      };
+      return FinalAwaiter();
+    }
+    void return_value(esp_err_t result) { this->result = result; }
+    void unhandled_exception() { abort(); }
+  };
+
+  HttpTask(HttpTask&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+  HttpTask& operator=(HttpTask&& other) noexcept {
+    if (this != &other) {
+      if (handle)
+        handle.destroy();
+      handle = other.handle;
+      other.handle = nullptr;
+    }
+    return *this;
+  }
+  HttpTask(const HttpTask&) = delete;
+  HttpTask& operator=(const HttpTask&) = delete;
+  ~HttpTask() {
+    if (handle)
+      handle.destroy();
+  }
+
+  bool await_ready() { return !handle || handle.done(); }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) {
+    handle.promise().continuation = continuation;
+    return handle;
+  }
+  esp_err_t await_resume() { return handle ? handle.promise().result : ESP_ERR_INVALID_STATE; }
+
+private:
+  friend class HttpScheduler;
+  std::coroutine_handle<promise_type> handle;
+
+  explicit HttpTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+};
+
+//==============================================================================
+
+/// @brief Coroutine scheduler: runs the spawned coroutines in a single task and resumes them when the sockets they wait for are ready.
+/// A coroutine suspended on a socket takes its frame only instead of a task stack.
+class HttpScheduler : public Lockable {
+public:
+  /// @brief Default scheduler task parameters
+  static const TaskParameters defaultTaskParameters;
+
+  /// @brief Socket readiness awaitable. Its result is ESP_OK, ESP_ERR_TIMEOUT or ESP_FAIL if the wait has failed.
+  class SocketAwaiter {
+  public:
+    SocketAwaiter(HttpScheduler& scheduler, int sockfd, bool write, TickType_t timeout) :
+      scheduler(scheduler), sockfd(sockfd), write(write), timeout(timeout) {}
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    esp_err_t await_resume() { return result; }
+
+  private:
+    HttpScheduler& scheduler;
+    int sockfd;
+    bool write;
+    TickType_t timeout;
+    esp_err_t result = ESP_ERR_TIMEOUT;
+  };
+
+  /// @brief Creates a scheduler
+  /// @param taskParameters scheduler task parameters
+  HttpScheduler(const TaskParameters& taskParameters = defaultTaskParameters);
+  ~HttpScheduler();
+  HttpScheduler(const HttpScheduler&) = delete;
+  HttpScheduler& operator=(const HttpScheduler&) = delete;
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Starts the scheduler task
+  /// @return error code
+  esp_err_t Enable();
+
+  /// @brief Stops the scheduler task and destroys the coroutines that have not completed
+  /// @return error code
+  esp_err_t Disable();
+
+  /// @brief Checks if the scheduler task is running
+  /// @return true if the scheduler is enabled
+  bool IsEnabled();
+
+  /// @brief Runs the coroutine in the scheduler task. The coroutine is destroyed when it completes.
+  /// @param task coroutine
+  /// @return error code
+  esp_err_t Spawn(HttpTask&& task);
+
+  /// @brief Suspends the coroutine until the socket is readable. Should only be awaited by the coroutines run by the scheduler.
+  /// @param sockfd socket
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return awaitable
+  SocketAwaiter WaitUntilReadable(int sockfd, TickType_t timeout);
+
+  /// @brief Suspends the coroutine until the socket is writable. Should only be awaited by the coroutines run by the scheduler.
+  /// @param sockfd socket
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return awaitable
+  SocketAwaiter WaitUntilWritable(int sockfd, TickType_t timeout);
+
+  /// @brief Suspends the coroutine for the time. Should only be awaited by the coroutines run by the scheduler.
+  /// @param time time in FreeRTOS ticks
+  /// @return awaitable
+  SocketAwaiter Delay(TickType_t time);
+
+private:
+  struct Waiter {
+    std::coroutine_handle<> handle;
+    int sockfd;
+    bool write;
+    TickType_t startTime;
+    TickType_t timeout;
+    esp_err_t* result;
+  };
+
+  Mutex mutex;
+  TaskParameters taskParameters;
+  TaskHandle_t taskHandle = NULL;
+  volatile bool stopRequested = false;
+  // The wakeup socket interrupts the select call when a coroutine is spawned or the scheduler is disabled
+  int wakeupSocket = -1;
+  Mutex spawnMutex;
+  std::vector<HttpTask> spawnedTasks;
+  // The fields below are only accessed by the scheduler task
+  std::list<HttpTask> tasks;
+  std::vector<Waiter> waiters;
+
+  static void TaskCode(void* parameters);
+  void Run();
+  void Wakeup();
+};
+
+//==============================================================================
+
+}
+
+#endif
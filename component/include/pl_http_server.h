@@ -2,7 +2,12 @@
 #include "pl_common.h"
 #include "pl_network.h"
 #include "pl_http_server_transaction.h"
+#include "pl_http_rate_limiter.h"
+#ifndef CONFIG_IDF_TARGET_LINUX
 #include "esp_https_server.h"
+#include "esp_timer.h"
+#include <atomic>
+#include <list>
 
 //==============================================================================
 
@@ -10,6 +15,10 @@ namespace PL {
 
 //==============================================================================
 
+class HttpTracer;
+
+//==============================================================================
+
 /// @brief HTTP/HTTPS server class
 class HttpServer : public NetworkServer {
 public:
@@ -27,10 +36,36 @@ public:
   static constexpr TickType_t defaultReadTimeout = 5000 / portTICK_PERIOD_MS;
   /// @brief Default write operation timeout in FreeRTOS ticks
   static constexpr TickType_t defaultWriteTimeout = 5000 / portTICK_PERIOD_MS;
+  /// @brief Default request timeout in FreeRTOS ticks
+  static constexpr TickType_t defaultRequestTimeout = portMAX_DELAY;
   /// @brief Default server task parameters
   static const TaskParameters defaultTaskParameters;
+  /// @brief Default connection socket options
+  static const HttpSocketOptions defaultSocketOptions;
   /// @brief Default header buffer size
   static constexpr size_t defaultHeaderBufferSize = 1024;
+  /// @brief Default connection backlog size (0: same as the maximum number of clients)
+  static constexpr size_t defaultBacklogSize = 0;
+  /// @brief Default least recently used connection purge state
+  static constexpr bool defaultLruPurge = false;
+  /// @brief Default idle connection timeout in FreeRTOS ticks
+  static constexpr TickType_t defaultIdleTimeout = portMAX_DELAY;
+  /// @brief Default maximum number of requests per connection (0: unlimited)
+  static constexpr size_t defaultMaxNumberOfRequestsPerConnection = 0;
+  /// @brief Default previous listener drain timeout after the port change in FreeRTOS ticks
+  static constexpr TickType_t defaultDrainTimeout = 5000 / portTICK_PERIOD_MS;
+  /// @brief Default maximum number of concurrently handled requests (0: unlimited)
+  static constexpr size_t defaultMaxNumberOfConcurrentRequests = 0;
+  /// @brief Number of client rate limit buckets
+  static constexpr size_t numberOfRateLimitedClients = 32;
+  /// @brief Default TLS session ticket state
+  static constexpr bool defaultSessionTickets = false;
+  /// @brief Default maximum body size of a coalesced response
+  static constexpr size_t defaultMaxCoalescedBodySize = 4096;
+  /// @brief Default CORS policy: any origin, no credentials and preflight responses cached for a day
+  static const HttpCorsPolicy defaultCorsPolicy;
+  /// @brief Connection arena size (CONFIG_PL_HTTP_SERVER_ARENA_SIZE)
+  static constexpr size_t arenaSize = CONFIG_PL_HTTP_SERVER_ARENA_SIZE;
 
   Event<HttpServer, HttpServerTransaction&> requestEvent;
   
@@ -64,6 +99,18 @@ public:
   esp_err_t Enable() override;
   esp_err_t Disable() override;
 
+  /// @brief Begins the configuration update: the changes made until the matching EndUpdate call are applied together.
+  /// The server is locked until then.
+  /// @return error code
+  esp_err_t BeginUpdate();
+
+  /// @brief Ends the configuration update and applies the changes.
+  /// Timeouts, limits and the task priority are applied to the running server and the open connections.
+  /// A port change starts a new listener while the previous one drains.
+  /// A backlog size, certificate, task stack or core change, or raising the maximum number of clients restarts the server.
+  /// @return error code
+  esp_err_t EndUpdate();
+
   bool IsEnabled() override;
 
   uint16_t GetPort() override;
@@ -72,6 +119,46 @@ public:
   size_t GetMaxNumberOfClients() override;
   esp_err_t SetMaxNumberOfClients(size_t maxNumberOfClients) override;
 
+  /// @brief Gets the connection backlog size
+  /// @return backlog size (0: same as the maximum number of clients)
+  size_t GetBacklogSize();
+
+  /// @brief Sets the connection backlog size
+  /// @param backlogSize backlog size (0: same as the maximum number of clients)
+  /// @return error code
+  esp_err_t SetBacklogSize(size_t backlogSize);
+
+  /// @brief Gets the least recently used connection purge state
+  /// @return true if the least recently used connection is closed when a new client connects and all sockets are in use
+  bool GetLruPurge();
+
+  /// @brief Sets the least recently used connection purge state
+  /// @param lruPurge true to close the least recently used connection when a new client connects and all sockets are in use
+  /// @return error code
+  esp_err_t SetLruPurge(bool lruPurge);
+
+  /// @brief Gets the idle connection timeout
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetIdleTimeout();
+
+  /// @brief Sets the idle connection timeout (connections without requests for this time are closed)
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetIdleTimeout(TickType_t timeout);
+
+  /// @brief Gets the maximum number of requests per connection
+  /// @return maximum number of requests (0: unlimited)
+  size_t GetMaxNumberOfRequestsPerConnection();
+
+  /// @brief Sets the maximum number of requests per connection (the connection is closed after the response to the last request)
+  /// @param maxNumberOfRequests maximum number of requests (0: unlimited)
+  /// @return error code
+  esp_err_t SetMaxNumberOfRequestsPerConnection(size_t maxNumberOfRequests);
+
+  /// @brief Gets the number of open client connections
+  /// @return number of connections
+  size_t GetNumberOfConnections();
+
   /// @brief Gets the read operation timeout 
   /// @return timeout in FreeRTOS ticks
   TickType_t GetReadTimeout();
@@ -90,11 +177,166 @@ public:
   /// @return error code
   esp_err_t SetWriteTimeout(TickType_t timeout);
 
+  /// @brief Gets the request timeout
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetRequestTimeout();
+
+  /// @brief Sets the request timeout: the deadline for the request body receive and the response send counted from the start of the request handling.
+  /// The body receive that exceeds it is answered with 408, the response written after it is replaced with 503.
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetRequestTimeout(TickType_t timeout);
+
   /// @brief Sets the server task parameters
   /// @param taskParameters task parameters
   /// @return error code
   esp_err_t SetTaskParameters(const TaskParameters& taskParameters);
 
+  /// @brief Gets the connection socket options
+  /// @return socket options
+  HttpSocketOptions GetSocketOptions();
+
+  /// @brief Sets the connection socket options. They are applied to the open connections as well.
+  /// Options not supported by the network stack (e.g. the send buffer size in lwIP) are ignored.
+  /// @param socketOptions socket options
+  /// @return error code
+  esp_err_t SetSocketOptions(const HttpSocketOptions& socketOptions);
+
+  /// @brief Sets the HTTPS server certificate and private key
+  /// @param certificate certificate
+  /// @param privateKey private key
+  /// @return error code
+  esp_err_t SetCertificate(const char* certificate, const char* privateKey);
+
+  /// @brief Adds an HTTP listener. Requests received on its port are handled by the same request handler.
+  /// Each listener has its own server task and header buffer, so listeners do not wait for each other's transactions.
+  /// @param port port
+  /// @param headerBufferSize header buffer size
+  /// @return error code
+  esp_err_t AddListener(uint16_t port, size_t headerBufferSize = defaultHeaderBufferSize);
+
+  /// @brief Adds an HTTPS listener. Requests received on its port are handled by the same request handler.
+  /// Each listener has its own server task and header buffer, so listeners do not wait for each other's transactions.
+  /// @param port port
+  /// @param certificate certificate
+  /// @param privateKey private key
+  /// @param headerBufferSize header buffer size
+  /// @return error code
+  esp_err_t AddListener(uint16_t port, const char* certificate, const char* privateKey, size_t headerBufferSize = defaultHeaderBufferSize);
+
+  /// @brief Adds an HTTP listener that redirects all requests to HTTPS with "308 Permanent Redirect" without calling the request handler
+  /// @param port port
+  /// @param httpsPort HTTPS port the requests are redirected to
+  /// @return error code
+  esp_err_t AddRedirectListener(uint16_t port, uint16_t httpsPort);
+
+  /// @brief Removes the listener added with AddListener or AddRedirectListener
+  /// @param port port
+  /// @return error code
+  esp_err_t RemoveListener(uint16_t port);
+
+  /// @brief Gets the TLS session ticket state
+  /// @return true if session tickets are enabled
+  bool GetSessionTickets();
+
+  /// @brief Enables or disables TLS session tickets (requires CONFIG_ESP_TLS_SERVER_SESSION_TICKETS).
+  /// A reconnecting client that presents a ticket resumes its session without the certificate verification and the key exchange.
+  /// Ticket lifetime and key rotation period are set by CONFIG_ESP_TLS_SERVER_SESSION_TICKET_TIMEOUT.
+  /// @param enabled true to enable session tickets
+  /// @return error code
+  esp_err_t SetSessionTickets(bool enabled);
+
+  /// @brief Gets the TLS handshake statistics
+  /// @return statistics
+  HttpTlsStatistics GetTlsStatistics();
+
+  /// @brief Resets the TLS handshake statistics
+  /// @return error code
+  esp_err_t ResetTlsStatistics();
+
+  /// @brief Gets the tracer
+  /// @return tracer (NULL if the requests are not traced)
+  HttpTracer* GetTracer();
+
+  /// @brief Sets the tracer the request spans are recorded to. The trace context is taken from the "traceparent" and "tracestate" request headers
+  /// (a request without them starts a new trace) and is the current context of the task while the request handler is called,
+  /// so the clients used by the handler propagate it.
+  /// @param tracer tracer (NULL: the requests are not traced). The tracer should exist while it is set and until the requests handled with it are complete.
+  /// @return error code
+  esp_err_t SetTracer(HttpTracer* tracer);
+
+  /// @brief Gets the previous listener drain timeout after the port change
+  /// @return timeout in FreeRTOS ticks
+  TickType_t GetDrainTimeout();
+
+  /// @brief Sets the previous listener drain timeout after the port change
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetDrainTimeout(TickType_t timeout);
+
+  /// @brief Sets the per-client request rate limit. Requests over the limit are rejected with 429 and "Retry-After" before the request handler is called.
+  /// @param rate number of requests per second (0: unlimited)
+  /// @param burstSize number of requests that can be made at once
+  /// @return error code
+  esp_err_t SetClientRateLimit(uint32_t rate, uint32_t burstSize);
+
+  /// @brief Adds the request rate limit shared by all clients for the URIs starting with the prefix (the first matching limit is applied).
+  /// Requests over the limit are rejected with 429 and "Retry-After" before the request handler is called.
+  /// @param uriPrefix URI prefix
+  /// @param rate number of requests per second
+  /// @param burstSize number of requests that can be made at once
+  /// @return error code
+  esp_err_t AddRouteRateLimit(const std::string& uriPrefix, uint32_t rate, uint32_t burstSize);
+
+  /// @brief Removes the route request rate limit
+  /// @param uriPrefix URI prefix
+  /// @return error code
+  esp_err_t RemoveRouteRateLimit(const std::string& uriPrefix);
+
+  /// @brief Gets the maximum number of concurrently handled requests
+  /// @return number of requests (0: unlimited)
+  size_t GetMaxNumberOfConcurrentRequests();
+
+  /// @brief Sets the maximum number of concurrently handled requests. Requests over the limit are rejected with 503 and "Retry-After".
+  /// @param maxNumberOfRequests number of requests (0: unlimited)
+  /// @return error code
+  esp_err_t SetMaxNumberOfConcurrentRequests(size_t maxNumberOfRequests);
+
+  /// @brief Enables request coalescing for the GET requests with the URIs starting with the prefix (the first matching route is applied).
+  /// Identical requests (same URI and vary header values) arriving while the first one is handled wait for it and receive a copy
+  /// of its response without calling the request handler. Listeners handle their requests one by one, so only the requests
+  /// received by different listeners are concurrent: the reuse time extends coalescing to the requests arriving after the response is complete.
+  /// The request handler should not set client-specific response headers for the coalesced routes.
+  /// The response body is copied for the waiting requests. A response with a larger body is not shared: the waiting requests
+  /// are handled separately as soon as the body exceeds the maximum size. A request waits for the response for the read timeout
+  /// at most, then it is handled separately.
+  /// @param uriPrefix URI prefix
+  /// @param varyHeaders request headers that make the requests different
+  /// @param reuseTime time the complete response is reused for in FreeRTOS ticks
+  /// @param maxBodySize maximum response body size
+  /// @return error code
+  esp_err_t AddCoalescedRoute(const std::string& uriPrefix, const std::vector<std::string>& varyHeaders = {}, TickType_t reuseTime = 0,
+                              size_t maxBodySize = defaultMaxCoalescedBodySize);
+
+  /// @brief Disables request coalescing for the route
+  /// @param uriPrefix URI prefix
+  /// @return error code
+  esp_err_t RemoveCoalescedRoute(const std::string& uriPrefix);
+
+  /// @brief Adds the cross-origin resource sharing policy for the URIs starting with the prefix (the first matching policy is applied).
+  /// The server answers the preflight requests (OPTIONS with "Origin" and "Access-Control-Request-Method") itself after the admission control
+  /// and without calling the request handler, and adds the CORS headers to the responses to the allowed origins.
+  /// Other OPTIONS requests are passed to the request handler.
+  /// @param uriPrefix URI prefix
+  /// @param policy CORS policy
+  /// @return error code
+  esp_err_t AddCorsRoute(const std::string& uriPrefix, const HttpCorsPolicy& policy = defaultCorsPolicy);
+
+  /// @brief Removes the route CORS policy
+  /// @param uriPrefix URI prefix
+  /// @return error code
+  esp_err_t RemoveCorsRoute(const std::string& uriPrefix);
+
 protected:
   /// @brief Handles the HTTP request
   /// @param transaction transaction 
@@ -104,48 +346,220 @@ protected:
 private:
   Mutex mutex;
   bool enabled = false;
-  uint16_t port;
-  size_t maxNumberOfClients = defaultMaxNumberOfClients;
-  TickType_t readTimeout = defaultReadTimeout;
-  TickType_t writeTimeout = defaultWriteTimeout;
+  std::atomic<size_t> maxNumberOfClients = defaultMaxNumberOfClients;
+  size_t backlogSize = defaultBacklogSize;
+  std::atomic<bool> lruPurge = defaultLruPurge;
+  std::atomic<TickType_t> idleTimeout = defaultIdleTimeout;
+  std::atomic<size_t> maxNumberOfRequestsPerConnection = defaultMaxNumberOfRequestsPerConnection;
+  std::atomic<TickType_t> readTimeout = defaultReadTimeout;
+  std::atomic<TickType_t> writeTimeout = defaultWriteTimeout;
+  std::atomic<TickType_t> requestTimeout = defaultRequestTimeout;
   TaskParameters taskParameters = defaultTaskParameters;
-  std::shared_ptr<Buffer> headerBuffer;
-  char* headerDataEnd;
-  bool https = false;
-  const char* serverCertificate = NULL;
-  const char* privateKey = NULL;
+  std::atomic<std::shared_ptr<const HttpSocketOptions>> socketOptions = std::make_shared<const HttpSocketOptions>(defaultSocketOptions);
   httpd_ssl_config_t serverConfig;
-  httpd_handle_t serverHandle = NULL;
+
+  struct Listener {
+    HttpServer* server = NULL;
+    uint16_t port = 0;
+    bool https = false;
+    const char* certificate = NULL;
+    const char* privateKey = NULL;
+    uint16_t redirectPort = 0;
+    std::shared_ptr<Buffer> headerBuffer;
+    char* headerDataEnd = NULL;
+    httpd_handle_t handle = NULL;
+  };
+  // The main listener has the port and the certificate of the server. After the port change its previous server handle drains.
+  Listener mainListener;
+  std::list<Listener> listeners;
+  uint16_t boundPort = 0;
+  std::atomic<httpd_handle_t> drainingServerHandle = NULL;
+  uint16_t drainingServerPort = 0;
+  TickType_t drainStartTime = 0;
+  // Draining servers replaced by a new port change are stopped by the maintenance timer without the lock
+  std::vector<std::pair<httpd_handle_t, uint16_t>> stoppingServers;
+  // The drained servers are stopped by one-shot tasks, as stopping a server waits for its running request handlers
+  struct StopTask {
+    HttpServer* server;
+    std::vector<httpd_handle_t> handles;
+  };
+  std::atomic<size_t> numberOfStopTasks{0};
+  TickType_t drainTimeout = defaultDrainTimeout;
+  size_t numberOfSockets = 0;
+  esp_timer_handle_t maintenanceTimer = NULL;
+  typedef std::vector<std::pair<std::string, std::shared_ptr<HttpRateLimiter>>> RouteRateLimiters;
+
+  // Admission control does not lock: the rate limiters are replaced as a whole and the route table is copied on change.
+  // The mutex only serializes the changes.
+  Mutex admissionMutex;
+  std::atomic<size_t> maxNumberOfConcurrentRequests = defaultMaxNumberOfConcurrentRequests;
+  std::atomic<size_t> numberOfConcurrentRequests{0};
+  std::atomic<std::shared_ptr<HttpRateLimiter>> clientRateLimiter;
+  std::atomic<std::shared_ptr<const RouteRateLimiters>> routeRateLimiters;
+  bool sessionTickets = defaultSessionTickets;
+  Mutex tlsStatisticsMutex;
+  HttpTlsStatistics tlsStatistics = {};
+  // The tracer is read by the transactions without the server lock
+  std::atomic<HttpTracer*> tracer{NULL};
+
+  struct CoalescedRoute {
+    std::string uriPrefix;
+    std::vector<std::string> varyHeaders;
+    TickType_t reuseTime;
+    size_t maxBodySize;
+  };
+  // The response mutex is held by the transaction that calls the request handler until the response is complete
+  // or until its body exceeds the maximum size (the response is bypassed)
+  struct CoalescedResponse {
+    Mutex mutex;
+    std::string key;
+    TickType_t reuseTime = 0;
+    size_t maxBodySize = 0;
+    bool bypassed = false;
+    bool complete = false;
+    TickType_t completionTime = 0;
+    uint16_t statusCode = 0;
+    std::string headers;
+    std::string body;
+  };
+  Mutex coalescingMutex;
+  std::vector<CoalescedRoute> coalescedRoutes;
+  std::list<std::shared_ptr<CoalescedResponse>> coalescedResponses;
+
+  struct CorsRoute {
+    std::string uriPrefix;
+    HttpCorsPolicy policy;
+    char maxAge[11];
+  };
+  // CORS header values are read into fixed-size buffers, so that CORS requests do not allocate memory
+  static constexpr size_t maxCorsHeaderValueSize = 256;
+  Mutex corsMutex;
+  std::vector<CorsRoute> corsRoutes;
+
+  static constexpr uint64_t maxMaintenancePeriodMs = 1000;
+
+  // Connection contexts are reused by the following connections, so that the arena and the context itself are allocated once
+  struct Connection {
+    HttpServer& server;
+    TickType_t lastActivityTime;
+    size_t numberOfRequests = 0;
+    uint32_t addressHash = 0;
+    std::shared_ptr<NetworkStream> networkStream;
+    HttpArena arena;
+    Connection* nextFreeConnection = NULL;
+
+    Connection(HttpServer& server);
+  };
+  Mutex connectionPoolMutex;
+  Connection* freeConnections = NULL;
   
+  enum class Update {
+    none,
+    live,
+    rebind,
+    restart
+  };
+  int updateDepth = 0;
+  Update pendingUpdate = Update::none;
+
   static esp_err_t HandleRequest(httpd_req_t* req);
-  esp_err_t RestartIfEnabled();
+  static esp_err_t HandleAdmittedRequest(httpd_req_t* req);
+  uint16_t AdmitRequest(httpd_req_t* req, uint32_t& retryAfter);
+  static esp_err_t RejectRequest(httpd_req_t* req, uint16_t statusCode, uint32_t retryAfter);
+  static esp_err_t RedirectRequest(httpd_req_t* req, uint16_t port);
+  bool HandlePreflightRequest(httpd_req_t* req, esp_err_t& error);
+  const CorsRoute* FindCorsRoute(const char* uri);
+  class Transaction;
+  esp_err_t HandleCoalescedRequest(Transaction& transaction, httpd_req_t* req);
+  static const HttpTraceContext* BeginTraceSpan(Transaction& transaction, httpd_req_t* req, HttpTraceContext& context, HttpSpan& span);
+  esp_err_t SetCorsResponseHeaders(Transaction& transaction, httpd_req_t* req);
+  static esp_err_t WriteCoalescedResponse(Transaction& transaction, const CoalescedResponse& response);
+  esp_err_t StartServer(Listener& listener, httpd_handle_t& handle);
+  esp_err_t StopServer(httpd_handle_t& handle);
+  esp_err_t AddListener(const Listener& listener);
+  std::vector<Listener*> GetListeners();
+  esp_err_t UpdateIfEnabled(Update update);
+  void SetSocketTimeouts(int sockfd);
+  void ApplySocketOptions(int sockfd);
+  static void SetSocketTimeout(int sockfd, int option, TickType_t timeout);
+  static void SetTaskPriority(void* arg);
+  esp_err_t UpdateMaintenanceTimer();
+  static void HandleMaintenanceTimer(void* arg);
+  esp_err_t StartStopTask(const std::vector<std::pair<httpd_handle_t, uint16_t>>& servers);
+  static void StopTaskCode(void* parameters);
+  static void CloseIdleConnections(void* arg);
+  static esp_err_t OpenConnection(httpd_handle_t handle, int sockfd);
+#ifdef CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK
+  static int HandleClientHello(mbedtls_ssl_context* ssl);
+#endif
+  static void HandleTlsSession(esp_https_server_user_cb_arg_t* arg);
+  void UpdateTlsStatistics();
+  Connection* AllocateConnection();
+  static void FreeConnection(void* ctx);
+  void DeleteFreeConnections();
 
   class Transaction : public HttpServerTransaction {
   public:
-    Transaction(HttpServer& server, httpd_req_t* req);
+    Transaction(HttpServer& server, Listener& listener, httpd_req_t* req);
+    ~Transaction();
 
     esp_err_t ReadRequestBody(void* dest, size_t size) override;
     using HttpServerTransaction::WriteResponse;
     esp_err_t WriteResponse(uint16_t statusCode, const void* body, size_t bodySize) override;
+    esp_err_t WriteResponseHeaders(uint16_t statusCode) override;
+    esp_err_t WriteResponseBody(const void* src, size_t size) override;
+    esp_err_t EndResponseBody() override;
 
     std::shared_ptr<NetworkStream> GetNetworkStream() override;
     HttpMethod GetRequestMethod() override;
     esp_err_t GetRequestUri(std::string& uri) override;
     esp_err_t GetRequestHeader(const std::string& name, std::string& value) override;
     size_t GetRequestBodySize() override;
+    HttpArena& GetArena() override;
+    TickType_t GetRemainingTime() override;
 
     esp_err_t SetResponseHeader(const std::string& name, const std::string& value) override;
+    esp_err_t SetResponseHeader(const char* name, const char* value);
 
     bool IsResponseWritten();
+    uint16_t GetResponseStatusCode();
+    bool IsResponseBodyOpen();
+    void CloseConnectionAfterResponse();
+    bool IsConnectionClosedAfterResponse();
+    bool AreSocketTimeoutsChanged();
+    bool IsContinueWithheld();
+    void CaptureResponse(CoalescedResponse* response);
+    void CaptureResponseBody(const void* data, size_t size);
 
   private:
     HttpServer& server;
+    Listener& listener;
     httpd_req_t* req;
     std::shared_ptr<NetworkStream> networkStream;
+    HttpArena& arena;
     bool responseWritten = false;
+    uint16_t responseStatusCode = 0;
+    TickType_t startTime;
+    TickType_t requestTimeout;
+    bool socketTimeoutsChanged = false;
+    size_t requestBodyRemainingSize;
+    bool continueExpected = false;
+    bool continueSent = false;
+    bool closeConnection = false;
+    bool chunkedResponseBody = false;
+    char status[48];
+    CoalescedResponse* capturedResponse = NULL;
+    const char* capturedHeaderData = NULL;
+    bool headRequest;
+
+    esp_err_t WriteResponseStatus(uint16_t statusCode);
+    esp_err_t SendResponse(const char* framingHeader, const void* body, size_t bodySize);
+    esp_err_t Send(const void* data, size_t size);
   };
 };
 
 //==============================================================================
 
-}
\ No newline at end of file
+}
+
+#endif
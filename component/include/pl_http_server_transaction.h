@@ -2,6 +2,7 @@
 #include "pl_common.h"
 #include "pl_network.h"
 #include "pl_http_types.h"
+#include "pl_http_arena.h"
 
 //==============================================================================
 
@@ -51,6 +52,22 @@ public:
   /// @return error code
   esp_err_t WriteResponse(uint16_t statusCode);
 
+  /// @brief Writes the response headers for a body of unknown size (chunked transfer encoding).
+  /// The status and the headers are sent with the first body part.
+  /// @param statusCode status code
+  /// @return error code
+  virtual esp_err_t WriteResponseHeaders(uint16_t statusCode) = 0;
+
+  /// @brief Writes the response body part as a single chunk
+  /// @param src source
+  /// @param size number of bytes to write
+  /// @return error code
+  virtual esp_err_t WriteResponseBody(const void* src, size_t size) = 0;
+
+  /// @brief Ends the chunked response body (called after the request handler if the handler has not called it)
+  /// @return error code
+  virtual esp_err_t EndResponseBody() = 0;
+
   /// @brief Gets the request HTTP method
   /// @return HTTP method
   virtual HttpMethod GetRequestMethod() = 0;
@@ -70,6 +87,14 @@ public:
   /// @return body size
   virtual size_t GetRequestBodySize() = 0;
 
+  /// @brief Gets the arena for the request-scoped allocations. The arena is reset after the transaction.
+  /// @return arena
+  virtual HttpArena& GetArena() = 0;
+
+  /// @brief Gets the time remaining until the request deadline
+  /// @return remaining time in FreeRTOS ticks (portMAX_DELAY if there is no deadline)
+  virtual TickType_t GetRemainingTime() = 0;
+
   /// @brief Sets the response header
   /// @param name header name
   /// @param value header value
@@ -0,0 +1,171 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_http_client.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <atomic>
+#include <memory>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief HTTP tracer class. The spans of the traced servers and clients are recorded into a fixed-size lock-free ring buffer
+/// and the exporter task posts them in batches with the client as OTLP/JSON (OpenTelemetry protocol).
+/// The trace context of the request handled by the task is propagated to the requests the task sends (W3C Trace Context).
+class HttpTracer : public Lockable {
+public:
+  /// @brief Default exporter task parameters
+  static const TaskParameters defaultTaskParameters;
+  /// @brief Default span buffer capacity (rounded up to a power of two)
+  static constexpr size_t defaultCapacity = 64;
+  /// @brief Default maximum number of spans in an export request
+  static constexpr size_t defaultMaxBatchSize = 16;
+  /// @brief Default time in FreeRTOS ticks between the exports
+  static constexpr TickType_t defaultBatchTime = 5000 / portTICK_PERIOD_MS;
+  /// @brief Default service name of the exported spans
+  static const std::string defaultServiceName;
+  /// @brief "traceparent" header value size (version 00)
+  static constexpr size_t traceParentSize = 55;
+  /// @brief Maximum "tracestate" header value size. A longer trace state is not propagated.
+  static constexpr size_t maxTraceStateSize = 512;
+  /// @brief Sampled trace flag
+  static constexpr uint8_t sampledFlag = 0x01;
+
+  /// @brief Creates a tracer
+  /// @param client HTTP client of the exporter. It is locked while a batch is sent.
+  /// @param uri URI the batches are posted to (e.g. "/v1/traces")
+  /// @param capacity span buffer capacity
+  /// @param taskParameters exporter task parameters
+  HttpTracer(HttpClient& client, const std::string& uri, size_t capacity = defaultCapacity, const TaskParameters& taskParameters = defaultTaskParameters);
+  ~HttpTracer();
+  HttpTracer(const HttpTracer&) = delete;
+  HttpTracer& operator=(const HttpTracer&) = delete;
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Starts the exporter task
+  /// @return error code
+  esp_err_t Enable();
+
+  /// @brief Stops the exporter task. The spans in the buffer are kept.
+  /// @return error code
+  esp_err_t Disable();
+
+  /// @brief Checks if the exporter task is running
+  /// @return true if the tracer is enabled
+  bool IsEnabled();
+
+  /// @brief Gets the service name of the exported spans
+  /// @return service name
+  std::string GetServiceName();
+
+  /// @brief Sets the service name of the exported spans
+  /// @param serviceName service name
+  /// @return error code
+  esp_err_t SetServiceName(const std::string& serviceName);
+
+  /// @brief Gets the maximum number of spans in an export request
+  /// @return batch size
+  size_t GetMaxBatchSize();
+
+  /// @brief Gets the time between the exports
+  /// @return time in FreeRTOS ticks
+  TickType_t GetBatchTime();
+
+  /// @brief Sets the batch limits. The spans are exported when the buffer has the maximum batch size of them
+  /// or when the batch time has passed since the previous export.
+  /// @param maxSize maximum number of spans in an export request
+  /// @param time time in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetBatchLimits(size_t maxSize, TickType_t time);
+
+  /// @brief Records the span. The method does not lock the tracer and can be called by any task.
+  /// @param span span
+  /// @return error code (ESP_ERR_NO_MEM if the buffer is full: the span is dropped)
+  esp_err_t Record(const HttpSpan& span);
+
+  /// @brief Takes the recorded spans from the buffer. Should not be called while the exporter task is running.
+  /// @param spans spans
+  /// @param maxNumberOfSpans maximum number of spans
+  /// @return number of spans taken
+  size_t TakeSpans(HttpSpan* spans, size_t maxNumberOfSpans);
+
+  /// @brief Gets the tracer statistics
+  /// @return statistics
+  HttpTracerStatistics GetStatistics();
+
+  /// @brief Gets the trace context of the current task: the context of the request the task handles
+  /// @return trace context (NULL if the task does not handle a traced request)
+  static const HttpTraceContext* GetCurrentContext();
+
+  /// @brief Sets the trace context of the current task. The clients used by the task send their requests in this context.
+  /// @param context trace context (NULL: no context). The context should exist until it is replaced.
+  /// @return previous trace context
+  static const HttpTraceContext* SetCurrentContext(const HttpTraceContext* context);
+
+  /// @brief Parses the "traceparent" header value
+  /// @param value header value
+  /// @param context trace context (the trace state is not changed)
+  /// @return error code
+  static esp_err_t ParseTraceParent(const std::string& value, HttpTraceContext& context);
+
+  /// @brief Formats the "traceparent" header value
+  /// @param context trace context
+  /// @param dest destination of traceParentSize + 1 characters
+  static void FormatTraceParent(const HttpTraceContext& context, char* dest);
+
+  /// @brief Begins the span: the context gets a new span ID, the trace ID and the flags of the parent context
+  /// @param kind span kind
+  /// @param method request method
+  /// @param uri request URI
+  /// @param parent parent context (NULL: the span starts a new sampled trace)
+  /// @param context span context
+  /// @param span span
+  static void BeginSpan(HttpSpanKind kind, HttpMethod method, const char* uri, const HttpTraceContext* parent, HttpTraceContext& context, HttpSpan& span);
+
+  /// @brief Ends the span begun by BeginSpan
+  /// @param span span
+  /// @param statusCode response status code (0 if the request has failed without a response)
+  static void EndSpan(HttpSpan& span, uint16_t statusCode);
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    HttpSpan span;
+  };
+
+  Mutex mutex;
+  HttpClient& client;
+  std::string uri;
+  TaskParameters taskParameters;
+  TaskHandle_t taskHandle = NULL;
+  volatile bool stopRequested = false;
+  // The producers wake up the exporter with the semaphore, because it exists while the exporter task is being deleted
+  StaticSemaphore_t batchSemaphoreBuffer;
+  SemaphoreHandle_t batchSemaphore;
+  std::string serviceName = defaultServiceName;
+  std::atomic<size_t> maxBatchSize = defaultMaxBatchSize;
+  TickType_t batchTime = defaultBatchTime;
+  // Bounded multi-producer queue: a slot is free for the position equal to its sequence and holds a span for the position one less
+  std::unique_ptr<Slot[]> slots;
+  size_t capacity;
+  std::atomic<size_t> enqueuePosition{0};
+  std::atomic<size_t> dequeuePosition{0};
+  std::atomic<size_t> numberOfRecordedSpans{0};
+  std::atomic<size_t> numberOfDroppedSpans{0};
+  size_t numberOfExportedSpans = 0;
+  size_t numberOfBatches = 0;
+
+  static void TaskCode(void* parameters);
+  void Run();
+  esp_err_t ExportBatch(const HttpSpan* spans, size_t numberOfSpans);
+  esp_err_t PostBatch(const std::string& body);
+};
+
+//==============================================================================
+
+}
@@ -1,4 +1,10 @@
 #pragma once
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 //==============================================================================
 
@@ -19,7 +25,11 @@ enum class HttpMethod {
   /// @brief PATCH method
   PATCH,
   /// @brief DELETE method
-  DELETE
+  DELETE,
+  /// @brief HEAD method
+  HEAD,
+  /// @brief OPTIONS method
+  OPTIONS
 };
 
 enum class HttpAuthScheme {
@@ -31,6 +41,326 @@ enum class HttpAuthScheme {
   digest
 };
 
+/// @brief HTTP body fragment (scatter/gather element)
+struct HttpBodyFragment {
+  /// @brief fragment data
+  const void* data;
+  /// @brief fragment size
+  size_t size;
+};
+
+/// @brief HTTP body source: fills dest with up to maxSize bytes and sets size to the number of bytes written (0 at the end of the body)
+using HttpBodySource = std::function<esp_err_t(void* dest, size_t maxSize, size_t& size)>;
+
+/// @brief HTTPS server TLS handshake statistics
+struct HttpTlsStatistics {
+  /// @brief number of completed handshakes (full and resumed)
+  size_t numberOfHandshakes;
+  /// @brief number of completed handshakes that have resumed a session (CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK)
+  size_t numberOfResumedHandshakes;
+  /// @brief total time of the full handshakes in microseconds, from the client hello (CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK)
+  uint64_t fullHandshakeTime;
+  /// @brief total time of the resumed handshakes in microseconds, from the client hello (CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK)
+  uint64_t resumedHandshakeTime;
+};
+
+/// @brief HTTP server connection socket options
+struct HttpSocketOptions {
+  /// @brief true to send the data without waiting for the acknowledgement of the previous segment (TCP_NODELAY)
+  bool noDelay;
+  /// @brief socket send buffer size (0: network stack default)
+  int sendBufferSize;
+  /// @brief socket receive buffer size (0: network stack default)
+  int receiveBufferSize;
+  /// @brief idle time in seconds before the keep-alive probes are sent (0: keep-alive probes are disabled)
+  int keepAliveIdleTime;
+  /// @brief keep-alive probe interval in seconds
+  int keepAliveInterval;
+  /// @brief number of unanswered keep-alive probes after which the connection is closed
+  int keepAliveCount;
+};
+
+/// @brief HTTP server cross-origin resource sharing (CORS) policy
+struct HttpCorsPolicy {
+  /// @brief allowed request origins ("*": any origin)
+  std::vector<std::string> allowedOrigins;
+  /// @brief "Access-Control-Allow-Methods" value
+  std::string allowedMethods;
+  /// @brief "Access-Control-Allow-Headers" value (empty: the headers requested by the preflight request are allowed)
+  std::string allowedHeaders;
+  /// @brief "Access-Control-Expose-Headers" value (empty: not sent)
+  std::string exposedHeaders;
+  /// @brief true to allow the requests with credentials (cookies, authorization)
+  bool allowCredentials;
+  /// @brief time in seconds the preflight response can be cached by the browser
+  uint32_t maxAge;
+};
+
+/// @brief HTTP client request phase timings
+struct HttpClientTimings {
+  /// @brief hostname resolution time in microseconds (0 if the cached address has been used or the connection has been reused)
+  int64_t resolveTime;
+  /// @brief connection time in microseconds including the address family race and the TLS handshake (0 if the connection has been reused)
+  int64_t connectTime;
+  /// @brief time in microseconds from the end of the request to the response headers
+  int64_t responseTime;
+};
+
+/// @brief HTTP client request policy
+struct HttpRequestPolicy {
+  /// @brief maximum number of retries of an idempotent request (GET, HEAD, OPTIONS, PUT, DELETE) after an error or a 502, 503 or 504 status code
+  uint8_t maxNumberOfRetries;
+  /// @brief delay before the first retry in FreeRTOS ticks. It is doubled for each following retry and up to a half of it is subtracted at random.
+  TickType_t initialBackoff;
+  /// @brief maximum delay before a retry in FreeRTOS ticks
+  TickType_t maxBackoff;
+  /// @brief request deadline including the retries in FreeRTOS ticks (portMAX_DELAY: no deadline)
+  TickType_t deadline;
+  /// @brief true to abandon an idempotent request attempt that has waited for the response longer than the 95th percentile
+  /// of the recent response times and to send it again at once
+  bool hedging;
+  /// @brief number of consecutive failed requests to the host that opens its circuit breaker (0: no circuit breaker)
+  uint8_t circuitBreakerThreshold;
+  /// @brief time in FreeRTOS ticks the open circuit breaker fails the requests to the host without sending them
+  TickType_t circuitBreakerOpenTime;
+};
+
+/// @brief HTTP upload queue batch encoder (e.g. compressor): encodes the batch body src into dest
+using HttpBatchEncoder = std::function<esp_err_t(const std::string& src, std::string& dest)>;
+
+/// @brief HTTP payload format
+enum class HttpPayloadFormat {
+  /// @brief JSON (application/json)
+  json,
+  /// @brief CBOR (application/cbor)
+  cbor,
+  /// @brief MessagePack (application/msgpack)
+  messagePack
+};
+
+/// @brief HTTP payload value type
+enum class HttpPayloadValueType {
+  /// @brief null
+  null,
+  /// @brief boolean
+  boolean,
+  /// @brief signed integer
+  integer,
+  /// @brief unsigned integer greater than INT64_MAX
+  unsignedInteger,
+  /// @brief floating-point number
+  floatingPoint,
+  /// @brief text string
+  string,
+  /// @brief byte string (CBOR and MessagePack only)
+  binary,
+  /// @brief map start
+  mapStart,
+  /// @brief map end
+  mapEnd,
+  /// @brief array start
+  arrayStart,
+  /// @brief array end
+  arrayEnd
+};
+
+/// @brief HTTP payload value read by HttpPayloadReader
+struct HttpPayloadValue {
+  /// @brief value type
+  HttpPayloadValueType type;
+  /// @brief boolean value
+  bool boolean;
+  /// @brief signed integer value
+  int64_t integer;
+  /// @brief unsigned integer value (also set for non-negative signed integers)
+  uint64_t unsignedInteger;
+  /// @brief floating-point value (also set for integers)
+  double floatingPoint;
+  /// @brief text or byte string in the reader buffer, valid until the next read
+  std::string_view string;
+  /// @brief number of map entries or array elements (SIZE_MAX if unknown)
+  size_t size;
+};
+
+/// @brief HTTP upload queue statistics
+struct HttpUploadQueueStatistics {
+  /// @brief number of records in memory
+  size_t numberOfQueuedRecords;
+  /// @brief number of records in the spill file
+  size_t numberOfSpilledRecords;
+  /// @brief number of records sent
+  size_t numberOfSentRecords;
+  /// @brief number of records dropped because the memory or the spill file was full or the server rejected them
+  size_t numberOfDroppedRecords;
+  /// @brief number of batch requests sent
+  size_t numberOfBatches;
+};
+
+/// @brief HTTP link emulator profile. The random values are drawn from a generator seeded with the seed and the connection number.
+struct HttpLinkProfile {
+  /// @brief one-way delay in microseconds
+  uint32_t latency;
+  /// @brief maximum random delay in microseconds added to the latency of a segment
+  uint32_t jitter;
+  /// @brief link bandwidth in bytes per second in each direction (0: not limited)
+  uint32_t bandwidth;
+  /// @brief probability (0-1) of a segment loss. The lost segment is delivered after the retransmission timeout
+  /// and the following segments wait for it as they do in TCP.
+  float lossProbability;
+  /// @brief retransmission timeout in microseconds (doubled for each following loss of the same segment)
+  uint32_t retransmissionTimeout;
+  /// @brief probability (0-1) of a connection reset on a segment transfer
+  float resetProbability;
+  /// @brief random number generator seed
+  uint32_t seed;
+};
+
+/// @brief HTTP link emulator statistics
+struct HttpLinkStatistics {
+  /// @brief number of accepted connections
+  size_t numberOfConnections;
+  /// @brief number of segments transferred
+  size_t numberOfSegments;
+  /// @brief number of segment losses
+  size_t numberOfLostSegments;
+  /// @brief number of connections reset
+  size_t numberOfResets;
+  /// @brief number of bytes delivered
+  size_t numberOfBytes;
+};
+
+/// @brief HTTP load generator request
+struct HttpLoadRequest {
+  /// @brief method
+  HttpMethod method;
+  /// @brief URI
+  std::string uri;
+  /// @brief body
+  std::string body;
+  /// @brief relative frequency of the request in the request mix
+  uint32_t weight;
+};
+
+/// @brief HTTP load generator mode
+enum class HttpLoadMode {
+  /// @brief each client sends the next request when the previous response has been received
+  closedLoop,
+  /// @brief the requests are started at random (Poisson) times at the request rate whether the previous responses have been received or not
+  openLoop
+};
+
+/// @brief HTTP load generator profile
+struct HttpLoadProfile {
+  /// @brief load mode
+  HttpLoadMode mode;
+  /// @brief number of clients (concurrent connections)
+  size_t numberOfClients;
+  /// @brief open-loop mean request rate in requests per second
+  float requestRate;
+  /// @brief closed-loop delay in FreeRTOS ticks between the response and the next request of the client
+  TickType_t thinkTime;
+  /// @brief total number of requests (0: limited by the duration only)
+  size_t numberOfRequests;
+  /// @brief load duration in FreeRTOS ticks (portMAX_DELAY: limited by the number of requests only)
+  TickType_t duration;
+  /// @brief true to keep the connections alive between the requests, false to connect for each request
+  bool reuseConnections;
+  /// @brief seed of the request mix and the open-loop arrival time random number generator
+  uint32_t seed;
+};
+
+/// @brief HTTP load generator statistics
+struct HttpLoadStatistics {
+  /// @brief number of requests completed (with or without a response)
+  size_t numberOfRequests;
+  /// @brief number of requests failed without a response (connection errors, resets, timeouts)
+  size_t numberOfErrors;
+  /// @brief number of 4xx responses
+  size_t numberOfClientErrors;
+  /// @brief number of 5xx responses
+  size_t numberOfServerErrors;
+  /// @brief number of connections opened
+  size_t numberOfConnections;
+  /// @brief load duration in microseconds
+  int64_t duration;
+  /// @brief number of requests completed per second
+  float throughput;
+  /// @brief median latency in microseconds. The open-loop latency is counted from the scheduled request start time,
+  /// so the time a request has waited for a free client is included.
+  int64_t medianLatency;
+  /// @brief 90th percentile latency in microseconds
+  int64_t p90Latency;
+  /// @brief 99th percentile latency in microseconds
+  int64_t p99Latency;
+  /// @brief 99.9th percentile latency in microseconds
+  int64_t p999Latency;
+  /// @brief maximum latency in microseconds
+  int64_t maxLatency;
+};
+
+/// @brief HTTP trace context (W3C Trace Context "traceparent" and "tracestate")
+struct HttpTraceContext {
+  /// @brief trace ID
+  uint8_t traceId[16];
+  /// @brief span ID
+  uint8_t spanId[8];
+  /// @brief trace flags (bit 0: sampled)
+  uint8_t flags;
+  /// @brief vendor-specific trace state ("tracestate" header value) propagated as it is
+  std::string state;
+};
+
+/// @brief HTTP trace span kind
+enum class HttpSpanKind {
+  /// @brief request handled by the server
+  server,
+  /// @brief request sent by the client
+  client
+};
+
+/// @brief HTTP trace span. The span is a fixed-size structure, so it is recorded without allocation.
+struct HttpSpan {
+  /// @brief trace ID
+  uint8_t traceId[16];
+  /// @brief span ID
+  uint8_t spanId[8];
+  /// @brief parent span ID (all zeros for a root span)
+  uint8_t parentSpanId[8];
+  /// @brief trace flags (bit 0: sampled)
+  uint8_t flags;
+  /// @brief span kind
+  HttpSpanKind kind;
+  /// @brief request method
+  HttpMethod method;
+  /// @brief response status code (0 if the request has failed without a response)
+  uint16_t statusCode;
+  /// @brief request URI without the query (truncated)
+  char uri[48];
+  /// @brief start time in microseconds since the Unix epoch
+  int64_t startTime;
+  /// @brief duration in microseconds
+  int64_t duration;
+  /// @brief client span: hostname resolution time in microseconds
+  int64_t resolveTime;
+  /// @brief client span: connection time in microseconds
+  int64_t connectTime;
+  /// @brief client span: time in microseconds from the end of the request to the response headers.
+  /// Server span: request handler time in microseconds.
+  int64_t responseTime;
+};
+
+/// @brief HTTP tracer statistics
+struct HttpTracerStatistics {
+  /// @brief number of spans recorded
+  size_t numberOfRecordedSpans;
+  /// @brief number of spans dropped because the span buffer was full or the export failed
+  size_t numberOfDroppedSpans;
+  /// @brief number of spans exported
+  size_t numberOfExportedSpans;
+  /// @brief number of export requests sent
+  size_t numberOfBatches;
+};
+
 //==============================================================================
 
 }
\ No newline at end of file
@@ -0,0 +1,183 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_http_client.h"
+#include "freertos/task.h"
+#include <deque>
+#include <stdio.h>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+/// @brief HTTP/HTTPS store-and-forward upload queue class. Producers enqueue records without waiting for the network.
+/// The sender task joins the records into a batch and posts it with the client when the batch size or the batch time is reached.
+/// Memory use is bounded: when the memory is full, the oldest records of the lowest priority are dropped.
+/// While the server cannot be reached, the records are moved to an optional ring file on a VFS file system.
+class HttpUploadQueue : public Lockable {
+public:
+  /// @brief Default sender task parameters
+  static const TaskParameters defaultTaskParameters;
+  /// @brief Number of record priorities
+  static constexpr uint8_t numberOfPriorities = 4;
+  /// @brief Default maximum memory size of the queued records
+  static constexpr size_t defaultMaxMemorySize = 4096;
+  /// @brief Default maximum batch body size
+  static constexpr size_t defaultMaxBatchSize = 1024;
+  /// @brief Default time in FreeRTOS ticks from the first queued record to the batch send
+  static constexpr TickType_t defaultBatchTime = 1000 / portTICK_PERIOD_MS;
+  /// @brief Default time in FreeRTOS ticks between the send attempts while the server cannot be reached
+  static constexpr TickType_t defaultRetryTime = 5000 / portTICK_PERIOD_MS;
+  /// @brief Default batch content type
+  static const std::string defaultContentType;
+  /// @brief Default record separator in the batch
+  static const std::string defaultRecordSeparator;
+  /// @brief Maximum record size (the spill file stores the size in 16 bits)
+  static constexpr size_t maxRecordSize = UINT16_MAX;
+
+  /// @brief Creates an upload queue
+  /// @param client HTTP client. It is locked while a batch is sent.
+  /// @param uri URI the batches are posted to
+  /// @param maxMemorySize maximum memory size of the queued records
+  /// @param taskParameters sender task parameters
+  HttpUploadQueue(HttpClient& client, const std::string& uri, size_t maxMemorySize = defaultMaxMemorySize,
+                  const TaskParameters& taskParameters = defaultTaskParameters);
+  ~HttpUploadQueue();
+  HttpUploadQueue(const HttpUploadQueue&) = delete;
+  HttpUploadQueue& operator=(const HttpUploadQueue&) = delete;
+
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override;
+  esp_err_t Unlock() override;
+
+  /// @brief Opens the spill file (if set) and starts the sender task
+  /// @return error code
+  esp_err_t Enable();
+
+  /// @brief Stops the sender task and closes the spill file. The records in memory are kept.
+  /// @return error code
+  esp_err_t Disable();
+
+  /// @brief Checks if the sender task is running
+  /// @return true if the queue is enabled
+  bool IsEnabled();
+
+  /// @brief Adds the record to the queue. The method does not wait for the network or the file system.
+  /// If the memory is full, the oldest records of the lowest priority not higher than the record priority are dropped.
+  /// @param data record data
+  /// @param size record size
+  /// @param priority record priority (0 - lowest, numberOfPriorities - 1 - highest)
+  /// @return error code (ESP_ERR_NO_MEM if the memory is full of the records of higher priority)
+  esp_err_t Enqueue(const void* data, size_t size, uint8_t priority = 0);
+
+  /// @brief Adds the record to the queue. The method does not wait for the network or the file system.
+  /// @param record record
+  /// @param priority record priority (0 - lowest, numberOfPriorities - 1 - highest)
+  /// @return error code
+  esp_err_t Enqueue(const std::string& record, uint8_t priority = 0);
+
+  /// @brief Gets the maximum batch body size
+  /// @return batch size
+  size_t GetMaxBatchSize();
+
+  /// @brief Gets the batch time
+  /// @return time in FreeRTOS ticks
+  TickType_t GetBatchTime();
+
+  /// @brief Sets the batch limits. A batch is sent when the queued records reach the maximum batch size
+  /// or when the batch time has passed since the first of them was queued. A record larger than the batch size is sent alone.
+  /// @param maxSize maximum batch body size
+  /// @param time time in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetBatchLimits(size_t maxSize, TickType_t time);
+
+  /// @brief Gets the time between the send attempts while the server cannot be reached
+  /// @return time in FreeRTOS ticks
+  TickType_t GetRetryTime();
+
+  /// @brief Sets the time between the send attempts while the server cannot be reached
+  /// @param time time in FreeRTOS ticks
+  /// @return error code
+  esp_err_t SetRetryTime(TickType_t time);
+
+  /// @brief Sets the batch content type and the record separator
+  /// @param contentType content type
+  /// @param recordSeparator record separator
+  /// @return error code
+  esp_err_t SetBatchFormat(const std::string& contentType, const std::string& recordSeparator);
+
+  /// @brief Sets the batch encoder (e.g. a compressor). The batch body is encoded before it is sent.
+  /// @param contentEncoding "Content-Encoding" header value (e.g. "gzip")
+  /// @param encoder encoder (empty to send the batch as it is)
+  /// @return error code
+  esp_err_t SetBatchEncoder(const std::string& contentEncoding, const HttpBatchEncoder& encoder);
+
+  /// @brief Sets the spill file the records are moved to while the server cannot be reached.
+  /// The file is a ring buffer: when it is full, the oldest records are dropped. Should be set while the queue is disabled.
+  /// @param path file path on a mounted VFS file system (empty: no spill file)
+  /// @param maxSize maximum file size
+  /// @return error code
+  esp_err_t SetSpillFile(const std::string& path, size_t maxSize);
+
+  /// @brief Gets the queue statistics
+  /// @return statistics
+  HttpUploadQueueStatistics GetStatistics();
+
+private:
+  struct SpillFileHeader {
+    uint32_t signature;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t usedSize;
+    uint32_t numberOfRecords;
+  };
+
+  struct __attribute__((packed)) SpillRecordHeader {
+    uint16_t size;
+    uint8_t priority;
+  };
+
+  Mutex mutex;
+  HttpClient& client;
+  std::string uri;
+  TaskParameters taskParameters;
+  TaskHandle_t taskHandle = NULL;
+  volatile bool stopRequested = false;
+  size_t maxMemorySize;
+  size_t memorySize = 0;
+  std::deque<std::string> records[numberOfPriorities];
+  TickType_t firstRecordTime = 0;
+  size_t maxBatchSize = defaultMaxBatchSize;
+  TickType_t batchTime = defaultBatchTime;
+  TickType_t retryTime = defaultRetryTime;
+  std::string contentType = defaultContentType;
+  std::string recordSeparator = defaultRecordSeparator;
+  std::string contentEncoding;
+  HttpBatchEncoder encoder;
+  std::string spillFilePath;
+  size_t maxSpillFileSize = 0;
+  HttpUploadQueueStatistics statistics = {};
+  // The spill file is only accessed by the sender task while the queue is enabled
+  FILE* spillFile = NULL;
+  SpillFileHeader spillFileHeader = {};
+
+  static void TaskCode(void* parameters);
+  void Run();
+  TickType_t GetWaitTime(bool offline, TickType_t offlineTime);
+  size_t TakeBatch(std::vector<std::pair<uint8_t, std::string>>& batch);
+  void ReturnBatch(std::vector<std::pair<uint8_t, std::string>>& batch);
+  esp_err_t SendBatch(const std::vector<std::pair<uint8_t, std::string>>& batch, bool& rejected);
+  void DropRecords(size_t size);
+  esp_err_t OpenSpillFile();
+  void CloseSpillFile();
+  esp_err_t SpillRecords();
+  esp_err_t ReadSpilledRecords(std::vector<std::pair<uint8_t, std::string>>& batch);
+  esp_err_t RemoveSpilledRecords(size_t numberOfRecords);
+  esp_err_t ReadSpillFile(uint32_t offset, void* dest, size_t size);
+  esp_err_t WriteSpillFile(uint32_t offset, const void* src, size_t size);
+  esp_err_t WriteSpillFileHeader();
+};
+
+//==============================================================================
+
+}
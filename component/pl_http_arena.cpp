@@ -0,0 +1,54 @@
+#include "pl_http_arena.h"
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+HttpArena::HttpArena(size_t size, uint32_t caps) : data((uint8_t*)(size ? heap_caps_malloc(size, caps) : NULL)), size(data ? size : 0) {}
+
+//==============================================================================
+
+HttpArena::~HttpArena() {
+  if (data)
+    heap_caps_free(data);
+}
+
+//==============================================================================
+
+void* HttpArena::Allocate(size_t size, size_t alignment) {
+  size_t offset = (usedSize + alignment - 1) & ~(alignment - 1);
+  if (!data || offset > this->size || size > this->size - offset)
+    return NULL;
+  usedSize = offset + size;
+  return data + offset;
+}
+
+//==============================================================================
+
+void HttpArena::Reset() {
+  usedSize = 0;
+}
+
+//==============================================================================
+
+bool HttpArena::Contains(const void* ptr) {
+  return data && ptr >= data && ptr < data + size;
+}
+
+//==============================================================================
+
+size_t HttpArena::GetSize() {
+  return size;
+}
+
+//==============================================================================
+
+size_t HttpArena::GetUsedSize() {
+  return usedSize;
+}
+
+//==============================================================================
+
+}
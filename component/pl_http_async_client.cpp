@@ -0,0 +1,458 @@
+#include "pl_http_async_client.h"
+#ifdef __cpp_impl_coroutine
+#include "esp_check.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include <map>
+
+//==============================================================================
+
+static const char* TAG = "pl_http_async_client";
+
+// Coroutine versions of ESP_RETURN_ON_ERROR and ESP_RETURN_ON_FALSE: a coroutine cannot use return
+#define CO_RETURN_ON_ERROR(x, log_tag, format) do {                             \
+    esp_err_t err_rc_ = (x);                                                    \
+    if (err_rc_ != ESP_OK) {                                                    \
+      ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__);            \
+      co_return err_rc_;                                                        \
+    }                                                                           \
+  } while (0)
+
+#define CO_RETURN_ON_FALSE(a, err_code, log_tag, format) do {                  \
+    if (!(a)) {                                                                 \
+      ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__);            \
+      co_return err_code;                                                       \
+    }                                                                           \
+  } while (0)
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+static std::map<HttpMethod, const char*> httpMethodNameMap {
+  {HttpMethod::GET, "GET"}, {HttpMethod::POST, "POST"}, {HttpMethod::PUT, "PUT"}, {HttpMethod::PATCH, "PATCH"}, {HttpMethod::DELETE, "DELETE"},
+  {HttpMethod::HEAD, "HEAD"}, {HttpMethod::OPTIONS, "OPTIONS"}
+};
+
+//==============================================================================
+
+HttpAsyncClient::HttpAsyncClient(HttpScheduler& scheduler, const std::string& hostname, size_t bufferSize) :
+  scheduler(scheduler), hostname(hostname), buffer(new char[bufferSize]), bufferSize(bufferSize) {}
+
+//==============================================================================
+
+HttpAsyncClient::HttpAsyncClient(HttpScheduler& scheduler, const std::string& hostname, const char* serverCertificate, size_t bufferSize) :
+    HttpAsyncClient(scheduler, hostname, bufferSize) {
+  port = defaultHttpsPort;
+  https = true;
+  this->serverCertificate = serverCertificate;
+}
+
+//==============================================================================
+
+HttpAsyncClient::HttpAsyncClient(HttpScheduler& scheduler, const std::string& hostname, esp_err_t (*crt_bundle_attach)(void *conf), size_t bufferSize) :
+    HttpAsyncClient(scheduler, hostname, bufferSize) {
+  port = defaultHttpsPort;
+  https = true;
+  this->crt_bundle_attach = crt_bundle_attach;
+}
+
+//==============================================================================
+
+HttpAsyncClient::~HttpAsyncClient() {
+  Disconnect();
+}
+
+//==============================================================================
+
+HttpTask HttpAsyncClient::Send(HttpMethod method, std::string uri, std::string body, ushort& statusCode) {
+  auto methodName = httpMethodNameMap.find(method);
+  CO_RETURN_ON_FALSE(methodName != httpMethodNameMap.end(), ESP_ERR_INVALID_ARG, TAG, "invalid HTTP method");
+  // The rest of the previous response body is not drained
+  if (bodyState != BodyState::none)
+    Disconnect();
+
+  std::string request = std::string(methodName->second) + " " + uri + " HTTP/1.1\r\nHost: " + hostname;
+  if (port != (https ? defaultHttpsPort : defaultHttpPort))
+    request += ":" + std::to_string(port);
+  request += "\r\n";
+  if (body.size() || method == HttpMethod::POST || method == HttpMethod::PUT || method == HttpMethod::PATCH)
+    request += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  for (auto& header : requestHeaders)
+    request += header.first + ": " + header.second + "\r\n";
+  request += "\r\n";
+  request += body;
+
+  // A kept-alive connection may have been closed by the server before the request arrived: an idempotent request
+  // is sent once more over a new connection. Any other failure may come after the server has processed the request.
+  bool idempotent = method == HttpMethod::GET || method == HttpMethod::HEAD || method == HttpMethod::OPTIONS ||
+                    method == HttpMethod::PUT || method == HttpMethod::DELETE;
+  for (int attempt = 0; ; attempt++) {
+    bool reused = tls || sockfd >= 0;
+    CO_RETURN_ON_ERROR(co_await Connect(), TAG, "connect failed");
+    esp_err_t error = co_await Write(request.data(), request.size());
+    if (error == ESP_OK)
+      error = co_await ReadResponseHead(statusCode);
+    if (error == ESP_OK)
+      break;
+    bool closedBeforeResponse = error == ESP_ERR_NOT_FOUND && bufferEnd == bufferStart;
+    Disconnect();
+    CO_RETURN_ON_FALSE(reused && !attempt && closedBeforeResponse && idempotent, error, TAG, "send request failed");
+  }
+
+  // Interim responses ("100 Continue") are skipped
+  while (statusCode < 200)
+    CO_RETURN_ON_ERROR(co_await ReadResponseHead(statusCode), TAG, "read response head failed");
+
+  std::string value;
+  if (GetResponseHeader("Connection", value) == ESP_OK)
+    closeAfterResponse = strcasecmp(value.c_str(), "close") == 0;
+  // The response to a HEAD request has the headers of the body but not the body
+  if (statusCode == 204 || statusCode == 304 || method == HttpMethod::HEAD) {
+    bodyState = BodyState::none;
+    responseBodySize = 0;
+  }
+  else if (GetResponseHeader("Transfer-Encoding", value) == ESP_OK && strcasecmp(value.c_str(), "chunked") == 0) {
+    bodyState = BodyState::chunkSize;
+    responseBodySize = SIZE_MAX;
+  }
+  else if (GetResponseHeader("Content-Length", value) == ESP_OK) {
+    responseBodySize = bodyRemainingSize = strtoul(value.c_str(), NULL, 10);
+    bodyState = responseBodySize ? BodyState::contentLength : BodyState::none;
+  }
+  else {
+    bodyState = BodyState::untilClose;
+    responseBodySize = SIZE_MAX;
+    closeAfterResponse = true;
+  }
+  if (bodyState == BodyState::none && closeAfterResponse)
+    Disconnect();
+  co_return ESP_OK;
+}
+
+//==============================================================================
+
+HttpTask HttpAsyncClient::ReadResponseBody(void* dest, size_t maxSize, size_t& size) {
+  size = 0;
+  std::string line;
+  while (!size && bodyState != BodyState::none && maxSize) {
+    switch (bodyState) {
+      case BodyState::contentLength:
+      case BodyState::chunkData:
+      case BodyState::untilClose: {
+        if (bufferStart == bufferEnd) {
+          esp_err_t error = co_await Fill();
+          // The body of unknown size ends when the server closes the connection
+          if (error == ESP_ERR_NOT_FOUND && bodyState == BodyState::untilClose) {
+            bodyState = BodyState::none;
+            break;
+          }
+          CO_RETURN_ON_ERROR(error, TAG, "read response body failed");
+        }
+        size = std::min(maxSize, bufferEnd - bufferStart);
+        if (bodyState != BodyState::untilClose)
+          size = std::min(size, bodyRemainingSize);
+        memcpy(dest, buffer.get() + bufferStart, size);
+        bufferStart += size;
+        if (bodyState == BodyState::untilClose)
+          break;
+        bodyRemainingSize -= size;
+        if (!bodyRemainingSize)
+          bodyState = bodyState == BodyState::chunkData ? BodyState::chunkEnd : BodyState::none;
+        break;
+      }
+
+      case BodyState::chunkSize:
+        CO_RETURN_ON_ERROR(co_await ReadLine(line), TAG, "read chunk size failed");
+        bodyRemainingSize = strtoul(line.c_str(), NULL, 16);
+        bodyState = bodyRemainingSize ? BodyState::chunkData : BodyState::trailer;
+        break;
+
+      case BodyState::chunkEnd:
+        CO_RETURN_ON_ERROR(co_await ReadLine(line), TAG, "read chunk end failed");
+        bodyState = BodyState::chunkSize;
+        break;
+
+      case BodyState::trailer:
+        CO_RETURN_ON_ERROR(co_await ReadLine(line), TAG, "read trailer failed");
+        if (line.empty())
+          bodyState = BodyState::none;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  if (bodyState == BodyState::none && closeAfterResponse)
+    Disconnect();
+  co_return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpAsyncClient::Disconnect() {
+  if (tls)
+    esp_tls_conn_destroy(tls);
+  else if (sockfd >= 0)
+    close(sockfd);
+  tls = NULL;
+  sockfd = -1;
+  bufferStart = bufferEnd = 0;
+  bodyState = BodyState::none;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+uint16_t HttpAsyncClient::GetPort() {
+  return port;
+}
+
+//==============================================================================
+
+esp_err_t HttpAsyncClient::SetPort(uint16_t port) {
+  this->port = port;
+  return Disconnect();
+}
+
+//==============================================================================
+
+TickType_t HttpAsyncClient::GetTimeout() {
+  return timeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpAsyncClient::SetTimeout(TickType_t timeout) {
+  this->timeout = timeout;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpAsyncClient::SetRequestHeader(const std::string& name, const std::string& value) {
+  for (auto& header : requestHeaders) {
+    if (strcasecmp(header.first.c_str(), name.c_str()) == 0) {
+      header.second = value;
+      return ESP_OK;
+    }
+  }
+  requestHeaders.emplace_back(name, value);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpAsyncClient::DeleteRequestHeader(const std::string& name) {
+  for (auto header = requestHeaders.begin(); header != requestHeaders.end(); header++) {
+    if (strcasecmp(header->first.c_str(), name.c_str()) == 0) {
+      requestHeaders.erase(header);
+      return ESP_OK;
+    }
+  }
+  ESP_RETURN_ON_ERROR(ESP_ERR_NOT_FOUND, TAG, "header not found");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpAsyncClient::GetResponseHeader(const std::string& name, std::string& value) {
+  for (auto& header : responseHeaders) {
+    if (strcasecmp(header.first.c_str(), name.c_str()) == 0) {
+      value = header.second;
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+//==============================================================================
+
+size_t HttpAsyncClient::GetResponseBodySize() {
+  return responseBodySize;
+}
+
+//==============================================================================
+
+HttpTask HttpAsyncClient::Connect() {
+  if (tls || sockfd >= 0)
+    co_return ESP_OK;
+  bufferStart = bufferEnd = 0;
+  bodyState = BodyState::none;
+
+  if (https) {
+    // The hostname is resolved with a blocking call, the TCP connection and the TLS handshake do not block
+    tls = esp_tls_init();
+    CO_RETURN_ON_FALSE(tls, ESP_ERR_NO_MEM, TAG, "TLS init failed");
+    esp_tls_cfg_t tlsConfig = {};
+    tlsConfig.non_block = true;
+    tlsConfig.timeout_ms = timeout == portMAX_DELAY ? 0 : timeout * portTICK_PERIOD_MS;
+    tlsConfig.cacert_buf = (const unsigned char*)serverCertificate;
+    tlsConfig.cacert_bytes = serverCertificate ? strlen(serverCertificate) + 1 : 0;
+    tlsConfig.crt_bundle_attach = crt_bundle_attach;
+    while (true) {
+      int res = esp_tls_conn_new_async(hostname.c_str(), hostname.size(), port, &tlsConfig, tls);
+      if (res == 1)
+        break;
+      int tempSockfd = -1;
+      esp_tls_conn_state_t state;
+      esp_err_t error = res < 0 ? ESP_FAIL : ESP_OK;
+      if (error == ESP_OK && (esp_tls_get_conn_sockfd(tls, &tempSockfd) != ESP_OK || esp_tls_get_conn_state(tls, &state) != ESP_OK))
+        error = ESP_FAIL;
+      if (error == ESP_OK)
+        error = co_await (state == ESP_TLS_CONNECTING ? scheduler.WaitUntilWritable(tempSockfd, timeout) : scheduler.WaitUntilReadable(tempSockfd, timeout));
+      if (error != ESP_OK) {
+        Disconnect();
+        CO_RETURN_ON_ERROR(error, TAG, "TLS connect failed");
+      }
+    }
+    esp_tls_get_conn_sockfd(tls, &sockfd);
+    co_return ESP_OK;
+  }
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addressInfo = NULL;
+  CO_RETURN_ON_FALSE(getaddrinfo(hostname.c_str(), std::to_string(port).c_str(), &hints, &addressInfo) == 0 && addressInfo, ESP_ERR_NOT_FOUND, TAG, "hostname not resolved");
+  sockfd = socket(addressInfo->ai_family, SOCK_STREAM, IPPROTO_TCP);
+  esp_err_t error = sockfd >= 0 && fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK) >= 0 ? ESP_OK : ESP_FAIL;
+  if (error == ESP_OK && connect(sockfd, addressInfo->ai_addr, addressInfo->ai_addrlen) != 0)
+    error = errno == EINPROGRESS ? ESP_ERR_NOT_FINISHED : ESP_FAIL;
+  freeaddrinfo(addressInfo);
+  if (error == ESP_ERR_NOT_FINISHED) {
+    error = co_await scheduler.WaitUntilWritable(sockfd, timeout);
+    int socketError = 0;
+    socklen_t socketErrorSize = sizeof(socketError);
+    if (error == ESP_OK && (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &socketError, &socketErrorSize) != 0 || socketError))
+      error = ESP_FAIL;
+  }
+  if (error != ESP_OK) {
+    Disconnect();
+    CO_RETURN_ON_ERROR(error, TAG, "connect failed");
+  }
+  co_return ESP_OK;
+}
+
+//==============================================================================
+
+HttpTask HttpAsyncClient::Write(const void* src, size_t size) {
+  while (size) {
+    ssize_t res = tls ? esp_tls_conn_write(tls, src, size) : send(sockfd, src, size, 0);
+    if (res > 0) {
+      src = (const char*)src + res;
+      size -= res;
+      continue;
+    }
+    // A TLS connection may have to receive data before it can send
+    bool wantRead = tls && res == ESP_TLS_ERR_SSL_WANT_READ;
+    bool wantWrite = tls ? res == ESP_TLS_ERR_SSL_WANT_WRITE : res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    CO_RETURN_ON_FALSE(wantRead || wantWrite, ESP_FAIL, TAG, "write failed");
+    CO_RETURN_ON_ERROR(co_await (wantRead ? scheduler.WaitUntilReadable(sockfd, timeout) : scheduler.WaitUntilWritable(sockfd, timeout)), TAG, "write timeout");
+  }
+  co_return ESP_OK;
+}
+
+//==============================================================================
+
+HttpTask HttpAsyncClient::Fill() {
+  CO_RETURN_ON_FALSE(tls || sockfd >= 0, ESP_ERR_INVALID_STATE, TAG, "not connected");
+  if (bufferStart) {
+    memmove(buffer.get(), buffer.get() + bufferStart, bufferEnd - bufferStart);
+    bufferEnd -= bufferStart;
+    bufferStart = 0;
+  }
+  CO_RETURN_ON_FALSE(bufferEnd < bufferSize, ESP_ERR_INVALID_SIZE, TAG, "buffer is too small");
+
+  while (true) {
+    ssize_t res = tls ? esp_tls_conn_read(tls, buffer.get() + bufferEnd, bufferSize - bufferEnd) : recv(sockfd, buffer.get() + bufferEnd, bufferSize - bufferEnd, 0);
+    if (res > 0) {
+      bufferEnd += res;
+      co_return ESP_OK;
+    }
+    // The connection closed by the server is reported with ESP_ERR_NOT_FOUND
+    if (!res)
+      co_return ESP_ERR_NOT_FOUND;
+    bool wantWrite = tls && res == ESP_TLS_ERR_SSL_WANT_WRITE;
+    bool wantRead = tls ? res == ESP_TLS_ERR_SSL_WANT_READ : errno == EAGAIN || errno == EWOULDBLOCK;
+    CO_RETURN_ON_FALSE(wantRead || wantWrite, ESP_FAIL, TAG, "read failed");
+    CO_RETURN_ON_ERROR(co_await (wantWrite ? scheduler.WaitUntilWritable(sockfd, timeout) : scheduler.WaitUntilReadable(sockfd, timeout)), TAG, "read timeout");
+  }
+}
+
+//==============================================================================
+
+HttpTask HttpAsyncClient::ReadResponseHead(ushort& statusCode) {
+  // The head is parsed in place in the buffer. The lines parsed before a fill are not scanned again.
+  responseParser.Reset();
+  while (true) {
+    esp_err_t error = responseParser.Parse(buffer.get() + bufferStart, bufferEnd - bufferStart);
+    if (error == ESP_OK)
+      break;
+    // The head that does not fit in the buffer or exceeds the parser limits is read line by line: only each line should fit in the buffer
+    if (error == ESP_ERR_INVALID_SIZE || (error == ESP_ERR_NOT_FINISHED && bufferEnd - bufferStart == bufferSize))
+      co_return co_await ReadLongResponseHead(statusCode);
+    CO_RETURN_ON_FALSE(error == ESP_ERR_NOT_FINISHED, ESP_ERR_INVALID_RESPONSE, TAG, "invalid response head");
+    error = co_await Fill();
+    if (error != ESP_OK)
+      co_return error;
+  }
+
+  statusCode = responseParser.GetStatusCode();
+  closeAfterResponse = !responseParser.GetMinorVersion();
+  responseHeaders.clear();
+  for (size_t i = 0; i < responseParser.GetNumberOfHeaders(); i++)
+    responseHeaders.emplace_back(responseParser.GetHeaderName(i), responseParser.GetHeaderValue(i));
+  bufferStart += responseParser.GetHeadSize();
+  co_return ESP_OK;
+}
+
+//==============================================================================
+
+HttpTask HttpAsyncClient::ReadLongResponseHead(ushort& statusCode) {
+  std::string line;
+  CO_RETURN_ON_ERROR(co_await ReadLine(line), TAG, "read status line failed");
+  CO_RETURN_ON_FALSE(line.compare(0, 5, "HTTP/") == 0 && line.size() >= 12, ESP_ERR_INVALID_RESPONSE, TAG, "invalid status line");
+  statusCode = atoi(line.c_str() + 9);
+  closeAfterResponse = line.compare(5, 3, "1.0") == 0;
+  responseHeaders.clear();
+  while (true) {
+    CO_RETURN_ON_ERROR(co_await ReadLine(line), TAG, "read response headers failed");
+    if (line.empty())
+      co_return ESP_OK;
+    size_t separator = line.find(':');
+    if (separator == std::string::npos)
+      continue;
+    size_t valueStart = line.find_first_not_of(' ', separator + 1);
+    responseHeaders.emplace_back(line.substr(0, separator), valueStart == std::string::npos ? "" : line.substr(valueStart));
+  }
+}
+
+//==============================================================================
+
+HttpTask HttpAsyncClient::ReadLine(std::string& line) {
+  size_t searchStart = bufferStart;
+  while (true) {
+    char* start = buffer.get() + bufferStart;
+    char* end = (char*)memchr(buffer.get() + searchStart, '\n', bufferEnd - searchStart);
+    if (end) {
+      line.assign(start, end > start && end[-1] == '\r' ? end - 1 : end);
+      bufferStart = end + 1 - buffer.get();
+      co_return ESP_OK;
+    }
+    searchStart = bufferEnd - bufferStart;
+    esp_err_t error = co_await Fill();
+    if (error != ESP_OK)
+      co_return error;
+    searchStart += bufferStart;
+  }
+}
+
+//==============================================================================
+
+}
+
+#endif
@@ -1,5 +1,13 @@
 #include "pl_http_client.h"
+#include "pl_http_tracer.h"
 #include "esp_check.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/md.h"
+#include <algorithm>
 #include <map>
 
 //==============================================================================
@@ -13,19 +21,195 @@ namespace PL {
 //==============================================================================
 
 static std::map<HttpMethod, esp_http_client_method_t> httpMethodMap {
-  {HttpMethod::GET, HTTP_METHOD_GET}, {HttpMethod::POST, HTTP_METHOD_POST}, {HttpMethod::PUT, HTTP_METHOD_PUT}, {HttpMethod::PATCH, HTTP_METHOD_PATCH}, {HttpMethod::DELETE, HTTP_METHOD_DELETE}
+  {HttpMethod::GET, HTTP_METHOD_GET}, {HttpMethod::POST, HTTP_METHOD_POST}, {HttpMethod::PUT, HTTP_METHOD_PUT}, {HttpMethod::PATCH, HTTP_METHOD_PATCH}, {HttpMethod::DELETE, HTTP_METHOD_DELETE},
+  {HttpMethod::HEAD, HTTP_METHOD_HEAD}, {HttpMethod::OPTIONS, HTTP_METHOD_OPTIONS}
 };
 
-static std::map<HttpAuthScheme, esp_http_client_auth_type_t> httpAuthSchemeMap {
-  {HttpAuthScheme::none, HTTP_AUTH_TYPE_NONE}, {HttpAuthScheme::basic, HTTP_AUTH_TYPE_BASIC}, {HttpAuthScheme::digest, HTTP_AUTH_TYPE_DIGEST}
+static std::map<HttpMethod, const char*> httpMethodNameMap {
+  {HttpMethod::GET, "GET"}, {HttpMethod::POST, "POST"}, {HttpMethod::PUT, "PUT"}, {HttpMethod::PATCH, "PATCH"}, {HttpMethod::DELETE, "DELETE"},
+  {HttpMethod::HEAD, "HEAD"}, {HttpMethod::OPTIONS, "OPTIONS"}
 };
 
+static std::map<std::string, mbedtls_md_type_t> digestAlgorithmMap {
+  {"MD5", MBEDTLS_MD_MD5}, {"SHA-256", MBEDTLS_MD_SHA256}, {"SHA-512", MBEDTLS_MD_SHA512}
+};
+
+//==============================================================================
+
+/// @brief Digest authentication challenge shared by all clients connected to the same host
+struct DigestChallenge {
+  std::string host;
+  std::string realm;
+  std::string nonce;
+  std::string opaque;
+  std::string algorithm;
+  mbedtls_md_type_t mdType;
+  bool session;
+  std::string qop;
+  uint32_t nonceCount;
+  uint32_t lastUse;
+};
+
+static Mutex digestChallengeMutex;
+static std::vector<DigestChallenge> digestChallenges;
+static uint32_t digestChallengeUseCounter = 0;
+
+/// @brief Circuit breaker shared by all clients connected to the same host
+struct CircuitBreaker {
+  std::string host;
+  uint16_t port;
+  uint8_t numberOfFailures;
+  TickType_t openingTime;
+};
+
+static Mutex circuitBreakerMutex;
+static std::vector<CircuitBreaker> circuitBreakers;
+
+/// @brief Host addresses shared by all clients connected to the same host. The address last connected to is the first one.
+struct CachedAddress {
+  std::string host;
+  uint16_t port;
+  std::vector<std::string> addresses;
+  int64_t expirationTime;
+};
+
+static Mutex addressCacheMutex;
+static std::vector<CachedAddress> addressCache;
+
+//==============================================================================
+
+const HttpRequestPolicy HttpClient::defaultRequestPolicy = {0, 100 / portTICK_PERIOD_MS, 2000 / portTICK_PERIOD_MS, portMAX_DELAY, false, 0, 10000 / portTICK_PERIOD_MS};
+
+//==============================================================================
+
+static std::string ToHex(const uint8_t* data, size_t size) {
+  static const char hexDigits[] = "0123456789abcdef";
+  std::string hex(size * 2, 0);
+  for (size_t i = 0; i < size; i++) {
+    hex[i * 2] = hexDigits[data[i] >> 4];
+    hex[i * 2 + 1] = hexDigits[data[i] & 0xF];
+  }
+  return hex;
+}
+
+//==============================================================================
+
+static esp_err_t Hash(mbedtls_md_type_t mdType, const HttpBodyFragment* fragments, size_t numberOfFragments, std::string& hash) {
+  const mbedtls_md_info_t* mdInfo = mbedtls_md_info_from_type(mdType);
+  ESP_RETURN_ON_FALSE(mdInfo, ESP_ERR_NOT_SUPPORTED, TAG, "hash algorithm is not supported");
+  uint8_t digest[MBEDTLS_MD_MAX_SIZE];
+  mbedtls_md_context_t mdContext;
+  mbedtls_md_init(&mdContext);
+  bool ok = mbedtls_md_setup(&mdContext, mdInfo, 0) == 0 && mbedtls_md_starts(&mdContext) == 0;
+  for (size_t i = 0; ok && i < numberOfFragments; i++)
+    ok = mbedtls_md_update(&mdContext, (const unsigned char*)fragments[i].data, fragments[i].size) == 0;
+  ok = ok && mbedtls_md_finish(&mdContext, digest) == 0;
+  mbedtls_md_free(&mdContext);
+  ESP_RETURN_ON_FALSE(ok, ESP_FAIL, TAG, "hash failed");
+  hash = ToHex(digest, mbedtls_md_get_size(mdInfo));
+  return ESP_OK;
+}
+
+//==============================================================================
+
+static esp_err_t Hash(mbedtls_md_type_t mdType, const std::string& data, std::string& hash) {
+  HttpBodyFragment fragment = {data.data(), data.size()};
+  return Hash(mdType, &fragment, 1, hash);
+}
+
+//==============================================================================
+
+static void ParseAuthParameters(const char* str, std::map<std::string, std::string>& parameters) {
+  while (*str) {
+    for (; *str == ' ' || *str == ','; str++);
+    const char* nameStart = str;
+    for (; *str && *str != '=' && *str != ',' && *str != ' '; str++);
+    std::string name(nameStart, str);
+    for (; *str == ' '; str++);
+    if (*str != '=')
+      continue;
+    for (str++; *str == ' '; str++);
+
+    std::string value;
+    if (*str == '"') {
+      for (str++; *str && *str != '"'; str++) {
+        if (*str == '\\' && str[1])
+          str++;
+        value += *str;
+      }
+      if (*str)
+        str++;
+    }
+    else {
+      const char* valueStart = str;
+      for (; *str && *str != ',' && *str != ' '; str++);
+      value.assign(valueStart, str);
+    }
+
+    for (auto& c : name)
+      c = tolower(c);
+    parameters[name] = value;
+  }
+}
+
+//==============================================================================
+
+static esp_err_t ResolveHostname(const std::string& hostname, std::vector<sockaddr_storage>& addresses) {
+  // The address lists of the families are interleaved starting with IPv6 (RFC 8305)
+  std::vector<sockaddr_storage> familyAddresses[2];
+  const int families[] = {AF_INET6, AF_INET};
+  for (int i = 0; i < 2; i++) {
+    addrinfo hints = {};
+    hints.ai_family = families[i];
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = NULL;
+    if (getaddrinfo(hostname.c_str(), NULL, &hints, &result) != 0)
+      continue;
+    for (addrinfo* info = result; info; info = info->ai_next) {
+      sockaddr_storage address = {};
+      memcpy(&address, info->ai_addr, std::min((size_t)info->ai_addrlen, sizeof(address)));
+      familyAddresses[i].push_back(address);
+    }
+    freeaddrinfo(result);
+  }
+  ESP_RETURN_ON_FALSE(familyAddresses[0].size() || familyAddresses[1].size(), ESP_ERR_NOT_FOUND, TAG, "hostname not resolved");
+
+  addresses.clear();
+  for (size_t i = 0; i < std::max(familyAddresses[0].size(), familyAddresses[1].size()); i++) {
+    for (auto& family : familyAddresses) {
+      if (i < family.size())
+        addresses.push_back(family[i]);
+    }
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+static bool HasToken(const std::string& list, const char* token) {
+  size_t tokenSize = strlen(token);
+  for (size_t start = 0; start < list.size(); ) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos)
+      end = list.size();
+    size_t tokenStart = list.find_first_not_of(' ', start);
+    size_t tokenEnd = list.find_last_not_of(' ', end - 1) + 1;
+    if (tokenStart < tokenEnd && tokenEnd - tokenStart == tokenSize && strncasecmp(list.c_str() + tokenStart, token, tokenSize) == 0)
+      return true;
+    start = end + 1;
+  }
+  return false;
+}
+
 //==============================================================================
 
 HttpClient::HttpClient(const std::string& hostname, size_t headerBufferSize) :
-    hostname(hostname), headerBuffer(std::make_shared<Buffer>(headerBufferSize)) {
+    defaultHostname(hostname), headerBuffer(std::make_shared<Buffer>(headerBufferSize)) {
   headerDataEnd = (char*)headerBuffer->data;
-  clientConfig.host = hostname.c_str();
+  // The connection is made to the resolved address, so the certificate is verified against the hostname
+  SetHostname(hostname);
+  clientConfig.common_name = commonName;
+  clientConfig.host = defaultHostname.c_str();
   clientConfig.path = "/";
   clientConfig.event_handler = HandleResponse;
   clientConfig.user_data = this;
@@ -41,6 +225,8 @@ HttpClient::HttpClient(const std::string& hostname, const char* certificate, siz
   clientConfig.cert_len = certificate ? strlen(certificate) + 1 : 0;
   clientConfig.transport_type = HTTP_TRANSPORT_OVER_SSL;
   clientConfig.port = defaultHttpsPort;
+  defaultHostPort = defaultHttpsPort;
+  defaultHostHttps = true;
 }
 
 //==============================================================================
@@ -50,6 +236,8 @@ HttpClient::HttpClient(const std::string& hostname, esp_err_t (*crt_bundle_attac
   clientConfig.crt_bundle_attach = crt_bundle_attach;
   clientConfig.transport_type = HTTP_TRANSPORT_OVER_SSL;
   clientConfig.port = defaultHttpsPort;
+  defaultHostPort = defaultHttpsPort;
+  defaultHostHttps = true;
 }
 
 //==============================================================================
@@ -90,15 +278,16 @@ esp_err_t HttpClient::Initialize() {
 
 esp_err_t HttpClient::WriteRequestHeaders(HttpMethod method, const std::string& uri, size_t bodySize) {
   LockGuard lg(*this);
-  ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
+  ESP_RETURN_ON_ERROR(OpenRequest(method, uri, bodySize), TAG, "open request failed");
+  return ESP_OK;
+}
 
-  auto espMethod = httpMethodMap.find(method);
-  ESP_RETURN_ON_FALSE(espMethod != httpMethodMap.end(), ESP_ERR_INVALID_ARG, TAG, "invalid HTTP method");
+//==============================================================================
 
-  ESP_RETURN_ON_ERROR(esp_http_client_flush_response(clientHandle, NULL), TAG, "flush response failed");
-  ESP_RETURN_ON_ERROR(esp_http_client_set_method(clientHandle, espMethod->second), TAG, "set method failed");
-  ESP_RETURN_ON_ERROR(esp_http_client_set_url(clientHandle, uri.c_str()), TAG, "set URL failed");
-  ESP_RETURN_ON_ERROR(esp_http_client_open(clientHandle, bodySize), TAG, "open failed");
+esp_err_t HttpClient::WriteRequestHeaders(HttpMethod method, const std::string& uri) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_ERROR(OpenRequest(method, uri, -1), TAG, "open request failed");
+  chunkedRequestBody = !earlyResponse;
   return ESP_OK;
 }
 
@@ -107,15 +296,44 @@ esp_err_t HttpClient::WriteRequestHeaders(HttpMethod method, const std::string&
 esp_err_t HttpClient::WriteRequestBody(const void* src, size_t size) {
   LockGuard lg(*this);
   ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
-  ESP_RETURN_ON_ERROR(esp_http_client_set_timeout_ms(clientHandle, writeTimeout == portMAX_DELAY ? -1 : writeTimeout * portTICK_PERIOD_MS), TAG, "set timeout failed");
-  ESP_RETURN_ON_FALSE(esp_http_client_write(clientHandle, (char*)src, size) >= 0, ESP_FAIL, TAG, "write failed");
+  if (earlyResponse)
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(SetTimeout(writeTimeout), TAG, "set timeout failed");
+  if (!chunkedRequestBody) {
+    ESP_RETURN_ON_ERROR(WriteRequestData(src, size), TAG, "write failed");
+    return ESP_OK;
+  }
+
+  // A zero-size chunk would end the body
+  if (!size)
+    return ESP_OK;
+  char chunkHeader[sizeof(size_t) * 2 + 3];
+  int chunkHeaderSize = snprintf(chunkHeader, sizeof(chunkHeader), "%x\r\n", (unsigned int)size);
+  ESP_RETURN_ON_ERROR(WriteRequestData(chunkHeader, chunkHeaderSize), TAG, "write failed");
+  ESP_RETURN_ON_ERROR(WriteRequestData(src, size), TAG, "write failed");
+  ESP_RETURN_ON_ERROR(WriteRequestData("\r\n", 2), TAG, "write failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::EndRequestBody() {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
+  if (!chunkedRequestBody)
+    return ESP_OK;
+  chunkedRequestBody = false;
+  ESP_RETURN_ON_ERROR(SetTimeout(writeTimeout), TAG, "set timeout failed");
+  ESP_RETURN_ON_ERROR(WriteRequestData("0\r\n\r\n", 5), TAG, "write failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
 esp_err_t HttpClient::WriteRequest(HttpMethod method, const std::string& uri, const std::string& body) {
-  ESP_RETURN_ON_ERROR(WriteRequestHeaders(method, uri, body.size()), TAG, "write request headers failed");
+  LockGuard lg(*this);
+  HttpBodyFragment fragment = {body.data(), body.size()};
+  ESP_RETURN_ON_ERROR(OpenRequest(method, uri, body.size(), &fragment, 1), TAG, "open request failed");
   ESP_RETURN_ON_ERROR(WriteRequestBody(body.data(), body.size()), TAG, "write request body failed");
   return ESP_OK;
 }
@@ -128,19 +346,128 @@ esp_err_t HttpClient::WriteRequest(HttpMethod method, const std::string& uri) {
 
 //==============================================================================
 
-esp_err_t HttpClient::ReadResponseHeaders(ushort& statusCode, size_t* bodySize) {
+esp_err_t HttpClient::WriteRequest(HttpMethod method, const std::string& uri, const HttpBodyFragment* fragments, size_t numberOfFragments) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(fragments || !numberOfFragments, ESP_ERR_INVALID_ARG, TAG, "fragments are NULL");
+  size_t bodySize = 0;
+  for (size_t i = 0; i < numberOfFragments; i++)
+    bodySize += fragments[i].size;
+
+  ESP_RETURN_ON_ERROR(OpenRequest(method, uri, bodySize, fragments, numberOfFragments), TAG, "open request failed");
+  if (earlyResponse)
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(SetTimeout(writeTimeout), TAG, "set timeout failed");
+  for (size_t i = 0; i < numberOfFragments; i++)
+    ESP_RETURN_ON_ERROR(WriteRequestData(fragments[i].data, fragments[i].size), TAG, "write request body failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::WriteRequest(HttpMethod method, const std::string& uri, const HttpBodySource& source) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(source, ESP_ERR_INVALID_ARG, TAG, "source is empty");
+  ESP_RETURN_ON_ERROR(WriteRequestHeaders(method, uri), TAG, "write request headers failed");
+  ESP_RETURN_ON_ERROR(WriteChunkedRequestBody(source), TAG, "write request body failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::WriteRequest(HttpMethod method, const std::string& uri, Stream& stream, size_t bodySize) {
+  LockGuard lg(*this, stream);
+  uint8_t chunk[requestBodyChunkSize];
+  // A body that fits in one chunk is read first and written as a single fragment
+  if (bodySize && bodySize <= requestBodyChunkSize) {
+    ESP_RETURN_ON_ERROR(stream.Read(chunk, bodySize), TAG, "stream read failed");
+    HttpBodyFragment fragment = {chunk, bodySize};
+    ESP_RETURN_ON_ERROR(WriteRequest(method, uri, &fragment, 1), TAG, "write request failed");
+    return ESP_OK;
+  }
+
+  ESP_RETURN_ON_ERROR(WriteRequestHeaders(method, uri, bodySize), TAG, "write request headers failed");
+  if (earlyResponse)
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(SetTimeout(writeTimeout), TAG, "set timeout failed");
+
+  while (bodySize) {
+    size_t size = std::min(bodySize, requestBodyChunkSize);
+    ESP_RETURN_ON_ERROR(stream.Read(chunk, size), TAG, "stream read failed");
+    ESP_RETURN_ON_ERROR(WriteRequestData(chunk, size), TAG, "write request body failed");
+    bodySize -= size;
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::WriteRequest(const HttpRequest& request) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(request.valid, ESP_ERR_INVALID_ARG, TAG, "invalid request");
+  if (request.bodySource) {
+    ESP_RETURN_ON_ERROR(OpenRequest(request.method, request.target, -1, NULL, 0, &request), TAG, "open request failed");
+    chunkedRequestBody = !earlyResponse;
+    ESP_RETURN_ON_ERROR(WriteChunkedRequestBody(request.bodySource), TAG, "write request body failed");
+    return ESP_OK;
+  }
+
+  HttpBodyFragment fragment = {request.body.data(), request.body.size()};
+  ESP_RETURN_ON_ERROR(OpenRequest(request.method, request.target, request.body.size(), &fragment, 1, &request), TAG, "open request failed");
+  ESP_RETURN_ON_ERROR(WriteRequestBody(request.body.data(), request.body.size()), TAG, "write request body failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SendRequest(HttpMethod method, const std::string& uri, const std::string& body, ushort& statusCode, size_t* bodySize) {
   LockGuard lg(*this);
   ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
+  // The host is selected before its circuit breaker is checked
+  ESP_RETURN_ON_ERROR(SelectHost(NULL), TAG, "select host failed");
+  return SendRequest(method, true, [&]() { return WriteRequest(method, uri, body); }, statusCode, bodySize);
+}
 
-  ESP_RETURN_ON_ERROR(esp_http_client_set_timeout_ms(clientHandle, readTimeout == portMAX_DELAY ? -1 : readTimeout * portTICK_PERIOD_MS), TAG, "HTTP client set timeout failed");
-  headerDataEnd = (char*)headerBuffer->data;
-  
-  int64_t tempResponseBodySize = esp_http_client_fetch_headers(clientHandle);
-  ESP_RETURN_ON_FALSE(tempResponseBodySize >= 0, ESP_FAIL, TAG, "fetch headers failed");
+//==============================================================================
+
+esp_err_t HttpClient::SendRequest(HttpMethod method, const std::string& uri, ushort& statusCode, size_t* bodySize) {
+  return SendRequest(method, uri, std::string(), statusCode, bodySize);
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SendRequest(const HttpRequest& request, ushort& statusCode, size_t* bodySize) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
+  ESP_RETURN_ON_FALSE(request.valid, ESP_ERR_INVALID_ARG, TAG, "invalid request");
+  ESP_RETURN_ON_ERROR(SelectHost(&request), TAG, "select host failed");
+  return SendRequest(request.method, !request.bodySource, [&]() { return WriteRequest(request); }, statusCode, bodySize);
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::ReadResponseHeaders(ushort& statusCode, size_t* bodySize) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
+  ESP_RETURN_ON_ERROR(EndRequestBody(), TAG, "end request body failed");
+
+  int64_t tempResponseBodySize = earlyResponseBodySize;
+  if (earlyResponse)
+    earlyResponse = false;
+  else {
+    ESP_RETURN_ON_ERROR(SetTimeout(readTimeout), TAG, "HTTP client set timeout failed");
+    ClearResponseHeaders();
+    int64_t time = esp_timer_get_time();
+    tempResponseBodySize = esp_http_client_fetch_headers(clientHandle);
+    timings.responseTime = esp_timer_get_time() - time;
+    if (tempResponseBodySize < 0)
+      EndTraceSpan(0);
+    ESP_RETURN_ON_FALSE(tempResponseBodySize >= 0, ESP_FAIL, TAG, "fetch headers failed");
+  }
 
   statusCode = esp_http_client_get_status_code(clientHandle);
-  if (statusCode == 401)
-    esp_http_client_add_auth(clientHandle);
+  EndTraceSpan(statusCode);
+  if (statusCode == 401 && authScheme == HttpAuthScheme::digest)
+    UpdateDigestChallenge();
   if (bodySize)
     *bodySize = tempResponseBodySize;
     
@@ -152,13 +479,25 @@ esp_err_t HttpClient::ReadResponseHeaders(ushort& statusCode, size_t* bodySize)
 esp_err_t HttpClient::ReadResponseBody(void* dest, size_t size) {
   LockGuard lg(*this);
   ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
-  ESP_RETURN_ON_ERROR(esp_http_client_set_timeout_ms(clientHandle, readTimeout == portMAX_DELAY ? -1 : readTimeout * portTICK_PERIOD_MS), TAG, "set timeout failed");
+  ESP_RETURN_ON_ERROR(SetTimeout(readTimeout), TAG, "set timeout failed");
   ESP_RETURN_ON_FALSE(esp_http_client_read(clientHandle, (char*)dest, size) == size, ESP_FAIL, TAG, "read failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
+esp_err_t HttpClient::ReadResponseBody(void* dest, size_t maxSize, size_t& size) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
+  ESP_RETURN_ON_ERROR(SetTimeout(readTimeout), TAG, "set timeout failed");
+  int res = esp_http_client_read(clientHandle, (char*)dest, maxSize);
+  ESP_RETURN_ON_FALSE(res >= 0, ESP_FAIL, TAG, "read failed");
+  size = res;
+  return ESP_OK;
+}
+
+//==============================================================================
+
 esp_err_t HttpClient::Disconnect() {
   LockGuard lg(*this);
   ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
@@ -170,20 +509,27 @@ esp_err_t HttpClient::Disconnect() {
 
 uint16_t HttpClient::GetPort() {
   LockGuard lg(*this);
-  return clientConfig.port;
+  return defaultHostPort;
 }
 
 //==============================================================================
 
 esp_err_t HttpClient::SetPort(uint16_t port) {
   LockGuard lg(*this);
+  defaultHostPort = port;
+  SetHostname(defaultHostname);
   clientConfig.port = port;
+  clientConfig.transport_type = defaultHostHttps ? HTTP_TRANSPORT_OVER_SSL : HTTP_TRANSPORT_OVER_TCP;
 
   if (!clientHandle)
     return ESP_OK;
   esp_http_client_handle_t tempHandle = clientHandle;
   ESP_RETURN_ON_ERROR(esp_http_client_cleanup(tempHandle), TAG, "cleanup failed");
   clientHandle = NULL;
+  connected = false;
+  hostAddress.clear();
+  appliedRequestId = 0;
+  appliedRequestHeaders.clear();
   ESP_RETURN_ON_ERROR(Initialize(), TAG, "initialize failed");
   return ESP_OK; 
 }
@@ -220,12 +566,74 @@ esp_err_t HttpClient::SetWriteTimeout(TickType_t timeout) {
 
 //==============================================================================
 
+TickType_t HttpClient::GetContinueTimeout() {
+  LockGuard lg(*this);
+  return continueTimeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SetContinueTimeout(TickType_t timeout) {
+  LockGuard lg(*this);
+  this->continueTimeout = timeout;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpClientTimings HttpClient::GetTimings() {
+  LockGuard lg(*this);
+  return timings;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::ClearAddressCache() {
+  LockGuard lg(addressCacheMutex);
+  addressCache.clear();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpRequestPolicy HttpClient::GetRequestPolicy() {
+  LockGuard lg(*this);
+  return requestPolicy;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SetRequestPolicy(const HttpRequestPolicy& requestPolicy) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(requestPolicy.initialBackoff <= requestPolicy.maxBackoff, ESP_ERR_INVALID_ARG, TAG, "invalid backoff");
+  this->requestPolicy = requestPolicy;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpTracer* HttpClient::GetTracer() {
+  LockGuard lg(*this);
+  return tracer;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SetTracer(HttpTracer* tracer) {
+  LockGuard lg(*this);
+  this->tracer = tracer;
+  return ESP_OK;
+}
+
+//==============================================================================
+
 esp_err_t HttpClient::SetAuthScheme(HttpAuthScheme scheme) {
   LockGuard lg(*this);
   ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
-  auto espAuthScheme = httpAuthSchemeMap.find(scheme);
-  ESP_RETURN_ON_FALSE(espAuthScheme != httpAuthSchemeMap.end(), ESP_ERR_INVALID_ARG, TAG, "invalid authentication scheme");
-  ESP_RETURN_ON_ERROR(esp_http_client_set_authtype(clientHandle, espAuthScheme->second), TAG, "set authentication scheme failed");
+  ESP_RETURN_ON_FALSE(scheme == HttpAuthScheme::none || scheme == HttpAuthScheme::basic || scheme == HttpAuthScheme::digest, ESP_ERR_INVALID_ARG, TAG, "invalid authentication scheme");
+  if (authScheme != HttpAuthScheme::none && scheme == HttpAuthScheme::none)
+    esp_http_client_delete_header(clientHandle, "Authorization");
+  authScheme = scheme;
   return ESP_OK;
 }
 
@@ -234,8 +642,8 @@ esp_err_t HttpClient::SetAuthScheme(HttpAuthScheme scheme) {
 esp_err_t HttpClient::SetAuthCredentials(const std::string& username, const std::string& password) {
   LockGuard lg(*this);
   ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
-  ESP_RETURN_ON_ERROR(esp_http_client_set_username(clientHandle, username.c_str()), TAG, "set username failed");
-  ESP_RETURN_ON_ERROR(esp_http_client_set_password(clientHandle, password.c_str()), TAG, "set password failed");
+  this->username = username;
+  this->password = password;
   return ESP_OK;
 }
  
@@ -261,38 +669,617 @@ esp_err_t HttpClient::DeleteRequestHeader(const std::string& name) {
 
 esp_err_t HttpClient::GetResponseHeader(const std::string& name, std::string& value) {
   LockGuard lg(*this);
-  char* base = (char*)headerBuffer->data;
-  size_t headerDataSize = headerDataEnd - base;
-  char* end = base + (headerDataSize > name.size() + 2 ? headerDataSize - name.size() - 2 : 0);
-  for (char* ptr = base; ptr < end; ) {
-    if (strncasecmp(ptr, name.c_str(), name.size()) == 0 && *(ptr + name.size()) == ':') {
-      value = ptr + name.size() + 1;
-      return ESP_OK; 
+  const ResponseHeader* header = FindResponseHeader(name, NULL);
+  ESP_RETURN_ON_FALSE(header, ESP_ERR_NOT_FOUND, TAG, "header not found");
+  value.assign(header->value, header->valueSize);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::GetResponseHeaders(std::vector<std::pair<std::string, std::string>>& headers) {
+  LockGuard lg(*this);
+  headers.clear();
+  headers.reserve(responseHeaders.size());
+  for (auto& header : responseHeaders)
+    headers.emplace_back(std::string(header.name, header.nameSize), std::string(header.value, header.valueSize));
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::OpenRequest(HttpMethod method, const std::string& uri, int bodySize, const HttpBodyFragment* bodyFragments, size_t numberOfBodyFragments,
+                                  const HttpRequest* request) {
+  ESP_RETURN_ON_FALSE(clientHandle, ESP_ERR_INVALID_STATE, TAG, "HTTP client is not initialized");
+
+  auto espMethod = httpMethodMap.find(method);
+  ESP_RETURN_ON_FALSE(espMethod != httpMethodMap.end(), ESP_ERR_INVALID_ARG, TAG, "invalid HTTP method");
+
+  chunkedRequestBody = false;
+  earlyResponse = false;
+  // The server may not have read the body the early response rejected, so the connection cannot be reused
+  if (closeBeforeRequest) {
+    closeBeforeRequest = false;
+    ESP_RETURN_ON_ERROR(esp_http_client_close(clientHandle), TAG, "close failed");
+  }
+  else
+    ESP_RETURN_ON_ERROR(esp_http_client_flush_response(clientHandle, NULL), TAG, "flush response failed");
+  ESP_RETURN_ON_ERROR(SelectHost(request), TAG, "select host failed");
+  // The span of the previous request that has failed before the response headers ends without a response
+  EndTraceSpan(0);
+  timings = {};
+  bool newConnection = !connected;
+  std::vector<std::string> addresses;
+  if (newConnection) {
+    ESP_RETURN_ON_ERROR(GetHostAddresses(addresses), TAG, "get host addresses failed");
+    ESP_RETURN_ON_ERROR(SetHostAddress(addresses.front()), TAG, "set host address failed");
+  }
+  ESP_RETURN_ON_ERROR(esp_http_client_set_method(clientHandle, espMethod->second), TAG, "set method failed");
+
+  // A request sent again keeps the URL path and the headers applied the previous time
+  if (!request || request->id != appliedRequestId) {
+    ESP_RETURN_ON_ERROR(esp_http_client_set_url(clientHandle, uri.c_str()), TAG, "set URL failed");
+    // An absolute URI connects to its host directly, so the address is set again for the next request
+    if (!request && uri.find("://") != std::string::npos)
+      hostAddress.clear();
+    for (auto& name : appliedRequestHeaders)
+      esp_http_client_delete_header(clientHandle, name.c_str());
+    appliedRequestHeaders.clear();
+    appliedRequestId = 0;
+    if (request) {
+      for (auto& header : request->headers) {
+        ESP_RETURN_ON_ERROR(esp_http_client_set_header(clientHandle, header.first.c_str(), header.second.c_str()), TAG, "set header failed");
+        appliedRequestHeaders.push_back(header.first);
+      }
+      appliedRequestId = request->id;
+    }
+  }
+  ESP_RETURN_ON_ERROR(SetAuthHeader(method, uri, bodySize, bodyFragments, numberOfBodyFragments), TAG, "set authorization header failed");
+
+  bool expectContinue = continueTimeout && bodySize;
+  if (expectContinue)
+    ESP_RETURN_ON_ERROR(esp_http_client_set_header(clientHandle, "Expect", "100-continue"), TAG, "set header failed");
+  else
+    esp_http_client_delete_header(clientHandle, "Expect");
+  ESP_RETURN_ON_ERROR(SetTraceHeaders(method, uri), TAG, "set trace headers failed");
+  connectionStartTime = esp_timer_get_time();
+  esp_err_t error = esp_http_client_open(clientHandle, bodySize);
+  // A new connection that cannot be opened is made to the next address of the host when the connect timeout expires.
+  // The addresses of the families are interleaved, so a broken IPv6 route costs one timeout. An absolute URI is connected to directly.
+  bool absoluteUri = !request && uri.find("://") != std::string::npos;
+  size_t addressIndex = 0;
+  while (error != ESP_OK && newConnection && !absoluteUri && ++addressIndex < addresses.size()) {
+    ESP_RETURN_ON_ERROR(SetHostAddress(addresses[addressIndex]), TAG, "set host address failed");
+    ESP_RETURN_ON_ERROR(esp_http_client_set_url(clientHandle, uri.c_str()), TAG, "set URL failed");
+    if (request)
+      appliedRequestId = request->id;
+    connectionStartTime = esp_timer_get_time();
+    error = esp_http_client_open(clientHandle, bodySize);
+  }
+  if (error != ESP_OK)
+    EndTraceSpan(0);
+  if (newConnection && !absoluteUri && (error != ESP_OK || addressIndex)) {
+    // The address connected to is tried first by the next connections. If none is reachable, the cached addresses may be stale:
+    // the next connection resolves the hostname again.
+    LockGuard lg(addressCacheMutex);
+    for (auto cachedAddress = addressCache.begin(); cachedAddress != addressCache.end(); cachedAddress++) {
+      if (cachedAddress->host == hostname && cachedAddress->port == clientConfig.port) {
+        if (error != ESP_OK)
+          addressCache.erase(cachedAddress);
+        else {
+          auto& cachedAddresses = cachedAddress->addresses;
+          auto connectedAddress = std::find(cachedAddresses.begin(), cachedAddresses.end(), addresses[addressIndex]);
+          if (connectedAddress != cachedAddresses.end())
+            std::rotate(cachedAddresses.begin(), connectedAddress, connectedAddress + 1);
+        }
+        break;
+      }
+    }
+  }
+  ESP_RETURN_ON_ERROR(error, TAG, "open failed");
+  if (!expectContinue)
+    return ESP_OK;
+
+  // Wait for the interim response. If it does not arrive in time, the body is sent anyway.
+  ESP_RETURN_ON_ERROR(SetTimeout(continueTimeout), TAG, "set timeout failed");
+  ClearResponseHeaders();
+  int64_t time = esp_timer_get_time();
+  int64_t responseBodySize = esp_http_client_fetch_headers(clientHandle);
+  timings.responseTime = esp_timer_get_time() - time;
+  if (responseBodySize < 0 || esp_http_client_get_status_code(clientHandle) == 100)
+    return ESP_OK;
+
+  earlyResponse = true;
+  earlyResponseBodySize = responseBodySize;
+  closeBeforeRequest = true;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::WriteChunkedRequestBody(const HttpBodySource& source) {
+  if (earlyResponse)
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(SetTimeout(writeTimeout), TAG, "set timeout failed");
+
+  // The chunk size line is written right before the data and the chunk trailer right after it so that every chunk is sent with a single write
+  constexpr size_t chunkHeaderMaxSize = sizeof(size_t) * 2 + 2;
+  uint8_t chunk[chunkHeaderMaxSize + requestBodyChunkSize + 2];
+  uint8_t* chunkData = chunk + chunkHeaderMaxSize;
+  while (true) {
+    size_t size = 0;
+    ESP_RETURN_ON_ERROR(source(chunkData, requestBodyChunkSize, size), TAG, "body source failed");
+    ESP_RETURN_ON_FALSE(size <= requestBodyChunkSize, ESP_ERR_INVALID_SIZE, TAG, "body source returned too many bytes");
+    if (!size)
+      break;
+
+    char chunkHeader[chunkHeaderMaxSize + 1];
+    int chunkHeaderSize = snprintf(chunkHeader, sizeof(chunkHeader), "%x\r\n", (unsigned int)size);
+    memcpy(chunkData - chunkHeaderSize, chunkHeader, chunkHeaderSize);
+    chunkData[size] = '\r';
+    chunkData[size + 1] = '\n';
+    ESP_RETURN_ON_ERROR(WriteRequestData(chunkData - chunkHeaderSize, chunkHeaderSize + size + 2), TAG, "write request body failed");
+  }
+
+  ESP_RETURN_ON_ERROR(EndRequestBody(), TAG, "end request body failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::WriteRequestData(const void* src, size_t size) {
+  if (attemptTimeout != portMAX_DELAY)
+    ESP_RETURN_ON_ERROR(SetTimeout(socketTimeout), TAG, "set timeout failed");
+  ESP_RETURN_ON_FALSE(esp_http_client_write(clientHandle, (const char*)src, size) >= 0, ESP_FAIL, TAG, "write failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SetTimeout(TickType_t timeout) {
+  socketTimeout = timeout;
+  if (attemptTimeout != portMAX_DELAY) {
+    TickType_t elapsedTime = xTaskGetTickCount() - attemptStartTime;
+    // After the deadline the shortest timeout makes the next socket operation fail
+    timeout = std::min(timeout, elapsedTime < attemptTimeout ? attemptTimeout - elapsedTime : 1);
+  }
+  ESP_RETURN_ON_ERROR(esp_http_client_set_timeout_ms(clientHandle, timeout == portMAX_DELAY ? -1 : timeout * portTICK_PERIOD_MS), TAG, "set timeout failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpClient::ClearResponseHeaders() {
+  headerDataEnd = (char*)headerBuffer->data;
+  responseHeaders.clear();
+}
+
+//==============================================================================
+
+const HttpClient::ResponseHeader* HttpClient::FindResponseHeader(const std::string& name, const ResponseHeader* previousHeader) {
+  const ResponseHeader* end = responseHeaders.data() + responseHeaders.size();
+  for (const ResponseHeader* header = previousHeader ? previousHeader + 1 : responseHeaders.data(); header < end; header++) {
+    if (header->nameSize == name.size() && strncasecmp(header->name, name.c_str(), name.size()) == 0)
+      return header;
+  }
+  return NULL;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SetTraceHeaders(HttpMethod method, const std::string& uri) {
+  // Without the tracer and the trace context the request costs a check of the previous trace headers
+  const HttpTraceContext* parentContext = HttpTracer::GetCurrentContext();
+  if (!tracer && !parentContext) {
+    if (traceHeadersSet) {
+      esp_http_client_delete_header(clientHandle, "traceparent");
+      esp_http_client_delete_header(clientHandle, "tracestate");
+      traceHeadersSet = false;
     }
-    for (; ptr < end && *ptr; ptr++);
-    ptr++;
+    return ESP_OK;
   }
-  ESP_RETURN_ON_ERROR(ESP_ERR_NOT_FOUND, TAG, "header not found");
+
+  // Each attempt of a retried request is a separate span
+  HttpTraceContext context;
+  HttpTracer::BeginSpan(HttpSpanKind::client, method, uri.c_str(), parentContext, context, traceSpan);
+  traceSpanOpen = true;
+  traceHeadersSet = true;
+  char traceParent[HttpTracer::traceParentSize + 1];
+  HttpTracer::FormatTraceParent(context, traceParent);
+  ESP_RETURN_ON_ERROR(esp_http_client_set_header(clientHandle, "traceparent", traceParent), TAG, "set header failed");
+  if (context.state.empty())
+    esp_http_client_delete_header(clientHandle, "tracestate");
+  else
+    ESP_RETURN_ON_ERROR(esp_http_client_set_header(clientHandle, "tracestate", context.state.c_str()), TAG, "set header failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
+void HttpClient::EndTraceSpan(uint16_t statusCode) {
+  if (!traceSpanOpen)
+    return;
+  traceSpanOpen = false;
+  traceSpan.resolveTime = timings.resolveTime;
+  traceSpan.connectTime = timings.connectTime;
+  traceSpan.responseTime = timings.responseTime;
+  HttpTracer::EndSpan(traceSpan, statusCode);
+  // A span of a trace the caller has not sampled is propagated, but not recorded
+  if (tracer && (traceSpan.flags & HttpTracer::sampledFlag))
+    tracer->Record(traceSpan);
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SetAuthHeader(HttpMethod method, const std::string& uri, int bodySize, const HttpBodyFragment* bodyFragments, size_t numberOfBodyFragments) {
+  if (authScheme == HttpAuthScheme::none)
+    return ESP_OK;
+
+  if (authScheme == HttpAuthScheme::basic) {
+    std::string credentials = username + ":" + password;
+    std::string authorization(6 + (credentials.size() + 2) / 3 * 4 + 1, 0);
+    memcpy(authorization.data(), "Basic ", 6);
+    size_t encodedSize = 0;
+    ESP_RETURN_ON_FALSE(mbedtls_base64_encode((unsigned char*)authorization.data() + 6, authorization.size() - 6, &encodedSize, (const unsigned char*)credentials.data(), credentials.size()) == 0, ESP_FAIL, TAG, "base64 encode failed");
+    authorization.resize(6 + encodedSize);
+    ESP_RETURN_ON_ERROR(esp_http_client_set_header(clientHandle, "Authorization", authorization.c_str()), TAG, "set header failed");
+    return ESP_OK;
+  }
+
+  // Digest: the cached challenge of the host is used to authorize the request without waiting for a 401 response.
+  // Without it the request is sent unauthorized and the challenge is taken from the 401 response.
+  std::string host = hostname + ":" + std::to_string(clientConfig.port);
+  bool bodyKnown = !bodySize || bodyFragments;
+  DigestChallenge challenge;
+  {
+    LockGuard lg(digestChallengeMutex);
+    auto cachedChallenge = std::find_if(digestChallenges.begin(), digestChallenges.end(), [&host](const DigestChallenge& c) { return c.host == host; });
+    if (cachedChallenge == digestChallenges.end() || (cachedChallenge->qop == "auth-int" && !bodyKnown)) {
+      esp_http_client_delete_header(clientHandle, "Authorization");
+      return ESP_OK;
+    }
+    cachedChallenge->nonceCount++;
+    cachedChallenge->lastUse = ++digestChallengeUseCounter;
+    challenge = *cachedChallenge;
+  }
+
+  auto methodName = httpMethodNameMap.find(method);
+  ESP_RETURN_ON_FALSE(methodName != httpMethodNameMap.end(), ESP_ERR_INVALID_ARG, TAG, "invalid HTTP method");
+  // The digest URI is the request target: the path and the query of an absolute URL
+  std::string digestUri = uri;
+  size_t schemeEnd = uri.find("://");
+  if (schemeEnd != std::string::npos) {
+    size_t pathStart = uri.find('/', schemeEnd + 3);
+    digestUri = pathStart == std::string::npos ? "/" : uri.substr(pathStart);
+  }
+
+  uint32_t cnonceData[2] = {esp_random(), esp_random()};
+  std::string cnonce = ToHex((const uint8_t*)cnonceData, sizeof(cnonceData));
+  char nonceCount[9];
+  snprintf(nonceCount, sizeof(nonceCount), "%08x", (unsigned int)challenge.nonceCount);
+
+  std::string ha1, ha2, bodyHash, response;
+  ESP_RETURN_ON_ERROR(Hash(challenge.mdType, username + ":" + challenge.realm + ":" + password, ha1), TAG, "hash failed");
+  if (challenge.session)
+    ESP_RETURN_ON_ERROR(Hash(challenge.mdType, ha1 + ":" + challenge.nonce + ":" + cnonce, ha1), TAG, "hash failed");
+  std::string a2 = std::string(methodName->second) + ":" + digestUri;
+  if (challenge.qop == "auth-int") {
+    ESP_RETURN_ON_ERROR(Hash(challenge.mdType, bodyFragments, numberOfBodyFragments, bodyHash), TAG, "hash failed");
+    a2 += ":" + bodyHash;
+  }
+  ESP_RETURN_ON_ERROR(Hash(challenge.mdType, a2, ha2), TAG, "hash failed");
+  if (challenge.qop.empty())
+    ESP_RETURN_ON_ERROR(Hash(challenge.mdType, ha1 + ":" + challenge.nonce + ":" + ha2, response), TAG, "hash failed");
+  else
+    ESP_RETURN_ON_ERROR(Hash(challenge.mdType, ha1 + ":" + challenge.nonce + ":" + nonceCount + ":" + cnonce + ":" + challenge.qop + ":" + ha2, response), TAG, "hash failed");
+
+  std::string authorization = "Digest username=\"" + username + "\", realm=\"" + challenge.realm + "\", nonce=\"" + challenge.nonce +
+                              "\", uri=\"" + digestUri + "\", algorithm=" + challenge.algorithm + ", response=\"" + response + "\"";
+  if (!challenge.qop.empty())
+    authorization += ", qop=" + challenge.qop + ", nc=" + nonceCount + ", cnonce=\"" + cnonce + "\"";
+  if (!challenge.opaque.empty())
+    authorization += ", opaque=\"" + challenge.opaque + "\"";
+  ESP_RETURN_ON_ERROR(esp_http_client_set_header(clientHandle, "Authorization", authorization.c_str()), TAG, "set header failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpClient::UpdateDigestChallenge() {
+  for (auto header = FindResponseHeader("WWW-Authenticate", NULL); header; header = FindResponseHeader("WWW-Authenticate", header)) {
+    const char* value = header->value;
+    for (; *value == ' '; value++);
+    if (strncasecmp(value, "Digest ", 7) != 0)
+      continue;
+
+    std::map<std::string, std::string> parameters;
+    ParseAuthParameters(value + 7, parameters);
+    DigestChallenge challenge = {};
+    challenge.host = hostname + ":" + std::to_string(clientConfig.port);
+    challenge.realm = parameters["realm"];
+    challenge.nonce = parameters["nonce"];
+    challenge.opaque = parameters["opaque"];
+    challenge.algorithm = parameters["algorithm"].empty() ? "MD5" : parameters["algorithm"];
+    for (auto& c : challenge.algorithm)
+      c = toupper(c);
+    challenge.session = challenge.algorithm.size() > 5 && challenge.algorithm.compare(challenge.algorithm.size() - 5, 5, "-SESS") == 0;
+    auto algorithm = digestAlgorithmMap.find(challenge.session ? challenge.algorithm.substr(0, challenge.algorithm.size() - 5) : challenge.algorithm);
+    if (challenge.nonce.empty() || algorithm == digestAlgorithmMap.end())
+      continue;
+    challenge.mdType = algorithm->second;
+    std::string& qop = parameters["qop"];
+    challenge.qop = HasToken(qop, "auth") ? "auth" : HasToken(qop, "auth-int") ? "auth-int" : "";
+    if (!qop.empty() && challenge.qop.empty())
+      continue;
+
+    // The new challenge replaces the cached one of the host (a stale nonce or changed parameters) or the least recently used one
+    LockGuard lg(digestChallengeMutex);
+    challenge.lastUse = ++digestChallengeUseCounter;
+    auto cachedChallenge = std::find_if(digestChallenges.begin(), digestChallenges.end(), [&challenge](const DigestChallenge& c) { return c.host == challenge.host; });
+    if (cachedChallenge != digestChallenges.end())
+      *cachedChallenge = challenge;
+    else if (digestChallenges.size() < maxNumberOfCachedAuthChallenges)
+      digestChallenges.push_back(challenge);
+    else
+      *std::min_element(digestChallenges.begin(), digestChallenges.end(), [](const DigestChallenge& a, const DigestChallenge& b) { return a.lastUse < b.lastUse; }) = challenge;
+    return;
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SelectHost(const HttpRequest* request) {
+  const std::string& newHostname = request && !request->hostname.empty() ? request->hostname : defaultHostname;
+  uint16_t port = request && !request->hostname.empty() ? request->port : defaultHostPort;
+  bool https = request && !request->hostname.empty() ? request->https : defaultHostHttps;
+  if (newHostname == hostname && port == clientConfig.port && https == (clientConfig.transport_type == HTTP_TRANSPORT_OVER_SSL))
+    return ESP_OK;
+  ESP_RETURN_ON_FALSE(newHostname.size() <= maxHostnameSize, ESP_ERR_INVALID_SIZE, TAG, "hostname is too long");
+
+  // The connection to the previous host is closed. The address of the new host is set when the connection is opened.
+  ESP_RETURN_ON_ERROR(esp_http_client_close(clientHandle), TAG, "close failed");
+  connected = false;
+  closeBeforeRequest = false;
+  hostAddress.clear();
+  SetHostname(newHostname);
+  clientConfig.port = port;
+  clientConfig.transport_type = https ? HTTP_TRANSPORT_OVER_SSL : HTTP_TRANSPORT_OVER_TCP;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpClient::SetHostname(const std::string& hostname) {
+  this->hostname = hostname;
+  snprintf(commonName, sizeof(commonName), "%s", hostname.c_str());
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::GetHostAddresses(std::vector<std::string>& addresses) {
+  // A hostname that is an address is connected to directly
+  in6_addr tempAddress;
+  addresses.clear();
+  if (inet_pton(AF_INET, hostname.c_str(), &tempAddress) == 1)
+    addresses.push_back(hostname);
+  else if (inet_pton(AF_INET6, hostname.c_str(), &tempAddress) == 1)
+    addresses.push_back("[" + hostname + "]");
+  if (addresses.size())
+    return ESP_OK;
+
+  int64_t time = esp_timer_get_time();
+  {
+    LockGuard lg(addressCacheMutex);
+    for (auto& cachedAddress : addressCache) {
+      if (cachedAddress.host == hostname && cachedAddress.port == clientConfig.port && cachedAddress.expirationTime > time) {
+        addresses = cachedAddress.addresses;
+        return ESP_OK;
+      }
+    }
+  }
+
+  std::vector<sockaddr_storage> resolvedAddresses;
+  ESP_RETURN_ON_ERROR(ResolveHostname(hostname, resolvedAddresses), TAG, "resolve hostname failed");
+  timings.resolveTime = esp_timer_get_time() - time;
+  for (auto& resolvedAddress : resolvedAddresses) {
+    char addressString[INET6_ADDRSTRLEN + 2] = {};
+    if (resolvedAddress.ss_family == AF_INET6) {
+      addressString[0] = '[';
+      inet_ntop(AF_INET6, &((sockaddr_in6*)&resolvedAddress)->sin6_addr, addressString + 1, INET6_ADDRSTRLEN);
+      strcat(addressString, "]");
+    }
+    else
+      inet_ntop(AF_INET, &((sockaddr_in*)&resolvedAddress)->sin_addr, addressString, INET6_ADDRSTRLEN);
+    addresses.push_back(addressString);
+  }
+
+  LockGuard lg(addressCacheMutex);
+  CachedAddress newCachedAddress = {hostname, (uint16_t)clientConfig.port, addresses, esp_timer_get_time() + (int64_t)addressCacheTime * 1000000};
+  auto cachedAddress = std::find_if(addressCache.begin(), addressCache.end(),
+    [this](const CachedAddress& a) { return a.host == hostname && a.port == clientConfig.port; });
+  if (cachedAddress != addressCache.end())
+    *cachedAddress = newCachedAddress;
+  else if (addressCache.size() < maxNumberOfCachedAddresses)
+    addressCache.push_back(newCachedAddress);
+  else
+    *std::min_element(addressCache.begin(), addressCache.end(), [](const CachedAddress& a, const CachedAddress& b) { return a.expirationTime < b.expirationTime; }) = newCachedAddress;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SetHostAddress(const std::string& address) {
+  if (address == hostAddress)
+    return ESP_OK;
+  // The URL host is replaced by the address and the "Host" header keeps the hostname
+  std::string url = std::string(clientConfig.transport_type == HTTP_TRANSPORT_OVER_SSL ? "https://" : "http://") + address + ":" + std::to_string(clientConfig.port) + "/";
+  ESP_RETURN_ON_ERROR(esp_http_client_set_url(clientHandle, url.c_str()), TAG, "set URL failed");
+  bool defaultPort = clientConfig.port == (clientConfig.transport_type == HTTP_TRANSPORT_OVER_SSL ? defaultHttpsPort : defaultHttpPort);
+  // A hostname that is an IPv6 address is bracketed
+  std::string host = address == "[" + hostname + "]" ? address : hostname;
+  if (!defaultPort)
+    host += ":" + std::to_string(clientConfig.port);
+  ESP_RETURN_ON_ERROR(esp_http_client_set_header(clientHandle, "Host", host.c_str()), TAG, "set header failed");
+  hostAddress = address;
+  // The URL path has been reset, so the next request sets it again
+  appliedRequestId = 0;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SendRequest(HttpMethod method, bool replayable, const std::function<esp_err_t()>& writeRequest, ushort& statusCode, size_t* bodySize) {
+  bool idempotent = replayable && (method == HttpMethod::GET || method == HttpMethod::HEAD || method == HttpMethod::OPTIONS ||
+                                   method == HttpMethod::PUT || method == HttpMethod::DELETE);
+  TickType_t startTime = xTaskGetTickCount();
+  TickType_t backoff = requestPolicy.initialBackoff;
+  bool hedged = false;
+
+  for (uint8_t retry = 0; ; ) {
+    ESP_RETURN_ON_FALSE(IsCircuitClosed(), ESP_ERR_INVALID_STATE, TAG, "circuit breaker is open");
+    TickType_t remainingTime = portMAX_DELAY;
+    if (requestPolicy.deadline != portMAX_DELAY) {
+      TickType_t elapsedTime = xTaskGetTickCount() - startTime;
+      remainingTime = elapsedTime < requestPolicy.deadline ? requestPolicy.deadline - elapsedTime : 0;
+      ESP_RETURN_ON_FALSE(remainingTime, ESP_ERR_TIMEOUT, TAG, "request deadline exceeded");
+    }
+
+    // Only one attempt is hedged: a second slow attempt means the server is slow, not that the first one has hit a tail latency
+    TickType_t hedgingTime = requestPolicy.hedging && idempotent && !hedged ? GetHedgingTime() : portMAX_DELAY;
+    TickType_t attemptStartTime = xTaskGetTickCount();
+    esp_err_t error = SendRequestAttempt(writeRequest, statusCode, bodySize, std::min(remainingTime, hedgingTime));
+    TickType_t responseTime = xTaskGetTickCount() - attemptStartTime;
+    bool hedge = error != ESP_OK && hedgingTime != portMAX_DELAY && responseTime >= hedgingTime;
+    bool failed = error != ESP_OK || statusCode == 502 || statusCode == 503 || statusCode == 504;
+    if (!hedge)
+      UpdateCircuitBreaker(!failed);
+    if (!failed) {
+      responseTimes[numberOfResponseTimes++ % numberOfResponseTimeSamples] = responseTime;
+      return ESP_OK;
+    }
+
+    // The connection state after an error is unknown, so the next attempt opens a new one
+    if (error != ESP_OK)
+      esp_http_client_close(clientHandle);
+    if (!idempotent || (!hedge && retry >= requestPolicy.maxNumberOfRetries)) {
+      ESP_RETURN_ON_ERROR(error, TAG, "request failed");
+      return ESP_OK;
+    }
+    if (hedge) {
+      hedged = true;
+      continue;
+    }
+
+    TickType_t delay = backoff - esp_random() % (backoff / 2 + 1);
+    if (requestPolicy.deadline != portMAX_DELAY)
+      delay = std::min(delay, requestPolicy.deadline - std::min(requestPolicy.deadline, xTaskGetTickCount() - startTime));
+    vTaskDelay(delay);
+    backoff = std::min(backoff * 2, requestPolicy.maxBackoff);
+    retry++;
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpClient::SendRequestAttempt(const std::function<esp_err_t()>& writeRequest, ushort& statusCode, size_t* bodySize, TickType_t timeout) {
+  // The socket timeouts are clamped to the time left before the attempt deadline, so the attempt does not exceed it however many
+  // socket operations it takes
+  attemptStartTime = xTaskGetTickCount();
+  attemptTimeout = timeout;
+  esp_err_t error = SetTimeout(writeTimeout);
+  if (error == ESP_OK)
+    error = writeRequest();
+  if (error == ESP_OK)
+    error = ReadResponseHeaders(statusCode, bodySize);
+  attemptTimeout = portMAX_DELAY;
+  return error;
+}
+
+//==============================================================================
+
+TickType_t HttpClient::GetHedgingTime() {
+  if (numberOfResponseTimes < numberOfResponseTimeSamples)
+    return portMAX_DELAY;
+  TickType_t sortedResponseTimes[numberOfResponseTimeSamples];
+  memcpy(sortedResponseTimes, responseTimes, sizeof(responseTimes));
+  TickType_t* percentile = sortedResponseTimes + (numberOfResponseTimeSamples * 95 + 99) / 100 - 1;
+  std::nth_element(sortedResponseTimes, percentile, sortedResponseTimes + numberOfResponseTimeSamples);
+  return std::max(*percentile, (TickType_t)1);
+}
+
+//==============================================================================
+
+bool HttpClient::IsCircuitClosed() {
+  if (!requestPolicy.circuitBreakerThreshold)
+    return true;
+  LockGuard lg(circuitBreakerMutex);
+  for (auto& circuitBreaker : circuitBreakers) {
+    if (circuitBreaker.host == hostname && circuitBreaker.port == clientConfig.port) {
+      if (circuitBreaker.numberOfFailures < requestPolicy.circuitBreakerThreshold)
+        return true;
+      // After the open time one request is let through to probe the host. Until it completes, the circuit stays open for the others.
+      if (xTaskGetTickCount() - circuitBreaker.openingTime < requestPolicy.circuitBreakerOpenTime)
+        return false;
+      circuitBreaker.openingTime = xTaskGetTickCount();
+      return true;
+    }
+  }
+  return true;
+}
+
+//==============================================================================
+
+void HttpClient::UpdateCircuitBreaker(bool success) {
+  if (!requestPolicy.circuitBreakerThreshold)
+    return;
+  LockGuard lg(circuitBreakerMutex);
+  for (auto circuitBreaker = circuitBreakers.begin(); circuitBreaker != circuitBreakers.end(); circuitBreaker++) {
+    if (circuitBreaker->host == hostname && circuitBreaker->port == clientConfig.port) {
+      if (success)
+        circuitBreakers.erase(circuitBreaker);
+      else {
+        if (circuitBreaker->numberOfFailures < UINT8_MAX)
+          circuitBreaker->numberOfFailures++;
+        if (circuitBreaker->numberOfFailures >= requestPolicy.circuitBreakerThreshold)
+          circuitBreaker->openingTime = xTaskGetTickCount();
+      }
+      return;
+    }
+  }
+
+  // Only the hosts with failed requests are tracked. If the table is full, the new host is not tracked until another one recovers.
+  if (!success && circuitBreakers.size() < maxNumberOfCircuitBreakers)
+    circuitBreakers.push_back({hostname, (uint16_t)clientConfig.port, 1, xTaskGetTickCount()});
+}
+
+//==============================================================================
+
 esp_err_t HttpClient::HandleResponse(esp_http_client_event_t* evt) {
   HttpClient& client = *(HttpClient*)evt->user_data;
   auto headerBuffer = client.headerBuffer;
   char*& headerDataEnd = client.headerDataEnd;
 
-  if (evt->event_id == HTTP_EVENT_ON_HEADER) {
+  if (evt->event_id == HTTP_EVENT_ON_CONNECTED) {
+    client.connected = true;
+    client.timings.connectTime += esp_timer_get_time() - client.connectionStartTime;
+  }
+  else if (evt->event_id == HTTP_EVENT_DISCONNECTED)
+    client.connected = false;
+  else if (evt->event_id == HTTP_EVENT_ON_HEADER) {
     size_t headerNameSize = strlen(evt->header_key);
     size_t headerValueSize = strlen(evt->header_value);
 
     ESP_RETURN_ON_FALSE(headerDataEnd - (char*)headerBuffer->data + headerNameSize + headerValueSize + 2 <= headerBuffer->size, ESP_ERR_INVALID_SIZE, TAG, "header buffer is too small");
+    ResponseHeader header = {headerDataEnd, headerNameSize, headerDataEnd + headerNameSize + 1, headerValueSize};
     memcpy(headerDataEnd, evt->header_key, headerNameSize);
     headerDataEnd += headerNameSize;
     *(headerDataEnd++) = ':';
     memcpy(headerDataEnd, evt->header_value, headerValueSize + 1);
     headerDataEnd += headerValueSize + 1;
+    client.responseHeaders.push_back(header);
+    // esp_http_client reads the head with the timeout set before: within a request attempt it is clamped again between the reads
+    if (client.attemptTimeout != portMAX_DELAY)
+      client.SetTimeout(client.socketTimeout);
   }
 
   return ESP_OK;
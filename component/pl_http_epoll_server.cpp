@@ -0,0 +1,976 @@
+#include "pl_http_epoll_server.h"
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include "esp_check.h"
+#include <chrono>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+//==============================================================================
+
+static const char* TAG = "pl_http_epoll_server";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+const std::string HttpEpollServer::defaultName = "HTTP Epoll Server";
+
+//==============================================================================
+
+static bool EqualsIgnoreCase(std::string_view string1, const char* string2) {
+  return string1.size() == strlen(string2) && strncasecmp(string1.data(), string2, string1.size()) == 0;
+}
+
+//==============================================================================
+
+static esp_err_t WaitForSocket(int socket, short events, int timeoutMs) {
+  pollfd pfd = {socket, events, 0};
+  int res;
+  while ((res = poll(&pfd, 1, timeoutMs)) < 0 && errno == EINTR);
+  if (res == 0)
+    return ESP_ERR_TIMEOUT;
+  return res > 0 ? ESP_OK : ESP_FAIL;
+}
+
+//==============================================================================
+
+HttpEpollServer::Connection::Connection(size_t bufferSize) : buffer(new (std::nothrow) char[bufferSize]), arena(arenaSize) {}
+
+//==============================================================================
+
+HttpEpollServer::HttpEpollServer(size_t bufferSize) : bufferSize(bufferSize) {
+  SetName(defaultName);
+}
+
+//==============================================================================
+
+HttpEpollServer::~HttpEpollServer() {
+  Disable();
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error != ESP_OK && (error != ESP_ERR_TIMEOUT || timeout != 0))
+    ESP_LOGE(TAG, "mutex lock failed");
+  return error;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Enable() {
+  LockGuard lg(*this);
+  if (!workers.empty())
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(StartWorkers(), TAG, "start workers failed");
+  enabledEvent.Generate();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Disable() {
+  LockGuard lg(*this);
+  if (workers.empty())
+    return ESP_OK;
+  StopWorkers();
+  disabledEvent.Generate();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool HttpEpollServer::IsEnabled() {
+  LockGuard lg(*this);
+  return !workers.empty();
+}
+
+//==============================================================================
+
+uint16_t HttpEpollServer::GetPort() {
+  LockGuard lg(*this);
+  return port;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::SetPort(uint16_t port) {
+  LockGuard lg(*this);
+  if (port == this->port)
+    return ESP_OK;
+  this->port = port;
+  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpEpollServer::GetMaxNumberOfClients() {
+  LockGuard lg(*this);
+  return maxNumberOfClients;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::SetMaxNumberOfClients(size_t maxNumberOfClients) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(maxNumberOfClients, ESP_ERR_INVALID_ARG, TAG, "invalid maximum number of clients");
+  this->maxNumberOfClients = maxNumberOfClients;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpEpollServer::GetNumberOfWorkers() {
+  LockGuard lg(*this);
+  return numberOfWorkers;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::SetNumberOfWorkers(size_t numberOfWorkers) {
+  LockGuard lg(*this);
+  if (numberOfWorkers == this->numberOfWorkers)
+    return ESP_OK;
+  this->numberOfWorkers = numberOfWorkers;
+  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpEpollServer::GetNumberOfHandlers() {
+  LockGuard lg(*this);
+  return numberOfHandlers;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::SetNumberOfHandlers(size_t numberOfHandlers) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(numberOfHandlers, ESP_ERR_INVALID_ARG, TAG, "invalid number of handlers");
+  if (numberOfHandlers == this->numberOfHandlers)
+    return ESP_OK;
+  this->numberOfHandlers = numberOfHandlers;
+  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpEpollServer::GetReadTimeout() {
+  LockGuard lg(*this);
+  return readTimeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::SetReadTimeout(TickType_t timeout) {
+  LockGuard lg(*this);
+  readTimeout = timeout;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpEpollServer::GetWriteTimeout() {
+  LockGuard lg(*this);
+  return writeTimeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::SetWriteTimeout(TickType_t timeout) {
+  LockGuard lg(*this);
+  writeTimeout = timeout;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpEpollServer::GetRequestTimeout() {
+  LockGuard lg(*this);
+  return requestTimeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::SetRequestTimeout(TickType_t timeout) {
+  LockGuard lg(*this);
+  requestTimeout = timeout;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpEpollServer::GetIdleTimeout() {
+  LockGuard lg(*this);
+  return idleTimeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::SetIdleTimeout(TickType_t timeout) {
+  LockGuard lg(*this);
+  idleTimeout = timeout;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpEpollServer::GetNumberOfConnections() {
+  return numberOfConnections;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::StartWorkers() {
+  size_t numberOfCores = std::max(std::thread::hardware_concurrency(), 1u);
+  size_t numberOfStartedWorkers = numberOfWorkers ? numberOfWorkers : numberOfCores;
+  stopRequested = false;
+
+  for (size_t i = 0; i < numberOfStartedWorkers; i++) {
+    workers.emplace_back(new Worker());
+    Worker& worker = *workers.back();
+    worker.coreId = i % numberOfCores;
+
+    // Every worker has its own listening socket: with SO_REUSEPORT the kernel distributes the incoming connections among them
+    // instead of waking all workers on a shared socket. The IPv6 socket accepts IPv4 connections as well.
+    worker.listeningSocket = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int on = 1, off = 0;
+    sockaddr_in6 address = {};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(port);
+    if (worker.listeningSocket < 0 || setsockopt(worker.listeningSocket, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) != 0 ||
+        setsockopt(worker.listeningSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+        setsockopt(worker.listeningSocket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+        bind(worker.listeningSocket, (sockaddr*)&address, sizeof(address)) != 0 || listen(worker.listeningSocket, SOMAXCONN) != 0) {
+      StopWorkers();
+      ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "listening socket create failed");
+    }
+
+    worker.epollSocket = epoll_create1(EPOLL_CLOEXEC);
+    worker.wakeupSocket = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    // The listening socket event has no data, the wakeup event points to the worker and the connection events point to the connections
+    epoll_event listeningEvent = {}, wakeupEvent = {};
+    listeningEvent.events = wakeupEvent.events = EPOLLIN;
+    wakeupEvent.data.ptr = &worker;
+    if (worker.epollSocket < 0 || worker.wakeupSocket < 0 ||
+        epoll_ctl(worker.epollSocket, EPOLL_CTL_ADD, worker.listeningSocket, &listeningEvent) != 0 ||
+        epoll_ctl(worker.epollSocket, EPOLL_CTL_ADD, worker.wakeupSocket, &wakeupEvent) != 0) {
+      StopWorkers();
+      ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "event loop create failed");
+    }
+
+    worker.thread = std::thread(&HttpEpollServer::Run, this, std::ref(worker));
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(worker.coreId, &cpuSet);
+    if (pthread_setaffinity_np(worker.thread.native_handle(), sizeof(cpuSet), &cpuSet) != 0)
+      ESP_LOGW(TAG, "worker %u is not pinned to a core", (unsigned int)i);
+  }
+
+  for (size_t i = 0; i < numberOfHandlers; i++)
+    handlers.emplace_back(&HttpEpollServer::RunHandler, this);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpEpollServer::StopWorkers() {
+  // The handlers are stopped first: they return the connections to the workers. A request being handled is completed.
+  {
+    std::lock_guard<std::mutex> lock(handlerMutex);
+    stopRequested = true;
+  }
+  handlerCondition.notify_all();
+  for (auto& handler : handlers)
+    handler.join();
+  handlers.clear();
+  firstQueuedConnection = lastQueuedConnection = NULL;
+
+  for (auto& worker : workers) {
+    if (worker->thread.joinable()) {
+      uint64_t value = 1;
+      if (write(worker->wakeupSocket, &value, sizeof(value)) != sizeof(value))
+        ESP_LOGE(TAG, "worker wakeup failed");
+      worker->thread.join();
+    }
+
+    for (auto connection : worker->connections) {
+      close(connection->socket);
+      delete connection;
+    }
+    numberOfConnections -= worker->connections.size();
+    for (auto connection : worker->closedConnections)
+      delete connection;
+    while (Connection* connection = worker->freeConnections) {
+      worker->freeConnections = connection->nextFreeConnection;
+      delete connection;
+    }
+    for (int socket : {worker->listeningSocket, worker->epollSocket, worker->wakeupSocket}) {
+      if (socket >= 0)
+        close(socket);
+    }
+  }
+  workers.clear();
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::RestartIfEnabled() {
+  if (workers.empty())
+    return ESP_OK;
+  StopWorkers();
+  ESP_RETURN_ON_ERROR(StartWorkers(), TAG, "start workers failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpEpollServer::Run(Worker& worker) {
+  epoll_event events[maxNumberOfEvents];
+  worker.lastMaintenanceTime = GetTime();
+  while (!stopRequested) {
+    int maintenancePeriod = GetMaintenancePeriodMs();
+    int numberOfEvents = epoll_wait(worker.epollSocket, events, maxNumberOfEvents, maintenancePeriod);
+    for (int i = 0; i < numberOfEvents; i++) {
+      void* ptr = events[i].data.ptr;
+      if (!ptr)
+        AcceptConnections(worker);
+      else if (ptr == &worker) {
+        uint64_t value;
+        if (read(worker.wakeupSocket, &value, sizeof(value)) == sizeof(value))
+          ResumeHandledConnections(worker);
+      }
+      else {
+        Connection& connection = *(Connection*)ptr;
+        // The connection can be closed by the previous event of the batch
+        if (connection.socket < 0)
+          continue;
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+          CloseConnection(worker, connection);
+        else
+          HandleConnection(worker, connection);
+      }
+    }
+
+    int64_t time = GetTime();
+    if (time - worker.lastMaintenanceTime >= maintenancePeriod) {
+      worker.lastMaintenanceTime = time;
+      CloseExpiredConnections(worker);
+    }
+    // Closed connections are reused after the batch, so that the remaining events of the batch do not refer to a new connection
+    for (auto connection : worker.closedConnections) {
+      connection->nextFreeConnection = worker.freeConnections;
+      worker.freeConnections = connection;
+    }
+    worker.closedConnections.clear();
+  }
+}
+
+//==============================================================================
+
+void HttpEpollServer::AcceptConnections(Worker& worker) {
+  while (true) {
+    int socket = accept4(worker.listeningSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (socket < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        ESP_LOGE(TAG, "accept failed (%d)", errno);
+      return;
+    }
+    if (numberOfConnections >= maxNumberOfClients) {
+      close(socket);
+      continue;
+    }
+
+    Connection* connection = worker.freeConnections;
+    if (connection)
+      worker.freeConnections = connection->nextFreeConnection;
+    else if (!(connection = new (std::nothrow) Connection(bufferSize)) || !connection->buffer) {
+      delete connection;
+      close(socket);
+      ESP_LOGE(TAG, "connection allocation failed");
+      continue;
+    }
+
+    int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    connection->worker = &worker;
+    connection->socket = socket;
+    connection->dataSize = 0;
+    connection->parser.Reset();
+    connection->lastActivityTime = GetTime();
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    if (epoll_ctl(worker.epollSocket, EPOLL_CTL_ADD, socket, &event) != 0) {
+      close(socket);
+      connection->socket = -1;
+      connection->nextFreeConnection = worker.freeConnections;
+      worker.freeConnections = connection;
+      ESP_LOGE(TAG, "connection event add failed");
+      continue;
+    }
+    connection->index = worker.connections.size();
+    worker.connections.push_back(connection);
+    numberOfConnections++;
+  }
+}
+
+//==============================================================================
+
+void HttpEpollServer::HandleConnection(Worker& worker, Connection& connection) {
+  // The request received just before the client has closed its side of the connection is still handled
+  bool clientClosed = false;
+  size_t previousDataSize = connection.dataSize;
+  while (connection.dataSize < bufferSize) {
+    ssize_t res = recv(connection.socket, connection.buffer.get() + connection.dataSize, bufferSize - connection.dataSize, 0);
+    if (res > 0)
+      connection.dataSize += res;
+    else if (res < 0 && errno == EINTR)
+      continue;
+    else {
+      clientClosed = res == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+      break;
+    }
+  }
+  connection.lastActivityTime = GetTime();
+  // The head receive time is limited from its first byte, so a client sending the head slowly does not keep the connection open
+  if (!previousDataSize && connection.dataSize)
+    connection.headStartTime = connection.lastActivityTime;
+  HandleReceivedRequest(worker, connection, clientClosed);
+}
+
+//==============================================================================
+
+void HttpEpollServer::HandleReceivedRequest(Worker& worker, Connection& connection, bool clientClosed) {
+  if (connection.dataSize) {
+    esp_err_t error = connection.parser.Parse(connection.buffer.get(), connection.dataSize);
+    if (error == ESP_OK) {
+      // The connection is not polled until the handler returns it: the handler receives the body and sends the response itself
+      if (epoll_ctl(worker.epollSocket, EPOLL_CTL_DEL, connection.socket, NULL) != 0) {
+        CloseConnection(worker, connection);
+        return;
+      }
+      connection.handled = true;
+      {
+        std::lock_guard<std::mutex> lock(handlerMutex);
+        connection.nextQueuedConnection = NULL;
+        if (lastQueuedConnection)
+          lastQueuedConnection->nextQueuedConnection = &connection;
+        else
+          firstQueuedConnection = &connection;
+        lastQueuedConnection = &connection;
+      }
+      handlerCondition.notify_one();
+      return;
+    }
+    if (error != ESP_ERR_NOT_FINISHED || connection.dataSize == bufferSize) {
+      // The request head that does not fit in the buffer or has too many headers is rejected with 431
+      RejectRequest(connection, error == ESP_ERR_INVALID_ARG ? 400 : 431);
+      CloseConnection(worker, connection);
+      return;
+    }
+  }
+  if (clientClosed)
+    CloseConnection(worker, connection);
+}
+
+//==============================================================================
+
+void HttpEpollServer::ResumeHandledConnections(Worker& worker) {
+  Connection* connection;
+  {
+    std::lock_guard<std::mutex> lock(worker.handledMutex);
+    connection = worker.handledConnections;
+    worker.handledConnections = NULL;
+  }
+
+  while (connection) {
+    Connection& handledConnection = *connection;
+    connection = connection->nextQueuedConnection;
+    handledConnection.handled = false;
+    if (!handledConnection.keptAlive) {
+      CloseConnection(worker, handledConnection);
+      continue;
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &handledConnection;
+    if (epoll_ctl(worker.epollSocket, EPOLL_CTL_ADD, handledConnection.socket, &event) != 0) {
+      CloseConnection(worker, handledConnection);
+      continue;
+    }
+    // The pipelined request received with the previous one is handled next
+    handledConnection.lastActivityTime = handledConnection.headStartTime = GetTime();
+    HandleReceivedRequest(worker, handledConnection, false);
+  }
+}
+
+//==============================================================================
+
+void HttpEpollServer::RunHandler() {
+  while (true) {
+    Connection* connection;
+    {
+      std::unique_lock<std::mutex> lock(handlerMutex);
+      handlerCondition.wait(lock, [this]() { return stopRequested || firstQueuedConnection; });
+      if (stopRequested)
+        return;
+      connection = firstQueuedConnection;
+      firstQueuedConnection = connection->nextQueuedConnection;
+      if (!firstQueuedConnection)
+        lastQueuedConnection = NULL;
+    }
+
+    connection->keptAlive = HandleConnectionRequest(*connection);
+    Worker& worker = *connection->worker;
+    {
+      std::lock_guard<std::mutex> lock(worker.handledMutex);
+      connection->nextQueuedConnection = worker.handledConnections;
+      worker.handledConnections = connection;
+    }
+    uint64_t value = 1;
+    if (write(worker.wakeupSocket, &value, sizeof(value)) != sizeof(value))
+      ESP_LOGE(TAG, "worker wakeup failed");
+  }
+}
+
+//==============================================================================
+
+bool HttpEpollServer::HandleConnectionRequest(Connection& connection) {
+  Transaction transaction(*this, connection);
+  esp_err_t error = transaction.Begin();
+  if (error == ESP_OK)
+    error = HandleRequest(transaction);
+  error = transaction.End(error);
+  return error == ESP_OK && transaction.IsConnectionKeptAlive();
+}
+
+//==============================================================================
+
+void HttpEpollServer::RejectRequest(Connection& connection, uint16_t statusCode) {
+  char response[80];
+  int size = snprintf(response, sizeof(response), "HTTP/1.1 %u \r\nContent-Length: 0\r\nConnection: close\r\n\r\n", (unsigned int)statusCode);
+  // The connection is closed after the response, so it is not waited for
+  send(connection.socket, response, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+//==============================================================================
+
+void HttpEpollServer::CloseConnection(Worker& worker, Connection& connection) {
+  close(connection.socket);
+  connection.socket = -1;
+  connection.networkStream.reset();
+  Connection* lastConnection = worker.connections.back();
+  worker.connections[connection.index] = lastConnection;
+  lastConnection->index = connection.index;
+  worker.connections.pop_back();
+  worker.closedConnections.push_back(&connection);
+  numberOfConnections--;
+}
+
+//==============================================================================
+
+void HttpEpollServer::CloseExpiredConnections(Worker& worker) {
+  int idleTimeoutMs = GetTimeoutMs(idleTimeout);
+  int readTimeoutMs = GetTimeoutMs(readTimeout);
+  int64_t time = GetTime();
+  // A closed connection is replaced with the last one, which has already been checked. The connections being handled are skipped.
+  for (size_t i = worker.connections.size(); i-- > 0; ) {
+    Connection& connection = *worker.connections[i];
+    if (connection.handled)
+      continue;
+    if (connection.dataSize && readTimeoutMs >= 0 && time - connection.headStartTime >= readTimeoutMs) {
+      RejectRequest(connection, 408);
+      CloseConnection(worker, connection);
+    }
+    else if (idleTimeoutMs >= 0 && time - connection.lastActivityTime >= idleTimeoutMs)
+      CloseConnection(worker, connection);
+  }
+}
+
+//==============================================================================
+
+int HttpEpollServer::GetMaintenancePeriodMs() {
+  // The timeouts are checked at least four times within them
+  int period = maintenancePeriodMs;
+  for (TickType_t timeout : {readTimeout, idleTimeout}) {
+    int timeoutMs = GetTimeoutMs(timeout);
+    if (timeoutMs >= 0)
+      period = std::max(std::min(period, timeoutMs / 4), 1);
+  }
+  return period;
+}
+
+//==============================================================================
+
+int64_t HttpEpollServer::GetTime() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//==============================================================================
+
+int HttpEpollServer::GetTimeoutMs(TickType_t timeout) {
+  return timeout == portMAX_DELAY ? -1 : (int)(timeout * portTICK_PERIOD_MS);
+}
+
+//==============================================================================
+
+HttpEpollServer::Transaction::Transaction(HttpEpollServer& server, Connection& connection) :
+    server(server), connection(connection), parser(connection.parser), startTime(GetTime()), requestTimeout(server.requestTimeout) {
+  connection.responseHeaders.clear();
+}
+
+//==============================================================================
+
+HttpEpollServer::Transaction::~Transaction() {
+  connection.arena.Reset();
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::Begin() {
+  std::string_view value;
+  bool connectionHeader = parser.FindHeader("Connection", value);
+  keepAlive = parser.GetMinorVersion() ? !(connectionHeader && EqualsIgnoreCase(value, "close")) :
+                                         connectionHeader && EqualsIgnoreCase(value, "keep-alive");
+  headRequest = parser.GetMethod() == HttpMethod::HEAD;
+
+  size_t headSize = parser.GetHeadSize();
+  bufferedBodyPosition = bufferedBodyEnd = headSize;
+  // Chunked request bodies are not supported, as in httpd
+  if (parser.FindHeader("Transfer-Encoding", value)) {
+    keepAlive = false;
+    WriteResponse(501);
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  if (parser.FindHeader("Content-Length", value)) {
+    bool valid = !value.empty() && value.size() <= 10;
+    for (char c : value) {
+      valid = valid && c >= '0' && c <= '9';
+      bodySize = bodySize * 10 + (c - '0');
+    }
+    if (!valid) {
+      keepAlive = false;
+      WriteResponse(400);
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+  bodyRemainingSize = bodySize;
+  bufferedBodyEnd = headSize + std::min(bodySize, connection.dataSize - headSize);
+  continueExpected = bodySize && parser.FindHeader("Expect", value) && EqualsIgnoreCase(value, "100-continue");
+
+  if (parser.GetMethod() == HttpMethod::unknown) {
+    keepAlive = false;
+    WriteResponse(501);
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::End(esp_err_t handlerError) {
+  esp_err_t error = handlerError;
+  if (!responseWritten)
+    WriteResponse(error == ESP_OK ? 200 : 500);
+  // An unfinished chunked response is ended, unless the handler has failed: then the connection is closed to show the body is incomplete
+  if (error == ESP_OK && chunkedResponseBody)
+    error = EndResponseBody();
+  // The unread body received with the head is skipped. If the rest of the body has not been received,
+  // the connection is closed instead of draining the body.
+  if (bodyRemainingSize == bufferedBodyEnd - bufferedBodyPosition)
+    bodyRemainingSize = 0;
+  if (error != ESP_OK || bodyRemainingSize)
+    keepAlive = false;
+
+  // The pipelined requests received after the body are moved to the buffer start
+  if (keepAlive) {
+    connection.dataSize -= bufferedBodyEnd;
+    memmove(connection.buffer.get(), connection.buffer.get() + bufferedBodyEnd, connection.dataSize);
+  }
+  parser.Reset();
+  return error;
+}
+
+//==============================================================================
+
+bool HttpEpollServer::Transaction::IsConnectionKeptAlive() {
+  return keepAlive;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::ReadRequestBody(void* dest, size_t size) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+  ESP_RETURN_ON_FALSE(size <= bodyRemainingSize, ESP_ERR_INVALID_SIZE, TAG, "size exceeds the request body size");
+
+  // The part of the body received with the head is taken from the connection buffer
+  size_t bufferedSize = std::min(size, bufferedBodyEnd - bufferedBodyPosition);
+  if (dest && bufferedSize) {
+    memcpy(dest, connection.buffer.get() + bufferedBodyPosition, bufferedSize);
+    dest = (uint8_t*)dest + bufferedSize;
+  }
+  bufferedBodyPosition += bufferedSize;
+  bodyRemainingSize -= bufferedSize;
+  size -= bufferedSize;
+  if (!size)
+    return ESP_OK;
+
+  if (continueExpected && !continueSent) {
+    char continueResponse[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    iovec part = {continueResponse, sizeof(continueResponse) - 1};
+    ESP_RETURN_ON_ERROR(Send(&part, 1, GetSendTimeout()), TAG, "continue response send failed");
+    continueSent = true;
+  }
+
+  while (size) {
+    constexpr size_t discardBufferSize = 64;
+    char discardBuffer[discardBufferSize];
+    ssize_t res = dest ? recv(connection.socket, dest, size, 0) : recv(connection.socket, discardBuffer, std::min(size, discardBufferSize), 0);
+    if (res > 0) {
+      size -= res;
+      bodyRemainingSize -= res;
+      if (dest)
+        dest = (uint8_t*)dest + res;
+      continue;
+    }
+    if (res < 0 && errno == EINTR)
+      continue;
+    ESP_RETURN_ON_FALSE(res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK), ESP_FAIL, TAG, "request receive failed");
+    esp_err_t error = WaitForSocket(connection.socket, POLLIN, GetTimeoutMs(std::min(server.readTimeout, GetRemainingTime())));
+    if (error == ESP_ERR_TIMEOUT) {
+      keepAlive = false;
+      WriteStatusResponse(408);
+    }
+    ESP_RETURN_ON_ERROR(error, TAG, "request receive failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::WriteResponse(uint16_t statusCode, const void* body, size_t bodySize) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+  if (!GetRemainingTime()) {
+    WriteStatusResponse(503);
+    ESP_RETURN_ON_ERROR(ESP_ERR_TIMEOUT, TAG, "request timeout");
+  }
+  responseWritten = true;
+  char contentLength[40];
+  snprintf(contentLength, sizeof(contentLength), "Content-Length: %u\r\n", (unsigned int)bodySize);
+  BuildResponseHead(statusCode, contentLength);
+
+  // The head and the body are sent with a single call without copying the body. The response to a HEAD request has no body.
+  iovec parts[] = {{connection.responseHead.data(), connection.responseHead.size()}, {(void*)body, headRequest ? 0 : bodySize}};
+  ESP_RETURN_ON_ERROR(Send(parts, 2, GetSendTimeout()), TAG, "response send failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::WriteResponseHeaders(uint16_t statusCode) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+  if (!GetRemainingTime()) {
+    WriteStatusResponse(503);
+    ESP_RETURN_ON_ERROR(ESP_ERR_TIMEOUT, TAG, "request timeout");
+  }
+  responseWritten = true;
+  BuildResponseHead(statusCode, "Transfer-Encoding: chunked\r\n");
+  // The head is sent with the first body part
+  responseHeadPending = true;
+  chunkedResponseBody = true;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::WriteResponseBody(const void* src, size_t size) {
+  ESP_RETURN_ON_FALSE(chunkedResponseBody, ESP_ERR_INVALID_STATE, TAG, "response headers have not been sent");
+  // A zero-size chunk would end the body
+  if (!size || headRequest)
+    return ESP_OK;
+  TickType_t timeout = GetSendTimeout();
+  ESP_RETURN_ON_FALSE(timeout, ESP_ERR_TIMEOUT, TAG, "request timeout");
+
+  char chunkSize[12];
+  char chunkEnd[] = "\r\n";
+  iovec parts[] = {{connection.responseHead.data(), responseHeadPending ? connection.responseHead.size() : 0},
+                   {chunkSize, (size_t)snprintf(chunkSize, sizeof(chunkSize), "%x\r\n", (unsigned int)size)},
+                   {(void*)src, size}, {chunkEnd, 2}};
+  ESP_RETURN_ON_ERROR(Send(parts, 4, timeout), TAG, "response chunk send failed");
+  responseHeadPending = false;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::EndResponseBody() {
+  if (!chunkedResponseBody)
+    return ESP_OK;
+  chunkedResponseBody = false;
+
+  char lastChunk[] = "0\r\n\r\n";
+  iovec parts[] = {{connection.responseHead.data(), responseHeadPending ? connection.responseHead.size() : 0}, {lastChunk, headRequest ? 0 : sizeof(lastChunk) - 1}};
+  ESP_RETURN_ON_ERROR(Send(parts, 2, GetSendTimeout()), TAG, "response chunk send failed");
+  responseHeadPending = false;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+std::shared_ptr<NetworkStream> HttpEpollServer::Transaction::GetNetworkStream() {
+  if (!connection.networkStream)
+    connection.networkStream = std::make_shared<NetworkStream>(connection.socket);
+  return connection.networkStream;
+}
+
+//==============================================================================
+
+HttpMethod HttpEpollServer::Transaction::GetRequestMethod() {
+  return parser.GetMethod();
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::GetRequestUri(std::string& uri) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+  uri.assign(parser.GetTarget());
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::GetRequestHeader(const std::string& name, std::string& value) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+  std::string_view headerValue;
+  // A missing header is not logged: optional headers are looked up on every request
+  if (!parser.FindHeader(name, headerValue))
+    return ESP_ERR_NOT_FOUND;
+  value.assign(headerValue);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpEpollServer::Transaction::GetRequestBodySize() {
+  return bodySize;
+}
+
+//==============================================================================
+
+HttpArena& HttpEpollServer::Transaction::GetArena() {
+  return connection.arena;
+}
+
+//==============================================================================
+
+TickType_t HttpEpollServer::Transaction::GetRemainingTime() {
+  if (requestTimeout == portMAX_DELAY)
+    return portMAX_DELAY;
+  TickType_t elapsedTime = (GetTime() - startTime) / portTICK_PERIOD_MS;
+  return elapsedTime < requestTimeout ? requestTimeout - elapsedTime : 0;
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::SetResponseHeader(const std::string& name, const std::string& value) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+  contentTypeSet |= EqualsIgnoreCase(name, "Content-Type");
+  // The string keeps its capacity between the requests of the connection
+  connection.responseHeaders.append(name).append(": ").append(value).append("\r\n");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpEpollServer::Transaction::BuildResponseHead(uint16_t statusCode, const char* framingHeader) {
+  // The reason phrase is optional in HTTP/1.1, so the status line has the code only
+  char statusLine[20];
+  snprintf(statusLine, sizeof(statusLine), "HTTP/1.1 %u \r\n", (unsigned int)statusCode);
+  std::string& head = connection.responseHead;
+  head.assign(statusLine);
+  if (!contentTypeSet)
+    head.append("Content-Type: text/html\r\n");
+  head.append(framingHeader);
+  head.append(connection.responseHeaders);
+  if (!keepAlive)
+    head.append("Connection: close\r\n");
+  head.append("\r\n");
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::WriteStatusResponse(uint16_t statusCode) {
+  // The response replacing the one that cannot be written has no body and is not limited by the request deadline
+  responseWritten = true;
+  BuildResponseHead(statusCode, "Content-Length: 0\r\n");
+  iovec part = {connection.responseHead.data(), connection.responseHead.size()};
+  ESP_RETURN_ON_ERROR(Send(&part, 1, server.writeTimeout), TAG, "response send failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpEpollServer::Transaction::GetSendTimeout() {
+  return std::min(server.writeTimeout, GetRemainingTime());
+}
+
+//==============================================================================
+
+esp_err_t HttpEpollServer::Transaction::Send(iovec* parts, size_t numberOfParts, TickType_t timeout) {
+  msghdr message = {};
+  message.msg_iov = parts;
+  message.msg_iovlen = numberOfParts;
+  while (message.msg_iovlen) {
+    ssize_t res = sendmsg(connection.socket, &message, MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      ESP_RETURN_ON_FALSE(errno == EAGAIN || errno == EWOULDBLOCK, ESP_FAIL, TAG, "send failed");
+      ESP_RETURN_ON_ERROR(WaitForSocket(connection.socket, POLLOUT, GetTimeoutMs(timeout)), TAG, "send failed");
+      continue;
+    }
+    // The parts sent completely are skipped and the partially sent one is advanced
+    while (message.msg_iovlen && (size_t)res >= message.msg_iov->iov_len) {
+      res -= message.msg_iov->iov_len;
+      message.msg_iov++;
+      message.msg_iovlen--;
+    }
+    if (message.msg_iovlen) {
+      message.msg_iov->iov_base = (uint8_t*)message.msg_iov->iov_base + res;
+      message.msg_iov->iov_len -= res;
+    }
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+}
+
+#endif
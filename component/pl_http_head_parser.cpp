@@ -0,0 +1,260 @@
+#include "pl_http_head_parser.h"
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+HttpHeadParser::HttpHeadParser(size_t maxHeadSize) : maxHeadSize(std::min(maxHeadSize, maxMaxHeadSize)) {}
+
+//==============================================================================
+
+void HttpHeadParser::Reset() {
+  data = NULL;
+  minorVersion = 1;
+  parsedSize = 0;
+  scannedSize = 0;
+  startLineParsed = false;
+  complete = false;
+  numberOfHeaders = 0;
+}
+
+//==============================================================================
+
+esp_err_t HttpHeadParser::Parse(const char* data, size_t size) {
+  this->data = data;
+  if (complete)
+    return ESP_OK;
+
+  // The data beyond the head size limit is not scanned. Invalid messages are not logged: they come from the network.
+  size_t limit = std::min(size, maxHeadSize);
+  while (true) {
+    // Only the data received after the previous call is scanned for the line end
+    size_t scanStart = std::max(parsedSize, scannedSize);
+    const char* lineEnd = scanStart < limit ? FindChar(data + scanStart, data + limit, '\n') : NULL;
+    if (!lineEnd) {
+      scannedSize = std::max(scanStart, limit);
+      return size < maxHeadSize ? ESP_ERR_NOT_FINISHED : ESP_ERR_INVALID_SIZE;
+    }
+
+    const char* line = data + parsedSize;
+    parsedSize = lineEnd + 1 - data;
+    if (lineEnd > line && lineEnd[-1] == '\r')
+      lineEnd--;
+
+    if (!startLineParsed) {
+      // Empty lines before the start line are ignored
+      if (lineEnd == line)
+        continue;
+      esp_err_t error = ParseStartLine(line, lineEnd);
+      if (error != ESP_OK)
+        return error;
+      startLineParsed = true;
+    }
+    else if (lineEnd == line) {
+      complete = true;
+      return ESP_OK;
+    }
+    else {
+      esp_err_t error = ParseHeader(line, lineEnd);
+      if (error != ESP_OK)
+        return error;
+    }
+  }
+}
+
+//==============================================================================
+
+bool HttpHeadParser::IsComplete() {
+  return complete;
+}
+
+//==============================================================================
+
+size_t HttpHeadParser::GetHeadSize() {
+  return complete ? parsedSize : 0;
+}
+
+//==============================================================================
+
+uint8_t HttpHeadParser::GetMinorVersion() {
+  return minorVersion;
+}
+
+//==============================================================================
+
+size_t HttpHeadParser::GetNumberOfHeaders() {
+  return numberOfHeaders;
+}
+
+//==============================================================================
+
+std::string_view HttpHeadParser::GetHeaderName(size_t index) {
+  return index < numberOfHeaders ? GetString(headerNames[index]) : std::string_view();
+}
+
+//==============================================================================
+
+std::string_view HttpHeadParser::GetHeaderValue(size_t index) {
+  return index < numberOfHeaders ? GetString(headerValues[index]) : std::string_view();
+}
+
+//==============================================================================
+
+bool HttpHeadParser::FindHeader(std::string_view name, std::string_view& value) {
+  for (size_t i = 0; i < numberOfHeaders; i++) {
+    if (headerNames[i].size == name.size() && strncasecmp(data + headerNames[i].offset, name.data(), name.size()) == 0) {
+      value = GetString(headerValues[i]);
+      return true;
+    }
+  }
+  return false;
+}
+
+//==============================================================================
+
+const char* HttpHeadParser::FindChar(const char* begin, const char* end, char c) {
+#if defined(__SSE2__)
+  const __m128i pattern = _mm_set1_epi8(c);
+  for (; end - begin >= 16; begin += 16) {
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)begin), pattern));
+    if (mask)
+      return begin + __builtin_ctz(mask);
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  const uint8x16_t pattern = vdupq_n_u8(c);
+  for (; end - begin >= 16; begin += 16) {
+    // The comparison result is narrowed to 4 bits per character
+    uint8x16_t equal = vceqq_u8(vld1q_u8((const uint8_t*)begin), pattern);
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+    if (mask)
+      return begin + __builtin_ctzll(mask) / 4;
+  }
+#else
+  // SWAR: a word is compared with the character repeated in every byte. The characters before the first aligned word
+  // are compared one by one: Xtensa does not allow unaligned word loads.
+  using Word = uintptr_t;
+  for (; begin < end && (uintptr_t)begin % sizeof(Word); begin++) {
+    if (*begin == c)
+      return begin;
+  }
+  const Word ones = (Word)-1 / 0xFF;
+  const Word highBits = ones * 0x80;
+  const Word pattern = ones * (uint8_t)c;
+  for (; end - begin >= (ptrdiff_t)sizeof(Word); begin += sizeof(Word)) {
+    Word word;
+    memcpy(&word, __builtin_assume_aligned(begin, sizeof(Word)), sizeof(Word));
+    word ^= pattern;
+    // The high bit is set in the zero bytes (and may be set in the bytes after the first zero one)
+    Word mask = (word - ones) & ~word & highBits;
+    if (mask) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      return begin + (sizeof(Word) == 8 ? __builtin_ctzll(mask) : __builtin_ctz(mask)) / 8;
+#else
+      return begin + (sizeof(Word) == 8 ? __builtin_clzll(mask) : __builtin_clz(mask)) / 8;
+#endif
+    }
+  }
+#endif
+  for (; begin < end; begin++) {
+    if (*begin == c)
+      return begin;
+  }
+  return NULL;
+}
+
+//==============================================================================
+
+esp_err_t HttpHeadParser::ParseVersion(const char* version) {
+  if (memcmp(version, "HTTP/1.", 7) != 0 || (version[7] != '0' && version[7] != '1'))
+    return ESP_ERR_INVALID_ARG;
+  minorVersion = version[7] - '0';
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpHeadParser::Span HttpHeadParser::GetSpan(const char* begin, const char* end) {
+  return {(uint16_t)(begin - data), (uint16_t)(end - begin)};
+}
+
+//==============================================================================
+
+std::string_view HttpHeadParser::GetString(const Span& span) {
+  return data ? std::string_view(data + span.offset, span.size) : std::string_view();
+}
+
+//==============================================================================
+
+esp_err_t HttpHeadParser::ParseHeader(const char* line, const char* lineEnd) {
+  if (numberOfHeaders == maxNumberOfHeaders)
+    return ESP_ERR_INVALID_SIZE;
+
+  const char* colon = FindChar(line, lineEnd, ':');
+  // A line starting with whitespace is an obsolete folded line. Whitespace before the colon is not allowed.
+  if (!colon || colon == line || line[0] == ' ' || line[0] == '\t' || colon[-1] == ' ' || colon[-1] == '\t')
+    return ESP_ERR_INVALID_ARG;
+
+  const char* value = colon + 1;
+  while (value < lineEnd && (*value == ' ' || *value == '\t'))
+    value++;
+  const char* valueEnd = lineEnd;
+  while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+    valueEnd--;
+
+  headerNames[numberOfHeaders] = GetSpan(line, colon);
+  headerValues[numberOfHeaders] = GetSpan(value, valueEnd);
+  numberOfHeaders++;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpResponseParser::Reset() {
+  HttpHeadParser::Reset();
+  statusCode = 0;
+  reasonPhrase = {};
+}
+
+//==============================================================================
+
+uint16_t HttpResponseParser::GetStatusCode() {
+  return statusCode;
+}
+
+//==============================================================================
+
+std::string_view HttpResponseParser::GetReasonPhrase() {
+  return GetString(reasonPhrase);
+}
+
+//==============================================================================
+
+esp_err_t HttpResponseParser::ParseStartLine(const char* line, const char* lineEnd) {
+  // The reason phrase and the space before it are optional
+  if (lineEnd - line < 12 || ParseVersion(line) != ESP_OK || line[8] != ' ' || (lineEnd - line > 12 && line[12] != ' '))
+    return ESP_ERR_INVALID_ARG;
+  uint16_t code = 0;
+  for (const char* digit = line + 9; digit < line + 12; digit++) {
+    if (*digit < '0' || *digit > '9')
+      return ESP_ERR_INVALID_ARG;
+    code = code * 10 + (*digit - '0');
+  }
+
+  statusCode = code;
+  reasonPhrase = GetSpan(std::min(line + 13, lineEnd), lineEnd);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+}
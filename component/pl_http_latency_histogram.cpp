@@ -0,0 +1,117 @@
+#include "pl_http_latency_histogram.h"
+#include <math.h>
+#include <algorithm>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+void HttpLatencyHistogram::Record(int64_t value) {
+  value = std::clamp(value, (int64_t)0, maxValue);
+  counts[GetBucketIndex(value)]++;
+  min = count ? std::min(min, value) : value;
+  max = count ? std::max(max, value) : value;
+  sum += value;
+  count++;
+}
+
+//==============================================================================
+
+void HttpLatencyHistogram::Merge(const HttpLatencyHistogram& histogram) {
+  if (!histogram.count)
+    return;
+  for (size_t i = 0; i < numberOfBuckets; i++)
+    counts[i] += histogram.counts[i];
+  min = count ? std::min(min, histogram.min) : histogram.min;
+  max = count ? std::max(max, histogram.max) : histogram.max;
+  sum += histogram.sum;
+  count += histogram.count;
+}
+
+//==============================================================================
+
+void HttpLatencyHistogram::Reset() {
+  std::fill(counts, counts + numberOfBuckets, 0);
+  count = 0;
+  min = max = sum = 0;
+}
+
+//==============================================================================
+
+size_t HttpLatencyHistogram::GetCount() const {
+  return count;
+}
+
+//==============================================================================
+
+int64_t HttpLatencyHistogram::GetMin() const {
+  return min;
+}
+
+//==============================================================================
+
+int64_t HttpLatencyHistogram::GetMax() const {
+  return max;
+}
+
+//==============================================================================
+
+int64_t HttpLatencyHistogram::GetMean() const {
+  return count ? sum / (int64_t)count : 0;
+}
+
+//==============================================================================
+
+int64_t HttpLatencyHistogram::GetPercentile(double percentile) const {
+  if (!count)
+    return 0;
+  size_t rank = std::max((size_t)ceil(std::clamp(percentile, 0.0, 100.0) / 100 * count), (size_t)1);
+  size_t cumulativeCount = 0;
+  for (size_t i = 0; i < numberOfBuckets; i++) {
+    cumulativeCount += counts[i];
+    if (cumulativeCount >= rank)
+      return std::clamp(GetBucketMaxValue(i), min, max);
+  }
+  return max;
+}
+
+//==============================================================================
+
+size_t HttpLatencyHistogram::GetBucketCount(size_t index) const {
+  return index < numberOfBuckets ? counts[index] : 0;
+}
+
+//==============================================================================
+
+int64_t HttpLatencyHistogram::GetBucketMinValue(size_t index) {
+  if (index < 64)
+    return index;
+  // Bucket index is 32 * exponent + mantissa, where the 6-bit mantissa has the high bit set
+  size_t exponent = index / 32 - 1;
+  return (int64_t)(index % 32 + 32) << exponent;
+}
+
+//==============================================================================
+
+int64_t HttpLatencyHistogram::GetBucketMaxValue(size_t index) {
+  if (index < 64)
+    return index;
+  size_t exponent = index / 32 - 1;
+  return ((int64_t)(index % 32 + 33) << exponent) - 1;
+}
+
+//==============================================================================
+
+size_t HttpLatencyHistogram::GetBucketIndex(int64_t value) {
+  value = std::clamp(value, (int64_t)0, maxValue);
+  if (value < 64)
+    return value;
+  size_t exponent = 63 - __builtin_clzll(value) - 5;
+  return 32 * exponent + (value >> exponent);
+}
+
+//==============================================================================
+
+}
@@ -0,0 +1,460 @@
+#include "pl_http_link_emulator.h"
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include "esp_check.h"
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+//==============================================================================
+
+static const char* TAG = "pl_http_link_emulator";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+const HttpLinkProfile HttpLinkEmulator::defaultProfile = {0, 0, 0, 0, 200000, 0, 1};
+
+//==============================================================================
+
+HttpLinkEmulator::Connection::Connection(int clientSocket, int serverSocket, uint64_t randomState) :
+    clientSocket(clientSocket), serverSocket(serverSocket), randomState(randomState) {
+  uplink.source = downlink.destination = &this->clientSocket;
+  uplink.destination = downlink.source = &this->serverSocket;
+}
+
+//==============================================================================
+
+HttpLinkEmulator::HttpLinkEmulator(uint16_t port, const std::string& targetHost, uint16_t targetPort) :
+  port(port), targetHost(targetHost), targetPort(targetPort) {}
+
+//==============================================================================
+
+HttpLinkEmulator::~HttpLinkEmulator() {
+  Disable();
+}
+
+//==============================================================================
+
+esp_err_t HttpLinkEmulator::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error != ESP_OK && (error != ESP_ERR_TIMEOUT || timeout != 0))
+    ESP_LOGE(TAG, "mutex lock failed");
+  return error;
+}
+
+//==============================================================================
+
+esp_err_t HttpLinkEmulator::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpLinkEmulator::Enable() {
+  LockGuard lg(*this);
+  if (thread.joinable())
+    return ESP_OK;
+
+  // The IPv6 socket accepts IPv4 connections as well
+  listeningSocket = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int on = 1, off = 0;
+  sockaddr_in6 address = {};
+  address.sin6_family = AF_INET6;
+  address.sin6_addr = in6addr_any;
+  address.sin6_port = htons(port);
+  if (listeningSocket < 0 || setsockopt(listeningSocket, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) != 0 ||
+      setsockopt(listeningSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+      bind(listeningSocket, (sockaddr*)&address, sizeof(address)) != 0 || listen(listeningSocket, SOMAXCONN) != 0 ||
+      (wakeupSocket = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+    for (int* socket : {&listeningSocket, &wakeupSocket}) {
+      if (*socket >= 0)
+        close(*socket);
+      *socket = -1;
+    }
+    ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "listening socket create failed");
+  }
+
+  stopRequested = false;
+  resetRequested = false;
+  thread = std::thread(&HttpLinkEmulator::Run, this);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpLinkEmulator::Disable() {
+  LockGuard lg(*this);
+  if (!thread.joinable())
+    return ESP_OK;
+
+  stopRequested = true;
+  Wakeup();
+  thread.join();
+  for (auto& connection : connections)
+    CloseConnection(*connection);
+  connections.clear();
+  numberOfConnections = 0;
+  for (int* socket : {&listeningSocket, &wakeupSocket}) {
+    close(*socket);
+    *socket = -1;
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool HttpLinkEmulator::IsEnabled() {
+  LockGuard lg(*this);
+  return thread.joinable();
+}
+
+//==============================================================================
+
+uint16_t HttpLinkEmulator::GetPort() {
+  LockGuard lg(*this);
+  return port;
+}
+
+//==============================================================================
+
+HttpLinkProfile HttpLinkEmulator::GetProfile() {
+  std::lock_guard<std::mutex> lg(linkMutex);
+  return profile;
+}
+
+//==============================================================================
+
+esp_err_t HttpLinkEmulator::SetProfile(const HttpLinkProfile& profile) {
+  ESP_RETURN_ON_FALSE(profile.lossProbability >= 0 && profile.lossProbability <= 1, ESP_ERR_INVALID_ARG, TAG, "invalid loss probability");
+  ESP_RETURN_ON_FALSE(profile.resetProbability >= 0 && profile.resetProbability <= 1, ESP_ERR_INVALID_ARG, TAG, "invalid reset probability");
+  std::lock_guard<std::mutex> lg(linkMutex);
+  this->profile = profile;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpLinkEmulator::ResetConnections() {
+  LockGuard lg(*this);
+  if (!thread.joinable())
+    return ESP_OK;
+  resetRequested = true;
+  Wakeup();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpLinkEmulator::GetNumberOfConnections() {
+  return numberOfConnections;
+}
+
+//==============================================================================
+
+HttpLinkStatistics HttpLinkEmulator::GetStatistics() {
+  std::lock_guard<std::mutex> lg(linkMutex);
+  return statistics;
+}
+
+//==============================================================================
+
+esp_err_t HttpLinkEmulator::ResetStatistics() {
+  std::lock_guard<std::mutex> lg(linkMutex);
+  statistics = {};
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpLinkEmulator::Run() {
+  std::vector<pollfd> pollSockets;
+  while (!stopRequested) {
+    HttpLinkProfile profile;
+    {
+      std::lock_guard<std::mutex> lg(linkMutex);
+      profile = this->profile;
+    }
+    if (resetRequested.exchange(false)) {
+      for (auto& connection : connections)
+        ResetConnection(*connection);
+    }
+
+    // The due segments are delivered and the relay waits for the sockets or the next delivery time
+    int64_t time = GetTime();
+    int64_t nextDeliveryTime = INT64_MAX;
+    pollSockets.clear();
+    pollSockets.push_back({listeningSocket, POLLIN, 0});
+    pollSockets.push_back({wakeupSocket, POLLIN, 0});
+    for (auto it = connections.begin(); it != connections.end();) {
+      Connection& connection = **it;
+      for (Direction* direction : {&connection.uplink, &connection.downlink}) {
+        if (connection.clientSocket >= 0 && !Deliver(*direction, time))
+          ResetConnection(connection);
+      }
+      if (connection.clientSocket >= 0 && connection.uplink.closed && connection.downlink.closed)
+        CloseConnection(connection);
+      if (connection.clientSocket < 0) {
+        it = connections.erase(it);
+        numberOfConnections--;
+        continue;
+      }
+
+      short events[2] = {};
+      for (Direction* direction : {&connection.uplink, &connection.downlink}) {
+        bool uplink = direction == &connection.uplink;
+        if (!direction->endOfStream && direction->data.size() - direction->dataStart < maxQueuedSize)
+          events[uplink ? 0 : 1] |= POLLIN;
+        if (direction->blocked)
+          events[uplink ? 1 : 0] |= POLLOUT;
+        else if (!direction->segments.empty())
+          nextDeliveryTime = std::min(nextDeliveryTime, direction->segments.front().deliveryTime);
+      }
+      // A socket without events is not polled, so its hangup does not wake the relay while its queue is full
+      pollSockets.push_back({events[0] ? connection.clientSocket : -1, events[0], 0});
+      pollSockets.push_back({events[1] ? connection.serverSocket : -1, events[1], 0});
+      it++;
+    }
+
+    int64_t timeout = nextDeliveryTime == INT64_MAX ? -1 : std::max(nextDeliveryTime - time, (int64_t)0);
+    timespec timeoutTime = {(time_t)(timeout / 1000000), (long)(timeout % 1000000 * 1000)};
+    if (ppoll(pollSockets.data(), pollSockets.size(), timeout < 0 ? NULL : &timeoutTime, NULL) <= 0)
+      continue;
+
+    time = GetTime();
+    if (pollSockets[1].revents) {
+      uint64_t value;
+      if (read(wakeupSocket, &value, sizeof(value)) != sizeof(value))
+        continue;
+    }
+    for (size_t i = 0; i < connections.size(); i++) {
+      Connection& connection = *connections[i];
+      for (int s = 0; s < 2; s++) {
+        pollfd& pollSocket = pollSockets[2 + 2 * i + s];
+        if (!pollSocket.revents || connection.clientSocket < 0)
+          continue;
+        // The client socket receives the uplink data and sends the downlink data, the server socket does the opposite
+        Direction& receiveDirection = s ? connection.downlink : connection.uplink;
+        Direction& sendDirection = s ? connection.uplink : connection.downlink;
+        if ((pollSocket.revents & POLLERR) ||
+            ((pollSocket.revents & (POLLIN | POLLHUP)) && (pollSocket.events & POLLIN) && !Receive(connection, receiveDirection, profile, time))) {
+          ResetConnection(connection);
+          continue;
+        }
+        if (pollSocket.revents & (POLLOUT | POLLHUP))
+          sendDirection.blocked = false;
+      }
+    }
+    if (pollSockets[0].revents & POLLIN)
+      AcceptConnection();
+  }
+}
+
+//==============================================================================
+
+void HttpLinkEmulator::AcceptConnection() {
+  int clientSocket;
+  while ((clientSocket = accept4(listeningSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    uint64_t connectionNumber;
+    HttpLinkProfile profile;
+    {
+      std::lock_guard<std::mutex> lg(linkMutex);
+      connectionNumber = statistics.numberOfConnections++;
+      profile = this->profile;
+    }
+
+    // The random numbers of each connection depend on the seed and the connection number only
+    std::unique_ptr<Connection> connection(new Connection(clientSocket, ConnectToTarget(), ((uint64_t)profile.seed << 32) ^ connectionNumber));
+    int on = 1;
+    if (connection->serverSocket < 0 || setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0 ||
+        setsockopt(connection->serverSocket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0) {
+      ResetConnection(*connection);
+      continue;
+    }
+    // The client connection has been accepted at once: the handshake round trip delays the first client segment
+    connection->uplink.linkFreeTime = GetTime() + 2 * (int64_t)profile.latency;
+    connections.push_back(std::move(connection));
+    numberOfConnections++;
+  }
+}
+
+//==============================================================================
+
+int HttpLinkEmulator::ConnectToTarget() {
+  // The relay thread waits for the connection: the target should be on the same host
+  addrinfo hints = {};
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses;
+  if (getaddrinfo(targetHost.c_str(), std::to_string(targetPort).c_str(), &hints, &addresses) != 0)
+    return -1;
+  int socket = -1;
+  for (addrinfo* address = addresses; address && socket < 0; address = address->ai_next) {
+    socket = ::socket(address->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket >= 0 && connect(socket, address->ai_addr, address->ai_addrlen) != 0) {
+      close(socket);
+      socket = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (socket >= 0 && fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK) != 0) {
+    close(socket);
+    socket = -1;
+  }
+  return socket;
+}
+
+//==============================================================================
+
+bool HttpLinkEmulator::Receive(Connection& connection, Direction& direction, const HttpLinkProfile& profile, int64_t time) {
+  char buffer[16384];
+  ssize_t size = recv(*direction.source, buffer, std::min(sizeof(buffer), maxQueuedSize - (direction.data.size() - direction.dataStart)), 0);
+  if (size < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  if (size == 0) {
+    // The end of the stream follows the data
+    direction.endOfStream = true;
+    direction.lastDeliveryTime = std::max(std::max(direction.linkFreeTime, time) + profile.latency, direction.lastDeliveryTime);
+    direction.segments.push_back({direction.lastDeliveryTime, 0});
+    return true;
+  }
+
+  direction.data.append(buffer, size);
+  size_t numberOfSegments = 0, numberOfLostSegments = 0;
+  bool reset = false;
+  for (ssize_t offset = 0; offset < size; offset += segmentSize) {
+    if (profile.resetProbability > 0 && GetRandom(connection.randomState) < profile.resetProbability) {
+      reset = true;
+      break;
+    }
+    size_t dataSize = std::min((size_t)(size - offset), segmentSize);
+    // The segments are serialized at the link bandwidth one after another
+    direction.linkFreeTime = std::max(direction.linkFreeTime, time) + (profile.bandwidth ? (int64_t)dataSize * 1000000 / profile.bandwidth : 0);
+    int64_t delay = profile.latency + (profile.jitter ? (int64_t)(GetRandom(connection.randomState) * (profile.jitter + 1)) : 0);
+    for (int i = 0; i < maxNumberOfRetransmissions && profile.lossProbability > 0 && GetRandom(connection.randomState) < profile.lossProbability; i++) {
+      delay += (int64_t)profile.retransmissionTimeout << i;
+      numberOfLostSegments++;
+    }
+    // TCP delivers the data in order: a delayed segment holds the following ones back
+    direction.lastDeliveryTime = std::max(direction.linkFreeTime + delay, direction.lastDeliveryTime);
+    direction.segments.push_back({direction.lastDeliveryTime, dataSize});
+    numberOfSegments++;
+  }
+
+  std::lock_guard<std::mutex> lg(linkMutex);
+  statistics.numberOfSegments += numberOfSegments;
+  statistics.numberOfLostSegments += numberOfLostSegments;
+  return !reset;
+}
+
+//==============================================================================
+
+bool HttpLinkEmulator::Deliver(Direction& direction, int64_t time) {
+  size_t deliveredSize = 0;
+  while (!direction.blocked && !direction.segments.empty() && direction.segments.front().deliveryTime <= time) {
+    Segment& segment = direction.segments.front();
+    if (!segment.size) {
+      shutdown(*direction.destination, SHUT_WR);
+      direction.closed = true;
+      direction.segments.pop_front();
+      continue;
+    }
+    ssize_t size = send(*direction.destination, direction.data.data() + direction.dataStart, segment.size, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (size < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return false;
+      direction.blocked = true;
+      break;
+    }
+    direction.dataStart += size;
+    deliveredSize += size;
+    segment.size -= size;
+    if (segment.size)
+      direction.blocked = true;
+    else
+      direction.segments.pop_front();
+  }
+
+  if (direction.dataStart == direction.data.size()) {
+    direction.data.clear();
+    direction.dataStart = 0;
+  }
+  else if (direction.dataStart >= maxQueuedSize) {
+    direction.data.erase(0, direction.dataStart);
+    direction.dataStart = 0;
+  }
+  if (deliveredSize) {
+    std::lock_guard<std::mutex> lg(linkMutex);
+    statistics.numberOfBytes += deliveredSize;
+  }
+  return true;
+}
+
+//==============================================================================
+
+void HttpLinkEmulator::ResetConnection(Connection& connection) {
+  if (connection.clientSocket < 0)
+    return;
+  // A zero linger time makes the close send RST instead of FIN
+  linger lingerOption = {1, 0};
+  for (int* socket : {&connection.clientSocket, &connection.serverSocket}) {
+    if (*socket >= 0) {
+      setsockopt(*socket, SOL_SOCKET, SO_LINGER, &lingerOption, sizeof(lingerOption));
+      close(*socket);
+    }
+    *socket = -1;
+  }
+  std::lock_guard<std::mutex> lg(linkMutex);
+  statistics.numberOfResets++;
+}
+
+//==============================================================================
+
+void HttpLinkEmulator::CloseConnection(Connection& connection) {
+  for (int* socket : {&connection.clientSocket, &connection.serverSocket}) {
+    if (*socket >= 0)
+      close(*socket);
+    *socket = -1;
+  }
+}
+
+//==============================================================================
+
+void HttpLinkEmulator::Wakeup() {
+  uint64_t value = 1;
+  if (write(wakeupSocket, &value, sizeof(value)) != sizeof(value))
+    ESP_LOGE(TAG, "relay wakeup failed");
+}
+
+//==============================================================================
+
+double HttpLinkEmulator::GetRandom(uint64_t& state) {
+  // SplitMix64: a uniform number in [0, 1)
+  uint64_t value = (state += 0x9E3779B97F4A7C15);
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+  return ((value ^ (value >> 31)) >> 11) * 0x1.0p-53;
+}
+
+//==============================================================================
+
+int64_t HttpLinkEmulator::GetTime() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//==============================================================================
+
+}
+
+#endif
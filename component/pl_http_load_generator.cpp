@@ -0,0 +1,279 @@
+#include "pl_http_load_generator.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include <math.h>
+
+//==============================================================================
+
+static const char* TAG = "pl_http_load_generator";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+const TaskParameters HttpLoadGenerator::defaultTaskParameters = {4096, tskIDLE_PRIORITY + 5, tskNO_AFFINITY};
+const HttpLoadProfile HttpLoadGenerator::defaultProfile = {HttpLoadMode::closedLoop, 1, 10, 0, 100, portMAX_DELAY, true, 1};
+
+//==============================================================================
+
+HttpLoadGenerator::Client::Client(HttpLoadGenerator& generator) : generator(generator), client(generator.hostname) {}
+
+//==============================================================================
+
+HttpLoadGenerator::HttpLoadGenerator(const std::string& hostname, uint16_t port, const TaskParameters& taskParameters) :
+  hostname(hostname), port(port), taskParameters(taskParameters) {}
+
+//==============================================================================
+
+esp_err_t HttpLoadGenerator::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error != ESP_OK && (error != ESP_ERR_TIMEOUT || timeout != 0))
+    ESP_LOGE(TAG, "mutex lock failed");
+  return error;
+}
+
+//==============================================================================
+
+esp_err_t HttpLoadGenerator::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpLoadGenerator::AddRequest(const HttpLoadRequest& request) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(request.weight, ESP_ERR_INVALID_ARG, TAG, "invalid request weight");
+  requests.push_back(request);
+  totalWeight += request.weight;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpLoadGenerator::RemoveRequests() {
+  LockGuard lg(*this);
+  requests.clear();
+  totalWeight = 0;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpLoadProfile HttpLoadGenerator::GetProfile() {
+  LockGuard lg(*this);
+  return profile;
+}
+
+//==============================================================================
+
+esp_err_t HttpLoadGenerator::SetProfile(const HttpLoadProfile& profile) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(profile.numberOfClients, ESP_ERR_INVALID_ARG, TAG, "invalid number of clients");
+  ESP_RETURN_ON_FALSE(profile.numberOfRequests || profile.duration != portMAX_DELAY, ESP_ERR_INVALID_ARG, TAG, "load is not limited");
+  ESP_RETURN_ON_FALSE(profile.mode != HttpLoadMode::openLoop || profile.requestRate > 0, ESP_ERR_INVALID_ARG, TAG, "invalid request rate");
+  this->profile = profile;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpRequestPolicy HttpLoadGenerator::GetRequestPolicy() {
+  LockGuard lg(*this);
+  return requestPolicy;
+}
+
+//==============================================================================
+
+esp_err_t HttpLoadGenerator::SetRequestPolicy(const HttpRequestPolicy& requestPolicy) {
+  LockGuard lg(*this);
+  this->requestPolicy = requestPolicy;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpLoadGenerator::GetReadTimeout() {
+  LockGuard lg(*this);
+  return readTimeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpLoadGenerator::SetReadTimeout(TickType_t timeout) {
+  LockGuard lg(*this);
+  readTimeout = timeout;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpLoadGenerator::Run(HttpLoadStatistics& statistics) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(totalWeight, ESP_ERR_INVALID_STATE, TAG, "request mix is empty");
+
+  std::vector<std::unique_ptr<Client>> clients;
+  for (size_t i = 0; i < profile.numberOfClients; i++) {
+    Client* client = new (std::nothrow) Client(*this);
+    ESP_RETURN_ON_FALSE(client, ESP_ERR_NO_MEM, TAG, "client allocation failed");
+    clients.emplace_back(client);
+    ESP_RETURN_ON_ERROR(client->client.Initialize(), TAG, "client initialize failed");
+    ESP_RETURN_ON_ERROR(client->client.SetPort(port), TAG, "client set port failed");
+    ESP_RETURN_ON_ERROR(client->client.SetReadTimeout(readTimeout), TAG, "client set read timeout failed");
+    ESP_RETURN_ON_ERROR(client->client.SetRequestPolicy(requestPolicy), TAG, "client set request policy failed");
+  }
+
+  // The generator stays locked during the run, so the client tasks read the profile and the request mix without locking
+  int64_t startTime = esp_timer_get_time();
+  endTime = profile.duration == portMAX_DELAY ? INT64_MAX : startTime + (int64_t)profile.duration * portTICK_PERIOD_MS * 1000;
+  nextRequestIndex = 0;
+  nextScheduledTime = startTime;
+  stopRequested = false;
+  runTaskHandle = xTaskGetCurrentTaskHandle();
+  size_t numberOfStartedClients = 0;
+  for (auto& client : clients) {
+    if (xTaskCreatePinnedToCore(TaskCode, "pl_http_load", taskParameters.stackDepth, client.get(), taskParameters.priority, NULL,
+                                taskParameters.coreId) != pdPASS) {
+      stopRequested = true;
+      break;
+    }
+    numberOfStartedClients++;
+  }
+  // Each client task notifies the run task once when it is done
+  for (size_t i = 0; i < numberOfStartedClients; i++)
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+  int64_t duration = esp_timer_get_time() - startTime;
+  ESP_RETURN_ON_FALSE(numberOfStartedClients == clients.size(), ESP_ERR_NO_MEM, TAG, "task create failed");
+
+  latencyHistogram.Reset();
+  statistics = {};
+  for (auto& client : clients) {
+    latencyHistogram.Merge(client->latencyHistogram);
+    statistics.numberOfRequests += client->statistics.numberOfRequests;
+    statistics.numberOfErrors += client->statistics.numberOfErrors;
+    statistics.numberOfClientErrors += client->statistics.numberOfClientErrors;
+    statistics.numberOfServerErrors += client->statistics.numberOfServerErrors;
+    statistics.numberOfConnections += client->statistics.numberOfConnections;
+  }
+  statistics.duration = duration;
+  statistics.throughput = duration ? statistics.numberOfRequests * 1000000.0f / duration : 0;
+  statistics.medianLatency = latencyHistogram.GetPercentile(50);
+  statistics.p90Latency = latencyHistogram.GetPercentile(90);
+  statistics.p99Latency = latencyHistogram.GetPercentile(99);
+  statistics.p999Latency = latencyHistogram.GetPercentile(99.9);
+  statistics.maxLatency = latencyHistogram.GetMax();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpLatencyHistogram HttpLoadGenerator::GetLatencyHistogram() {
+  LockGuard lg(*this);
+  return latencyHistogram;
+}
+
+//==============================================================================
+
+void HttpLoadGenerator::TaskCode(void* parameters) {
+  Client& client = *(Client*)parameters;
+  HttpLoadGenerator& generator = client.generator;
+  generator.RunClient(client);
+  xTaskNotifyGive(generator.runTaskHandle);
+  vTaskDelete(NULL);
+}
+
+//==============================================================================
+
+void HttpLoadGenerator::RunClient(Client& client) {
+  size_t index;
+  int64_t scheduledTime;
+  while (ClaimRequest(index, scheduledTime)) {
+    // An open-loop request that is late because all clients have been busy keeps its scheduled time, so the latency includes the wait.
+    // An early one waits for its time and the latency is counted from the actual start: the tick rounding of the delay is not included.
+    int64_t time = esp_timer_get_time();
+    if (scheduledTime > time) {
+      int64_t tickTime = portTICK_PERIOD_MS * 1000;
+      vTaskDelay((scheduledTime - time + tickTime - 1) / tickTime);
+      scheduledTime = esp_timer_get_time();
+    }
+    SendRequest(client, SelectRequest(index));
+    client.latencyHistogram.Record(esp_timer_get_time() - scheduledTime);
+    client.statistics.numberOfRequests++;
+    if (profile.mode == HttpLoadMode::closedLoop && profile.thinkTime)
+      vTaskDelay(profile.thinkTime);
+  }
+}
+
+//==============================================================================
+
+bool HttpLoadGenerator::ClaimRequest(size_t& index, int64_t& scheduledTime) {
+  LockGuard lg(scheduleMutex);
+  if (stopRequested || (profile.numberOfRequests && nextRequestIndex >= profile.numberOfRequests))
+    return false;
+  if (profile.mode == HttpLoadMode::openLoop) {
+    // Exponentially distributed intervals between the requests make a Poisson arrival process
+    double random = (Hash(((uint64_t)profile.seed << 32) ^ (2 * nextRequestIndex + 1)) >> 11) * 0x1.0p-53;
+    nextScheduledTime -= log1p(-random) * 1000000 / profile.requestRate;
+    scheduledTime = nextScheduledTime;
+  }
+  else
+    scheduledTime = esp_timer_get_time();
+  if (scheduledTime >= endTime)
+    return false;
+  index = nextRequestIndex++;
+  return true;
+}
+
+//==============================================================================
+
+esp_err_t HttpLoadGenerator::SendRequest(Client& client, const HttpLoadRequest& request) {
+  ushort statusCode;
+  esp_err_t error = client.client.SendRequest(request.method, request.uri, request.body, statusCode, NULL);
+  // The body is read to the end, so that the connection can be reused
+  size_t size;
+  while (error == ESP_OK && (error = client.client.ReadResponseBody(client.responseBody, sizeof(client.responseBody), size)) == ESP_OK && size);
+  if (client.client.GetTimings().connectTime)
+    client.statistics.numberOfConnections++;
+
+  if (error != ESP_OK) {
+    client.statistics.numberOfErrors++;
+    client.client.Disconnect();
+    return error;
+  }
+  if (statusCode >= 500)
+    client.statistics.numberOfServerErrors++;
+  else if (statusCode >= 400)
+    client.statistics.numberOfClientErrors++;
+  if (!profile.reuseConnections)
+    client.client.Disconnect();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+const HttpLoadRequest& HttpLoadGenerator::SelectRequest(size_t index) {
+  // The request of each index is fixed by the seed whichever client sends it
+  uint64_t random = Hash(((uint64_t)profile.seed << 32) ^ (2 * index)) % totalWeight;
+  for (auto& request : requests) {
+    if (random < request.weight)
+      return request;
+    random -= request.weight;
+  }
+  return requests.back();
+}
+
+//==============================================================================
+
+uint64_t HttpLoadGenerator::Hash(uint64_t value) {
+  // SplitMix64 finalizer
+  value += 0x9E3779B97F4A7C15;
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+  return value ^ (value >> 31);
+}
+
+//==============================================================================
+
+}
@@ -0,0 +1,91 @@
+#include "pl_http_middleware.h"
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+HttpServerTransactionFilter::HttpServerTransactionFilter(HttpServerTransaction& transaction) : transaction(transaction) {}
+
+//==============================================================================
+
+std::shared_ptr<NetworkStream> HttpServerTransactionFilter::GetNetworkStream() {
+  return transaction.GetNetworkStream();
+}
+
+//==============================================================================
+
+esp_err_t HttpServerTransactionFilter::ReadRequestBody(void* dest, size_t size) {
+  return transaction.ReadRequestBody(dest, size);
+}
+
+//==============================================================================
+
+esp_err_t HttpServerTransactionFilter::WriteResponse(uint16_t statusCode, const void* body, size_t bodySize) {
+  return transaction.WriteResponse(statusCode, body, bodySize);
+}
+
+//==============================================================================
+
+esp_err_t HttpServerTransactionFilter::WriteResponseHeaders(uint16_t statusCode) {
+  return transaction.WriteResponseHeaders(statusCode);
+}
+
+//==============================================================================
+
+esp_err_t HttpServerTransactionFilter::WriteResponseBody(const void* src, size_t size) {
+  return transaction.WriteResponseBody(src, size);
+}
+
+//==============================================================================
+
+esp_err_t HttpServerTransactionFilter::EndResponseBody() {
+  return transaction.EndResponseBody();
+}
+
+//==============================================================================
+
+HttpMethod HttpServerTransactionFilter::GetRequestMethod() {
+  return transaction.GetRequestMethod();
+}
+
+//==============================================================================
+
+esp_err_t HttpServerTransactionFilter::GetRequestUri(std::string& uri) {
+  return transaction.GetRequestUri(uri);
+}
+
+//==============================================================================
+
+esp_err_t HttpServerTransactionFilter::GetRequestHeader(const std::string& name, std::string& value) {
+  return transaction.GetRequestHeader(name, value);
+}
+
+//==============================================================================
+
+size_t HttpServerTransactionFilter::GetRequestBodySize() {
+  return transaction.GetRequestBodySize();
+}
+
+//==============================================================================
+
+HttpArena& HttpServerTransactionFilter::GetArena() {
+  return transaction.GetArena();
+}
+
+//==============================================================================
+
+TickType_t HttpServerTransactionFilter::GetRemainingTime() {
+  return transaction.GetRemainingTime();
+}
+
+//==============================================================================
+
+esp_err_t HttpServerTransactionFilter::SetResponseHeader(const std::string& name, const std::string& value) {
+  return transaction.SetResponseHeader(name, value);
+}
+
+//==============================================================================
+
+}
@@ -0,0 +1,1127 @@
+#include "pl_http_payload.h"
+#include "esp_check.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+//==============================================================================
+
+static const char* TAG = "pl_http_payload";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+static const char* const contentTypes[] = {"application/json", "application/cbor", "application/msgpack"};
+
+//==============================================================================
+
+static std::string_view Trim(std::string_view string) {
+  size_t start = string.find_first_not_of(" \t");
+  if (start == std::string_view::npos)
+    return std::string_view();
+  return string.substr(start, string.find_last_not_of(" \t") - start + 1);
+}
+
+//==============================================================================
+
+static bool EqualsIgnoreCase(std::string_view string1, std::string_view string2) {
+  return string1.size() == string2.size() && strncasecmp(string1.data(), string2.data(), string1.size()) == 0;
+}
+
+//==============================================================================
+
+static bool EndsWithIgnoreCase(std::string_view string, std::string_view suffix) {
+  return string.size() >= suffix.size() && EqualsIgnoreCase(string.substr(string.size() - suffix.size()), suffix);
+}
+
+//==============================================================================
+
+static esp_err_t GetMediaTypeFormat(std::string_view mediaType, HttpPayloadFormat& format) {
+  if (EqualsIgnoreCase(mediaType, "application/json") || EndsWithIgnoreCase(mediaType, "+json"))
+    format = HttpPayloadFormat::json;
+  else if (EqualsIgnoreCase(mediaType, "application/cbor") || EndsWithIgnoreCase(mediaType, "+cbor"))
+    format = HttpPayloadFormat::cbor;
+  else if (EqualsIgnoreCase(mediaType, "application/msgpack") || EqualsIgnoreCase(mediaType, "application/x-msgpack") ||
+           EqualsIgnoreCase(mediaType, "application/vnd.msgpack"))
+    format = HttpPayloadFormat::messagePack;
+  else
+    return ESP_ERR_NOT_SUPPORTED;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+static uint8_t* AllocateBuffer(HttpServerTransaction& transaction, size_t size, std::unique_ptr<uint8_t[]>& heapBuffer) {
+  // The buffer is taken from the connection arena, so a transaction on an open connection does not allocate heap memory
+  uint8_t* buffer = (uint8_t*)transaction.GetArena().Allocate(size, 1);
+  if (!buffer) {
+    heapBuffer.reset(new (std::nothrow) uint8_t[size]);
+    buffer = heapBuffer.get();
+  }
+  return buffer;
+}
+
+//==============================================================================
+
+HttpPayloadWriter::HttpPayloadWriter(HttpServerTransaction& transaction, size_t bufferSize) :
+    HttpPayloadWriter(transaction, HttpPayloadFormat::json, bufferSize) {
+  std::string accept;
+  if (transaction.GetRequestHeader("Accept", accept) == ESP_OK)
+    format = SelectFormat(accept);
+  formatNegotiated = true;
+}
+
+//==============================================================================
+
+HttpPayloadWriter::HttpPayloadWriter(HttpServerTransaction& transaction, HttpPayloadFormat format, size_t bufferSize) :
+    transaction(transaction), format(format), formatNegotiated(false), buffer(AllocateBuffer(transaction, bufferSize, heapBuffer)),
+    bufferSize(buffer ? bufferSize : 0) {}
+
+//==============================================================================
+
+HttpPayloadFormat HttpPayloadWriter::SelectFormat(std::string_view accept) {
+  HttpPayloadFormat selectedFormat = HttpPayloadFormat::json;
+  float selectedQuality = 0;
+  while (!accept.empty()) {
+    size_t mediaRangeEnd = std::min(accept.find(','), accept.size());
+    std::string_view mediaRange = accept.substr(0, mediaRangeEnd);
+    accept.remove_prefix(std::min(mediaRangeEnd + 1, accept.size()));
+
+    size_t parameterStart = std::min(mediaRange.find(';'), mediaRange.size());
+    std::string_view mediaType = Trim(mediaRange.substr(0, parameterStart));
+    float quality = 1;
+    while (parameterStart < mediaRange.size()) {
+      size_t parameterEnd = std::min(mediaRange.find(';', parameterStart + 1), mediaRange.size());
+      std::string_view parameter = Trim(mediaRange.substr(parameterStart + 1, parameterEnd - parameterStart - 1));
+      if (parameter.size() > 2 && parameter.size() < 8 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=') {
+        char qualityString[8] = {};
+        memcpy(qualityString, parameter.data() + 2, parameter.size() - 2);
+        quality = std::min(strtof(qualityString, NULL), 1.0f);
+      }
+      parameterStart = parameterEnd;
+    }
+
+    // Wildcards get JSON. Of the formats with the same quality the first listed one is selected.
+    HttpPayloadFormat format;
+    if (mediaType == "*/*" || EqualsIgnoreCase(mediaType, "application/*"))
+      format = HttpPayloadFormat::json;
+    else if (GetMediaTypeFormat(mediaType, format) != ESP_OK)
+      continue;
+    if (quality > selectedQuality) {
+      selectedFormat = format;
+      selectedQuality = quality;
+    }
+  }
+  return selectedFormat;
+}
+
+//==============================================================================
+
+const char* HttpPayloadWriter::GetContentType(HttpPayloadFormat format) {
+  return contentTypes[(int)format];
+}
+
+//==============================================================================
+
+HttpPayloadFormat HttpPayloadWriter::GetFormat() {
+  return format;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::Begin(uint16_t statusCode) {
+  this->statusCode = statusCode;
+  ESP_RETURN_ON_ERROR(transaction.SetResponseHeader("Content-Type", GetContentType(format)), TAG, "set content type failed");
+  // Caches should not return the response in this format to a client accepting another one
+  if (formatNegotiated)
+    ESP_RETURN_ON_ERROR(transaction.SetResponseHeader("Vary", "Accept"), TAG, "set vary header failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::End() {
+  ESP_RETURN_ON_FALSE(!depth, ESP_ERR_INVALID_STATE, TAG, "map or array is not ended");
+  // The payload that fits in the buffer is sent with the body size instead of chunks
+  if (!headersWritten) {
+    headersWritten = true;
+    ESP_RETURN_ON_ERROR(transaction.WriteResponse(statusCode, buffer, dataSize), TAG, "write response failed");
+    return ESP_OK;
+  }
+  ESP_RETURN_ON_ERROR(Flush(), TAG, "flush failed");
+  ESP_RETURN_ON_ERROR(transaction.EndResponseBody(), TAG, "end response body failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::BeginMap(size_t size) {
+  return BeginContainer(true, size);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::EndMap() {
+  return EndContainer(true);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::BeginArray(size_t size) {
+  return BeginContainer(false, size);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::EndArray() {
+  return EndContainer(false);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteKey(std::string_view key) {
+  ESP_RETURN_ON_FALSE(depth && (mapBits & (1u << (depth - 1))) && !keyWritten, ESP_ERR_INVALID_STATE, TAG, "key is not expected");
+  if (format != HttpPayloadFormat::json)
+    return WriteString(key);
+
+  uint32_t bit = 1u << (depth - 1);
+  if (nonEmptyBits & bit)
+    ESP_RETURN_ON_ERROR(WriteByte(','), TAG, "write failed");
+  nonEmptyBits |= bit;
+  ESP_RETURN_ON_ERROR(WriteJsonString(key), TAG, "write failed");
+  ESP_RETURN_ON_ERROR(WriteByte(':'), TAG, "write failed");
+  keyWritten = true;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteNull() {
+  ESP_RETURN_ON_ERROR(BeginValue(), TAG, "value is not expected");
+  switch (format) {
+    case HttpPayloadFormat::json:
+      return Write("null", 4);
+    case HttpPayloadFormat::cbor:
+      return WriteByte(0xF6);
+    default:
+      return WriteByte(0xC0);
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteBool(bool value) {
+  ESP_RETURN_ON_ERROR(BeginValue(), TAG, "value is not expected");
+  switch (format) {
+    case HttpPayloadFormat::json:
+      return value ? Write("true", 4) : Write("false", 5);
+    case HttpPayloadFormat::cbor:
+      return WriteByte(value ? 0xF5 : 0xF4);
+    default:
+      return WriteByte(value ? 0xC3 : 0xC2);
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteInt(int64_t value) {
+  if (value >= 0)
+    return WriteUInt(value);
+  ESP_RETURN_ON_ERROR(BeginValue(), TAG, "value is not expected");
+  switch (format) {
+    case HttpPayloadFormat::json: {
+      char string[24];
+      return Write(string, snprintf(string, sizeof(string), "%lld", (long long)value));
+    }
+    case HttpPayloadFormat::cbor:
+      // -1 - value
+      return WriteHead(1, ~(uint64_t)value);
+    default:
+      if (value >= -32)
+        return WriteByte((uint8_t)value);
+      if (value >= INT8_MIN)
+        return WriteBigEndian(0xD0, (uint8_t)value, 1);
+      if (value >= INT16_MIN)
+        return WriteBigEndian(0xD1, (uint16_t)value, 2);
+      if (value >= INT32_MIN)
+        return WriteBigEndian(0xD2, (uint32_t)value, 4);
+      return WriteBigEndian(0xD3, (uint64_t)value, 8);
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteUInt(uint64_t value) {
+  ESP_RETURN_ON_ERROR(BeginValue(), TAG, "value is not expected");
+  switch (format) {
+    case HttpPayloadFormat::json: {
+      char string[24];
+      return Write(string, snprintf(string, sizeof(string), "%llu", (unsigned long long)value));
+    }
+    case HttpPayloadFormat::cbor:
+      return WriteHead(0, value);
+    default:
+      if (value < 0x80)
+        return WriteByte(value);
+      if (value <= UINT8_MAX)
+        return WriteBigEndian(0xCC, value, 1);
+      if (value <= UINT16_MAX)
+        return WriteBigEndian(0xCD, value, 2);
+      if (value <= UINT32_MAX)
+        return WriteBigEndian(0xCE, value, 4);
+      return WriteBigEndian(0xCF, value, 8);
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteDouble(double value) {
+  if (format == HttpPayloadFormat::json && !isfinite(value))
+    return WriteNull();
+  ESP_RETURN_ON_ERROR(BeginValue(), TAG, "value is not expected");
+  if (format == HttpPayloadFormat::json) {
+    // The shortest of the two representations that reads back as the same number
+    char string[32];
+    int size = snprintf(string, sizeof(string), "%.15g", value);
+    if (strtod(string, NULL) != value)
+      size = snprintf(string, sizeof(string), "%.17g", value);
+    return Write(string, size);
+  }
+
+  float singleValue = (float)value;
+  if ((double)singleValue == value || isnan(value)) {
+    uint32_t bits;
+    memcpy(&bits, &singleValue, sizeof(bits));
+    return WriteBigEndian(format == HttpPayloadFormat::cbor ? 0xFA : 0xCA, bits, 4);
+  }
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return WriteBigEndian(format == HttpPayloadFormat::cbor ? 0xFB : 0xCB, bits, 8);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteString(std::string_view value) {
+  ESP_RETURN_ON_ERROR(BeginValue(), TAG, "value is not expected");
+  switch (format) {
+    case HttpPayloadFormat::json:
+      return WriteJsonString(value);
+    case HttpPayloadFormat::cbor:
+      ESP_RETURN_ON_ERROR(WriteHead(3, value.size()), TAG, "write failed");
+      break;
+    default:
+      if (value.size() < 32)
+        ESP_RETURN_ON_ERROR(WriteByte(0xA0 | value.size()), TAG, "write failed");
+      else if (value.size() <= UINT8_MAX)
+        ESP_RETURN_ON_ERROR(WriteBigEndian(0xD9, value.size(), 1), TAG, "write failed");
+      else if (value.size() <= UINT16_MAX)
+        ESP_RETURN_ON_ERROR(WriteBigEndian(0xDA, value.size(), 2), TAG, "write failed");
+      else
+        ESP_RETURN_ON_ERROR(WriteBigEndian(0xDB, value.size(), 4), TAG, "write failed");
+      break;
+  }
+  return Write(value.data(), value.size());
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteBinary(const void* data, size_t size) {
+  ESP_RETURN_ON_ERROR(BeginValue(), TAG, "value is not expected");
+  switch (format) {
+    case HttpPayloadFormat::json: {
+      static const char base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+      const uint8_t* src = (const uint8_t*)data;
+      char encoded[64];
+      size_t encodedSize = 0;
+      encoded[encodedSize++] = '"';
+      for (size_t i = 0; i < size; i += 3) {
+        uint32_t group = src[i] << 16 | (i + 1 < size ? src[i + 1] << 8 : 0) | (i + 2 < size ? src[i + 2] : 0);
+        encoded[encodedSize++] = base64Digits[group >> 18];
+        encoded[encodedSize++] = base64Digits[(group >> 12) & 0x3F];
+        encoded[encodedSize++] = i + 1 < size ? base64Digits[(group >> 6) & 0x3F] : '=';
+        encoded[encodedSize++] = i + 2 < size ? base64Digits[group & 0x3F] : '=';
+        if (encodedSize > sizeof(encoded) - 4) {
+          ESP_RETURN_ON_ERROR(Write(encoded, encodedSize), TAG, "write failed");
+          encodedSize = 0;
+        }
+      }
+      encoded[encodedSize++] = '"';
+      return Write(encoded, encodedSize);
+    }
+    case HttpPayloadFormat::cbor:
+      ESP_RETURN_ON_ERROR(WriteHead(2, size), TAG, "write failed");
+      break;
+    default:
+      if (size <= UINT8_MAX)
+        ESP_RETURN_ON_ERROR(WriteBigEndian(0xC4, size, 1), TAG, "write failed");
+      else if (size <= UINT16_MAX)
+        ESP_RETURN_ON_ERROR(WriteBigEndian(0xC5, size, 2), TAG, "write failed");
+      else
+        ESP_RETURN_ON_ERROR(WriteBigEndian(0xC6, size, 4), TAG, "write failed");
+      break;
+  }
+  return Write(data, size);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::BeginValue() {
+  if (format != HttpPayloadFormat::json || !depth)
+    return ESP_OK;
+  uint32_t bit = 1u << (depth - 1);
+  if (mapBits & bit) {
+    ESP_RETURN_ON_FALSE(keyWritten, ESP_ERR_INVALID_STATE, TAG, "key is expected");
+    keyWritten = false;
+    return ESP_OK;
+  }
+  if (nonEmptyBits & bit)
+    ESP_RETURN_ON_ERROR(WriteByte(','), TAG, "write failed");
+  nonEmptyBits |= bit;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::BeginContainer(bool map, size_t size) {
+  ESP_RETURN_ON_FALSE(depth < maxDepth, ESP_ERR_INVALID_SIZE, TAG, "nesting is too deep");
+  ESP_RETURN_ON_FALSE(format != HttpPayloadFormat::messagePack || size != SIZE_MAX, ESP_ERR_NOT_SUPPORTED, TAG, "MessagePack size is unknown");
+  ESP_RETURN_ON_ERROR(BeginValue(), TAG, "value is not expected");
+  switch (format) {
+    case HttpPayloadFormat::json:
+      ESP_RETURN_ON_ERROR(WriteByte(map ? '{' : '['), TAG, "write failed");
+      break;
+    case HttpPayloadFormat::cbor:
+      // Indefinite-length map or array ended with a break
+      if (size == SIZE_MAX)
+        ESP_RETURN_ON_ERROR(WriteByte(map ? 0xBF : 0x9F), TAG, "write failed");
+      else
+        ESP_RETURN_ON_ERROR(WriteHead(map ? 5 : 4, size), TAG, "write failed");
+      break;
+    default:
+      if (size < 16)
+        ESP_RETURN_ON_ERROR(WriteByte((map ? 0x80 : 0x90) | size), TAG, "write failed");
+      else if (size <= UINT16_MAX)
+        ESP_RETURN_ON_ERROR(WriteBigEndian(map ? 0xDE : 0xDC, size, 2), TAG, "write failed");
+      else
+        ESP_RETURN_ON_ERROR(WriteBigEndian(map ? 0xDF : 0xDD, size, 4), TAG, "write failed");
+      break;
+  }
+
+  uint32_t bit = 1u << depth;
+  mapBits = map ? mapBits | bit : mapBits & ~bit;
+  nonEmptyBits &= ~bit;
+  indefiniteBits = size == SIZE_MAX ? indefiniteBits | bit : indefiniteBits & ~bit;
+  depth++;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::EndContainer(bool map) {
+  ESP_RETURN_ON_FALSE(depth && ((mapBits >> (depth - 1)) & 1) == map && !keyWritten, ESP_ERR_INVALID_STATE, TAG, "%s is not expected", map ? "map end" : "array end");
+  depth--;
+  if (format == HttpPayloadFormat::json)
+    return WriteByte(map ? '}' : ']');
+  if (format == HttpPayloadFormat::cbor && (indefiniteBits & (1u << depth)))
+    return WriteByte(0xFF);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::Write(const void* src, size_t size) {
+  ESP_RETURN_ON_FALSE(buffer, ESP_ERR_NO_MEM, TAG, "buffer allocation failed");
+  while (size) {
+    if (dataSize == bufferSize)
+      ESP_RETURN_ON_ERROR(Flush(), TAG, "flush failed");
+    size_t partSize = std::min(size, bufferSize - dataSize);
+    memcpy(buffer + dataSize, src, partSize);
+    dataSize += partSize;
+    src = (const uint8_t*)src + partSize;
+    size -= partSize;
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteByte(uint8_t value) {
+  return Write(&value, 1);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteHead(uint8_t majorType, uint64_t value) {
+  uint8_t type = majorType << 5;
+  if (value < 24)
+    return WriteByte(type | value);
+  if (value <= UINT8_MAX)
+    return WriteBigEndian(type | 24, value, 1);
+  if (value <= UINT16_MAX)
+    return WriteBigEndian(type | 25, value, 2);
+  if (value <= UINT32_MAX)
+    return WriteBigEndian(type | 26, value, 4);
+  return WriteBigEndian(type | 27, value, 8);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteBigEndian(uint8_t type, uint64_t value, size_t size) {
+  uint8_t data[9] = {type};
+  for (size_t i = size; i > 0; i--, value >>= 8)
+    data[i] = (uint8_t)value;
+  return Write(data, size + 1);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::WriteJsonString(std::string_view value) {
+  ESP_RETURN_ON_ERROR(WriteByte('"'), TAG, "write failed");
+  // The characters that need no escaping are copied in runs
+  size_t runStart = 0;
+  for (size_t i = 0; i < value.size(); i++) {
+    uint8_t c = value[i];
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    ESP_RETURN_ON_ERROR(Write(value.data() + runStart, i - runStart), TAG, "write failed");
+    runStart = i + 1;
+    char escape[8];
+    const char* shortEscape = c == '"' ? "\\\"" : c == '\\' ? "\\\\" : c == '\n' ? "\\n" : c == '\r' ? "\\r" : c == '\t' ? "\\t" : NULL;
+    if (shortEscape)
+      ESP_RETURN_ON_ERROR(Write(shortEscape, 2), TAG, "write failed");
+    else
+      ESP_RETURN_ON_ERROR(Write(escape, snprintf(escape, sizeof(escape), "\\u%04x", c)), TAG, "write failed");
+  }
+  ESP_RETURN_ON_ERROR(Write(value.data() + runStart, value.size() - runStart), TAG, "write failed");
+  return WriteByte('"');
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadWriter::Flush() {
+  if (!headersWritten) {
+    headersWritten = true;
+    ESP_RETURN_ON_ERROR(transaction.WriteResponseHeaders(statusCode), TAG, "write response headers failed");
+  }
+  if (dataSize)
+    ESP_RETURN_ON_ERROR(transaction.WriteResponseBody(buffer, dataSize), TAG, "write response body failed");
+  dataSize = 0;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpPayloadReader::HttpPayloadReader(HttpServerTransaction& transaction, size_t bufferSize) :
+    HttpPayloadReader(transaction, HttpPayloadFormat::json, bufferSize) {
+  std::string contentType;
+  if (transaction.GetRequestHeader("Content-Type", contentType) == ESP_OK)
+    formatError = GetFormat(contentType, format);
+}
+
+//==============================================================================
+
+HttpPayloadReader::HttpPayloadReader(HttpServerTransaction& transaction, HttpPayloadFormat format, size_t bufferSize) :
+    transaction(transaction), format(format), buffer(AllocateBuffer(transaction, bufferSize, heapBuffer)), bufferSize(buffer ? bufferSize : 0),
+    bodyRemainingSize(transaction.GetRequestBodySize()) {}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::GetFormat(std::string_view contentType, HttpPayloadFormat& format) {
+  return GetMediaTypeFormat(Trim(contentType.substr(0, contentType.find(';'))), format);
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::GetFormat(HttpPayloadFormat& format) {
+  format = this->format;
+  return formatError;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::Read(HttpPayloadValue& value) {
+  ESP_RETURN_ON_ERROR(formatError, TAG, "content type is not supported");
+  ESP_RETURN_ON_FALSE(buffer, ESP_ERR_NO_MEM, TAG, "buffer allocation failed");
+  value = {};
+  value.size = SIZE_MAX;
+  if (format == HttpPayloadFormat::json)
+    return ReadJson(value);
+
+  // The end of a map or an array of known size is reported when its last item has been read
+  if (depth && !remainingItems[depth - 1]) {
+    EndContainer(value);
+    return ESP_OK;
+  }
+  // The payload is a single value
+  if (!depth && (valueRead || (dataStart == dataEnd && !bodyRemainingSize)))
+    return ESP_ERR_NOT_FOUND;
+
+  esp_err_t error = format == HttpPayloadFormat::cbor ? ReadCbor(value) : ReadMessagePack(value);
+  if (error != ESP_OK || value.type == HttpPayloadValueType::mapEnd || value.type == HttpPayloadValueType::arrayEnd)
+    return error;
+
+  if (depth && remainingItems[depth - 1] != SIZE_MAX)
+    remainingItems[depth - 1]--;
+  // In an indefinite-length map the key bit is set between the key and the value
+  else if (depth)
+    keyBits ^= 1u << (depth - 1);
+  if (!depth)
+    valueRead = true;
+  if (value.type == HttpPayloadValueType::mapStart || value.type == HttpPayloadValueType::arrayStart)
+    return BeginContainer(value.type == HttpPayloadValueType::mapStart, value.size);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::SkipContainer() {
+  ESP_RETURN_ON_FALSE(depth, ESP_ERR_INVALID_STATE, TAG, "not in a map or an array");
+  size_t containerDepth = depth;
+  HttpPayloadValue value;
+  while (depth >= containerDepth)
+    ESP_RETURN_ON_ERROR(Read(value), TAG, "read failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::Fill(size_t size) {
+  if (dataEnd - dataStart >= size)
+    return ESP_OK;
+  // Invalid payloads are not logged: they come from the network
+  if (size > bufferSize)
+    return ESP_ERR_INVALID_SIZE;
+  if (dataStart) {
+    memmove(buffer, buffer + dataStart, dataEnd - dataStart);
+    dataEnd -= dataStart;
+    dataStart = 0;
+  }
+  size_t readSize = std::min(bufferSize - dataEnd, bodyRemainingSize);
+  if (dataEnd + readSize < size)
+    return ESP_ERR_INVALID_RESPONSE;
+  ESP_RETURN_ON_ERROR(transaction.ReadRequestBody(buffer + dataEnd, readSize), TAG, "read request body failed");
+  dataEnd += readSize;
+  bodyRemainingSize -= readSize;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::ReadBytes(size_t size, const uint8_t*& data) {
+  esp_err_t error = Fill(size);
+  if (error != ESP_OK)
+    return error;
+  data = buffer + dataStart;
+  dataStart += size;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::ReadBigEndian(size_t size, uint64_t& value) {
+  const uint8_t* data;
+  esp_err_t error = ReadBytes(size, data);
+  if (error != ESP_OK)
+    return error;
+  value = 0;
+  for (size_t i = 0; i < size; i++)
+    value = value << 8 | data[i];
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::ReadCbor(HttpPayloadValue& value) {
+  while (true) {
+    const uint8_t* data;
+    esp_err_t error = ReadBytes(1, data);
+    if (error != ESP_OK)
+      return error;
+    uint8_t majorType = *data >> 5;
+    uint8_t additionalInfo = *data & 0x1F;
+
+    if (*data == 0xFF) {
+      // Break ends an indefinite-length map or array
+      if (!depth || remainingItems[depth - 1] != SIZE_MAX || ((mapBits & keyBits) & (1u << (depth - 1))))
+        return ESP_ERR_INVALID_RESPONSE;
+      EndContainer(value);
+      return ESP_OK;
+    }
+
+    uint64_t argument = additionalInfo;
+    if (additionalInfo >= 24 && additionalInfo <= 27) {
+      if ((error = ReadBigEndian(1 << (additionalInfo - 24), argument)) != ESP_OK)
+        return error;
+    }
+    else if (additionalInfo == 31 && (majorType == 4 || majorType == 5))
+      argument = SIZE_MAX;
+    else if (additionalInfo >= 24 && majorType != 7)
+      return additionalInfo == 31 && (majorType == 2 || majorType == 3) ? ESP_ERR_NOT_SUPPORTED : ESP_ERR_INVALID_RESPONSE;
+
+    switch (majorType) {
+      case 0:
+        SetUnsignedInteger(value, argument);
+        return ESP_OK;
+      case 1:
+        if (argument > INT64_MAX)
+          return ESP_ERR_NOT_SUPPORTED;
+        SetInteger(value, -1 - (int64_t)argument);
+        return ESP_OK;
+      case 2:
+      case 3:
+        if (argument > bufferSize)
+          return ESP_ERR_INVALID_SIZE;
+        if ((error = ReadBytes(argument, data)) != ESP_OK)
+          return error;
+        value.type = majorType == 2 ? HttpPayloadValueType::binary : HttpPayloadValueType::string;
+        value.string = std::string_view((const char*)data, argument);
+        return ESP_OK;
+      case 4:
+      case 5:
+        if (argument != SIZE_MAX && argument > SIZE_MAX / 2)
+          return ESP_ERR_INVALID_RESPONSE;
+        value.type = majorType == 5 ? HttpPayloadValueType::mapStart : HttpPayloadValueType::arrayStart;
+        value.size = argument;
+        return ESP_OK;
+      case 6:
+        // Tags are ignored: the tagged item is read
+        continue;
+      default:
+        switch (additionalInfo) {
+          case 20:
+          case 21:
+            value.type = HttpPayloadValueType::boolean;
+            value.boolean = additionalInfo == 21;
+            return ESP_OK;
+          case 22:
+          case 23:
+            value.type = HttpPayloadValueType::null;
+            return ESP_OK;
+          case 25: {
+            // Half-precision float
+            int exponent = (argument >> 10) & 0x1F;
+            double mantissa = argument & 0x3FF;
+            double halfValue = exponent == 0 ? ldexp(mantissa, -24) : exponent != 31 ? ldexp(mantissa + 1024, exponent - 25) : mantissa == 0 ? INFINITY : NAN;
+            value.type = HttpPayloadValueType::floatingPoint;
+            value.floatingPoint = argument & 0x8000 ? -halfValue : halfValue;
+            return ESP_OK;
+          }
+          case 26: {
+            uint32_t bits = argument;
+            float singleValue;
+            memcpy(&singleValue, &bits, sizeof(singleValue));
+            value.type = HttpPayloadValueType::floatingPoint;
+            value.floatingPoint = singleValue;
+            return ESP_OK;
+          }
+          case 27:
+            value.type = HttpPayloadValueType::floatingPoint;
+            memcpy(&value.floatingPoint, &argument, sizeof(value.floatingPoint));
+            return ESP_OK;
+          default:
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::ReadMessagePack(HttpPayloadValue& value) {
+  const uint8_t* data;
+  esp_err_t error = ReadBytes(1, data);
+  if (error != ESP_OK)
+    return error;
+  uint8_t type = *data;
+  uint64_t argument;
+
+  if (type < 0x80 || type >= 0xE0) {
+    SetInteger(value, (int8_t)type);
+    return ESP_OK;
+  }
+  if (type < 0xA0) {
+    value.type = type < 0x90 ? HttpPayloadValueType::mapStart : HttpPayloadValueType::arrayStart;
+    value.size = type & 0x0F;
+    return ESP_OK;
+  }
+  size_t stringSize = type & 0x1F;
+  value.type = HttpPayloadValueType::string;
+  switch (type) {
+    case 0xC0:
+      value.type = HttpPayloadValueType::null;
+      return ESP_OK;
+    case 0xC2:
+    case 0xC3:
+      value.type = HttpPayloadValueType::boolean;
+      value.boolean = type == 0xC3;
+      return ESP_OK;
+    case 0xC4:
+    case 0xC5:
+    case 0xC6:
+      if ((error = ReadBigEndian(1 << (type - 0xC4), argument)) != ESP_OK)
+        return error;
+      value.type = HttpPayloadValueType::binary;
+      stringSize = argument;
+      break;
+    case 0xCA:
+    case 0xCB: {
+      if ((error = ReadBigEndian(type == 0xCA ? 4 : 8, argument)) != ESP_OK)
+        return error;
+      value.type = HttpPayloadValueType::floatingPoint;
+      if (type == 0xCA) {
+        uint32_t bits = argument;
+        float singleValue;
+        memcpy(&singleValue, &bits, sizeof(singleValue));
+        value.floatingPoint = singleValue;
+      }
+      else
+        memcpy(&value.floatingPoint, &argument, sizeof(value.floatingPoint));
+      return ESP_OK;
+    }
+    case 0xCC:
+    case 0xCD:
+    case 0xCE:
+    case 0xCF:
+      if ((error = ReadBigEndian(1 << (type - 0xCC), argument)) != ESP_OK)
+        return error;
+      SetUnsignedInteger(value, argument);
+      return ESP_OK;
+    case 0xD0:
+    case 0xD1:
+    case 0xD2:
+    case 0xD3: {
+      size_t size = 1 << (type - 0xD0);
+      if ((error = ReadBigEndian(size, argument)) != ESP_OK)
+        return error;
+      // Sign extension
+      int shift = 64 - size * 8;
+      SetInteger(value, shift ? (int64_t)(argument << shift) >> shift : (int64_t)argument);
+      return ESP_OK;
+    }
+    case 0xD9:
+    case 0xDA:
+    case 0xDB:
+      if ((error = ReadBigEndian(1 << (type - 0xD9), argument)) != ESP_OK)
+        return error;
+      stringSize = argument;
+      break;
+    case 0xDC:
+    case 0xDD:
+    case 0xDE:
+    case 0xDF:
+      if ((error = ReadBigEndian(type == 0xDC || type == 0xDE ? 2 : 4, argument)) != ESP_OK)
+        return error;
+      value.type = type < 0xDE ? HttpPayloadValueType::arrayStart : HttpPayloadValueType::mapStart;
+      value.size = argument;
+      return ESP_OK;
+    default:
+      // Extension types
+      if (type >= 0xC1 && type < 0xD9)
+        return ESP_ERR_NOT_SUPPORTED;
+      break;
+  }
+
+  if (stringSize > bufferSize)
+    return ESP_ERR_INVALID_SIZE;
+  if ((error = ReadBytes(stringSize, data)) != ESP_OK)
+    return error;
+  value.string = std::string_view((const char*)data, stringSize);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::ReadJson(HttpPayloadValue& value) {
+  uint8_t c;
+  esp_err_t error = SkipJsonWhitespace(c);
+  // The payload is a single value: only whitespace can follow it
+  if (!depth && valueRead)
+    return error == ESP_ERR_NOT_FOUND ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_RESPONSE;
+  if (error != ESP_OK)
+    return error == ESP_ERR_NOT_FOUND && depth ? ESP_ERR_INVALID_RESPONSE : error;
+
+  if (depth) {
+    uint32_t bit = 1u << (depth - 1);
+    bool map = mapBits & bit;
+    if (keyBits & bit) {
+      // The colon is read with the value, since reading more data can move the key in the buffer
+      if (c != ':')
+        return ESP_ERR_INVALID_RESPONSE;
+      dataStart++;
+      if ((error = SkipJsonWhitespace(c)) != ESP_OK)
+        return error == ESP_ERR_NOT_FOUND ? ESP_ERR_INVALID_RESPONSE : error;
+      keyBits &= ~bit;
+    }
+    else {
+      if (c == (map ? '}' : ']')) {
+        dataStart++;
+        EndContainer(value);
+        return ESP_OK;
+      }
+      if (nonEmptyBits & bit) {
+        if (c != ',')
+          return ESP_ERR_INVALID_RESPONSE;
+        dataStart++;
+        if ((error = SkipJsonWhitespace(c)) != ESP_OK)
+          return error == ESP_ERR_NOT_FOUND ? ESP_ERR_INVALID_RESPONSE : error;
+      }
+      nonEmptyBits |= bit;
+      if (map) {
+        if (c != '"')
+          return ESP_ERR_INVALID_RESPONSE;
+        keyBits |= bit;
+        return ReadJsonString(value);
+      }
+    }
+  }
+  else
+    valueRead = true;
+
+  switch (c) {
+    case '{':
+    case '[':
+      dataStart++;
+      value.type = c == '{' ? HttpPayloadValueType::mapStart : HttpPayloadValueType::arrayStart;
+      return BeginContainer(c == '{', SIZE_MAX);
+    case '"':
+      return ReadJsonString(value);
+    case 't':
+    case 'f':
+    case 'n': {
+      const char* literal = c == 't' ? "true" : c == 'f' ? "false" : "null";
+      size_t literalSize = strlen(literal);
+      const uint8_t* data;
+      if ((error = ReadBytes(literalSize, data)) != ESP_OK || memcmp(data, literal, literalSize) != 0)
+        return error == ESP_ERR_INVALID_SIZE ? error : ESP_ERR_INVALID_RESPONSE;
+      value.type = c == 'n' ? HttpPayloadValueType::null : HttpPayloadValueType::boolean;
+      value.boolean = c == 't';
+      return ESP_OK;
+    }
+    default:
+      return ReadJsonNumber(value);
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::ReadJsonString(HttpPayloadValue& value) {
+  // The whole string is received first: it is unescaped in place, since an escaped string is never shorter
+  size_t end = 1;
+  bool escape = false;
+  while (true) {
+    for (; dataStart + end < dataEnd; end++) {
+      uint8_t c = buffer[dataStart + end];
+      if (escape)
+        escape = false;
+      else if (c == '\\')
+        escape = true;
+      else if (c == '"')
+        break;
+    }
+    if (dataStart + end < dataEnd)
+      break;
+    esp_err_t error = Fill(dataEnd - dataStart + 1);
+    if (error != ESP_OK)
+      return error;
+  }
+
+  uint8_t* src = buffer + dataStart + 1;
+  uint8_t* srcEnd = buffer + dataStart + end;
+  uint8_t* dest = src;
+  uint8_t* string = src;
+  dataStart += end + 1;
+  while (src < srcEnd) {
+    uint8_t c = *(src++);
+    if (c < 0x20)
+      return ESP_ERR_INVALID_RESPONSE;
+    if (c != '\\') {
+      *(dest++) = c;
+      continue;
+    }
+    c = *(src++);
+    switch (c) {
+      case '"': case '\\': case '/': *(dest++) = c; break;
+      case 'b': *(dest++) = '\b'; break;
+      case 'f': *(dest++) = '\f'; break;
+      case 'n': *(dest++) = '\n'; break;
+      case 'r': *(dest++) = '\r'; break;
+      case 't': *(dest++) = '\t'; break;
+      case 'u': {
+        uint32_t codePoint = 0;
+        for (int surrogate = 0; surrogate < 2; surrogate++) {
+          uint32_t unit = 0;
+          if (srcEnd - src < 4)
+            return ESP_ERR_INVALID_RESPONSE;
+          for (int i = 0; i < 4; i++) {
+            uint8_t digit = *(src++);
+            unit = unit << 4 | (digit >= '0' && digit <= '9' ? digit - '0' : (digit | 0x20) >= 'a' && (digit | 0x20) <= 'f' ? (digit | 0x20) - 'a' + 10 : 16);
+            if ((digit < '0' || digit > '9') && ((digit | 0x20) < 'a' || (digit | 0x20) > 'f'))
+              return ESP_ERR_INVALID_RESPONSE;
+          }
+          if (!surrogate && unit >= 0xD800 && unit < 0xDC00) {
+            // A high surrogate is followed by a low one
+            if (srcEnd - src < 6 || src[0] != '\\' || src[1] != 'u')
+              return ESP_ERR_INVALID_RESPONSE;
+            src += 2;
+            codePoint = unit;
+            continue;
+          }
+          if (surrogate) {
+            if (unit < 0xDC00 || unit >= 0xE000)
+              return ESP_ERR_INVALID_RESPONSE;
+            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (unit - 0xDC00);
+          }
+          else
+            codePoint = unit;
+          break;
+        }
+        // UTF-8 encoding
+        if (codePoint < 0x80)
+          *(dest++) = codePoint;
+        else if (codePoint < 0x800) {
+          *(dest++) = 0xC0 | codePoint >> 6;
+          *(dest++) = 0x80 | (codePoint & 0x3F);
+        }
+        else if (codePoint < 0x10000) {
+          *(dest++) = 0xE0 | codePoint >> 12;
+          *(dest++) = 0x80 | ((codePoint >> 6) & 0x3F);
+          *(dest++) = 0x80 | (codePoint & 0x3F);
+        }
+        else {
+          *(dest++) = 0xF0 | codePoint >> 18;
+          *(dest++) = 0x80 | ((codePoint >> 12) & 0x3F);
+          *(dest++) = 0x80 | ((codePoint >> 6) & 0x3F);
+          *(dest++) = 0x80 | (codePoint & 0x3F);
+        }
+        break;
+      }
+      default:
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+  }
+  value.type = HttpPayloadValueType::string;
+  value.string = std::string_view((const char*)string, dest - string);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::ReadJsonNumber(HttpPayloadValue& value) {
+  constexpr size_t maxNumberSize = 32;
+  size_t size = 0;
+  bool integer = true;
+  while (true) {
+    for (; dataStart + size < dataEnd; size++) {
+      uint8_t c = buffer[dataStart + size];
+      if (c == '.' || c == 'e' || c == 'E')
+        integer = false;
+      else if ((c < '0' || c > '9') && c != '-' && c != '+')
+        break;
+    }
+    if (dataStart + size < dataEnd || !bodyRemainingSize || size >= maxNumberSize)
+      break;
+    esp_err_t error = Fill(dataEnd - dataStart + 1);
+    if (error != ESP_OK)
+      return error;
+  }
+  if (!size || size >= maxNumberSize)
+    return ESP_ERR_INVALID_RESPONSE;
+
+  char number[maxNumberSize];
+  memcpy(number, buffer + dataStart, size);
+  number[size] = 0;
+  dataStart += size;
+  // JSON numbers have no leading plus sign
+  if (number[0] == '+' || (number[0] == '-' && !number[1]))
+    return ESP_ERR_INVALID_RESPONSE;
+
+  char* end;
+  errno = 0;
+  if (integer && number[0] == '-') {
+    long long integerValue = strtoll(number, &end, 10);
+    if (errno != ERANGE && *end == 0) {
+      SetInteger(value, integerValue);
+      return ESP_OK;
+    }
+  }
+  else if (integer) {
+    unsigned long long unsignedValue = strtoull(number, &end, 10);
+    if (errno != ERANGE && *end == 0) {
+      SetUnsignedInteger(value, unsignedValue);
+      return ESP_OK;
+    }
+  }
+  // Out-of-range integers are read as floating-point numbers
+  value.type = HttpPayloadValueType::floatingPoint;
+  value.floatingPoint = strtod(number, &end);
+  return *end ? ESP_ERR_INVALID_RESPONSE : ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::SkipJsonWhitespace(uint8_t& c) {
+  while (true) {
+    if (dataStart == dataEnd) {
+      if (!bodyRemainingSize)
+        return ESP_ERR_NOT_FOUND;
+      esp_err_t error = Fill(1);
+      if (error != ESP_OK)
+        return error;
+    }
+    c = buffer[dataStart];
+    if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+      return ESP_OK;
+    dataStart++;
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpPayloadReader::BeginContainer(bool map, size_t size) {
+  if (depth == maxDepth)
+    return ESP_ERR_INVALID_SIZE;
+  uint32_t bit = 1u << depth;
+  mapBits = map ? mapBits | bit : mapBits & ~bit;
+  nonEmptyBits &= ~bit;
+  keyBits &= ~bit;
+  // A map entry is a key and a value
+  remainingItems[depth] = size == SIZE_MAX ? SIZE_MAX : map ? size * 2 : size;
+  depth++;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpPayloadReader::EndContainer(HttpPayloadValue& value) {
+  depth--;
+  value.type = (mapBits & (1u << depth)) ? HttpPayloadValueType::mapEnd : HttpPayloadValueType::arrayEnd;
+  value.size = 0;
+}
+
+//==============================================================================
+
+void HttpPayloadReader::SetInteger(HttpPayloadValue& value, int64_t integer) {
+  value.type = HttpPayloadValueType::integer;
+  value.integer = integer;
+  value.unsignedInteger = integer >= 0 ? integer : 0;
+  value.floatingPoint = integer;
+}
+
+//==============================================================================
+
+void HttpPayloadReader::SetUnsignedInteger(HttpPayloadValue& value, uint64_t unsignedInteger) {
+  value.type = unsignedInteger > INT64_MAX ? HttpPayloadValueType::unsignedInteger : HttpPayloadValueType::integer;
+  value.integer = unsignedInteger > INT64_MAX ? 0 : unsignedInteger;
+  value.unsignedInteger = unsignedInteger;
+  value.floatingPoint = unsignedInteger;
+}
+
+//==============================================================================
+
+}
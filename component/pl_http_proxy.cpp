@@ -0,0 +1,234 @@
+#include "pl_http_proxy.h"
+#include "esp_check.h"
+#include <new>
+
+//==============================================================================
+
+static const char* TAG = "pl_http_proxy";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+// Hop-by-hop headers describe the connection they are received on. Content-Length is replaced by the chunked transfer encoding.
+static const char* const hopByHopHeaders[] = {
+  "Connection", "Keep-Alive", "Proxy-Authenticate", "Proxy-Authorization", "TE", "Trailer", "Transfer-Encoding", "Upgrade", "Content-Length"
+};
+
+//==============================================================================
+
+const std::vector<std::string> HttpProxy::defaultForwardedRequestHeaders = {
+  "Accept", "Accept-Encoding", "Accept-Language", "Authorization", "Cache-Control", "Content-Type", "Cookie",
+  "If-Match", "If-Modified-Since", "If-None-Match", "If-Unmodified-Since", "Range", "User-Agent"
+};
+
+//==============================================================================
+
+HttpProxy::HttpProxy(const std::string& hostname, size_t maxNumberOfConnections, size_t bufferSize) :
+  HttpProxy(maxNumberOfConnections, bufferSize, [&hostname]() { return new HttpClient(hostname); }) {}
+
+//==============================================================================
+
+HttpProxy::HttpProxy(const std::string& hostname, const char* serverCertificate, size_t maxNumberOfConnections, size_t bufferSize) :
+  HttpProxy(maxNumberOfConnections, bufferSize, [&hostname, serverCertificate]() { return new HttpClient(hostname, serverCertificate); }) {}
+
+//==============================================================================
+
+HttpProxy::HttpProxy(const std::string& hostname, esp_err_t (*crt_bundle_attach)(void *conf), size_t maxNumberOfConnections, size_t bufferSize) :
+  HttpProxy(maxNumberOfConnections, bufferSize, [&hostname, crt_bundle_attach]() { return new HttpClient(hostname, crt_bundle_attach); }) {}
+
+//==============================================================================
+
+HttpProxy::HttpProxy(size_t maxNumberOfConnections, size_t bufferSize, const std::function<HttpClient*()>& createClient) :
+    bufferSize(std::max(bufferSize, (size_t)1)), connections(std::max(maxNumberOfConnections, (size_t)1)) {
+  for (auto& connection : connections) {
+    connection.client.reset(createClient());
+    connection.buffer.reset(new uint8_t[this->bufferSize]);
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpProxy::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error != ESP_OK && (error != ESP_ERR_TIMEOUT || timeout != 0))
+    ESP_LOGE(TAG, "mutex lock failed");
+  return error;
+}
+
+//==============================================================================
+
+esp_err_t HttpProxy::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpProxy::ForwardRequest(HttpServerTransaction& transaction, const std::string& uri) {
+  Connection* connection = TakeConnection();
+  if (!connection) {
+    transaction.SetResponseHeader("Retry-After", "1");
+    return transaction.WriteResponse(503);
+  }
+  esp_err_t error = ForwardRequest(*connection, transaction, uri);
+  ReleaseConnection(*connection);
+  ESP_RETURN_ON_ERROR(error, TAG, "forward request failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpProxy::ForwardRequest(HttpServerTransaction& transaction) {
+  std::string uri;
+  ESP_RETURN_ON_ERROR(transaction.GetRequestUri(uri), TAG, "get request URI failed");
+  return ForwardRequest(transaction, uri);
+}
+
+//==============================================================================
+
+uint16_t HttpProxy::GetPort() {
+  LockGuard lg(*this);
+  return connections.front().client->GetPort();
+}
+
+//==============================================================================
+
+esp_err_t HttpProxy::SetPort(uint16_t port) {
+  LockGuard lg(*this);
+  for (auto& connection : connections)
+    ESP_RETURN_ON_FALSE(!connection.busy, ESP_ERR_INVALID_STATE, TAG, "request is being forwarded");
+  for (auto& connection : connections)
+    ESP_RETURN_ON_ERROR(connection.client->SetPort(port), TAG, "set port failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpProxy::AddForwardedRequestHeader(const std::string& name) {
+  LockGuard lg(*this);
+  for (auto& header : forwardedRequestHeaders) {
+    if (strcasecmp(header.c_str(), name.c_str()) == 0)
+      return ESP_OK;
+  }
+  forwardedRequestHeaders.push_back(name);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpProxy::RemoveForwardedRequestHeader(const std::string& name) {
+  LockGuard lg(*this);
+  for (auto header = forwardedRequestHeaders.begin(); header != forwardedRequestHeaders.end(); header++) {
+    if (strcasecmp(header->c_str(), name.c_str()) == 0) {
+      forwardedRequestHeaders.erase(header);
+      return ESP_OK;
+    }
+  }
+  ESP_RETURN_ON_ERROR(ESP_ERR_NOT_FOUND, TAG, "header not found");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpProxy::Connection* HttpProxy::TakeConnection() {
+  LockGuard lg(*this);
+  for (auto& connection : connections) {
+    if (!connection.busy) {
+      connection.busy = true;
+      return &connection;
+    }
+  }
+  return NULL;
+}
+
+//==============================================================================
+
+void HttpProxy::ReleaseConnection(Connection& connection) {
+  LockGuard lg(*this);
+  connection.busy = false;
+}
+
+//==============================================================================
+
+esp_err_t HttpProxy::ForwardRequest(Connection& connection, HttpServerTransaction& transaction, const std::string& uri) {
+  HttpClient& client = *connection.client;
+  uint8_t* buffer = connection.buffer.get();
+
+  // The upstream client keeps the request headers between requests, so the headers missing from this request are deleted
+  bool upstreamFailed = client.Initialize() != ESP_OK;
+  if (!upstreamFailed) {
+    LockGuard lg(*this);
+    std::string value;
+    for (auto& name : forwardedRequestHeaders) {
+      if (transaction.GetRequestHeader(name, value) == ESP_OK)
+        upstreamFailed |= client.SetRequestHeader(name, value) != ESP_OK;
+      else
+        client.DeleteRequestHeader(name);
+    }
+    auto networkStream = transaction.GetNetworkStream();
+    if (networkStream)
+      upstreamFailed |= client.SetRequestHeader("X-Forwarded-For", networkStream->GetRemoteEndpoint().address.ToString()) != ESP_OK;
+  }
+
+  // The request body is relayed in parts: a part is only read from the client after the previous one has been written upstream
+  size_t requestBodySize = transaction.GetRequestBodySize();
+  upstreamFailed = upstreamFailed || client.WriteRequestHeaders(transaction.GetRequestMethod(), uri, requestBodySize) != ESP_OK;
+  for (size_t remainingSize = requestBodySize; remainingSize && !upstreamFailed; ) {
+    size_t size = std::min(remainingSize, bufferSize);
+    esp_err_t error = transaction.ReadRequestBody(buffer, size);
+    if (error != ESP_OK) {
+      // The upstream request is incomplete, so the connection cannot be reused
+      client.Disconnect();
+      ESP_RETURN_ON_ERROR(error, TAG, "read request body failed");
+    }
+    upstreamFailed = client.WriteRequestBody(buffer, size) != ESP_OK;
+    remainingSize -= size;
+  }
+
+  ushort statusCode = 0;
+  size_t size = 0;
+  if (upstreamFailed || client.ReadResponseHeaders(statusCode, NULL) != ESP_OK || client.ReadResponseBody(buffer, bufferSize, size) != ESP_OK) {
+    client.Disconnect();
+    return transaction.WriteResponse(502);
+  }
+
+  // The rest of the upstream response is not drained if the relay fails, so the connection is closed
+  std::vector<std::pair<std::string, std::string>> headers;
+  esp_err_t error = client.GetResponseHeaders(headers);
+  for (auto header = headers.begin(); header != headers.end() && error == ESP_OK; header++) {
+    bool hopByHop = false;
+    for (auto hopByHopHeader : hopByHopHeaders)
+      hopByHop |= strcasecmp(header->first.c_str(), hopByHopHeader) == 0;
+    if (!hopByHop)
+      error = transaction.SetResponseHeader(header->first, header->second);
+  }
+  if (error != ESP_OK) {
+    client.Disconnect();
+    ESP_RETURN_ON_ERROR(error, TAG, "relay response headers failed");
+  }
+
+  if (!size)
+    return transaction.WriteResponse(statusCode);
+
+  // The response body is relayed in parts as well: the first part is sent to the client before the rest is received
+  error = transaction.WriteResponseHeaders(statusCode);
+  while (size) {
+    if (error == ESP_OK)
+      error = transaction.WriteResponseBody(buffer, size);
+    if (error == ESP_OK)
+      error = client.ReadResponseBody(buffer, bufferSize, size);
+    if (error != ESP_OK) {
+      client.Disconnect();
+      ESP_RETURN_ON_ERROR(error, TAG, "relay response failed");
+    }
+  }
+  ESP_RETURN_ON_ERROR(transaction.EndResponseBody(), TAG, "end response body failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+}
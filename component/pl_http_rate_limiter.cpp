@@ -0,0 +1,67 @@
+#include "pl_http_rate_limiter.h"
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+HttpRateLimiter::HttpRateLimiter(size_t numberOfBuckets, uint32_t rate, uint32_t burstSize) : rate(rate), burstSize(burstSize) {
+  for (size_t i = 0; i < numberOfShards; i++)
+    shards[i].buckets.resize(std::max((size_t)1, (numberOfBuckets + numberOfShards - 1 - i) / numberOfShards));
+}
+
+//==============================================================================
+
+bool HttpRateLimiter::TakeToken(uint32_t key, uint32_t& retryAfter) {
+  if (!rate)
+    return true;
+
+  Shard& shard = shards[key % numberOfShards];
+  LockGuard lg(shard.mutex);
+  TickType_t time = xTaskGetTickCount();
+
+  // A bucket that has not been used for the longest time is the most likely to be full, so forgetting it loses the least
+  Bucket* bucket = NULL;
+  for (auto& b : shard.buckets) {
+    if (b.used && b.key == key) {
+      bucket = &b;
+      break;
+    }
+    if (!bucket || (bucket->used && (!b.used || (TickType_t)(time - b.refillTime) > (TickType_t)(time - bucket->refillTime))))
+      bucket = &b;
+  }
+  if (!bucket->used || bucket->key != key) {
+    bucket->used = true;
+    bucket->key = key;
+    bucket->tokens = burstSize * tokenScale;
+    bucket->refillTime = time;
+  }
+
+  uint64_t tokens = bucket->tokens + (uint64_t)(time - bucket->refillTime) * portTICK_PERIOD_MS * rate;
+  bucket->tokens = std::min(tokens, (uint64_t)burstSize * tokenScale);
+  bucket->refillTime = time;
+  if (bucket->tokens >= tokenScale) {
+    bucket->tokens -= tokenScale;
+    return true;
+  }
+
+  retryAfter = ((tokenScale - bucket->tokens) + rate * 1000 - 1) / (rate * 1000);
+  return false;
+}
+
+//==============================================================================
+
+uint32_t HttpRateLimiter::GetRate() {
+  return rate;
+}
+
+//==============================================================================
+
+uint32_t HttpRateLimiter::GetBurstSize() {
+  return burstSize;
+}
+
+//==============================================================================
+
+}
@@ -0,0 +1,169 @@
+#include "pl_http_request.h"
+#include "esp_log.h"
+#include <atomic>
+#include <stdlib.h>
+
+//==============================================================================
+
+static const char* TAG = "pl_http_request";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+static std::atomic<uint32_t> lastRequestId(0);
+
+//==============================================================================
+
+HttpRequest::HttpRequest(HttpMethod method, const std::string& url, const std::vector<std::pair<std::string, std::string>>& headers,
+                         const std::string& body) :
+    id(++lastRequestId), method(method), url(url), headers(headers), body(body) {
+  ParseUrl();
+}
+
+//==============================================================================
+
+HttpRequest::HttpRequest(HttpMethod method, const std::string& url, const std::vector<std::pair<std::string, std::string>>& headers,
+                         const HttpBodySource& bodySource) :
+    id(++lastRequestId), method(method), url(url), headers(headers), bodySource(bodySource) {
+  ParseUrl();
+}
+
+//==============================================================================
+
+bool HttpRequest::IsValid() const {
+  return valid;
+}
+
+//==============================================================================
+
+HttpMethod HttpRequest::GetMethod() const {
+  return method;
+}
+
+//==============================================================================
+
+const std::string& HttpRequest::GetUrl() const {
+  return url;
+}
+
+//==============================================================================
+
+const std::string& HttpRequest::GetHostname() const {
+  return hostname;
+}
+
+//==============================================================================
+
+uint16_t HttpRequest::GetPort() const {
+  return port;
+}
+
+//==============================================================================
+
+bool HttpRequest::IsHttps() const {
+  return https;
+}
+
+//==============================================================================
+
+const std::string& HttpRequest::GetTarget() const {
+  return target;
+}
+
+//==============================================================================
+
+const std::vector<std::pair<std::string, std::string>>& HttpRequest::GetHeaders() const {
+  return headers;
+}
+
+//==============================================================================
+
+const std::string& HttpRequest::GetBody() const {
+  return body;
+}
+
+//==============================================================================
+
+const HttpBodySource& HttpRequest::GetBodySource() const {
+  return bodySource;
+}
+
+//==============================================================================
+
+void HttpRequest::ParseUrl() {
+  if (method == HttpMethod::unknown) {
+    ESP_LOGE(TAG, "invalid HTTP method");
+    return;
+  }
+  if (url.compare(0, 1, "/") == 0) {
+    target = url;
+    valid = true;
+    return;
+  }
+
+  size_t hostStart;
+  if (url.compare(0, 7, "http://") == 0)
+    hostStart = 7;
+  else if (url.compare(0, 8, "https://") == 0) {
+    hostStart = 8;
+    https = true;
+  }
+  else {
+    ESP_LOGE(TAG, "invalid URL scheme");
+    return;
+  }
+
+  size_t targetStart = url.find_first_of("/?", hostStart);
+  if (targetStart == std::string::npos)
+    targetStart = url.size();
+  target = targetStart == url.size() ? "/" : url[targetStart] == '?' ? "/" + url.substr(targetStart) : url.substr(targetStart);
+
+  // An IPv6 address is enclosed in brackets, so its colons are not taken for the port separator
+  size_t hostEnd = targetStart;
+  size_t portStart = std::string::npos;
+  if (url.compare(hostStart, 1, "[") == 0) {
+    size_t bracket = url.find(']', hostStart);
+    if (bracket == std::string::npos || bracket > targetStart) {
+      ESP_LOGE(TAG, "invalid URL host");
+      return;
+    }
+    hostname = url.substr(hostStart + 1, bracket - hostStart - 1);
+    if (bracket + 1 < targetStart && url[bracket + 1] == ':')
+      portStart = bracket + 2;
+    else if (bracket + 1 != targetStart) {
+      ESP_LOGE(TAG, "invalid URL host");
+      return;
+    }
+  }
+  else {
+    size_t colon = url.find(':', hostStart);
+    if (colon < targetStart) {
+      hostEnd = colon;
+      portStart = colon + 1;
+    }
+    hostname = url.substr(hostStart, hostEnd - hostStart);
+  }
+
+  port = https ? 443 : 80;
+  if (portStart != std::string::npos) {
+    char* portEnd;
+    unsigned long tempPort = strtoul(url.c_str() + portStart, &portEnd, 10);
+    if (portEnd != url.c_str() + targetStart || portStart == targetStart || !tempPort || tempPort > UINT16_MAX) {
+      ESP_LOGE(TAG, "invalid URL port");
+      return;
+    }
+    port = tempPort;
+  }
+  if (hostname.empty()) {
+    ESP_LOGE(TAG, "invalid URL host");
+    return;
+  }
+  valid = true;
+}
+
+//==============================================================================
+
+}
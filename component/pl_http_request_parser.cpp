@@ -0,0 +1,69 @@
+#include "pl_http_request_parser.h"
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+static const std::pair<std::string_view, HttpMethod> httpMethods[] = {
+  {"GET", HttpMethod::GET}, {"POST", HttpMethod::POST}, {"PUT", HttpMethod::PUT}, {"PATCH", HttpMethod::PATCH},
+  {"DELETE", HttpMethod::DELETE}, {"HEAD", HttpMethod::HEAD}, {"OPTIONS", HttpMethod::OPTIONS}
+};
+
+//==============================================================================
+
+void HttpRequestParser::Reset() {
+  HttpHeadParser::Reset();
+  method = {};
+  httpMethod = HttpMethod::unknown;
+  target = {};
+}
+
+//==============================================================================
+
+HttpMethod HttpRequestParser::GetMethod() {
+  return httpMethod;
+}
+
+//==============================================================================
+
+std::string_view HttpRequestParser::GetMethodName() {
+  return GetString(method);
+}
+
+//==============================================================================
+
+std::string_view HttpRequestParser::GetTarget() {
+  return GetString(target);
+}
+
+//==============================================================================
+
+esp_err_t HttpRequestParser::ParseStartLine(const char* line, const char* lineEnd) {
+  const char* methodEnd = FindChar(line, lineEnd, ' ');
+  if (!methodEnd || methodEnd == line)
+    return ESP_ERR_INVALID_ARG;
+  const char* targetStart = methodEnd + 1;
+  const char* targetEnd = FindChar(targetStart, lineEnd, ' ');
+  if (!targetEnd || targetEnd == targetStart)
+    return ESP_ERR_INVALID_ARG;
+  const char* version = targetEnd + 1;
+  if (lineEnd - version != 8 || ParseVersion(version) != ESP_OK)
+    return ESP_ERR_INVALID_ARG;
+
+  method = GetSpan(line, methodEnd);
+  target = GetSpan(targetStart, targetEnd);
+  httpMethod = HttpMethod::unknown;
+  for (auto& httpMethodInfo : httpMethods) {
+    if (httpMethodInfo.first == GetString(method)) {
+      httpMethod = httpMethodInfo.second;
+      break;
+    }
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+}
@@ -0,0 +1,244 @@
+#include "pl_http_scheduler.h"
+#ifdef __cpp_impl_coroutine
+#include "esp_check.h"
+#include "lwip/sockets.h"
+
+//==============================================================================
+
+static const char* TAG = "pl_http_scheduler";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+const TaskParameters HttpScheduler::defaultTaskParameters = {4096, tskIDLE_PRIORITY + 5, 0};
+
+//==============================================================================
+
+void HttpScheduler::SocketAwaiter::await_suspend(std::coroutine_handle<> handle) {
+  scheduler.waiters.push_back({handle, sockfd, write, xTaskGetTickCount(), timeout, &result});
+}
+
+//==============================================================================
+
+HttpScheduler::HttpScheduler(const TaskParameters& taskParameters) : taskParameters(taskParameters) {}
+
+//==============================================================================
+
+HttpScheduler::~HttpScheduler() {
+  Disable();
+}
+
+//==============================================================================
+
+esp_err_t HttpScheduler::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error != ESP_OK && (error != ESP_ERR_TIMEOUT || timeout != 0))
+    ESP_LOGE(TAG, "mutex lock failed");
+  return error;
+}
+
+//==============================================================================
+
+esp_err_t HttpScheduler::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpScheduler::Enable() {
+  LockGuard lg(*this);
+  if (taskHandle)
+    return ESP_OK;
+
+  // The wakeup socket is a UDP socket bound to the loopback address that sends datagrams to itself
+  wakeupSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  ESP_RETURN_ON_FALSE(wakeupSocket >= 0, ESP_FAIL, TAG, "wakeup socket create failed");
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addressSize = sizeof(address);
+  if (bind(wakeupSocket, (sockaddr*)&address, sizeof(address)) != 0 || getsockname(wakeupSocket, (sockaddr*)&address, &addressSize) != 0 ||
+      connect(wakeupSocket, (sockaddr*)&address, sizeof(address)) != 0 || fcntl(wakeupSocket, F_SETFL, O_NONBLOCK) != 0) {
+    close(wakeupSocket);
+    wakeupSocket = -1;
+    ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "wakeup socket bind failed");
+  }
+
+  stopRequested = false;
+  if (xTaskCreatePinnedToCore(TaskCode, "pl_http_sched", taskParameters.stackDepth, this, taskParameters.priority, &taskHandle,
+                              taskParameters.coreId) != pdPASS) {
+    taskHandle = NULL;
+    close(wakeupSocket);
+    wakeupSocket = -1;
+    ESP_RETURN_ON_ERROR(ESP_ERR_NO_MEM, TAG, "task create failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpScheduler::Disable() {
+  LockGuard lg(*this);
+  if (!taskHandle)
+    return ESP_OK;
+  ESP_RETURN_ON_FALSE(xTaskGetCurrentTaskHandle() != taskHandle, ESP_ERR_INVALID_STATE, TAG, "scheduler cannot be disabled by its coroutine");
+
+  stopRequested = true;
+  Wakeup();
+  while (taskHandle)
+    vTaskDelay(1);
+  close(wakeupSocket);
+  wakeupSocket = -1;
+
+  // The waiters refer to the frames that are destroyed with the tasks
+  waiters.clear();
+  tasks.clear();
+  LockGuard lgSpawn(spawnMutex);
+  spawnedTasks.clear();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool HttpScheduler::IsEnabled() {
+  LockGuard lg(*this);
+  return taskHandle;
+}
+
+//==============================================================================
+
+esp_err_t HttpScheduler::Spawn(HttpTask&& task) {
+  // The scheduler lock is not taken, so that a coroutine can spawn another one while the scheduler is being disabled
+  LockGuard lg(spawnMutex);
+  ESP_RETURN_ON_FALSE(task.handle, ESP_ERR_INVALID_ARG, TAG, "invalid task");
+  ESP_RETURN_ON_FALSE(taskHandle, ESP_ERR_INVALID_STATE, TAG, "scheduler is not enabled");
+  spawnedTasks.push_back(std::move(task));
+  Wakeup();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpScheduler::SocketAwaiter HttpScheduler::WaitUntilReadable(int sockfd, TickType_t timeout) {
+  return SocketAwaiter(*this, sockfd, false, timeout);
+}
+
+//==============================================================================
+
+HttpScheduler::SocketAwaiter HttpScheduler::WaitUntilWritable(int sockfd, TickType_t timeout) {
+  return SocketAwaiter(*this, sockfd, true, timeout);
+}
+
+//==============================================================================
+
+HttpScheduler::SocketAwaiter HttpScheduler::Delay(TickType_t time) {
+  return SocketAwaiter(*this, -1, false, time);
+}
+
+//==============================================================================
+
+void HttpScheduler::TaskCode(void* parameters) {
+  HttpScheduler& scheduler = *(HttpScheduler*)parameters;
+  scheduler.Run();
+  scheduler.taskHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+//==============================================================================
+
+void HttpScheduler::Run() {
+  std::vector<HttpTask> newTasks;
+  std::vector<Waiter> readyWaiters;
+  while (!stopRequested) {
+    {
+      LockGuard lg(spawnMutex);
+      newTasks.swap(spawnedTasks);
+    }
+    for (auto& task : newTasks) {
+      tasks.push_back(std::move(task));
+      tasks.back().handle.resume();
+    }
+    newTasks.clear();
+
+    // Resumed coroutines either wait for a socket again or complete
+    for (auto task = tasks.begin(); task != tasks.end(); ) {
+      if (task->handle.done()) {
+        if (task->handle.promise().result != ESP_OK)
+          ESP_LOGW(TAG, "coroutine failed: %s", esp_err_to_name(task->handle.promise().result));
+        task = tasks.erase(task);
+      }
+      else
+        task++;
+    }
+
+    fd_set readSet, writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    FD_SET(wakeupSocket, &readSet);
+    int maxSocket = wakeupSocket;
+    TickType_t time = xTaskGetTickCount();
+    TickType_t waitTime = portMAX_DELAY;
+    for (auto& waiter : waiters) {
+      if (waiter.sockfd >= 0) {
+        FD_SET(waiter.sockfd, waiter.write ? &writeSet : &readSet);
+        maxSocket = std::max(maxSocket, waiter.sockfd);
+      }
+      if (waiter.timeout != portMAX_DELAY) {
+        TickType_t elapsedTime = time - waiter.startTime;
+        waitTime = std::min(waitTime, elapsedTime < waiter.timeout ? waiter.timeout - elapsedTime : 0);
+      }
+    }
+    timeval tv = {(time_t)(waitTime * portTICK_PERIOD_MS / 1000), (suseconds_t)(waitTime * portTICK_PERIOD_MS % 1000 * 1000)};
+    int res = select(maxSocket + 1, &readSet, &writeSet, NULL, waitTime == portMAX_DELAY ? NULL : &tv);
+    // A socket closed by its coroutine's owner makes select fail with EBADF: the waiters are checked one by one below.
+    // Any other failure fails all socket waiters.
+    bool selectFailed = res < 0 && errno != EBADF;
+    if (res < 0) {
+      if (selectFailed)
+        ESP_LOGE(TAG, "select failed: %d", errno);
+      FD_ZERO(&readSet);
+      FD_ZERO(&writeSet);
+    }
+    if (FD_ISSET(wakeupSocket, &readSet)) {
+      char data[8];
+      while (recv(wakeupSocket, data, sizeof(data), 0) > 0);
+    }
+
+    time = xTaskGetTickCount();
+    for (auto waiter = waiters.begin(); waiter != waiters.end(); ) {
+      bool ready = waiter->sockfd >= 0 && FD_ISSET(waiter->sockfd, waiter->write ? &writeSet : &readSet);
+      if (ready || (waiter->timeout != portMAX_DELAY && time - waiter->startTime >= waiter->timeout) ||
+          (res < 0 && waiter->sockfd >= 0 && (selectFailed || fcntl(waiter->sockfd, F_GETFL, 0) < 0))) {
+        *waiter->result = ready || waiter->sockfd < 0 ? ESP_OK : selectFailed ? ESP_FAIL : ESP_ERR_TIMEOUT;
+        readyWaiters.push_back(*waiter);
+        waiter = waiters.erase(waiter);
+      }
+      else
+        waiter++;
+    }
+    // Resumed coroutines can add new waiters, so they are resumed after the waiter list is updated
+    for (auto& waiter : readyWaiters)
+      waiter.handle.resume();
+    // A failure that leaves no waiter to resume (e.g. of the wakeup socket) is retried after a tick, instead of spinning
+    if (res < 0 && readyWaiters.empty())
+      vTaskDelay(1);
+    readyWaiters.clear();
+  }
+}
+
+//==============================================================================
+
+void HttpScheduler::Wakeup() {
+  if (wakeupSocket >= 0)
+    send(wakeupSocket, "", 1, 0);
+}
+
+//==============================================================================
+
+}
+
+#endif
@@ -1,11 +1,24 @@
 #include "pl_http_server.h"
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "pl_http_tracer.h"
 #include "esp_check.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "esp_heap_caps.h"
+#include "mbedtls/ssl.h"
 #include <map>
+#include <new>
 
 //==============================================================================
 
 static const char* TAG = "pl_http_server";
 
+// The server task runs the handshake of a connection before the open callback: the callbacks called by the handshake
+// pass its kind and time to the open callback
+static thread_local bool handshakeResumed = false;
+static thread_local int64_t handshakeStartTime = 0;
+static thread_local int64_t handshakeTime = 0;
+
 //==============================================================================
 
 namespace PL {
@@ -13,7 +26,8 @@ namespace PL {
 //==============================================================================
 
 static std::map<int, HttpMethod> httpMethodMap {
-  {HTTP_GET, HttpMethod::GET}, {HTTP_POST, HttpMethod::POST}, {HTTP_PUT, HttpMethod::PUT}, {HTTP_PATCH, HttpMethod::PATCH}, {HTTP_DELETE, HttpMethod::DELETE}
+  {HTTP_GET, HttpMethod::GET}, {HTTP_POST, HttpMethod::POST}, {HTTP_PUT, HttpMethod::PUT}, {HTTP_PATCH, HttpMethod::PATCH}, {HTTP_DELETE, HttpMethod::DELETE},
+  {HTTP_HEAD, HttpMethod::HEAD}, {HTTP_OPTIONS, HttpMethod::OPTIONS}
 };
 
 //==============================================================================
@@ -42,11 +56,38 @@ static std::map<uint16_t, std::string> httpStatusCodeMap {
 const std::string HttpServer::defaultHttpName = "HTTP Server";
 const std::string HttpServer::defaultHttpsName = "HTTPS Server";
 const TaskParameters HttpServer::defaultTaskParameters = {4096, tskIDLE_PRIORITY + 5, 0};
+const HttpSocketOptions HttpServer::defaultSocketOptions = {false, 0, 0, 0, 5, 3};
+const HttpCorsPolicy HttpServer::defaultCorsPolicy = {{"*"}, "GET, HEAD, POST, PUT, PATCH, DELETE", "", "", false, 86400};
+
+#ifdef CONFIG_PL_HTTP_SERVER_ARENA_IN_PSRAM
+static constexpr uint32_t arenaCaps = MALLOC_CAP_SPIRAM;
+#else
+static constexpr uint32_t arenaCaps = MALLOC_CAP_DEFAULT;
+#endif
+// Used by the transactions of the connections without a context
+static HttpArena emptyArena(0);
+
+//==============================================================================
+
+// Gets the "Access-Control-Allow-Origin" value for the request origin (NULL if the origin is not allowed)
+static const char* GetAllowedOrigin(const HttpCorsPolicy& policy, const char* origin) {
+  for (auto& allowedOrigin : policy.allowedOrigins) {
+    // A response to a request with credentials cannot allow any origin: the origin is echoed instead
+    if (allowedOrigin == "*")
+      return policy.allowCredentials ? origin : "*";
+    if (allowedOrigin == origin)
+      return origin;
+  }
+  return NULL;
+}
 
 //==============================================================================
 
-HttpServer::HttpServer(std::shared_ptr<Buffer> headerBuffer) : requestEvent(*this), port(defaultHttpPort), headerBuffer(headerBuffer) {
+HttpServer::HttpServer(std::shared_ptr<Buffer> headerBuffer) : requestEvent(*this) {
   SetName(defaultHttpName);
+  mainListener.server = this;
+  mainListener.port = defaultHttpPort;
+  mainListener.headerBuffer = headerBuffer;
 }
 
 //==============================================================================
@@ -55,11 +96,14 @@ HttpServer::HttpServer(size_t headerBufferSize) : HttpServer(std::make_shared<Bu
 
 //==============================================================================
 
-HttpServer::HttpServer(const char* certificate, const char* privateKey, std::shared_ptr<Buffer> headerBuffer) : requestEvent(*this), port(defaultHttpsPort), headerBuffer(headerBuffer) {
+HttpServer::HttpServer(const char* certificate, const char* privateKey, std::shared_ptr<Buffer> headerBuffer) : requestEvent(*this) {
   SetName(defaultHttpsName);
-  https = true;
-  this->serverCertificate = certificate;
-  this->privateKey = privateKey;
+  mainListener.server = this;
+  mainListener.port = defaultHttpsPort;
+  mainListener.https = true;
+  mainListener.certificate = certificate;
+  mainListener.privateKey = privateKey;
+  mainListener.headerBuffer = headerBuffer;
 }
 
 //==============================================================================
@@ -71,6 +115,7 @@ HttpServer::HttpServer(const char* certificate, const char* privateKey, size_t h
 
 HttpServer::~HttpServer() {
   Disable();
+  DeleteFreeConnections();
 }
 
 //==============================================================================
@@ -96,39 +141,31 @@ esp_err_t HttpServer::Enable() {
   if (enabled)
     return ESP_OK;
 
-  serverConfig = HTTPD_SSL_CONFIG_DEFAULT();
-  serverConfig.transport_mode = https ? HTTPD_SSL_TRANSPORT_SECURE : HTTPD_SSL_TRANSPORT_INSECURE;
-  serverConfig.servercert = (https && serverCertificate) ? (const uint8_t*)serverCertificate : NULL;
-  serverConfig.servercert_len = (https && serverCertificate) ? strlen(serverCertificate) + 1 : 0;
-  serverConfig.prvtkey_pem = (https && privateKey) ? (const uint8_t*)privateKey : NULL;
-  serverConfig.prvtkey_len = (https && privateKey) ? strlen(privateKey) + 1 : 0;
-  serverConfig.httpd.task_priority = taskParameters.priority;
-  serverConfig.httpd.stack_size = taskParameters.stackDepth;
-  serverConfig.httpd.core_id = taskParameters.coreId;
-  serverConfig.httpd.server_port = serverConfig.httpd.ctrl_port = serverConfig.port_secure = serverConfig.port_insecure = port;
-  serverConfig.httpd.backlog_conn = serverConfig.httpd.max_open_sockets = maxNumberOfClients;
-  serverConfig.httpd.recv_wait_timeout = readTimeout == portMAX_DELAY ? UINT16_MAX : readTimeout * portTICK_PERIOD_MS / 1000 + 1;
-  serverConfig.httpd.send_wait_timeout = writeTimeout == portMAX_DELAY ? UINT16_MAX : writeTimeout * portTICK_PERIOD_MS / 1000 + 1;
-  serverConfig.httpd.uri_match_fn = httpd_uri_match_wildcard;
-
-  ESP_RETURN_ON_ERROR(httpd_ssl_start(&serverHandle, &serverConfig), TAG, "start failed");
-
-  httpd_uri_t requestHandlerInfo = {};
-  requestHandlerInfo.uri = "*";
-  requestHandlerInfo.handler = HandleRequest;
-  requestHandlerInfo.user_ctx = this;
-  http_method methods[] = {HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE};
-
-  for (uint32_t i = 0; i < sizeof(methods) / sizeof(http_method); i++) {
-    requestHandlerInfo.method = methods[i];
-    esp_err_t error = httpd_register_uri_handler(serverHandle, &requestHandlerInfo);
-    if (error != ESP_OK) {
-      httpd_ssl_stop(serverHandle);
-      ESP_RETURN_ON_ERROR(error, TAG, "register URI handler failed");
+  esp_timer_create_args_t maintenanceTimerArgs = {};
+  maintenanceTimerArgs.callback = HandleMaintenanceTimer;
+  maintenanceTimerArgs.arg = this;
+  maintenanceTimerArgs.name = "pl_http_server";
+  maintenanceTimerArgs.skip_unhandled_events = true;
+  ESP_RETURN_ON_ERROR(esp_timer_create(&maintenanceTimerArgs, &maintenanceTimer), TAG, "maintenance timer create failed");
+
+  esp_err_t startError = ESP_OK;
+  for (auto listener : GetListeners()) {
+    if ((startError = StartServer(*listener, listener->handle)) != ESP_OK)
+      break;
+  }
+  if (startError != ESP_OK) {
+    for (auto listener : GetListeners()) {
+      if (listener->handle)
+        StopServer(listener->handle);
     }
+    esp_timer_delete(maintenanceTimer);
+    maintenanceTimer = NULL;
+    ESP_RETURN_ON_ERROR(startError, TAG, "start failed");
   }
 
+  boundPort = mainListener.port;
   enabled = true;
+  UpdateMaintenanceTimer();
   enabledEvent.Generate();
   return ESP_OK;
 }
@@ -136,17 +173,70 @@ esp_err_t HttpServer::Enable() {
 //==============================================================================
 
 esp_err_t HttpServer::Disable() {
-  LockGuard lg(*this);
-  if (!enabled)
-    return ESP_OK;
+  std::vector<httpd_handle_t> drainedServerHandles, listenerHandles;
+  {
+    LockGuard lg(*this);
+    if (!enabled)
+      return ESP_OK;
+
+    esp_timer_stop(maintenanceTimer);
+    esp_timer_delete(maintenanceTimer);
+    maintenanceTimer = NULL;
+    if (drainingServerHandle)
+      drainedServerHandles.push_back(drainingServerHandle);
+    drainingServerHandle = NULL;
+    for (auto& stoppingServer : stoppingServers)
+      drainedServerHandles.push_back(stoppingServer.first);
+    stoppingServers.clear();
+    for (auto listener : GetListeners()) {
+      listenerHandles.push_back(listener->handle);
+      listener->handle = NULL;
+    }
+    enabled = false;
+  }
 
-  esp_err_t unregisterUriError = httpd_unregister_uri(serverHandle, "*");
-  if (unregisterUriError != ESP_OK)
-    ESP_LOGE(TAG, "unregister URI failed");
-  ESP_RETURN_ON_ERROR(httpd_ssl_stop(serverHandle), TAG, "stop failed");
-  enabled = false;
+  // The servers are stopped without holding the lock as their tasks may be waiting for it
+  for (auto handle : drainedServerHandles)
+    httpd_ssl_stop(handle);
+  esp_err_t error = ESP_OK;
+  for (auto handle : listenerHandles) {
+    esp_err_t stopError = StopServer(handle);
+    if (error == ESP_OK)
+      error = stopError;
+  }
+  while (numberOfStopTasks)
+    vTaskDelay(1);
+
+  LockGuard lg(*this);
+  DeleteFreeConnections();
   disabledEvent.Generate();
-  return unregisterUriError;
+  ESP_RETURN_ON_ERROR(error, TAG, "stop failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::BeginUpdate() {
+  ESP_RETURN_ON_ERROR(Lock(), TAG, "lock failed");
+  updateDepth++;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::EndUpdate() {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(updateDepth, ESP_ERR_INVALID_STATE, TAG, "no update in progress");
+  updateDepth--;
+  esp_err_t error = ESP_OK;
+  if (!updateDepth) {
+    Update update = pendingUpdate;
+    pendingUpdate = Update::none;
+    error = UpdateIfEnabled(update);
+  }
+  Unlock();
+  ESP_RETURN_ON_ERROR(error, TAG, "update failed");
+  return ESP_OK;
 }
 
 //==============================================================================
@@ -160,15 +250,19 @@ bool HttpServer::IsEnabled() {
 
 uint16_t HttpServer::GetPort() {
   LockGuard lg(*this);
-  return port;
+  return mainListener.port;
 }
 
 //==============================================================================
 
 esp_err_t HttpServer::SetPort(uint16_t port) {
   LockGuard lg(*this);
-  this->port = port;
-  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  if (port == mainListener.port)
+    return ESP_OK;
+  for (auto& listener : listeners)
+    ESP_RETURN_ON_FALSE(listener.port != port, ESP_ERR_INVALID_ARG, TAG, "port is used by another listener");
+  mainListener.port = port;
+  ESP_RETURN_ON_ERROR(UpdateIfEnabled(Update::rebind), TAG, "update failed");
   return ESP_OK;
 }
 
@@ -184,9 +278,90 @@ size_t HttpServer::GetMaxNumberOfClients() {
 esp_err_t HttpServer::SetMaxNumberOfClients(size_t maxNumberOfClients) {
   LockGuard lg(*this);
   this->maxNumberOfClients = maxNumberOfClients;
-  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  ESP_RETURN_ON_ERROR(UpdateIfEnabled(maxNumberOfClients < numberOfSockets ? Update::live : Update::restart), TAG, "update failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpServer::GetBacklogSize() {
+  LockGuard lg(*this);
+  return backlogSize;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetBacklogSize(size_t backlogSize) {
+  LockGuard lg(*this);
+  this->backlogSize = backlogSize;
+  // The backlog of the listening socket is set when the server starts
+  ESP_RETURN_ON_ERROR(UpdateIfEnabled(Update::restart), TAG, "update failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool HttpServer::GetLruPurge() {
+  LockGuard lg(*this);
+  return lruPurge;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetLruPurge(bool lruPurge) {
+  LockGuard lg(*this);
+  this->lruPurge = lruPurge;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpServer::GetIdleTimeout() {
+  LockGuard lg(*this);
+  return idleTimeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetIdleTimeout(TickType_t timeout) {
+  LockGuard lg(*this);
+  this->idleTimeout = timeout;
+  if (enabled)
+    ESP_RETURN_ON_ERROR(UpdateMaintenanceTimer(), TAG, "maintenance timer update failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpServer::GetMaxNumberOfRequestsPerConnection() {
+  LockGuard lg(*this);
+  return maxNumberOfRequestsPerConnection;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetMaxNumberOfRequestsPerConnection(size_t maxNumberOfRequests) {
+  LockGuard lg(*this);
+  this->maxNumberOfRequestsPerConnection = maxNumberOfRequests;
   return ESP_OK;
 }
+
+//==============================================================================
+
+size_t HttpServer::GetNumberOfConnections() {
+  LockGuard lg(*this);
+  if (!enabled)
+    return 0;
+  size_t numberOfConnections = 0;
+  for (auto listener : GetListeners()) {
+    int clientSockets[CONFIG_LWIP_MAX_SOCKETS];
+    size_t numberOfClients = CONFIG_LWIP_MAX_SOCKETS;
+    if (httpd_get_client_list(listener->handle, &numberOfClients, clientSockets) == ESP_OK)
+      numberOfConnections += numberOfClients;
+  }
+  return numberOfConnections;
+}
+
 //==============================================================================
 
 TickType_t HttpServer::GetReadTimeout() {
@@ -199,7 +374,7 @@ TickType_t HttpServer::GetReadTimeout() {
 esp_err_t HttpServer::SetReadTimeout(TickType_t timeout) {
   LockGuard lg(*this);
   this->readTimeout = timeout;
-  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  ESP_RETURN_ON_ERROR(UpdateIfEnabled(Update::live), TAG, "update failed");
   return ESP_OK;
 }
 
@@ -215,7 +390,22 @@ TickType_t HttpServer::GetWriteTimeout() {
 esp_err_t HttpServer::SetWriteTimeout(TickType_t timeout) {
   LockGuard lg(*this);
   this->writeTimeout = timeout;
-  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  ESP_RETURN_ON_ERROR(UpdateIfEnabled(Update::live), TAG, "update failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpServer::GetRequestTimeout() {
+  LockGuard lg(*this);
+  return requestTimeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetRequestTimeout(TickType_t timeout) {
+  LockGuard lg(*this);
+  this->requestTimeout = timeout;
   return ESP_OK;
 }
 
@@ -223,165 +413,1459 @@ esp_err_t HttpServer::SetWriteTimeout(TickType_t timeout) {
 
 esp_err_t HttpServer::SetTaskParameters(const TaskParameters& taskParameters) {
   LockGuard lg(*this);
+  bool restartRequired = taskParameters.stackDepth != this->taskParameters.stackDepth || taskParameters.coreId != this->taskParameters.coreId;
   this->taskParameters = taskParameters;
-  ESP_RETURN_ON_ERROR(RestartIfEnabled(), TAG, "restart failed");
+  ESP_RETURN_ON_ERROR(UpdateIfEnabled(restartRequired ? Update::restart : Update::live), TAG, "update failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
-esp_err_t HttpServer::HandleRequest(httpd_req_t* req) {
-  HttpServer& server = *(HttpServer*)req->user_ctx;
-  auto headerBuffer = server.headerBuffer;
+HttpSocketOptions HttpServer::GetSocketOptions() {
+  LockGuard lg(*this);
+  return *socketOptions.load();
+}
 
-  LockGuard lgServer(server, *headerBuffer);
-  Transaction transaction(server, req);
-  server.headerDataEnd = (char*)headerBuffer->data;
+//==============================================================================
 
-  server.requestEvent.Generate(transaction);
-  esp_err_t err = server.HandleRequest(transaction);
-  if (err != ESP_OK && !transaction.IsResponseWritten())
-    transaction.WriteResponse(500);
-  ESP_RETURN_ON_ERROR(err, TAG, "handle request failed");
+esp_err_t HttpServer::SetSocketOptions(const HttpSocketOptions& socketOptions) {
+  LockGuard lg(*this);
+  this->socketOptions.store(std::make_shared<const HttpSocketOptions>(socketOptions));
+  ESP_RETURN_ON_ERROR(UpdateIfEnabled(Update::live), TAG, "update failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
-esp_err_t HttpServer::RestartIfEnabled() {
-  if (!enabled)
+esp_err_t HttpServer::SetCertificate(const char* certificate, const char* privateKey) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(mainListener.https, ESP_ERR_INVALID_STATE, TAG, "not an HTTPS server");
+  mainListener.certificate = certificate;
+  mainListener.privateKey = privateKey;
+  ESP_RETURN_ON_ERROR(UpdateIfEnabled(Update::restart), TAG, "update failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool HttpServer::GetSessionTickets() {
+  LockGuard lg(*this);
+  return sessionTickets;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetSessionTickets(bool enabled) {
+  LockGuard lg(*this);
+  bool https = false;
+  for (auto listener : GetListeners())
+    https |= listener->https;
+  ESP_RETURN_ON_FALSE(https, ESP_ERR_INVALID_STATE, TAG, "no HTTPS listener");
+#ifndef CONFIG_ESP_TLS_SERVER_SESSION_TICKETS
+  ESP_RETURN_ON_FALSE(!enabled, ESP_ERR_NOT_SUPPORTED, TAG, "session tickets are disabled in the configuration");
+#endif
+  if (enabled == sessionTickets)
     return ESP_OK;
-  ESP_RETURN_ON_ERROR(Disable(), TAG, "disable failed");
-  ESP_RETURN_ON_ERROR(Enable(), TAG, "enable failed");
+  sessionTickets = enabled;
+  ESP_RETURN_ON_ERROR(UpdateIfEnabled(Update::restart), TAG, "update failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
-HttpServer::Transaction::Transaction(HttpServer& server, httpd_req_t* req) :
-  server(server), req(req), networkStream(std::make_shared<NetworkStream>(httpd_req_to_sockfd(req))) {}
+HttpTlsStatistics HttpServer::GetTlsStatistics() {
+  LockGuard lg(tlsStatisticsMutex);
+  return tlsStatistics;
+}
 
 //==============================================================================
 
-esp_err_t HttpServer::Transaction::ReadRequestBody(void* dest, size_t size) {
-  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
-  if (!size)
+esp_err_t HttpServer::ResetTlsStatistics() {
+  LockGuard lg(tlsStatisticsMutex);
+  tlsStatistics = {};
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpTracer* HttpServer::GetTracer() {
+  return tracer;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetTracer(HttpTracer* tracer) {
+  this->tracer = tracer;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpServer::GetDrainTimeout() {
+  LockGuard lg(*this);
+  return drainTimeout;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetDrainTimeout(TickType_t timeout) {
+  LockGuard lg(*this);
+  this->drainTimeout = timeout;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetClientRateLimit(uint32_t rate, uint32_t burstSize) {
+  LockGuard lg(*this, admissionMutex);
+  ESP_RETURN_ON_FALSE(!rate || burstSize, ESP_ERR_INVALID_ARG, TAG, "invalid burst size");
+  if (!rate) {
+    clientRateLimiter.store(NULL);
     return ESP_OK;
+  }
+  std::shared_ptr<HttpRateLimiter> rateLimiter(new (std::nothrow) HttpRateLimiter(numberOfRateLimitedClients, rate, burstSize));
+  ESP_RETURN_ON_FALSE(rateLimiter, ESP_ERR_NO_MEM, TAG, "rate limiter allocation failed");
+  clientRateLimiter = std::move(rateLimiter);
+  return ESP_OK;
+}
 
-  TimeOut_t xTimeOut;
-  vTaskSetTimeOutState(&xTimeOut);
-  TickType_t remainingTimeout = server.readTimeout;
+//==============================================================================
 
-  int res = 0;
-  do {
-    if (dest) {
-      res = httpd_req_recv(req, (char*)dest, size);
-      if (res > 0) {
-        size -= res;
-        dest = (uint8_t*)dest + res;
-      }
-    }
-    else {
-      constexpr size_t discardBufferSize = 64;
-      char discardBuffer[discardBufferSize];
-      res = httpd_req_recv(req, discardBuffer, std::min(size, discardBufferSize));
-      if (res > 0)
-        size -= res;
+esp_err_t HttpServer::AddRouteRateLimit(const std::string& uriPrefix, uint32_t rate, uint32_t burstSize) {
+  LockGuard lg(*this, admissionMutex);
+  ESP_RETURN_ON_FALSE(rate && burstSize, ESP_ERR_INVALID_ARG, TAG, "invalid rate or burst size");
+  std::shared_ptr<HttpRateLimiter> rateLimiter(new (std::nothrow) HttpRateLimiter(1, rate, burstSize));
+  ESP_RETURN_ON_FALSE(rateLimiter, ESP_ERR_NO_MEM, TAG, "rate limiter allocation failed");
+  // The admitted requests keep using the previous table, so the changed one is a copy
+  std::shared_ptr<const RouteRateLimiters> currentRateLimiters = routeRateLimiters;
+  std::shared_ptr<RouteRateLimiters> newRateLimiters(currentRateLimiters ? new RouteRateLimiters(*currentRateLimiters) : new RouteRateLimiters());
+  for (auto& routeRateLimiter : *newRateLimiters) {
+    if (routeRateLimiter.first == uriPrefix) {
+      routeRateLimiter.second = std::move(rateLimiter);
+      break;
     }
-  } while (size && res > 0 && xTaskCheckForTimeOut(&xTimeOut, &remainingTimeout) == pdFALSE);
+  }
+  if (rateLimiter)
+    newRateLimiters->emplace_back(uriPrefix, std::move(rateLimiter));
+  routeRateLimiters = std::move(newRateLimiters);
+  return ESP_OK;
+}
 
-  if (!size)
-    return ESP_OK;
+//==============================================================================
 
-  if (res > 0 || res == HTTPD_SOCK_ERR_TIMEOUT) {
-    responseWritten = true;
-    httpd_resp_send_408(req);
-    ESP_RETURN_ON_ERROR(ESP_ERR_TIMEOUT, TAG, "timeout");
+esp_err_t HttpServer::RemoveRouteRateLimit(const std::string& uriPrefix) {
+  LockGuard lg(*this, admissionMutex);
+  std::shared_ptr<const RouteRateLimiters> currentRateLimiters = routeRateLimiters;
+  for (size_t i = 0; currentRateLimiters && i < currentRateLimiters->size(); i++) {
+    if ((*currentRateLimiters)[i].first == uriPrefix) {
+      std::shared_ptr<RouteRateLimiters> newRateLimiters(new RouteRateLimiters(*currentRateLimiters));
+      newRateLimiters->erase(newRateLimiters->begin() + i);
+      routeRateLimiters = std::move(newRateLimiters);
+      return ESP_OK;
+    }
   }
-  ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "request receive failed");
+  ESP_RETURN_ON_ERROR(ESP_ERR_NOT_FOUND, TAG, "route rate limit not found");
   return ESP_OK;
 }
 
 //==============================================================================
 
-esp_err_t HttpServer::Transaction::WriteResponse(uint16_t statusCode, const void* body, size_t bodySize) {
-  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+size_t HttpServer::GetMaxNumberOfConcurrentRequests() {
+  LockGuard lg(*this);
+  return maxNumberOfConcurrentRequests;
+}
 
-  std::string status = std::to_string(statusCode) + " ";
-  auto statusCodeIterator = httpStatusCodeMap.find(statusCode);
-  if (statusCodeIterator != httpStatusCodeMap.end())
-    status += statusCodeIterator->second;
-  ESP_RETURN_ON_ERROR(httpd_resp_set_status(req, status.c_str()), TAG, "set status failed");
-  responseWritten = true;
-  ESP_RETURN_ON_ERROR(httpd_resp_send(req, (char*)body, bodySize), TAG, "response send failed");
+//==============================================================================
+
+esp_err_t HttpServer::SetMaxNumberOfConcurrentRequests(size_t maxNumberOfRequests) {
+  LockGuard lg(*this, admissionMutex);
+  this->maxNumberOfConcurrentRequests = maxNumberOfRequests;
   return ESP_OK;
 }
 
 //==============================================================================
 
-std::shared_ptr<NetworkStream> HttpServer::Transaction::GetNetworkStream() {
-  return networkStream;
+esp_err_t HttpServer::AddCoalescedRoute(const std::string& uriPrefix, const std::vector<std::string>& varyHeaders, TickType_t reuseTime,
+                                      size_t maxBodySize) {
+  LockGuard lg(*this, coalescingMutex);
+  for (auto& coalescedRoute : coalescedRoutes) {
+    if (coalescedRoute.uriPrefix == uriPrefix) {
+      coalescedRoute.varyHeaders = varyHeaders;
+      coalescedRoute.reuseTime = reuseTime;
+      coalescedRoute.maxBodySize = maxBodySize;
+      return ESP_OK;
+    }
+  }
+  coalescedRoutes.push_back({uriPrefix, varyHeaders, reuseTime, maxBodySize});
+  return ESP_OK;
 }
 
 //==============================================================================
 
-HttpMethod HttpServer::Transaction::GetRequestMethod() {
-  auto method = httpMethodMap.find(req->method);
-  return method != httpMethodMap.end() ? method->second : HttpMethod::unknown;
+esp_err_t HttpServer::RemoveCoalescedRoute(const std::string& uriPrefix) {
+  LockGuard lg(*this, coalescingMutex);
+  for (auto coalescedRoute = coalescedRoutes.begin(); coalescedRoute != coalescedRoutes.end(); coalescedRoute++) {
+    if (coalescedRoute->uriPrefix == uriPrefix) {
+      coalescedRoutes.erase(coalescedRoute);
+      return ESP_OK;
+    }
+  }
+  ESP_RETURN_ON_ERROR(ESP_ERR_NOT_FOUND, TAG, "coalesced route not found");
+  return ESP_OK;
 }
 
 //==============================================================================
 
-esp_err_t HttpServer::Transaction::GetRequestUri(std::string& uri) {
-  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+esp_err_t HttpServer::AddCorsRoute(const std::string& uriPrefix, const HttpCorsPolicy& policy) {
+  LockGuard lg(*this, corsMutex);
+  CorsRoute corsRoute = {uriPrefix, policy, {}};
+  snprintf(corsRoute.maxAge, sizeof(corsRoute.maxAge), "%u", (unsigned int)policy.maxAge);
+  for (auto& existingCorsRoute : corsRoutes) {
+    if (existingCorsRoute.uriPrefix == uriPrefix) {
+      existingCorsRoute = std::move(corsRoute);
+      return ESP_OK;
+    }
+  }
+  corsRoutes.push_back(std::move(corsRoute));
+  return ESP_OK;
+}
 
-  uri = req->uri;
+//==============================================================================
+
+esp_err_t HttpServer::RemoveCorsRoute(const std::string& uriPrefix) {
+  LockGuard lg(*this, corsMutex);
+  for (auto corsRoute = corsRoutes.begin(); corsRoute != corsRoutes.end(); corsRoute++) {
+    if (corsRoute->uriPrefix == uriPrefix) {
+      corsRoutes.erase(corsRoute);
+      return ESP_OK;
+    }
+  }
+  ESP_RETURN_ON_ERROR(ESP_ERR_NOT_FOUND, TAG, "CORS route not found");
   return ESP_OK;
 }
 
 //==============================================================================
 
-esp_err_t HttpServer::Transaction::GetRequestHeader(const std::string& name, std::string& value) {
-  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
-  
-  size_t valueSize = httpd_req_get_hdr_value_len(req, name.c_str()) + 1;
-  std::unique_ptr<char[]> tempValue(new char[valueSize]);
-  ESP_RETURN_ON_ERROR(httpd_req_get_hdr_value_str(req, name.c_str(), (char*)(tempValue.get()), valueSize), TAG, "get header value string failed");
-  value = tempValue.get();
+esp_err_t HttpServer::AddListener(uint16_t port, size_t headerBufferSize) {
+  Listener listener;
+  listener.port = port;
+  listener.headerBuffer = std::make_shared<Buffer>(headerBufferSize);
+  return AddListener(listener);
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::AddListener(uint16_t port, const char* certificate, const char* privateKey, size_t headerBufferSize) {
+  Listener listener;
+  listener.port = port;
+  listener.https = true;
+  listener.certificate = certificate;
+  listener.privateKey = privateKey;
+  listener.headerBuffer = std::make_shared<Buffer>(headerBufferSize);
+  return AddListener(listener);
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::AddRedirectListener(uint16_t port, uint16_t httpsPort) {
+  Listener listener;
+  listener.port = port;
+  listener.redirectPort = httpsPort;
+  return AddListener(listener);
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::RemoveListener(uint16_t port) {
+  // The listener is moved out of the list under the lock: its address stays valid for its requests until its server is stopped
+  std::list<Listener> removedListeners;
+  {
+    LockGuard lg(*this);
+    auto listener = listeners.begin();
+    while (listener != listeners.end() && listener->port != port)
+      listener++;
+    ESP_RETURN_ON_FALSE(listener != listeners.end(), ESP_ERR_NOT_FOUND, TAG, "listener not found");
+    removedListeners.splice(removedListeners.begin(), listeners, listener);
+  }
+
+  // The server is stopped without holding the lock as its task may be waiting for it
+  Listener& removedListener = removedListeners.front();
+  if (removedListener.handle)
+    ESP_RETURN_ON_ERROR(StopServer(removedListener.handle), TAG, "stop failed");
   return ESP_OK;
 }
 
 //==============================================================================
 
-size_t HttpServer::Transaction::GetRequestBodySize() {
-  return req->content_len;
+esp_err_t HttpServer::HandleRequest(httpd_req_t* req) {
+  Listener& listener = *(Listener*)req->user_ctx;
+  HttpServer& server = *listener.server;
+  if (listener.redirectPort)
+    return RedirectRequest(req, listener.redirectPort);
+  // Admission control does not take the server lock, so that requests arriving on the draining listener
+  // are not queued behind the running transaction only to be rejected
+  uint32_t retryAfter = 0;
+  uint16_t statusCode = server.AdmitRequest(req, retryAfter);
+  if (statusCode)
+    return RejectRequest(req, statusCode, retryAfter);
+
+  // A CORS preflight request on a CORS route is answered by the server. Other OPTIONS requests are passed to the request handler.
+  esp_err_t err;
+  if (req->method != HTTP_OPTIONS || !server.HandlePreflightRequest(req, err))
+    err = HandleAdmittedRequest(req);
+  server.numberOfConcurrentRequests--;
+  return err;
 }
 
 //==============================================================================
 
-esp_err_t HttpServer::Transaction::SetResponseHeader(const std::string& name, const std::string& value) {
-  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+esp_err_t HttpServer::HandleAdmittedRequest(httpd_req_t* req) {
+  Listener& listener = *(Listener*)req->user_ctx;
+  HttpServer& server = *listener.server;
 
-  char*& headerDataEnd = server.headerDataEnd;
-  ESP_RETURN_ON_FALSE(headerDataEnd - (char*)server.headerBuffer->data + name.size() + value.size() + 2 <= server.headerBuffer->size, \
-                      ESP_ERR_INVALID_SIZE, TAG, "header buffer is too small");
-  char* nameStr = headerDataEnd;
-  memcpy(headerDataEnd, name.c_str(), name.size() + 1);
-  headerDataEnd += name.size() + 1;
-  char* valueStr = headerDataEnd;
-  memcpy(headerDataEnd, value.c_str(), value.size() + 1);
-  headerDataEnd += value.size() + 1;
+  // Only the header buffer of the listener is locked, so that the listeners handle requests concurrently.
+  LockGuard lg(*listener.headerBuffer);
+  Transaction transaction(server, listener, req);
+  listener.headerDataEnd = (char*)listener.headerBuffer->data;
+
+  Connection* connection = (Connection*)req->sess_ctx;
+  size_t maxNumberOfRequestsPerConnection = server.maxNumberOfRequestsPerConnection;
+  if (connection && maxNumberOfRequestsPerConnection && ++connection->numberOfRequests >= maxNumberOfRequestsPerConnection)
+    transaction.CloseConnectionAfterResponse();
 
-  ESP_RETURN_ON_ERROR(httpd_resp_set_hdr(req, nameStr, valueStr), TAG, "set header failed");
+  // The trace headers are only read if the tracer is set, so a server without the tracer does not pay for tracing.
+  // The tracer is loaded once: the span is recorded to the tracer it has begun with even if the tracer is changed meanwhile.
+  HttpTracer* tracer = server.tracer.load();
+  HttpTraceContext traceContext;
+  HttpSpan traceSpan;
+  const HttpTraceContext* previousTraceContext = tracer ? BeginTraceSpan(transaction, req, traceContext, traceSpan) : NULL;
+
+  server.SetCorsResponseHeaders(transaction, req);
+  server.requestEvent.Generate(transaction);
+  esp_err_t err = server.HandleCoalescedRequest(transaction, req);
+  if (tracer)
+    traceSpan.responseTime = esp_timer_get_time() - traceSpan.startTime;
+  if (!transaction.IsResponseWritten() && (err != ESP_OK || !transaction.GetRemainingTime()))
+    transaction.WriteResponse(500);
+  // An unfinished chunked response is ended, unless the handler has failed: then the connection is closed to show the body is incomplete
+  if (err == ESP_OK && transaction.IsResponseBodyOpen())
+    err = transaction.EndResponseBody();
+  if (tracer) {
+    HttpTracer::SetCurrentContext(previousTraceContext);
+    HttpTracer::EndSpan(traceSpan, transaction.GetResponseStatusCode());
+    if (traceSpan.flags & HttpTracer::sampledFlag)
+      tracer->Record(traceSpan);
+  }
+  if (transaction.AreSocketTimeoutsChanged())
+    server.SetSocketTimeouts(httpd_req_to_sockfd(req));
+  if (connection)
+    connection->lastActivityTime = xTaskGetTickCount();
+  ESP_RETURN_ON_ERROR(err, TAG, "handle request failed");
+  if (transaction.IsConnectionClosedAfterResponse())
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+  // The client is still waiting for "100 Continue" before sending the body: close the connection instead of draining it
+  if (transaction.IsContinueWithheld())
+    return ESP_FAIL;
   return ESP_OK;
 }
 
 //==============================================================================
 
-bool HttpServer::Transaction::IsResponseWritten() {
-  return responseWritten;
+const HttpTraceContext* HttpServer::BeginTraceSpan(Transaction& transaction, httpd_req_t* req, HttpTraceContext& context, HttpSpan& span) {
+  // A request without a valid "traceparent" header starts a new trace. An invalid or too long "tracestate" header is not propagated.
+  HttpTraceContext parentContext;
+  std::string traceParent;
+  bool traced = transaction.GetRequestHeader("traceparent", traceParent) == ESP_OK && HttpTracer::ParseTraceParent(traceParent, parentContext) == ESP_OK;
+  if (traced && (transaction.GetRequestHeader("tracestate", parentContext.state) != ESP_OK || parentContext.state.size() > HttpTracer::maxTraceStateSize))
+    parentContext.state.clear();
+  HttpTracer::BeginSpan(HttpSpanKind::server, transaction.GetRequestMethod(), req->uri, traced ? &parentContext : NULL, context, span);
+  // The clients used by the request handler send their requests in the context of the span
+  return HttpTracer::SetCurrentContext(&context);
 }
 
 //==============================================================================
 
-}
\ No newline at end of file
+esp_err_t HttpServer::HandleCoalescedRequest(Transaction& transaction, httpd_req_t* req) {
+  // HEAD requests share the responses of GET requests, but do not start a coalesced response: its body may not be generated
+  if ((req->method != HTTP_GET && req->method != HTTP_HEAD) || req->content_len)
+    return HandleRequest(transaction);
+
+  std::shared_ptr<CoalescedResponse> response;
+  bool responseOwner = false;
+  {
+    LockGuard lg(coalescingMutex);
+    auto coalescedRoute = coalescedRoutes.begin();
+    while (coalescedRoute != coalescedRoutes.end() && strncmp(req->uri, coalescedRoute->uriPrefix.c_str(), coalescedRoute->uriPrefix.size()) != 0)
+      coalescedRoute++;
+    if (coalescedRoute != coalescedRoutes.end()) {
+      std::string key = req->uri;
+      std::string value;
+      for (auto& name : coalescedRoute->varyHeaders) {
+        key += '\n';
+        if (transaction.GetRequestHeader(name, value) == ESP_OK)
+          key += value;
+      }
+
+      TickType_t time = xTaskGetTickCount();
+      for (auto coalescedResponse = coalescedResponses.begin(); coalescedResponse != coalescedResponses.end(); ) {
+        if ((*coalescedResponse)->complete && time - (*coalescedResponse)->completionTime >= (*coalescedResponse)->reuseTime)
+          coalescedResponse = coalescedResponses.erase(coalescedResponse);
+        else if ((*coalescedResponse)->key == key)
+          response = *coalescedResponse++;
+        else
+          coalescedResponse++;
+      }
+
+      if (!response && req->method == HTTP_GET) {
+        response = std::make_shared<CoalescedResponse>();
+        response->key = std::move(key);
+        response->reuseTime = coalescedRoute->reuseTime;
+        response->maxBodySize = coalescedRoute->maxBodySize;
+        response->mutex.Lock();
+        coalescedResponses.push_back(response);
+        responseOwner = true;
+      }
+    }
+  }
+  if (!response)
+    return HandleRequest(transaction);
+
+  if (!responseOwner) {
+    // The response is complete when its owner releases the mutex. If the owner fails or does not complete the response
+    // within the read timeout, the request is handled separately.
+    if (response->mutex.Lock(std::min(transaction.GetRemainingTime(), readTimeout.load())) == ESP_OK) {
+      response->mutex.Unlock();
+      if (response->complete)
+        return WriteCoalescedResponse(transaction, *response);
+    }
+    return HandleRequest(transaction);
+  }
+
+  transaction.CaptureResponse(response.get());
+  esp_err_t err = HandleRequest(transaction);
+  {
+    LockGuard lg(coalescingMutex);
+    response->complete = err == ESP_OK && transaction.IsResponseWritten() && !response->bypassed;
+    response->completionTime = xTaskGetTickCount();
+    if (!response->complete || !response->reuseTime)
+      coalescedResponses.remove(response);
+  }
+  // The mutex of a bypassed response has been released when its body exceeded the maximum size
+  if (!response->bypassed)
+    response->mutex.Unlock();
+  return err;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::WriteCoalescedResponse(Transaction& transaction, const CoalescedResponse& response) {
+  const char* headersEnd = response.headers.data() + response.headers.size();
+  for (const char* name = response.headers.data(); name < headersEnd; ) {
+    const char* value = name + strlen(name) + 1;
+    ESP_RETURN_ON_ERROR(transaction.SetResponseHeader(name, value), TAG, "set response header failed");
+    name = value + strlen(value) + 1;
+  }
+  ESP_RETURN_ON_ERROR(transaction.WriteResponse(response.statusCode, response.body.data(), response.body.size()), TAG, "write response failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+uint16_t HttpServer::AdmitRequest(httpd_req_t* req, uint32_t& retryAfter) {
+  // The request is counted before the rate limits are checked, so that the concurrent admissions cannot exceed the limit together.
+  // The rate limiters lock only the shard of the key.
+  size_t maxNumberOfRequests = maxNumberOfConcurrentRequests;
+  if (numberOfConcurrentRequests++ >= maxNumberOfRequests && maxNumberOfRequests) {
+    numberOfConcurrentRequests--;
+    retryAfter = 1;
+    return 503;
+  }
+
+  Connection* connection = (Connection*)req->sess_ctx;
+  std::shared_ptr<HttpRateLimiter> rateLimiter = clientRateLimiter;
+  bool admitted = !rateLimiter || !connection || rateLimiter->TakeToken(connection->addressHash, retryAfter);
+  std::shared_ptr<const RouteRateLimiters> currentRateLimiters = routeRateLimiters;
+  for (size_t i = 0; admitted && currentRateLimiters && i < currentRateLimiters->size(); i++) {
+    auto& routeRateLimiter = (*currentRateLimiters)[i];
+    if (strncmp(req->uri, routeRateLimiter.first.c_str(), routeRateLimiter.first.size()) == 0) {
+      admitted = routeRateLimiter.second->TakeToken(0, retryAfter);
+      break;
+    }
+  }
+  if (admitted)
+    return 0;
+  numberOfConcurrentRequests--;
+  return 429;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::RejectRequest(httpd_req_t* req, uint16_t statusCode, uint32_t retryAfter) {
+  char retryAfterValue[11];
+  snprintf(retryAfterValue, sizeof(retryAfterValue), "%u", (unsigned int)retryAfter);
+  httpd_resp_set_status(req, statusCode == 429 ? "429 Too Many Requests" : "503 Service Unavailable");
+  httpd_resp_set_hdr(req, "Retry-After", retryAfterValue);
+  // The body of a rejected request is not received: the connection is closed instead of draining it
+  if (req->content_len)
+    httpd_resp_set_hdr(req, "Connection", "close");
+  httpd_resp_send(req, NULL, 0);
+  return req->content_len ? ESP_FAIL : ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::RedirectRequest(httpd_req_t* req, uint16_t port) {
+  size_t hostSize = httpd_req_get_hdr_value_len(req, "Host") + 1;
+  std::unique_ptr<char[]> host(new char[hostSize]);
+  std::string location;
+  if (hostSize > 1 && httpd_req_get_hdr_value_str(req, "Host", host.get(), hostSize) == ESP_OK) {
+    // The port of the request is replaced with the HTTPS port. An IPv6 address is enclosed in brackets and contains colons.
+    const char* hostEnd = host[0] == '[' ? strchr(host.get(), ']') : strchr(host.get(), ':');
+    if (host[0] == '[' && hostEnd)
+      hostEnd++;
+    location = "https://" + std::string(host.get(), hostEnd ? hostEnd - host.get() : hostSize - 1);
+    if (port != defaultHttpsPort)
+      location += ":" + std::to_string(port);
+    location += req->uri;
+    httpd_resp_set_status(req, "308 Permanent Redirect");
+    httpd_resp_set_hdr(req, "Location", location.c_str());
+  }
+  else
+    httpd_resp_set_status(req, "400 Bad Request");
+  // The request body is not received: the connection is closed instead of draining it
+  if (req->content_len)
+    httpd_resp_set_hdr(req, "Connection", "close");
+  httpd_resp_send(req, NULL, 0);
+  return req->content_len ? ESP_FAIL : ESP_OK;
+}
+
+//==============================================================================
+
+bool HttpServer::HandlePreflightRequest(httpd_req_t* req, esp_err_t& error) {
+  char origin[maxCorsHeaderValueSize];
+  char requestHeaders[maxCorsHeaderValueSize];
+  if (!httpd_req_get_hdr_value_len(req, "Access-Control-Request-Method") || httpd_req_get_hdr_value_str(req, "Origin", origin, sizeof(origin)) != ESP_OK)
+    return false;
+
+  // The route is locked until the response is sent: httpd keeps the header value pointers
+  LockGuard lg(corsMutex);
+  const CorsRoute* corsRoute = FindCorsRoute(req->uri);
+  if (!corsRoute)
+    return false;
+  const char* allowedOrigin = GetAllowedOrigin(corsRoute->policy, origin);
+  if (!allowedOrigin)
+    httpd_resp_set_status(req, "403 Forbidden");
+  else {
+    const HttpCorsPolicy& policy = corsRoute->policy;
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", allowedOrigin);
+    if (allowedOrigin == origin)
+      httpd_resp_set_hdr(req, "Vary", "Origin");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Methods", policy.allowedMethods.c_str());
+    if (!policy.allowedHeaders.empty())
+      httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", policy.allowedHeaders.c_str());
+    else if (httpd_req_get_hdr_value_str(req, "Access-Control-Request-Headers", requestHeaders, sizeof(requestHeaders)) == ESP_OK)
+      httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", requestHeaders);
+    if (policy.allowCredentials)
+      httpd_resp_set_hdr(req, "Access-Control-Allow-Credentials", "true");
+    httpd_resp_set_hdr(req, "Access-Control-Max-Age", corsRoute->maxAge);
+  }
+  // The request body is not received: the connection is closed instead of draining it
+  if (req->content_len)
+    httpd_resp_set_hdr(req, "Connection", "close");
+  httpd_resp_send(req, NULL, 0);
+  error = req->content_len ? ESP_FAIL : ESP_OK;
+  return true;
+}
+
+//==============================================================================
+
+const HttpServer::CorsRoute* HttpServer::FindCorsRoute(const char* uri) {
+  for (auto& corsRoute : corsRoutes) {
+    if (strncmp(uri, corsRoute.uriPrefix.c_str(), corsRoute.uriPrefix.size()) == 0)
+      return &corsRoute;
+  }
+  return NULL;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::SetCorsResponseHeaders(Transaction& transaction, httpd_req_t* req) {
+  char origin[maxCorsHeaderValueSize];
+  if (httpd_req_get_hdr_value_str(req, "Origin", origin, sizeof(origin)) != ESP_OK)
+    return ESP_OK;
+
+  LockGuard lg(corsMutex);
+  const CorsRoute* corsRoute = FindCorsRoute(req->uri);
+  const char* allowedOrigin = corsRoute ? GetAllowedOrigin(corsRoute->policy, origin) : NULL;
+  if (!allowedOrigin)
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(transaction.SetResponseHeader("Access-Control-Allow-Origin", allowedOrigin), TAG, "set response header failed");
+  if (allowedOrigin == origin)
+    ESP_RETURN_ON_ERROR(transaction.SetResponseHeader("Vary", "Origin"), TAG, "set response header failed");
+  if (corsRoute->policy.allowCredentials)
+    ESP_RETURN_ON_ERROR(transaction.SetResponseHeader("Access-Control-Allow-Credentials", "true"), TAG, "set response header failed");
+  if (!corsRoute->policy.exposedHeaders.empty())
+    ESP_RETURN_ON_ERROR(transaction.SetResponseHeader("Access-Control-Expose-Headers", corsRoute->policy.exposedHeaders.c_str()), TAG, "set response header failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::StartServer(Listener& listener, httpd_handle_t& handle) {
+  numberOfSockets = std::max(maxNumberOfClients.load(), std::min(maxNumberOfClients + 1, (size_t)CONFIG_LWIP_MAX_SOCKETS - 3));
+
+  serverConfig = HTTPD_SSL_CONFIG_DEFAULT();
+  serverConfig.transport_mode = listener.https ? HTTPD_SSL_TRANSPORT_SECURE : HTTPD_SSL_TRANSPORT_INSECURE;
+  serverConfig.servercert = (listener.https && listener.certificate) ? (const uint8_t*)listener.certificate : NULL;
+  serverConfig.servercert_len = (listener.https && listener.certificate) ? strlen(listener.certificate) + 1 : 0;
+  serverConfig.prvtkey_pem = (listener.https && listener.privateKey) ? (const uint8_t*)listener.privateKey : NULL;
+  serverConfig.prvtkey_len = (listener.https && listener.privateKey) ? strlen(listener.privateKey) + 1 : 0;
+#ifdef CONFIG_ESP_TLS_SERVER_SESSION_TICKETS
+  serverConfig.session_tickets = listener.https && sessionTickets;
+#endif
+  serverConfig.httpd.task_priority = taskParameters.priority;
+  serverConfig.httpd.stack_size = taskParameters.stackDepth;
+  serverConfig.httpd.core_id = taskParameters.coreId;
+  serverConfig.httpd.server_port = serverConfig.httpd.ctrl_port = serverConfig.port_secure = serverConfig.port_insecure = listener.port;
+  // One socket above the client limit lets OpenConnection enforce the limit and the LRU purge, so both can be changed without a restart
+  serverConfig.httpd.max_open_sockets = numberOfSockets;
+  serverConfig.httpd.backlog_conn = backlogSize ? backlogSize : maxNumberOfClients.load();
+  serverConfig.httpd.lru_purge_enable = lruPurge;
+  serverConfig.httpd.recv_wait_timeout = readTimeout == portMAX_DELAY ? UINT16_MAX : readTimeout * portTICK_PERIOD_MS / 1000 + 1;
+  serverConfig.httpd.send_wait_timeout = writeTimeout == portMAX_DELAY ? UINT16_MAX : writeTimeout * portTICK_PERIOD_MS / 1000 + 1;
+  serverConfig.httpd.uri_match_fn = httpd_uri_match_wildcard;
+  serverConfig.httpd.global_user_ctx = &listener;
+  serverConfig.httpd.global_user_ctx_free_fn = [](void* ctx) {};
+  serverConfig.httpd.open_fn = OpenConnection;
+  serverConfig.user_cb = listener.https ? HandleTlsSession : NULL;
+#ifdef CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK
+  serverConfig.cert_select_cb = listener.https ? HandleClientHello : NULL;
+#endif
+
+  ESP_RETURN_ON_ERROR(httpd_ssl_start(&handle, &serverConfig), TAG, "start failed");
+
+  httpd_uri_t requestHandlerInfo = {};
+  requestHandlerInfo.uri = "*";
+  requestHandlerInfo.handler = HandleRequest;
+  requestHandlerInfo.user_ctx = &listener;
+  http_method methods[] = {HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS};
+
+  for (uint32_t i = 0; i < sizeof(methods) / sizeof(http_method); i++) {
+    requestHandlerInfo.method = methods[i];
+    esp_err_t error = httpd_register_uri_handler(handle, &requestHandlerInfo);
+    if (error != ESP_OK) {
+      httpd_ssl_stop(handle);
+      handle = NULL;
+      ESP_RETURN_ON_ERROR(error, TAG, "register URI handler failed");
+    }
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::StopServer(httpd_handle_t& handle) {
+  if (httpd_unregister_uri(handle, "*") != ESP_OK)
+    ESP_LOGE(TAG, "unregister URI failed");
+  esp_err_t error = httpd_ssl_stop(handle);
+  handle = NULL;
+  ESP_RETURN_ON_ERROR(error, TAG, "stop failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::AddListener(const Listener& listener) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(listener.port != mainListener.port, ESP_ERR_INVALID_ARG, TAG, "port is used by another listener");
+  for (auto& otherListener : listeners)
+    ESP_RETURN_ON_FALSE(listener.port != otherListener.port, ESP_ERR_INVALID_ARG, TAG, "port is used by another listener");
+
+  // The list keeps the listener address unchanged: it is the context of the listener server and its requests
+  listeners.push_back(listener);
+  Listener& newListener = listeners.back();
+  newListener.server = this;
+  if (enabled) {
+    esp_err_t error = StartServer(newListener, newListener.handle);
+    if (error != ESP_OK) {
+      listeners.pop_back();
+      ESP_RETURN_ON_ERROR(error, TAG, "start failed");
+    }
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+std::vector<HttpServer::Listener*> HttpServer::GetListeners() {
+  std::vector<Listener*> allListeners = {&mainListener};
+  for (auto& listener : listeners)
+    allListeners.push_back(&listener);
+  return allListeners;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::UpdateIfEnabled(Update update) {
+  if (updateDepth) {
+    pendingUpdate = std::max(pendingUpdate, update);
+    return ESP_OK;
+  }
+  if (!enabled || update == Update::none)
+    return ESP_OK;
+
+  if (update == Update::rebind) {
+    // The port may have been changed back during the update. A port still bound by a draining server is freed by the restart.
+    if (mainListener.port == boundPort)
+      return ESP_OK;
+    // The ports of the servers being stopped by the stop tasks are not known, so the server is restarted while any of them runs
+    bool portBound = (drainingServerHandle && mainListener.port == drainingServerPort) || numberOfStopTasks;
+    for (auto& stoppingServer : stoppingServers)
+      portBound |= mainListener.port == stoppingServer.second;
+    if (portBound)
+      update = Update::restart;
+  }
+
+  switch (update) {
+    case Update::live: {
+      for (auto listener : GetListeners()) {
+        int clientSockets[CONFIG_LWIP_MAX_SOCKETS];
+        size_t numberOfClients = CONFIG_LWIP_MAX_SOCKETS;
+        if (httpd_get_client_list(listener->handle, &numberOfClients, clientSockets) == ESP_OK) {
+          for (size_t i = 0; i < numberOfClients; i++) {
+            SetSocketTimeouts(clientSockets[i]);
+            ApplySocketOptions(clientSockets[i]);
+          }
+        }
+        ESP_RETURN_ON_ERROR(httpd_queue_work(listener->handle, SetTaskPriority, (void*)(uintptr_t)taskParameters.priority), TAG, "queue work failed");
+      }
+      ESP_RETURN_ON_ERROR(UpdateMaintenanceTimer(), TAG, "maintenance timer update failed");
+      return ESP_OK;
+    }
+
+    case Update::rebind: {
+      // The previous listener is replaced by a new one. The previous listener does not accept new connections and is stopped
+      // when its clients disconnect or the drain timeout expires. A listener that is still draining is stopped at once.
+      httpd_handle_t newServerHandle = NULL;
+      ESP_RETURN_ON_ERROR(StartServer(mainListener, newServerHandle), TAG, "start failed");
+      if (drainingServerHandle)
+        stoppingServers.push_back({drainingServerHandle, drainingServerPort});
+      drainingServerHandle = mainListener.handle;
+      drainingServerPort = boundPort;
+      mainListener.handle = newServerHandle;
+      boundPort = mainListener.port;
+      drainStartTime = xTaskGetTickCount();
+      ESP_RETURN_ON_ERROR(UpdateMaintenanceTimer(), TAG, "maintenance timer update failed");
+      return ESP_OK;
+    }
+
+    default:
+      ESP_RETURN_ON_ERROR(Disable(), TAG, "disable failed");
+      ESP_RETURN_ON_ERROR(Enable(), TAG, "enable failed");
+      return ESP_OK;
+  }
+}
+
+//==============================================================================
+
+void HttpServer::SetSocketTimeouts(int sockfd) {
+  SetSocketTimeout(sockfd, SO_RCVTIMEO, readTimeout);
+  SetSocketTimeout(sockfd, SO_SNDTIMEO, writeTimeout);
+}
+
+//==============================================================================
+
+void HttpServer::ApplySocketOptions(int sockfd) {
+  // Unsupported options are ignored. The open callback does not take the server lock, so the options are read from a snapshot.
+  std::shared_ptr<const HttpSocketOptions> socketOptions = this->socketOptions.load();
+  int noDelay = socketOptions->noDelay;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  int bufferSize = socketOptions->sendBufferSize;
+  if (bufferSize)
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+  bufferSize = socketOptions->receiveBufferSize;
+  if (bufferSize)
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+  int keepAliveIdleTime = socketOptions->keepAliveIdleTime;
+  int keepAlive = keepAliveIdleTime ? 1 : 0;
+  setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(keepAlive));
+  if (keepAlive) {
+    int keepAliveInterval = socketOptions->keepAliveInterval;
+    int keepAliveCount = socketOptions->keepAliveCount;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &keepAliveIdleTime, sizeof(keepAliveIdleTime));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &keepAliveInterval, sizeof(keepAliveInterval));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, &keepAliveCount, sizeof(keepAliveCount));
+  }
+}
+
+//==============================================================================
+
+void HttpServer::SetSocketTimeout(int sockfd, int option, TickType_t timeout) {
+  struct timeval time = {};
+  if (timeout != portMAX_DELAY) {
+    time.tv_sec = timeout * portTICK_PERIOD_MS / 1000;
+    time.tv_usec = timeout * portTICK_PERIOD_MS % 1000 * 1000;
+  }
+  setsockopt(sockfd, SOL_SOCKET, option, &time, sizeof(time));
+}
+
+//==============================================================================
+
+void HttpServer::SetTaskPriority(void* arg) {
+  vTaskPrioritySet(NULL, (UBaseType_t)(uintptr_t)arg);
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::UpdateMaintenanceTimer() {
+  esp_timer_stop(maintenanceTimer);
+  if (idleTimeout == portMAX_DELAY && !drainingServerHandle && stoppingServers.empty())
+    return ESP_OK;
+  uint64_t period = maxMaintenancePeriodMs * 1000;
+  if (idleTimeout != portMAX_DELAY)
+    period = std::max(std::min((uint64_t)idleTimeout * portTICK_PERIOD_MS / 4, maxMaintenancePeriodMs), (uint64_t)1) * 1000;
+  ESP_RETURN_ON_ERROR(esp_timer_start_periodic(maintenanceTimer, period), TAG, "maintenance timer start failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpServer::HandleMaintenanceTimer(void* arg) {
+  HttpServer& server = *(HttpServer*)arg;
+  // The check is skipped if the server is being configured
+  if (server.Lock(0) != ESP_OK)
+    return;
+  if (!server.enabled) {
+    server.Unlock();
+    return;
+  }
+
+  if (server.idleTimeout != portMAX_DELAY) {
+    for (auto listener : server.GetListeners())
+      httpd_queue_work(listener->handle, CloseIdleConnections, listener);
+  }
+
+  std::vector<std::pair<httpd_handle_t, uint16_t>> drainedServers;
+  drainedServers.swap(server.stoppingServers);
+  if (server.drainingServerHandle) {
+    int clientSockets[CONFIG_LWIP_MAX_SOCKETS];
+    size_t numberOfClients = CONFIG_LWIP_MAX_SOCKETS;
+    if (httpd_get_client_list(server.drainingServerHandle, &numberOfClients, clientSockets) != ESP_OK || !numberOfClients ||
+        xTaskGetTickCount() - server.drainStartTime >= server.drainTimeout) {
+      drainedServers.push_back({server.drainingServerHandle, server.drainingServerPort});
+      server.drainingServerHandle = NULL;
+    }
+  }
+  // The servers are stopped by a task: stopping a server waits for its request handlers, which would block all esp_timer callbacks.
+  // If the task cannot be created, the servers are stopped at the next check.
+  if (!drainedServers.empty()) {
+    if (server.StartStopTask(drainedServers) != ESP_OK)
+      server.stoppingServers.insert(server.stoppingServers.end(), drainedServers.begin(), drainedServers.end());
+    server.UpdateMaintenanceTimer();
+  }
+  server.Unlock();
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::StartStopTask(const std::vector<std::pair<httpd_handle_t, uint16_t>>& servers) {
+  StopTask* stopTask = new (std::nothrow) StopTask{this, {}};
+  ESP_RETURN_ON_FALSE(stopTask, ESP_ERR_NO_MEM, TAG, "stop task allocation failed");
+  for (auto& server : servers)
+    stopTask->handles.push_back(server.first);
+  numberOfStopTasks++;
+  if (xTaskCreatePinnedToCore(StopTaskCode, "pl_http_stop", taskParameters.stackDepth, stopTask, taskParameters.priority, NULL,
+                              taskParameters.coreId) != pdPASS) {
+    numberOfStopTasks--;
+    delete stopTask;
+    ESP_RETURN_ON_ERROR(ESP_ERR_NO_MEM, TAG, "stop task create failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpServer::StopTaskCode(void* parameters) {
+  StopTask* stopTask = (StopTask*)parameters;
+  // The listeners are stopped without holding the lock as their tasks may be waiting for it. Disable waits for the task.
+  for (auto handle : stopTask->handles)
+    httpd_ssl_stop(handle);
+  HttpServer& server = *stopTask->server;
+  delete stopTask;
+  server.numberOfStopTasks--;
+  vTaskDelete(NULL);
+}
+
+//==============================================================================
+
+void HttpServer::CloseIdleConnections(void* arg) {
+  Listener& listener = *(Listener*)arg;
+  HttpServer& server = *listener.server;
+  // The lock is not waited for: Disable holds it while waiting for the server task to stop
+  if (server.Lock(0) != ESP_OK)
+    return;
+  httpd_handle_t serverHandle = listener.handle;
+  TickType_t idleTimeout = server.enabled ? server.idleTimeout.load() : portMAX_DELAY;
+  server.Unlock();
+  if (idleTimeout == portMAX_DELAY)
+    return;
+
+  int clientSockets[CONFIG_LWIP_MAX_SOCKETS];
+  size_t numberOfClients = CONFIG_LWIP_MAX_SOCKETS;
+  if (httpd_get_client_list(serverHandle, &numberOfClients, clientSockets) != ESP_OK)
+    return;
+  TickType_t time = xTaskGetTickCount();
+  for (size_t i = 0; i < numberOfClients; i++) {
+    Connection* connection = (Connection*)httpd_sess_get_ctx(serverHandle, clientSockets[i]);
+    if (connection && time - connection->lastActivityTime >= idleTimeout)
+      httpd_sess_trigger_close(serverHandle, clientSockets[i]);
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::OpenConnection(httpd_handle_t handle, int sockfd) {
+  // The server lock is not taken here: the server task must not block on it (see HandleMaintenanceTimer).
+  // The configuration fields read here are atomic.
+  Listener& listener = *(Listener*)httpd_get_global_user_ctx(handle);
+  HttpServer& server = *listener.server;
+  if (handle == server.drainingServerHandle)
+    return ESP_FAIL;
+
+  int clientSockets[CONFIG_LWIP_MAX_SOCKETS];
+  size_t numberOfClients = CONFIG_LWIP_MAX_SOCKETS;
+  ESP_RETURN_ON_ERROR(httpd_get_client_list(handle, &numberOfClients, clientSockets), TAG, "get client list failed");
+  if (numberOfClients > server.maxNumberOfClients) {
+    ESP_RETURN_ON_FALSE(server.lruPurge, ESP_FAIL, TAG, "too many clients");
+    Connection* lruConnection = NULL;
+    int lruSocket = -1;
+    for (size_t i = 0; i < numberOfClients; i++) {
+      Connection* connection = (Connection*)httpd_sess_get_ctx(handle, clientSockets[i]);
+      if (clientSockets[i] != sockfd && connection && (!lruConnection || (TickType_t)(connection->lastActivityTime - lruConnection->lastActivityTime) > portMAX_DELAY / 2)) {
+        lruConnection = connection;
+        lruSocket = clientSockets[i];
+      }
+    }
+    if (lruSocket >= 0)
+      httpd_sess_trigger_close(handle, lruSocket);
+  }
+
+  server.SetSocketTimeouts(sockfd);
+  server.ApplySocketOptions(sockfd);
+  if (listener.https)
+    server.UpdateTlsStatistics();
+
+  Connection* connection = server.AllocateConnection();
+  ESP_RETURN_ON_FALSE(connection, ESP_ERR_NO_MEM, TAG, "connection allocation failed");
+  connection->lastActivityTime = xTaskGetTickCount();
+  connection->numberOfRequests = 0;
+  connection->addressHash = 0;
+  connection->networkStream = std::make_shared<NetworkStream>(sockfd);
+
+  // The client rate limit key is the FNV-1a hash of the remote address (the port is excluded, so that reconnecting does not reset the limit)
+  struct sockaddr_storage address = {};
+  socklen_t addressSize = sizeof(address);
+  if (getpeername(sockfd, (struct sockaddr*)&address, &addressSize) == 0) {
+    const uint8_t* addressData = (const uint8_t*)&((struct sockaddr_in*)&address)->sin_addr;
+    size_t addressDataSize = sizeof(struct in_addr);
+    if (address.ss_family == AF_INET6) {
+      addressData = (const uint8_t*)&((struct sockaddr_in6*)&address)->sin6_addr;
+      addressDataSize = sizeof(struct in6_addr);
+    }
+    connection->addressHash = 2166136261;
+    for (size_t i = 0; i < addressDataSize; i++)
+      connection->addressHash = (connection->addressHash ^ addressData[i]) * 16777619;
+  }
+  httpd_sess_set_ctx(handle, sockfd, connection, FreeConnection);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpServer::Connection::Connection(HttpServer& server) : server(server), arena(arenaSize, arenaCaps) {}
+
+//==============================================================================
+
+HttpServer::Connection* HttpServer::AllocateConnection() {
+  {
+    LockGuard lg(connectionPoolMutex);
+    if (freeConnections) {
+      Connection* connection = freeConnections;
+      freeConnections = connection->nextFreeConnection;
+      return connection;
+    }
+  }
+  return new (std::nothrow) Connection(*this);
+}
+
+//==============================================================================
+
+void HttpServer::FreeConnection(void* ctx) {
+  Connection* connection = (Connection*)ctx;
+  connection->networkStream.reset();
+  LockGuard lg(connection->server.connectionPoolMutex);
+  connection->nextFreeConnection = connection->server.freeConnections;
+  connection->server.freeConnections = connection;
+}
+
+//==============================================================================
+
+void HttpServer::DeleteFreeConnections() {
+  LockGuard lg(connectionPoolMutex);
+  while (freeConnections) {
+    Connection* connection = freeConnections;
+    freeConnections = connection->nextFreeConnection;
+    delete connection;
+  }
+}
+
+//==============================================================================
+
+#ifdef CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK
+
+int HttpServer::HandleClientHello(mbedtls_ssl_context* ssl) {
+  // The certificate selection callback is called when the client hello has been parsed. The configured certificate is kept.
+  // A session restored from the session ticket of the client hello already has its cipher suite, a new one has not got it yet.
+  handshakeStartTime = esp_timer_get_time();
+  handshakeResumed = ssl->MBEDTLS_PRIVATE(session_negotiate)->MBEDTLS_PRIVATE(ciphersuite) != 0;
+  return 0;
+}
+
+#endif
+
+//==============================================================================
+
+void HttpServer::HandleTlsSession(esp_https_server_user_cb_arg_t* arg) {
+  // The session is created when the handshake has completed, just before the open callback
+  if (arg->user_cb_state != HTTPD_SSL_USER_CB_SESS_CREATE)
+    return;
+  handshakeTime = handshakeStartTime ? esp_timer_get_time() - handshakeStartTime : 0;
+  handshakeStartTime = 0;
+}
+
+//==============================================================================
+
+void HttpServer::UpdateTlsStatistics() {
+  LockGuard lg(tlsStatisticsMutex);
+  tlsStatistics.numberOfHandshakes++;
+  if (handshakeResumed) {
+    tlsStatistics.numberOfResumedHandshakes++;
+    tlsStatistics.resumedHandshakeTime += handshakeTime;
+  }
+  else
+    tlsStatistics.fullHandshakeTime += handshakeTime;
+  handshakeResumed = false;
+  handshakeTime = 0;
+}
+
+//==============================================================================
+
+HttpServer::Transaction::Transaction(HttpServer& server, Listener& listener, httpd_req_t* req) :
+    server(server), listener(listener), req(req),
+    networkStream(req->sess_ctx ? ((Connection*)req->sess_ctx)->networkStream : std::make_shared<NetworkStream>(httpd_req_to_sockfd(req))),
+    arena(req->sess_ctx ? ((Connection*)req->sess_ctx)->arena : emptyArena),
+    startTime(xTaskGetTickCount()), requestTimeout(server.requestTimeout), requestBodyRemainingSize(req->content_len), headRequest(req->method == HTTP_HEAD) {
+  constexpr char expectContinue[] = "100-continue";
+  char expect[sizeof(expectContinue)];
+  continueExpected = requestBodyRemainingSize && httpd_req_get_hdr_value_len(req, "Expect") == strlen(expectContinue) &&
+                     httpd_req_get_hdr_value_str(req, "Expect", expect, sizeof(expect)) == ESP_OK && strcasecmp(expect, expectContinue) == 0;
+}
+
+//==============================================================================
+
+HttpServer::Transaction::~Transaction() {
+  arena.Reset();
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::ReadRequestBody(void* dest, size_t size) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+  if (!size)
+    return ESP_OK;
+
+  if (continueExpected && !continueSent) {
+    constexpr char continueResponse[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    ESP_RETURN_ON_FALSE(httpd_send(req, continueResponse, sizeof(continueResponse) - 1) == sizeof(continueResponse) - 1, ESP_FAIL, TAG, "continue response send failed");
+    continueSent = true;
+  }
+
+  TimeOut_t xTimeOut;
+  vTaskSetTimeOutState(&xTimeOut);
+  TickType_t remainingTimeout = std::min(server.readTimeout.load(), GetRemainingTime());
+
+  int res = remainingTimeout ? 0 : HTTPD_SOCK_ERR_TIMEOUT;
+  while (size && remainingTimeout) {
+    // The socket timeout is limited by the request deadline so that a single receive cannot exceed it
+    if (requestTimeout != portMAX_DELAY) {
+      SetSocketTimeout(httpd_req_to_sockfd(req), SO_RCVTIMEO, remainingTimeout);
+      socketTimeoutsChanged = true;
+    }
+
+    if (dest) {
+      res = httpd_req_recv(req, (char*)dest, size);
+      if (res > 0) {
+        size -= res;
+        requestBodyRemainingSize -= res;
+        dest = (uint8_t*)dest + res;
+      }
+    }
+    else {
+      constexpr size_t discardBufferSize = 64;
+      char discardBuffer[discardBufferSize];
+      res = httpd_req_recv(req, discardBuffer, std::min(size, discardBufferSize));
+      if (res > 0) {
+        size -= res;
+        requestBodyRemainingSize -= res;
+      }
+    }
+
+    if (res <= 0 || xTaskCheckForTimeOut(&xTimeOut, &remainingTimeout) == pdTRUE)
+      break;
+  }
+
+  if (!size)
+    return ESP_OK;
+
+  if (res > 0 || res == HTTPD_SOCK_ERR_TIMEOUT) {
+    responseWritten = true;
+    httpd_resp_send_408(req);
+    ESP_RETURN_ON_ERROR(ESP_ERR_TIMEOUT, TAG, "timeout");
+  }
+  ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "request receive failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::WriteResponse(uint16_t statusCode, const void* body, size_t bodySize) {
+  ESP_RETURN_ON_ERROR(WriteResponseStatus(statusCode), TAG, "write response status failed");
+  CaptureResponseBody(body, bodySize);
+
+  char contentLength[40];
+  snprintf(contentLength, sizeof(contentLength), "Content-Length: %u\r\n", (unsigned int)bodySize);
+  // The response to a HEAD request has the body size, but not the body
+  esp_err_t error = SendResponse(contentLength, body, headRequest ? 0 : bodySize);
+  // If the arena is too small for the headers, httpd sends the response (the response to a HEAD request then has zero body size)
+  if (error == ESP_ERR_NO_MEM)
+    error = httpd_resp_send(req, headRequest ? NULL : (const char*)body, headRequest ? 0 : bodySize);
+  ESP_RETURN_ON_ERROR(error, TAG, "response send failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::SendResponse(const char* framingHeader, const void* body, size_t bodySize) {
+  // httpd_resp_send writes the status line, every header and the body separately. Instead the response is assembled in the arena
+  // and sent with a single write (the body is written separately if it does not fit). If the headers do not fit either,
+  // nothing is sent and ESP_ERR_NO_MEM is returned. The headers set by SetResponseHeader are stored in the header buffer
+  // as name and value strings one after another.
+  const char* headerData = (const char*)listener.headerBuffer->data;
+  bool contentTypeSet = false;
+  for (const char* name = headerData; name < listener.headerDataEnd; ) {
+    const char* value = name + strlen(name) + 1;
+    contentTypeSet |= strcasecmp(name, "Content-Type") == 0;
+    name = value + strlen(value) + 1;
+  }
+
+  char* response = NULL;
+  size_t responseSize = 0;
+  bool bodyIncluded = false;
+  auto append = [&](const char* data, size_t size) {
+    if (response)
+      memcpy(response + responseSize, data, size);
+    responseSize += size;
+  };
+  // The first pass gets the size, the second one writes the data
+  for (int pass = 0; pass < 2; pass++) {
+    responseSize = 0;
+    append("HTTP/1.1 ", 9);
+    append(status, strlen(status));
+    append("\r\n", 2);
+    if (!contentTypeSet)
+      append("Content-Type: text/html\r\n", 25);
+    append(framingHeader, strlen(framingHeader));
+    for (const char* name = headerData; name < listener.headerDataEnd; ) {
+      const char* value = name + strlen(name) + 1;
+      append(name, strlen(name));
+      append(": ", 2);
+      append(value, strlen(value));
+      append("\r\n", 2);
+      name = value + strlen(value) + 1;
+    }
+    if (closeConnection || IsContinueWithheld())
+      append("Connection: close\r\n", 19);
+    append("\r\n", 2);
+
+    if (pass)
+      break;
+    response = (char*)arena.Allocate(responseSize + bodySize, 1);
+    bodyIncluded = response != NULL;
+    if (!response && !(response = (char*)arena.Allocate(responseSize, 1)))
+      return ESP_ERR_NO_MEM;
+  }
+
+  if (bodyIncluded && bodySize) {
+    memcpy(response + responseSize, body, bodySize);
+    responseSize += bodySize;
+  }
+  ESP_RETURN_ON_ERROR(Send(response, responseSize), TAG, "response send failed");
+  if (!bodyIncluded && bodySize)
+    ESP_RETURN_ON_ERROR(Send(body, bodySize), TAG, "response body send failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::Send(const void* data, size_t size) {
+  for (size_t sentSize = 0; sentSize < size; ) {
+    int res = httpd_send(req, (const char*)data + sentSize, size - sentSize);
+    ESP_RETURN_ON_FALSE(res > 0, ESP_FAIL, TAG, "send failed");
+    sentSize += res;
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::WriteResponseHeaders(uint16_t statusCode) {
+  ESP_RETURN_ON_ERROR(WriteResponseStatus(statusCode), TAG, "write response status failed");
+  chunkedResponseBody = true;
+  // httpd sends the headers with the first chunk. The response to a HEAD request has no chunks, so its headers are sent at once.
+  if (headRequest) {
+    esp_err_t error = SendResponse("Transfer-Encoding: chunked\r\n", NULL, 0);
+    if (error == ESP_ERR_NO_MEM)
+      error = httpd_resp_send(req, NULL, 0);
+    ESP_RETURN_ON_ERROR(error, TAG, "response headers send failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::WriteResponseBody(const void* src, size_t size) {
+  ESP_RETURN_ON_FALSE(chunkedResponseBody, ESP_ERR_INVALID_STATE, TAG, "response headers have not been sent");
+  // A zero-size chunk would end the body
+  if (!size || headRequest)
+    return ESP_OK;
+  if (requestTimeout != portMAX_DELAY) {
+    TickType_t remainingTime = GetRemainingTime();
+    ESP_RETURN_ON_FALSE(remainingTime, ESP_ERR_TIMEOUT, TAG, "request timeout");
+    SetSocketTimeout(httpd_req_to_sockfd(req), SO_SNDTIMEO, std::min(server.writeTimeout.load(), remainingTime));
+  }
+  ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, (const char*)src, size), TAG, "response chunk send failed");
+  CaptureResponseBody(src, size);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::EndResponseBody() {
+  if (!chunkedResponseBody)
+    return ESP_OK;
+  chunkedResponseBody = false;
+  if (headRequest)
+    return ESP_OK;
+  ESP_RETURN_ON_ERROR(httpd_resp_send_chunk(req, NULL, 0), TAG, "response chunk send failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::WriteResponseStatus(uint16_t statusCode) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+
+  TickType_t remainingTime = GetRemainingTime();
+  if (!remainingTime) {
+    responseWritten = true;
+    responseStatusCode = 503;
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_send(req, NULL, 0);
+    ESP_RETURN_ON_ERROR(ESP_ERR_TIMEOUT, TAG, "request timeout");
+  }
+  if (requestTimeout != portMAX_DELAY) {
+    SetSocketTimeout(httpd_req_to_sockfd(req), SO_SNDTIMEO, std::min(server.writeTimeout.load(), remainingTime));
+    socketTimeoutsChanged = true;
+  }
+
+  // httpd keeps the status pointer until the response (or its first chunk) is sent
+  auto statusCodeIterator = httpStatusCodeMap.find(statusCode);
+  snprintf(status, sizeof(status), "%u %s", (unsigned int)statusCode, statusCodeIterator != httpStatusCodeMap.end() ? statusCodeIterator->second.c_str() : "");
+  ESP_RETURN_ON_ERROR(httpd_resp_set_status(req, status), TAG, "set status failed");
+  if (closeConnection || IsContinueWithheld())
+    ESP_RETURN_ON_ERROR(httpd_resp_set_hdr(req, "Connection", "close"), TAG, "set header failed");
+  responseWritten = true;
+  responseStatusCode = statusCode;
+  if (capturedResponse) {
+    capturedResponse->statusCode = statusCode;
+    capturedResponse->headers.assign(capturedHeaderData, (const char*)listener.headerDataEnd);
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+std::shared_ptr<NetworkStream> HttpServer::Transaction::GetNetworkStream() {
+  return networkStream;
+}
+
+//==============================================================================
+
+HttpMethod HttpServer::Transaction::GetRequestMethod() {
+  auto method = httpMethodMap.find(req->method);
+  return method != httpMethodMap.end() ? method->second : HttpMethod::unknown;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::GetRequestUri(std::string& uri) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+
+  uri = req->uri;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::GetRequestHeader(const std::string& name, std::string& value) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+  
+  // The value is read directly into the string, so that a string with enough capacity is not reallocated.
+  // A missing header has no length as an empty one, so it is looked up before the string is changed.
+  size_t valueSize = httpd_req_get_hdr_value_len(req, name.c_str());
+  char emptyValue[1];
+  esp_err_t error = valueSize ? ESP_OK : httpd_req_get_hdr_value_str(req, name.c_str(), emptyValue, sizeof(emptyValue));
+  if (error == ESP_OK) {
+    value.resize(valueSize);
+    error = httpd_req_get_hdr_value_str(req, name.c_str(), &value[0], valueSize + 1);
+  }
+  // A missing header is not logged: optional headers are looked up on every request
+  if (error == ESP_ERR_NOT_FOUND)
+    return error;
+  ESP_RETURN_ON_ERROR(error, TAG, "get header value string failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpServer::Transaction::GetRequestBodySize() {
+  return req->content_len;
+}
+
+//==============================================================================
+
+HttpArena& HttpServer::Transaction::GetArena() {
+  return arena;
+}
+
+//==============================================================================
+
+TickType_t HttpServer::Transaction::GetRemainingTime() {
+  if (requestTimeout == portMAX_DELAY)
+    return portMAX_DELAY;
+  TickType_t elapsedTime = xTaskGetTickCount() - startTime;
+  return elapsedTime < requestTimeout ? requestTimeout - elapsedTime : 0;
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::SetResponseHeader(const std::string& name, const std::string& value) {
+  return SetResponseHeader(name.c_str(), value.c_str());
+}
+
+//==============================================================================
+
+esp_err_t HttpServer::Transaction::SetResponseHeader(const char* name, const char* value) {
+  ESP_RETURN_ON_FALSE(!responseWritten, ESP_ERR_INVALID_STATE, TAG, "response has already been sent");
+
+  char*& headerDataEnd = listener.headerDataEnd;
+  size_t nameSize = strlen(name), valueSize = strlen(value);
+  ESP_RETURN_ON_FALSE(headerDataEnd - (char*)listener.headerBuffer->data + nameSize + valueSize + 2 <= listener.headerBuffer->size, \
+                      ESP_ERR_INVALID_SIZE, TAG, "header buffer is too small");
+  char* nameStr = headerDataEnd;
+  memcpy(headerDataEnd, name, nameSize + 1);
+  headerDataEnd += nameSize + 1;
+  char* valueStr = headerDataEnd;
+  memcpy(headerDataEnd, value, valueSize + 1);
+  headerDataEnd += valueSize + 1;
+
+  // httpd always sends the content type of the response, so it is not added as another header
+  if (strcasecmp(nameStr, "Content-Type") == 0)
+    ESP_RETURN_ON_ERROR(httpd_resp_set_type(req, valueStr), TAG, "set content type failed");
+  else
+    ESP_RETURN_ON_ERROR(httpd_resp_set_hdr(req, nameStr, valueStr), TAG, "set header failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool HttpServer::Transaction::IsResponseWritten() {
+  return responseWritten;
+}
+
+//==============================================================================
+
+uint16_t HttpServer::Transaction::GetResponseStatusCode() {
+  return responseStatusCode;
+}
+
+//==============================================================================
+
+bool HttpServer::Transaction::IsResponseBodyOpen() {
+  return chunkedResponseBody;
+}
+
+//==============================================================================
+
+void HttpServer::Transaction::CloseConnectionAfterResponse() {
+  closeConnection = true;
+}
+
+//==============================================================================
+
+bool HttpServer::Transaction::IsConnectionClosedAfterResponse() {
+  return closeConnection;
+}
+
+//==============================================================================
+
+bool HttpServer::Transaction::AreSocketTimeoutsChanged() {
+  return socketTimeoutsChanged;
+}
+
+//==============================================================================
+
+bool HttpServer::Transaction::IsContinueWithheld() {
+  return continueExpected && !continueSent && requestBodyRemainingSize;
+}
+
+//==============================================================================
+
+void HttpServer::Transaction::CaptureResponse(CoalescedResponse* response) {
+  capturedResponse = response;
+  // The headers set before the capture (e.g. CORS headers) are specific to the request and are not captured
+  capturedHeaderData = listener.headerDataEnd;
+}
+
+//==============================================================================
+
+void HttpServer::Transaction::CaptureResponseBody(const void* data, size_t size) {
+  if (!capturedResponse)
+    return;
+  if (capturedResponse->body.size() + size <= capturedResponse->maxBodySize) {
+    capturedResponse->body.append((const char*)data, size);
+    return;
+  }
+  // The body is too large to be copied: the waiting requests are released to be handled separately
+  std::string().swap(capturedResponse->body);
+  capturedResponse->bypassed = true;
+  capturedResponse->mutex.Unlock();
+  capturedResponse = NULL;
+}
+
+//==============================================================================
+
+}
+
+#endif
@@ -0,0 +1,513 @@
+#include "pl_http_tracer.h"
+#include "esp_check.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include <sys/time.h>
+#include <map>
+
+//==============================================================================
+
+static const char* TAG = "pl_http_tracer";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+static std::map<HttpMethod, const char*> httpMethodNameMap {
+  {HttpMethod::GET, "GET"}, {HttpMethod::POST, "POST"}, {HttpMethod::PUT, "PUT"}, {HttpMethod::PATCH, "PATCH"}, {HttpMethod::DELETE, "DELETE"},
+  {HttpMethod::HEAD, "HEAD"}, {HttpMethod::OPTIONS, "OPTIONS"}
+};
+
+// A pointer is trivially constructed, so the thread-local storage of the tasks needs no initialization
+static thread_local const HttpTraceContext* currentContext = NULL;
+
+//==============================================================================
+
+const TaskParameters HttpTracer::defaultTaskParameters = {4096, tskIDLE_PRIORITY + 1, 0};
+const std::string HttpTracer::defaultServiceName = "pl_http";
+
+//==============================================================================
+
+static void GenerateId(uint8_t* id, size_t size) {
+  esp_fill_random(id, size);
+  // An all-zero ID is invalid
+  for (size_t i = 0; i < size; i++) {
+    if (id[i])
+      return;
+  }
+  id[size - 1] = 1;
+}
+
+//==============================================================================
+
+static bool IsZeroId(const uint8_t* id, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (id[i])
+      return false;
+  }
+  return true;
+}
+
+//==============================================================================
+
+static bool ParseHex(const char* src, uint8_t* dest, size_t size) {
+  for (size_t i = 0; i < size * 2; i++) {
+    char c = src[i];
+    // W3C Trace Context allows lowercase hex digits only
+    uint8_t digit = c >= '0' && c <= '9' ? c - '0' : (c >= 'a' && c <= 'f' ? c - 'a' + 10 : 0xFF);
+    if (digit == 0xFF)
+      return false;
+    dest[i / 2] = i % 2 ? dest[i / 2] | digit : digit << 4;
+  }
+  return true;
+}
+
+//==============================================================================
+
+static char* FormatHex(const uint8_t* src, size_t size, char* dest) {
+  static const char hexDigits[] = "0123456789abcdef";
+  for (size_t i = 0; i < size; i++) {
+    *dest++ = hexDigits[src[i] >> 4];
+    *dest++ = hexDigits[src[i] & 0x0F];
+  }
+  return dest;
+}
+
+//==============================================================================
+
+static void AppendJsonString(std::string& json, const char* value) {
+  json += '"';
+  for (; *value; value++) {
+    if (*value == '"' || *value == '\\') {
+      json += '\\';
+      json += *value;
+    }
+    else if ((uint8_t)*value < 0x20) {
+      char escapedChar[7];
+      snprintf(escapedChar, sizeof(escapedChar), "\\u%04x", (unsigned int)*value);
+      json += escapedChar;
+    }
+    else
+      json += *value;
+  }
+  json += '"';
+}
+
+//==============================================================================
+
+static void AppendJsonAttribute(std::string& json, const char* key, const char* stringValue) {
+  json += "{\"key\":\"";
+  json += key;
+  json += "\",\"value\":{\"stringValue\":";
+  AppendJsonString(json, stringValue);
+  json += "}},";
+}
+
+//==============================================================================
+
+static void AppendJsonAttribute(std::string& json, const char* key, int64_t intValue) {
+  // OTLP/JSON encodes 64-bit integers as strings
+  json += "{\"key\":\"";
+  json += key;
+  json += "\",\"value\":{\"intValue\":\"";
+  json += std::to_string(intValue);
+  json += "\"}},";
+}
+
+//==============================================================================
+
+HttpTracer::HttpTracer(HttpClient& client, const std::string& uri, size_t capacity, const TaskParameters& taskParameters) :
+    client(client), uri(uri), taskParameters(taskParameters) {
+  // The capacity is a power of two, so the positions wrap around without gaps
+  this->capacity = 2;
+  while (this->capacity < capacity)
+    this->capacity *= 2;
+  slots.reset(new (std::nothrow) Slot[this->capacity]);
+  if (!slots) {
+    ESP_LOGE(TAG, "span buffer allocation failed");
+    this->capacity = 0;
+  }
+  for (size_t i = 0; i < this->capacity; i++)
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  batchSemaphore = xSemaphoreCreateBinaryStatic(&batchSemaphoreBuffer);
+}
+
+//==============================================================================
+
+HttpTracer::~HttpTracer() {
+  Disable();
+  vSemaphoreDelete(batchSemaphore);
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error != ESP_OK && (error != ESP_ERR_TIMEOUT || timeout != 0))
+    ESP_LOGE(TAG, "mutex lock failed");
+  return error;
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::Enable() {
+  LockGuard lg(*this);
+  if (taskHandle)
+    return ESP_OK;
+
+  ESP_RETURN_ON_FALSE(capacity, ESP_ERR_NO_MEM, TAG, "span buffer is not allocated");
+  stopRequested = false;
+  if (xTaskCreatePinnedToCore(TaskCode, "pl_http_tracer", taskParameters.stackDepth, this, taskParameters.priority, &taskHandle,
+                              taskParameters.coreId) != pdPASS) {
+    taskHandle = NULL;
+    ESP_RETURN_ON_ERROR(ESP_ERR_NO_MEM, TAG, "task create failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::Disable() {
+  {
+    LockGuard lg(*this);
+    if (!taskHandle)
+      return ESP_OK;
+    ESP_RETURN_ON_FALSE(xTaskGetCurrentTaskHandle() != taskHandle, ESP_ERR_INVALID_STATE, TAG, "tracer cannot be disabled by its task");
+    stopRequested = true;
+    xSemaphoreGive(batchSemaphore);
+  }
+
+  // The exporter task locks the tracer, so it is stopped without the lock. A batch being sent is completed first.
+  while (IsEnabled())
+    vTaskDelay(1);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool HttpTracer::IsEnabled() {
+  LockGuard lg(*this);
+  return taskHandle;
+}
+
+//==============================================================================
+
+std::string HttpTracer::GetServiceName() {
+  LockGuard lg(*this);
+  return serviceName;
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::SetServiceName(const std::string& serviceName) {
+  LockGuard lg(*this);
+  this->serviceName = serviceName;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpTracer::GetMaxBatchSize() {
+  LockGuard lg(*this);
+  return maxBatchSize;
+}
+
+//==============================================================================
+
+TickType_t HttpTracer::GetBatchTime() {
+  LockGuard lg(*this);
+  return batchTime;
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::SetBatchLimits(size_t maxSize, TickType_t time) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(maxSize, ESP_ERR_INVALID_ARG, TAG, "invalid batch size");
+  maxBatchSize = maxSize;
+  batchTime = time;
+  xSemaphoreGive(batchSemaphore);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::Record(const HttpSpan& span) {
+  // A full buffer is not logged: the spans are recorded on every request
+  size_t position = enqueuePosition.load(std::memory_order_relaxed);
+  while (true) {
+    if (!capacity) {
+      numberOfDroppedSpans++;
+      return ESP_ERR_NO_MEM;
+    }
+    Slot& slot = slots[position & (capacity - 1)];
+    size_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        slot.span = span;
+        slot.sequence.store(position + 1, std::memory_order_release);
+        break;
+      }
+    }
+    // The slot still holds the span of the previous round
+    else if ((intptr_t)(sequence - position) < 0) {
+      numberOfDroppedSpans++;
+      return ESP_ERR_NO_MEM;
+    }
+    else
+      position = enqueuePosition.load(std::memory_order_relaxed);
+  }
+
+  numberOfRecordedSpans++;
+  // The exporter does not wait for the batch time when a batch is ready
+  if (position + 1 - dequeuePosition.load(std::memory_order_relaxed) >= maxBatchSize.load(std::memory_order_relaxed))
+    xSemaphoreGive(batchSemaphore);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+size_t HttpTracer::TakeSpans(HttpSpan* spans, size_t maxNumberOfSpans) {
+  size_t position = dequeuePosition.load(std::memory_order_relaxed);
+  size_t numberOfSpans = 0;
+  while (numberOfSpans < maxNumberOfSpans && capacity) {
+    Slot& slot = slots[position & (capacity - 1)];
+    // The slot is empty or its span is being written
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+      break;
+    spans[numberOfSpans++] = slot.span;
+    slot.sequence.store(position + capacity, std::memory_order_release);
+    position++;
+  }
+  dequeuePosition.store(position, std::memory_order_relaxed);
+  return numberOfSpans;
+}
+
+//==============================================================================
+
+HttpTracerStatistics HttpTracer::GetStatistics() {
+  LockGuard lg(*this);
+  HttpTracerStatistics statistics;
+  statistics.numberOfRecordedSpans = numberOfRecordedSpans;
+  statistics.numberOfDroppedSpans = numberOfDroppedSpans;
+  statistics.numberOfExportedSpans = numberOfExportedSpans;
+  statistics.numberOfBatches = numberOfBatches;
+  return statistics;
+}
+
+//==============================================================================
+
+const HttpTraceContext* HttpTracer::GetCurrentContext() {
+  return currentContext;
+}
+
+//==============================================================================
+
+const HttpTraceContext* HttpTracer::SetCurrentContext(const HttpTraceContext* context) {
+  const HttpTraceContext* previousContext = currentContext;
+  currentContext = context;
+  return previousContext;
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::ParseTraceParent(const std::string& value, HttpTraceContext& context) {
+  // An invalid header of a request is not logged. A future version may append fields after the flags.
+  uint8_t version;
+  if (value.size() < traceParentSize || value[2] != '-' || value[35] != '-' || value[52] != '-' || !ParseHex(value.data(), &version, 1) || version == 0xFF ||
+      (value.size() > traceParentSize && (version == 0 || value[traceParentSize] != '-')))
+    return ESP_ERR_INVALID_ARG;
+  if (!ParseHex(value.data() + 3, context.traceId, sizeof(context.traceId)) || !ParseHex(value.data() + 36, context.spanId, sizeof(context.spanId)) ||
+      !ParseHex(value.data() + 53, &context.flags, 1))
+    return ESP_ERR_INVALID_ARG;
+  if (IsZeroId(context.traceId, sizeof(context.traceId)) || IsZeroId(context.spanId, sizeof(context.spanId)))
+    return ESP_ERR_INVALID_ARG;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpTracer::FormatTraceParent(const HttpTraceContext& context, char* dest) {
+  memcpy(dest, "00-", 3);
+  dest = FormatHex(context.traceId, sizeof(context.traceId), dest + 3);
+  *dest++ = '-';
+  dest = FormatHex(context.spanId, sizeof(context.spanId), dest);
+  *dest++ = '-';
+  *FormatHex(&context.flags, 1, dest) = 0;
+}
+
+//==============================================================================
+
+void HttpTracer::BeginSpan(HttpSpanKind kind, HttpMethod method, const char* uri, const HttpTraceContext* parent, HttpTraceContext& context, HttpSpan& span) {
+  if (parent) {
+    memcpy(context.traceId, parent->traceId, sizeof(context.traceId));
+    memcpy(span.parentSpanId, parent->spanId, sizeof(span.parentSpanId));
+    context.flags = parent->flags;
+    context.state = parent->state;
+  }
+  else {
+    GenerateId(context.traceId, sizeof(context.traceId));
+    memset(span.parentSpanId, 0, sizeof(span.parentSpanId));
+    context.flags = sampledFlag;
+    context.state.clear();
+  }
+  GenerateId(context.spanId, sizeof(context.spanId));
+
+  memcpy(span.traceId, context.traceId, sizeof(span.traceId));
+  memcpy(span.spanId, context.spanId, sizeof(span.spanId));
+  span.flags = context.flags;
+  span.kind = kind;
+  span.method = method;
+  span.statusCode = 0;
+  size_t uriSize = std::min(strcspn(uri, "?"), sizeof(span.uri) - 1);
+  memcpy(span.uri, uri, uriSize);
+  span.uri[uriSize] = 0;
+  // The start time is monotonic until the span ends, so the duration is not affected by the clock adjustments
+  span.startTime = esp_timer_get_time();
+  span.duration = 0;
+  span.resolveTime = 0;
+  span.connectTime = 0;
+  span.responseTime = 0;
+}
+
+//==============================================================================
+
+void HttpTracer::EndSpan(HttpSpan& span, uint16_t statusCode) {
+  span.statusCode = statusCode;
+  span.duration = esp_timer_get_time() - span.startTime;
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  span.startTime = (int64_t)time.tv_sec * 1000000 + time.tv_usec - span.duration;
+}
+
+//==============================================================================
+
+void HttpTracer::TaskCode(void* parameters) {
+  HttpTracer& tracer = *(HttpTracer*)parameters;
+  tracer.Run();
+  {
+    LockGuard lg(tracer);
+    tracer.taskHandle = NULL;
+  }
+  vTaskDelete(NULL);
+}
+
+//==============================================================================
+
+void HttpTracer::Run() {
+  std::vector<HttpSpan> batch;
+
+  while (!stopRequested) {
+    xSemaphoreTake(batchSemaphore, GetBatchTime());
+    batch.resize(GetMaxBatchSize());
+    // The buffer is drained, so that a burst of spans does not wait for the following batch times
+    size_t numberOfSpans;
+    while (!stopRequested && (numberOfSpans = TakeSpans(batch.data(), batch.size()))) {
+      // Spans are not retried: a failed batch is dropped, so that the buffer is free for the new spans
+      esp_err_t error = ExportBatch(batch.data(), numberOfSpans);
+      LockGuard lg(*this);
+      if (error != ESP_OK) {
+        numberOfDroppedSpans += numberOfSpans;
+        break;
+      }
+      numberOfExportedSpans += numberOfSpans;
+      numberOfBatches++;
+    }
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::ExportBatch(const HttpSpan* spans, size_t numberOfSpans) {
+  std::string body = "{\"resourceSpans\":[{\"resource\":{\"attributes\":[";
+  {
+    LockGuard lg(*this);
+    AppendJsonAttribute(body, "service.name", serviceName.c_str());
+  }
+  body.back() = ']';
+  body += "},\"scopeSpans\":[{\"scope\":{\"name\":\"pl_http\"},\"spans\":[";
+
+  char id[sizeof(HttpSpan::traceId) * 2];
+  for (size_t i = 0; i < numberOfSpans; i++) {
+    const HttpSpan& span = spans[i];
+    auto methodName = httpMethodNameMap.find(span.method);
+    const char* method = methodName != httpMethodNameMap.end() ? methodName->second : "_OTHER";
+
+    body += "{\"traceId\":\"";
+    body.append(id, FormatHex(span.traceId, sizeof(span.traceId), id) - id);
+    body += "\",\"spanId\":\"";
+    body.append(id, FormatHex(span.spanId, sizeof(span.spanId), id) - id);
+    if (!IsZeroId(span.parentSpanId, sizeof(span.parentSpanId))) {
+      body += "\",\"parentSpanId\":\"";
+      body.append(id, FormatHex(span.parentSpanId, sizeof(span.parentSpanId), id) - id);
+    }
+    body += "\",\"name\":\"";
+    body += method;
+    // OTLP span kinds: 2 - server, 3 - client
+    body += span.kind == HttpSpanKind::server ? "\",\"kind\":2" : "\",\"kind\":3";
+    body += ",\"startTimeUnixNano\":\"";
+    body += std::to_string(span.startTime * 1000);
+    body += "\",\"endTimeUnixNano\":\"";
+    body += std::to_string((span.startTime + span.duration) * 1000);
+    body += "\",\"attributes\":[";
+    AppendJsonAttribute(body, "http.request.method", method);
+    AppendJsonAttribute(body, "url.path", span.uri);
+    if (span.statusCode)
+      AppendJsonAttribute(body, "http.response.status_code", span.statusCode);
+    if (span.kind == HttpSpanKind::client) {
+      AppendJsonAttribute(body, "pl.http.resolve_time_us", span.resolveTime);
+      AppendJsonAttribute(body, "pl.http.connect_time_us", span.connectTime);
+      AppendJsonAttribute(body, "pl.http.response_time_us", span.responseTime);
+    }
+    else
+      AppendJsonAttribute(body, "pl.http.handler_time_us", span.responseTime);
+    body.back() = ']';
+    // The span is an error if there is no response, a server error response of the server or any error response of the client
+    if (!span.statusCode || span.statusCode >= (span.kind == HttpSpanKind::server ? 500 : 400))
+      body += ",\"status\":{\"code\":2}";
+    body += "},";
+  }
+  if (numberOfSpans)
+    body.pop_back();
+  body += "]}]}]}";
+
+  // The exporter requests of a client traced by this tracer are not recorded: each batch would record a span for the next one
+  LockGuard lg(client);
+  bool traced = client.GetTracer() == this;
+  if (traced)
+    client.SetTracer(NULL);
+  esp_err_t error = PostBatch(body);
+  if (traced)
+    client.SetTracer(this);
+  return error;
+}
+
+//==============================================================================
+
+esp_err_t HttpTracer::PostBatch(const std::string& body) {
+  ESP_RETURN_ON_ERROR(client.SetRequestHeader("Content-Type", "application/json"), TAG, "set content type failed");
+  ushort statusCode;
+  ESP_RETURN_ON_ERROR(client.SendRequest(HttpMethod::POST, uri, body, statusCode, NULL), TAG, "send batch failed");
+
+  // The response body is discarded, so that the connection can be reused
+  char buffer[64];
+  size_t size;
+  do {
+    ESP_RETURN_ON_ERROR(client.ReadResponseBody(buffer, sizeof(buffer), size), TAG, "read response body failed");
+  } while (size);
+  ESP_RETURN_ON_FALSE(statusCode >= 200 && statusCode < 300, ESP_FAIL, TAG, "batch failed with status code %d", statusCode);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+}
@@ -0,0 +1,579 @@
+#include "pl_http_upload_queue.h"
+#include "esp_check.h"
+
+//==============================================================================
+
+static const char* TAG = "pl_http_upload_queue";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+// The signature changes with the record format: a file with the records of another format is reset
+static constexpr uint32_t spillFileSignature = 0x51555032;
+
+//==============================================================================
+
+const TaskParameters HttpUploadQueue::defaultTaskParameters = {4096, tskIDLE_PRIORITY + 5, 0};
+const std::string HttpUploadQueue::defaultContentType = "application/x-ndjson";
+const std::string HttpUploadQueue::defaultRecordSeparator = "\n";
+
+//==============================================================================
+
+HttpUploadQueue::HttpUploadQueue(HttpClient& client, const std::string& uri, size_t maxMemorySize, const TaskParameters& taskParameters) :
+  client(client), uri(uri), taskParameters(taskParameters), maxMemorySize(maxMemorySize) {}
+
+//==============================================================================
+
+HttpUploadQueue::~HttpUploadQueue() {
+  Disable();
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::Lock(TickType_t timeout) {
+  esp_err_t error = mutex.Lock(timeout);
+  if (error != ESP_OK && (error != ESP_ERR_TIMEOUT || timeout != 0))
+    ESP_LOGE(TAG, "mutex lock failed");
+  return error;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::Unlock() {
+  ESP_RETURN_ON_ERROR(mutex.Unlock(), TAG, "mutex unlock failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::Enable() {
+  LockGuard lg(*this);
+  if (taskHandle)
+    return ESP_OK;
+
+  ESP_RETURN_ON_ERROR(OpenSpillFile(), TAG, "spill file open failed");
+  stopRequested = false;
+  if (xTaskCreatePinnedToCore(TaskCode, "pl_http_upload", taskParameters.stackDepth, this, taskParameters.priority, &taskHandle,
+                              taskParameters.coreId) != pdPASS) {
+    taskHandle = NULL;
+    CloseSpillFile();
+    ESP_RETURN_ON_ERROR(ESP_ERR_NO_MEM, TAG, "task create failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::Disable() {
+  {
+    LockGuard lg(*this);
+    if (!taskHandle)
+      return ESP_OK;
+    ESP_RETURN_ON_FALSE(xTaskGetCurrentTaskHandle() != taskHandle, ESP_ERR_INVALID_STATE, TAG, "queue cannot be disabled by its task");
+    stopRequested = true;
+    xTaskNotifyGive(taskHandle);
+  }
+
+  // The sender task locks the queue, so it is stopped without the lock. A batch being sent is completed first.
+  while (IsEnabled())
+    vTaskDelay(1);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+bool HttpUploadQueue::IsEnabled() {
+  LockGuard lg(*this);
+  return taskHandle;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::Enqueue(const void* data, size_t size, uint8_t priority) {
+  ESP_RETURN_ON_FALSE(size <= maxRecordSize && size <= maxMemorySize, ESP_ERR_INVALID_SIZE, TAG, "invalid record size");
+  ESP_RETURN_ON_FALSE(priority < numberOfPriorities, ESP_ERR_INVALID_ARG, TAG, "invalid priority");
+  LockGuard lg(*this);
+
+  if (memorySize + size > maxMemorySize) {
+    size_t droppableSize = 0;
+    for (int i = 0; i <= priority; i++) {
+      for (auto& record : records[i])
+        droppableSize += record.size();
+    }
+    // The producer is not blocked and the log is not flooded while the server cannot be reached
+    if (memorySize - droppableSize + size > maxMemorySize) {
+      statistics.numberOfDroppedRecords++;
+      return ESP_ERR_NO_MEM;
+    }
+    DropRecords(maxMemorySize - size);
+  }
+
+  if (!statistics.numberOfQueuedRecords)
+    firstRecordTime = xTaskGetTickCount();
+  records[priority].emplace_back((const char*)data, size);
+  memorySize += size;
+  statistics.numberOfQueuedRecords++;
+  if (taskHandle && (statistics.numberOfQueuedRecords == 1 || memorySize >= maxBatchSize))
+    xTaskNotifyGive(taskHandle);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::Enqueue(const std::string& record, uint8_t priority) {
+  return Enqueue(record.data(), record.size(), priority);
+}
+
+//==============================================================================
+
+size_t HttpUploadQueue::GetMaxBatchSize() {
+  LockGuard lg(*this);
+  return maxBatchSize;
+}
+
+//==============================================================================
+
+TickType_t HttpUploadQueue::GetBatchTime() {
+  LockGuard lg(*this);
+  return batchTime;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::SetBatchLimits(size_t maxSize, TickType_t time) {
+  LockGuard lg(*this);
+  maxBatchSize = maxSize;
+  batchTime = time;
+  if (taskHandle)
+    xTaskNotifyGive(taskHandle);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+TickType_t HttpUploadQueue::GetRetryTime() {
+  LockGuard lg(*this);
+  return retryTime;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::SetRetryTime(TickType_t time) {
+  LockGuard lg(*this);
+  retryTime = time;
+  if (taskHandle)
+    xTaskNotifyGive(taskHandle);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::SetBatchFormat(const std::string& contentType, const std::string& recordSeparator) {
+  LockGuard lg(*this);
+  this->contentType = contentType;
+  this->recordSeparator = recordSeparator;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::SetBatchEncoder(const std::string& contentEncoding, const HttpBatchEncoder& encoder) {
+  LockGuard lg(*this);
+  this->contentEncoding = contentEncoding;
+  this->encoder = encoder;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::SetSpillFile(const std::string& path, size_t maxSize) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(!taskHandle, ESP_ERR_INVALID_STATE, TAG, "queue is enabled");
+  ESP_RETURN_ON_FALSE(path.empty() || (maxSize > sizeof(SpillFileHeader) + sizeof(SpillRecordHeader) && maxSize <= UINT32_MAX), ESP_ERR_INVALID_SIZE, TAG, "invalid spill file size");
+  spillFilePath = path;
+  maxSpillFileSize = maxSize;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+HttpUploadQueueStatistics HttpUploadQueue::GetStatistics() {
+  LockGuard lg(*this);
+  return statistics;
+}
+
+//==============================================================================
+
+void HttpUploadQueue::TaskCode(void* parameters) {
+  HttpUploadQueue& queue = *(HttpUploadQueue*)parameters;
+  queue.Run();
+  queue.CloseSpillFile();
+  {
+    LockGuard lg(queue);
+    queue.taskHandle = NULL;
+  }
+  vTaskDelete(NULL);
+}
+
+//==============================================================================
+
+void HttpUploadQueue::Run() {
+  bool offline = false;
+  TickType_t offlineTime = 0;
+  std::vector<std::pair<uint8_t, std::string>> batch;
+
+  while (!stopRequested) {
+    TickType_t waitTime = GetWaitTime(offline, offlineTime);
+    if (waitTime) {
+      ulTaskNotifyTake(pdTRUE, waitTime);
+      continue;
+    }
+    // While the server cannot be reached, the ready batches are moved to the spill file instead of filling the memory
+    if (offline && xTaskGetTickCount() - offlineTime < GetRetryTime()) {
+      SpillRecords();
+      continue;
+    }
+
+    // The spilled records are older than the records in memory and are sent first
+    bool spilled = spillFile && spillFileHeader.numberOfRecords;
+    batch.clear();
+    if (spilled ? ReadSpilledRecords(batch) != ESP_OK : !TakeBatch(batch))
+      continue;
+
+    bool rejected = false;
+    if (SendBatch(batch, rejected) == ESP_OK || rejected) {
+      offline = false;
+      if (spilled)
+        RemoveSpilledRecords(batch.size());
+      LockGuard lg(*this);
+      if (rejected)
+        statistics.numberOfDroppedRecords += batch.size();
+      else {
+        statistics.numberOfSentRecords += batch.size();
+        statistics.numberOfBatches++;
+      }
+    }
+    else {
+      offline = true;
+      offlineTime = xTaskGetTickCount();
+      if (!spilled)
+        ReturnBatch(batch);
+      if (spillFile)
+        SpillRecords();
+    }
+  }
+}
+
+//==============================================================================
+
+TickType_t HttpUploadQueue::GetWaitTime(bool offline, TickType_t offlineTime) {
+  LockGuard lg(*this);
+  TickType_t time = xTaskGetTickCount();
+  bool queued = statistics.numberOfQueuedRecords;
+  bool spilled = spillFile && spillFileHeader.numberOfRecords;
+  if (!queued && !spilled)
+    return portMAX_DELAY;
+
+  TickType_t batchWaitTime = portMAX_DELAY;
+  if (queued)
+    batchWaitTime = memorySize >= maxBatchSize || time - firstRecordTime >= batchTime ? 0 : batchTime - (time - firstRecordTime);
+  if (!offline)
+    return spilled ? 0 : batchWaitTime;
+
+  TickType_t retryWaitTime = time - offlineTime >= retryTime ? 0 : retryTime - (time - offlineTime);
+  return spillFile ? std::min(retryWaitTime, batchWaitTime) : retryWaitTime;
+}
+
+//==============================================================================
+
+size_t HttpUploadQueue::TakeBatch(std::vector<std::pair<uint8_t, std::string>>& batch) {
+  LockGuard lg(*this);
+  size_t batchSize = 0;
+  for (int i = numberOfPriorities - 1; i >= 0; i--) {
+    while (!records[i].empty()) {
+      size_t recordSize = (batch.empty() ? 0 : recordSeparator.size()) + records[i].front().size();
+      if (!batch.empty() && batchSize + recordSize > maxBatchSize)
+        return batch.size();
+      batchSize += recordSize;
+      memorySize -= records[i].front().size();
+      statistics.numberOfQueuedRecords--;
+      batch.emplace_back(i, std::move(records[i].front()));
+      records[i].pop_front();
+    }
+  }
+  return batch.size();
+}
+
+//==============================================================================
+
+void HttpUploadQueue::ReturnBatch(std::vector<std::pair<uint8_t, std::string>>& batch) {
+  LockGuard lg(*this);
+  if (!statistics.numberOfQueuedRecords)
+    firstRecordTime = xTaskGetTickCount();
+  for (auto record = batch.rbegin(); record != batch.rend(); record++) {
+    memorySize += record->second.size();
+    statistics.numberOfQueuedRecords++;
+    records[record->first].push_front(std::move(record->second));
+  }
+  // The records queued while the batch was being sent may have filled the memory
+  DropRecords(maxMemorySize);
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::SendBatch(const std::vector<std::pair<uint8_t, std::string>>& batch, bool& rejected) {
+  std::string body, encodedBody, contentType, contentEncoding;
+  HttpBatchEncoder encoder;
+  {
+    LockGuard lg(*this);
+    for (auto& record : batch) {
+      if (!body.empty())
+        body += recordSeparator;
+      body += record.second;
+    }
+    contentType = this->contentType;
+    contentEncoding = this->contentEncoding;
+    encoder = this->encoder;
+  }
+  if (encoder) {
+    // The batch that cannot be encoded will not be encoded on a retry either
+    rejected = encoder(body, encodedBody) != ESP_OK;
+    ESP_RETURN_ON_FALSE(!rejected, ESP_FAIL, TAG, "batch encode failed");
+    body.swap(encodedBody);
+  }
+
+  LockGuard lg(client);
+  ESP_RETURN_ON_ERROR(client.SetRequestHeader("Content-Type", contentType), TAG, "set content type failed");
+  if (encoder && !contentEncoding.empty())
+    ESP_RETURN_ON_ERROR(client.SetRequestHeader("Content-Encoding", contentEncoding), TAG, "set content encoding failed");
+  else
+    ESP_RETURN_ON_ERROR(client.DeleteRequestHeader("Content-Encoding"), TAG, "delete content encoding failed");
+  ushort statusCode;
+  ESP_RETURN_ON_ERROR(client.SendRequest(HttpMethod::POST, uri, body, statusCode, NULL), TAG, "send batch failed");
+
+  // The response body is discarded, so that the connection can be reused
+  char buffer[64];
+  size_t size;
+  do {
+    ESP_RETURN_ON_ERROR(client.ReadResponseBody(buffer, sizeof(buffer), size), TAG, "read response body failed");
+  } while (size);
+
+  if (statusCode >= 200 && statusCode < 300)
+    return ESP_OK;
+  // A client error other than a timeout or a rate limit will be repeated on a retry
+  rejected = statusCode >= 400 && statusCode < 500 && statusCode != 408 && statusCode != 429;
+  ESP_LOGE(TAG, "batch failed with status code %d", statusCode);
+  return ESP_FAIL;
+}
+
+//==============================================================================
+
+void HttpUploadQueue::DropRecords(size_t size) {
+  for (int i = 0; i < numberOfPriorities && memorySize > size; i++) {
+    while (!records[i].empty() && memorySize > size) {
+      memorySize -= records[i].front().size();
+      records[i].pop_front();
+      statistics.numberOfQueuedRecords--;
+      statistics.numberOfDroppedRecords++;
+    }
+  }
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::OpenSpillFile() {
+  if (spillFilePath.empty())
+    return ESP_OK;
+
+  // The records spilled before a restart are kept if the file has the same capacity
+  uint32_t capacity = maxSpillFileSize - sizeof(SpillFileHeader);
+  spillFile = fopen(spillFilePath.c_str(), "r+b");
+  bool valid = spillFile && fread(&spillFileHeader, sizeof(spillFileHeader), 1, spillFile) == 1 &&
+               spillFileHeader.signature == spillFileSignature && spillFileHeader.capacity == capacity &&
+               spillFileHeader.head < capacity && spillFileHeader.usedSize <= capacity;
+  if (!spillFile)
+    spillFile = fopen(spillFilePath.c_str(), "w+b");
+  ESP_RETURN_ON_FALSE(spillFile, ESP_FAIL, TAG, "spill file open failed");
+  if (!valid) {
+    spillFileHeader = {spillFileSignature, capacity, 0, 0, 0};
+    if (WriteSpillFileHeader() != ESP_OK) {
+      CloseSpillFile();
+      ESP_RETURN_ON_ERROR(ESP_FAIL, TAG, "spill file header write failed");
+    }
+  }
+  statistics.numberOfSpilledRecords = spillFileHeader.numberOfRecords;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void HttpUploadQueue::CloseSpillFile() {
+  if (spillFile)
+    fclose(spillFile);
+  spillFile = NULL;
+  spillFileHeader = {};
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::SpillRecords() {
+  std::vector<std::pair<uint8_t, std::string>> spilledRecords;
+  {
+    LockGuard lg(*this);
+    for (int i = numberOfPriorities - 1; i >= 0; i--) {
+      for (auto& record : records[i])
+        spilledRecords.emplace_back(i, std::move(record));
+      records[i].clear();
+    }
+    memorySize = 0;
+    statistics.numberOfQueuedRecords = 0;
+  }
+
+  // The file is full: the oldest records are dropped
+  size_t numberOfDroppedRecords = 0;
+  esp_err_t error = ESP_OK;
+  for (auto& record : spilledRecords) {
+    SpillRecordHeader recordHeader = {(uint16_t)record.second.size(), record.first};
+    uint32_t recordSize = sizeof(recordHeader) + recordHeader.size;
+    if (recordSize > spillFileHeader.capacity) {
+      numberOfDroppedRecords++;
+      continue;
+    }
+    while (error == ESP_OK && spillFileHeader.usedSize + recordSize > spillFileHeader.capacity) {
+      SpillRecordHeader droppedRecordHeader;
+      error = ReadSpillFile(spillFileHeader.head, &droppedRecordHeader, sizeof(droppedRecordHeader));
+      spillFileHeader.head = (spillFileHeader.head + sizeof(droppedRecordHeader) + droppedRecordHeader.size) % spillFileHeader.capacity;
+      spillFileHeader.usedSize -= sizeof(droppedRecordHeader) + droppedRecordHeader.size;
+      spillFileHeader.numberOfRecords--;
+      numberOfDroppedRecords++;
+    }
+    uint32_t tail = (spillFileHeader.head + spillFileHeader.usedSize) % spillFileHeader.capacity;
+    if (error == ESP_OK)
+      error = WriteSpillFile(tail, &recordHeader, sizeof(recordHeader));
+    if (error == ESP_OK)
+      error = WriteSpillFile((tail + sizeof(recordHeader)) % spillFileHeader.capacity, record.second.data(), recordHeader.size);
+    if (error != ESP_OK)
+      break;
+    spillFileHeader.usedSize += recordSize;
+    spillFileHeader.numberOfRecords++;
+  }
+  if (error == ESP_OK)
+    error = WriteSpillFileHeader();
+
+  LockGuard lg(*this);
+  if (error != ESP_OK) {
+    // The records that might have been lost with the file are counted as dropped
+    numberOfDroppedRecords = spilledRecords.size() + spillFileHeader.numberOfRecords;
+    CloseSpillFile();
+  }
+  statistics.numberOfSpilledRecords = spillFileHeader.numberOfRecords;
+  statistics.numberOfDroppedRecords += numberOfDroppedRecords;
+  ESP_RETURN_ON_ERROR(error, TAG, "spill file write failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::ReadSpilledRecords(std::vector<std::pair<uint8_t, std::string>>& batch) {
+  size_t maxBatchSize = GetMaxBatchSize();
+  size_t separatorSize;
+  {
+    LockGuard lg(*this);
+    separatorSize = recordSeparator.size();
+  }
+
+  uint32_t offset = spillFileHeader.head;
+  size_t batchSize = 0;
+  esp_err_t error = ESP_OK;
+  for (uint32_t i = 0; i < spillFileHeader.numberOfRecords && error == ESP_OK; i++) {
+    SpillRecordHeader recordHeader;
+    error = ReadSpillFile(offset, &recordHeader, sizeof(recordHeader));
+    size_t recordSize = (batch.empty() ? 0 : separatorSize) + recordHeader.size;
+    if (error != ESP_OK || (!batch.empty() && batchSize + recordSize > maxBatchSize))
+      break;
+    std::string record(recordHeader.size, 0);
+    error = ReadSpillFile((offset + sizeof(recordHeader)) % spillFileHeader.capacity, record.data(), recordHeader.size);
+    batchSize += recordSize;
+    offset = (offset + sizeof(recordHeader) + recordHeader.size) % spillFileHeader.capacity;
+    batch.emplace_back(std::min(recordHeader.priority, (uint8_t)(numberOfPriorities - 1)), std::move(record));
+  }
+
+  if (error != ESP_OK) {
+    LockGuard lg(*this);
+    statistics.numberOfDroppedRecords += spillFileHeader.numberOfRecords;
+    statistics.numberOfSpilledRecords = 0;
+    CloseSpillFile();
+    ESP_RETURN_ON_ERROR(error, TAG, "spill file read failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::RemoveSpilledRecords(size_t numberOfRecords) {
+  esp_err_t error = ESP_OK;
+  for (size_t i = 0; i < numberOfRecords && error == ESP_OK; i++) {
+    SpillRecordHeader recordHeader;
+    error = ReadSpillFile(spillFileHeader.head, &recordHeader, sizeof(recordHeader));
+    spillFileHeader.head = (spillFileHeader.head + sizeof(recordHeader) + recordHeader.size) % spillFileHeader.capacity;
+    spillFileHeader.usedSize -= sizeof(recordHeader) + recordHeader.size;
+    spillFileHeader.numberOfRecords--;
+  }
+  if (error == ESP_OK)
+    error = WriteSpillFileHeader();
+
+  LockGuard lg(*this);
+  if (error != ESP_OK) {
+    statistics.numberOfDroppedRecords += spillFileHeader.numberOfRecords;
+    CloseSpillFile();
+  }
+  statistics.numberOfSpilledRecords = spillFileHeader.numberOfRecords;
+  ESP_RETURN_ON_ERROR(error, TAG, "spill file write failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::ReadSpillFile(uint32_t offset, void* dest, size_t size) {
+  // The record data can wrap around the end of the ring
+  while (size) {
+    size_t partSize = std::min(size, (size_t)(spillFileHeader.capacity - offset));
+    ESP_RETURN_ON_FALSE(fseek(spillFile, sizeof(SpillFileHeader) + offset, SEEK_SET) == 0 && fread(dest, 1, partSize, spillFile) == partSize,
+                        ESP_FAIL, TAG, "spill file read failed");
+    dest = (uint8_t*)dest + partSize;
+    size -= partSize;
+    offset = (offset + partSize) % spillFileHeader.capacity;
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::WriteSpillFile(uint32_t offset, const void* src, size_t size) {
+  while (size) {
+    size_t partSize = std::min(size, (size_t)(spillFileHeader.capacity - offset));
+    ESP_RETURN_ON_FALSE(fseek(spillFile, sizeof(SpillFileHeader) + offset, SEEK_SET) == 0 && fwrite(src, 1, partSize, spillFile) == partSize,
+                        ESP_FAIL, TAG, "spill file write failed");
+    src = (const uint8_t*)src + partSize;
+    size -= partSize;
+    offset = (offset + partSize) % spillFileHeader.capacity;
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t HttpUploadQueue::WriteSpillFileHeader() {
+  // The header is written after the records, so a restart during the write loses the new records only
+  ESP_RETURN_ON_FALSE(fflush(spillFile) == 0 && fseek(spillFile, 0, SEEK_SET) == 0 &&
+                      fwrite(&spillFileHeader, sizeof(spillFileHeader), 1, spillFile) == 1 && fflush(spillFile) == 0,
+                      ESP_FAIL, TAG, "spill file header write failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+}
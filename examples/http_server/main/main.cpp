@@ -33,13 +33,9 @@ const std::string wifiSsid = CONFIG_EXAMPLE_WIFI_SSID;
 const std::string wifiPassword = CONFIG_EXAMPLE_WIFI_PASSWORD;
 auto wiFiGotIpEventHandler = std::make_shared<WiFiGotIpEventHandler>();
 
-auto headerBuffer = std::make_shared<PL::Buffer>(1024);
-
-HttpServer httpServer(headerBuffer);
-
 extern const char certificate[] asm("_binary_cert_pem_start");
 extern const char privateKey[] asm("_binary_key_pem_start");
-HttpServer httpsServer(certificate, privateKey, headerBuffer);
+HttpServer httpServer(certificate, privateKey);
 
 auto requestEventHandler = std::make_shared<RequestEventHandler>();
 
@@ -55,8 +51,9 @@ extern "C" void app_main(void) {
   wifi.gotIpV4AddressEvent.AddHandler(wiFiGotIpEventHandler, &WiFiGotIpEventHandler::OnGotIpV4Address);
   wifi.gotIpV6AddressEvent.AddHandler(wiFiGotIpEventHandler, &WiFiGotIpEventHandler::OnGotIpV6Address);
 
+  // The same server handles HTTPS requests on the main port and HTTP requests on the additional listener
+  httpServer.AddListener(PL::HttpServer::defaultHttpPort);
   httpServer.requestEvent.AddHandler(requestEventHandler, &RequestEventHandler::OnRequest);
-  httpsServer.requestEvent.AddHandler(requestEventHandler, &RequestEventHandler::OnRequest);
 
   wifi.EnableIpV4DhcpClient();
   wifi.Enable();
@@ -84,24 +81,20 @@ esp_err_t HttpServer::HandleRequest(PL::HttpServerTransaction& transaction) {
 
 void WiFiGotIpEventHandler::OnGotIpV4Address(PL::NetworkInterface& wifi) {
   if (httpServer.Enable() == ESP_OK)
-    printf("Listening (address: %s, port: %d)\n", wifi.GetIpV4Address().ToString().c_str(), httpServer.GetPort());
-  if (httpsServer.Enable() == ESP_OK)
-    printf("Listening (address: %s, port: %d)\n", wifi.GetIpV4Address().ToString().c_str(), httpsServer.GetPort());
+    printf("Listening (address: %s, ports: %d, %d)\n", wifi.GetIpV4Address().ToString().c_str(), httpServer.GetPort(), PL::HttpServer::defaultHttpPort);
 }
 
 //==============================================================================
 
 void WiFiGotIpEventHandler::OnGotIpV6Address(PL::NetworkInterface& wifi) {
   if (httpServer.Enable() == ESP_OK)
-    printf("Listening (address: %s, port: %d)\n", wifi.GetIpV6LinkLocalAddress().ToString().c_str(), httpServer.GetPort());
-  if (httpsServer.Enable() == ESP_OK)
-    printf("Listening (address: %s, port: %d)\n", wifi.GetIpV6LinkLocalAddress().ToString().c_str(), httpsServer.GetPort());
+    printf("Listening (address: %s, ports: %d, %d)\n", wifi.GetIpV6LinkLocalAddress().ToString().c_str(), httpServer.GetPort(), PL::HttpServer::defaultHttpPort);
 }
 
 //==============================================================================
 
 void RequestEventHandler::OnRequest(PL::HttpServer& server, PL::HttpServerTransaction& transaction) {
-  printf("%s request from %s\n", &server == &httpServer ? "HTTP" : "HTTPS", transaction.GetNetworkStream()->GetRemoteEndpoint().address.ToString().c_str());
+  printf("Request from %s\n", transaction.GetNetworkStream()->GetRemoteEndpoint().address.ToString().c_str());
   std::string requestUri;
   transaction.GetRequestUri(requestUri);
   printf("URI: %s\n", requestUri.c_str());
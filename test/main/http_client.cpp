@@ -1,11 +1,16 @@
 #include "http_client.h"
 #include "esp_crt_bundle.h"
 #include "unity.h"
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "esp_spiffs.h"
+#endif
 
 //==============================================================================
 
 const TickType_t readTimeout = 5000 / portTICK_PERIOD_MS;
 const TickType_t writeTimeout = 6000 / portTICK_PERIOD_MS;
+const TickType_t requestDeadline = 500 / portTICK_PERIOD_MS;
+const TickType_t circuitBreakerOpenTime = 2000 / portTICK_PERIOD_MS;
 const std::string hostname = "httpbin.org";
 
 const std::vector<TestTransaction> testTransactions= {
@@ -35,6 +40,44 @@ static char responseBody[2000];
 
 //==============================================================================
 
+class BodyStream : public PL::Stream {
+public:
+  BodyStream(const std::string& data) : data(data) {}
+  esp_err_t Lock(TickType_t timeout = portMAX_DELAY) override { return mutex.Lock(timeout); }
+  esp_err_t Unlock() override { return mutex.Unlock(); }
+  esp_err_t Read(void* dest, size_t size) override {
+    if (size > data.size() - position)
+      return ESP_ERR_INVALID_SIZE;
+    memcpy(dest, data.data() + position, size);
+    position += size;
+    return ESP_OK;
+  }
+  esp_err_t Write(const void* src, size_t size) override { return ESP_ERR_NOT_SUPPORTED; }
+  size_t GetReadableSize() override { return data.size() - position; }
+  TickType_t GetReadTimeout() override { return 0; }
+  esp_err_t SetReadTimeout(TickType_t timeout) override { return ESP_OK; }
+
+private:
+  PL::Mutex mutex;
+  std::string data;
+  size_t position = 0;
+};
+
+//==============================================================================
+
+void TestDataResponse(PL::HttpClient& client) {
+  ushort responseStatusCode;
+  size_t responseBodySize;
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, &responseBodySize) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(responseBodySize + 1 <= sizeof(responseBody));
+  TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  responseBody[responseBodySize] = 0;
+  TEST_ASSERT(strstr(responseBody, "\"data\": \"Test data\"") != NULL);
+}
+
+//==============================================================================
+
 void TestClient(PL::HttpClient& client) {
   TEST_ASSERT(client.Initialize() == ESP_OK);
 
@@ -78,6 +121,111 @@ void TestClient(PL::HttpClient& client) {
       TEST_ASSERT(strstr(responseBody, s.c_str()) != NULL);
   }
 
+  printf("Test body fragments\n");
+  const std::string fragment1 = "Test ", fragment2 = "data";
+  const PL::HttpBodyFragment fragments[] = { {fragment1.data(), fragment1.size()}, {fragment2.data(), fragment2.size()} };
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::POST, "/post", fragments, 2) == ESP_OK);
+  TestDataResponse(client);
+
+  printf("Test body stream\n");
+  // The short body is written as a single fragment, the long one in chunks
+  for (const std::string& streamBody : {std::string("Test data"), std::string(PL::HttpClient::requestBodyChunkSize + 100, 'a')}) {
+    BodyStream stream(streamBody);
+    TEST_ASSERT(client.WriteRequest(PL::HttpMethod::POST, "/post", stream, streamBody.size()) == ESP_OK);
+    TEST_ASSERT_EQUAL(0, stream.GetReadableSize());
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, &responseBodySize) == ESP_OK);
+    TEST_ASSERT_EQUAL(200, responseStatusCode);
+    TEST_ASSERT(responseBodySize + 1 <= sizeof(responseBody));
+    TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+    responseBody[responseBodySize] = 0;
+    TEST_ASSERT(strstr(responseBody, ("\"data\": \"" + streamBody + "\"").c_str()) != NULL);
+  }
+
+  printf("Test body source\n");
+  const std::string sourceBody = "Test data";
+  size_t sourcePosition = 0;
+  auto source = [&](void* dest, size_t maxSize, size_t& size) {
+    size = std::min(std::min(maxSize, (size_t)4), sourceBody.size() - sourcePosition);
+    memcpy(dest, sourceBody.data() + sourcePosition, size);
+    sourcePosition += size;
+    return ESP_OK;
+  };
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::POST, "/post", source) == ESP_OK);
+  TestDataResponse(client);
+
+  printf("Test preemptive digest auth\n");
+  const std::string digestUri = "/digest-auth/auth/user/password/SHA-256";
+  TEST_ASSERT(client.SetAuthScheme(PL::HttpAuthScheme::digest) == ESP_OK);
+  TEST_ASSERT(client.SetAuthCredentials("user", "password") == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::GET, digestUri) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  if (responseStatusCode == 401) {
+    TEST_ASSERT(client.WriteRequest(PL::HttpMethod::GET, digestUri) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  }
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::GET, digestUri) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.SetAuthScheme(PL::HttpAuthScheme::none) == ESP_OK);
+
+  printf("Test address cache\n");
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::GET, "/get") == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  PL::HttpClientTimings timings = client.GetTimings();
+  TEST_ASSERT_EQUAL(0, timings.resolveTime);
+  TEST_ASSERT(timings.connectTime > 0);
+  TEST_ASSERT(timings.responseTime > 0);
+
+  printf("Test request policy\n");
+  PL::HttpRequestPolicy requestPolicy = client.GetRequestPolicy();
+  TEST_ASSERT_EQUAL(PL::HttpClient::defaultRequestPolicy.maxNumberOfRetries, requestPolicy.maxNumberOfRetries);
+  requestPolicy.maxNumberOfRetries = 2;
+  requestPolicy.deadline = requestDeadline;
+  TEST_ASSERT(client.SetRequestPolicy(requestPolicy) == ESP_OK);
+  // Every socket operation of an attempt is bounded by the time left before the deadline
+  TickType_t requestStartTime = xTaskGetTickCount();
+  TEST_ASSERT(client.SendRequest(PL::HttpMethod::GET, "/delay/1", responseStatusCode, NULL) == ESP_ERR_TIMEOUT);
+  TEST_ASSERT(xTaskGetTickCount() - requestStartTime <= requestDeadline + 100 / portTICK_PERIOD_MS);
+  requestPolicy.deadline = portMAX_DELAY;
+  requestPolicy.circuitBreakerThreshold = requestPolicy.maxNumberOfRetries + 1;
+  requestPolicy.circuitBreakerOpenTime = circuitBreakerOpenTime;
+  TEST_ASSERT(client.SetRequestPolicy(requestPolicy) == ESP_OK);
+  TEST_ASSERT(client.SendRequest(PL::HttpMethod::GET, "/status/503", responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(503, responseStatusCode);
+  TEST_ASSERT(client.SendRequest(PL::HttpMethod::GET, "/get", responseStatusCode, NULL) == ESP_ERR_INVALID_STATE);
+  vTaskDelay(circuitBreakerOpenTime);
+  TEST_ASSERT(client.SendRequest(PL::HttpMethod::GET, "/get", responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.SetRequestPolicy(PL::HttpClient::defaultRequestPolicy) == ESP_OK);
+
+  printf("Test prepared request\n");
+  const PL::HttpRequest headersRequest(PL::HttpMethod::GET, "/headers", { {"E", "F"} });
+  const PL::HttpRequest postRequest(PL::HttpMethod::POST, "http://" + hostname + "/post", {}, "Test data");
+  TEST_ASSERT(headersRequest.IsValid());
+  TEST_ASSERT(postRequest.IsValid());
+  TEST_ASSERT(!PL::HttpRequest(PL::HttpMethod::GET, "ftp://" + hostname).IsValid());
+  TEST_ASSERT_EQUAL(PL::HttpClient::defaultHttpPort, postRequest.GetPort());
+  for (int i = 0; i < 2; i++) {
+    TEST_ASSERT(client.SendRequest(headersRequest, responseStatusCode, &responseBodySize) == ESP_OK);
+    TEST_ASSERT_EQUAL(200, responseStatusCode);
+    TEST_ASSERT(responseBodySize + 1 <= sizeof(responseBody));
+    TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+    responseBody[responseBodySize] = 0;
+    TEST_ASSERT(strstr(responseBody, "\"E\": \"F\"") != NULL);
+  }
+  // The absolute URL switches the client to its host and scheme, the relative one returns it to the client host
+  TEST_ASSERT(client.WriteRequest(postRequest) == ESP_OK);
+  TestDataResponse(client);
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::GET, "/get") == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, &responseBodySize) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  responseBody[responseBodySize] = 0;
+  TEST_ASSERT(strstr(responseBody, "\"E\": \"F\"") == NULL);
+
   printf("Test delay\n");
   TEST_ASSERT(client.WriteRequest(PL::HttpMethod::GET, "/delay/1") == ESP_OK);
   TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
@@ -101,4 +249,238 @@ void TestHttpsClient() {
   PL::HttpClient client(hostname, esp_crt_bundle_attach);
   TEST_ASSERT_EQUAL(PL::HttpClient::defaultHttpsPort, client.GetPort());
   TestClient(client);
+}
+
+//==============================================================================
+
+// Two headers with this value make the response head larger than the default buffer of HttpAsyncClient
+static const std::string longHeaderValue(PL::HttpAsyncClient::defaultBufferSize / 2 + 100, 'a');
+
+//==============================================================================
+
+struct AsyncClientResult {
+  volatile bool done = false;
+  esp_err_t error = ESP_FAIL;
+  ushort getStatusCode = 0;
+  ushort postStatusCode = 0;
+  std::string postResponseBody;
+  ushort longHeadStatusCode = 0;
+  std::string longHeaderValue;
+};
+
+//==============================================================================
+
+PL::HttpTask AsyncClientRequests(PL::HttpAsyncClient& client, AsyncClientResult& result) {
+  esp_err_t error = co_await client.Send(PL::HttpMethod::GET, "/get", "", result.getStatusCode);
+  char buffer[256];
+  size_t size = 1;
+  // The connection is kept alive for the second request only if the first response body is read to the end
+  while (error == ESP_OK && size)
+    error = co_await client.ReadResponseBody(buffer, sizeof(buffer), size);
+  if (error == ESP_OK)
+    error = co_await client.Send(PL::HttpMethod::POST, "/post", "Test data", result.postStatusCode);
+  size = 1;
+  while (error == ESP_OK && size) {
+    error = co_await client.ReadResponseBody(buffer, sizeof(buffer), size);
+    result.postResponseBody.append(buffer, size);
+  }
+  // The response head larger than the client buffer is read line by line
+  if (error == ESP_OK)
+    error = co_await client.Send(PL::HttpMethod::GET, "/response-headers?A=" + longHeaderValue + "&B=" + longHeaderValue, "", result.longHeadStatusCode);
+  if (error == ESP_OK)
+    error = client.GetResponseHeader("B", result.longHeaderValue);
+  size = 1;
+  while (error == ESP_OK && size)
+    error = co_await client.ReadResponseBody(buffer, sizeof(buffer), size);
+  result.error = error;
+  result.done = true;
+  co_return error;
+}
+
+//==============================================================================
+
+void TestHttpAsyncClient() {
+  PL::HttpScheduler scheduler;
+  PL::HttpAsyncClient httpClient(scheduler, hostname);
+  PL::HttpAsyncClient httpsClient(scheduler, hostname, esp_crt_bundle_attach);
+  TEST_ASSERT_EQUAL(PL::HttpAsyncClient::defaultHttpsPort, httpsClient.GetPort());
+  AsyncClientResult httpResult, httpsResult;
+
+  TEST_ASSERT(scheduler.Spawn(AsyncClientRequests(httpClient, httpResult)) == ESP_ERR_INVALID_STATE);
+  TEST_ASSERT(scheduler.Enable() == ESP_OK);
+  TEST_ASSERT(scheduler.Spawn(AsyncClientRequests(httpClient, httpResult)) == ESP_OK);
+  TEST_ASSERT(scheduler.Spawn(AsyncClientRequests(httpsClient, httpsResult)) == ESP_OK);
+  TickType_t startTime = xTaskGetTickCount();
+  while (!(httpResult.done && httpsResult.done) && xTaskGetTickCount() - startTime < 2 * readTimeout)
+    vTaskDelay(1);
+
+  // The spawned request outlives the temporary URI and body it is created with
+  ushort statusCode = 0;
+  TEST_ASSERT(scheduler.Spawn(httpClient.Send(PL::HttpMethod::GET, std::string("/status/") + "204", std::string(), statusCode)) == ESP_OK);
+  startTime = xTaskGetTickCount();
+  while (!statusCode && xTaskGetTickCount() - startTime < readTimeout)
+    vTaskDelay(1);
+  TEST_ASSERT(scheduler.Disable() == ESP_OK);
+  TEST_ASSERT_EQUAL(204, statusCode);
+
+  for (auto result : {&httpResult, &httpsResult}) {
+    TEST_ASSERT(result->done);
+    TEST_ASSERT(result->error == ESP_OK);
+    TEST_ASSERT_EQUAL(200, result->getStatusCode);
+    TEST_ASSERT_EQUAL(200, result->postStatusCode);
+    TEST_ASSERT(result->postResponseBody.find("\"data\": \"Test data\"") != std::string::npos);
+    TEST_ASSERT_EQUAL(200, result->longHeadStatusCode);
+    TEST_ASSERT(result->longHeaderValue == longHeaderValue);
+  }
+}
+
+//==============================================================================
+
+void TestHttpUploadQueue() {
+  PL::HttpClient client(hostname);
+  TEST_ASSERT(client.Initialize() == ESP_OK);
+  PL::HttpUploadQueue queue(client, "/post", 32);
+
+  // Records of the lowest priority are dropped first when the memory is full
+  TEST_ASSERT(queue.Enqueue("0123456789", 0) == ESP_OK);
+  TEST_ASSERT(queue.Enqueue("0123456789", 1) == ESP_OK);
+  TEST_ASSERT(queue.Enqueue("0123456789", 1) == ESP_OK);
+  TEST_ASSERT(queue.Enqueue("0123456789", 1) == ESP_OK);
+  TEST_ASSERT(queue.Enqueue("0123456789", 0) == ESP_ERR_NO_MEM);
+  PL::HttpUploadQueueStatistics statistics = queue.GetStatistics();
+  TEST_ASSERT_EQUAL(3, statistics.numberOfQueuedRecords);
+  TEST_ASSERT_EQUAL(2, statistics.numberOfDroppedRecords);
+
+  TEST_ASSERT_EQUAL(PL::HttpUploadQueue::defaultMaxBatchSize, queue.GetMaxBatchSize());
+  TEST_ASSERT(queue.SetBatchLimits(100, 100 / portTICK_PERIOD_MS) == ESP_OK);
+  TEST_ASSERT_EQUAL(100 / portTICK_PERIOD_MS, queue.GetBatchTime());
+  TEST_ASSERT(queue.Enable() == ESP_OK);
+  TickType_t startTime = xTaskGetTickCount();
+  while (queue.GetStatistics().numberOfSentRecords < 3 && xTaskGetTickCount() - startTime < readTimeout)
+    vTaskDelay(1);
+  TEST_ASSERT(queue.Disable() == ESP_OK);
+
+  statistics = queue.GetStatistics();
+  TEST_ASSERT_EQUAL(0, statistics.numberOfQueuedRecords);
+  TEST_ASSERT_EQUAL(3, statistics.numberOfSentRecords);
+  TEST_ASSERT_EQUAL(1, statistics.numberOfBatches);
+}
+
+//==============================================================================
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+static const std::string spillFilePath = "/tmp/pl_http_test_spill";
+#else
+static const std::string spillFilePath = "/spiffs/spill";
+#endif
+
+// The spill file header and the record header size of HttpUploadQueue
+struct SpillFileHeader {
+  uint32_t signature;
+  uint32_t capacity;
+  uint32_t head;
+  uint32_t usedSize;
+  uint32_t numberOfRecords;
+};
+static constexpr size_t spillRecordHeaderSize = 3;
+
+//==============================================================================
+
+static std::vector<std::pair<uint8_t, std::string>> ReadSpillFile() {
+  std::vector<std::pair<uint8_t, std::string>> records;
+  FILE* file = fopen(spillFilePath.c_str(), "rb");
+  if (!file)
+    return records;
+  SpillFileHeader header = {};
+  std::string data;
+  if (fread(&header, sizeof(header), 1, file) == 1) {
+    data.resize(header.capacity);
+    fread(data.data(), 1, data.size(), file);
+  }
+  fclose(file);
+
+  // The records wrap around the end of the ring
+  uint32_t offset = header.head;
+  auto byte = [&](uint32_t i) { return (uint8_t)data[(offset + i) % header.capacity]; };
+  for (uint32_t i = 0; i < header.numberOfRecords; i++) {
+    uint16_t size = byte(0) | byte(1) << 8;
+    std::string record;
+    for (uint32_t j = 0; j < size; j++)
+      record += (char)byte(spillRecordHeaderSize + j);
+    records.emplace_back(byte(2), record);
+    offset = (offset + spillRecordHeaderSize + size) % header.capacity;
+  }
+  return records;
+}
+
+//==============================================================================
+
+void TestHttpUploadQueueSpillFile() {
+#ifndef CONFIG_IDF_TARGET_LINUX
+  esp_vfs_spiffs_conf_t spiffsConfig = {"/spiffs", NULL, 2, true};
+  TEST_ASSERT(esp_vfs_spiffs_register(&spiffsConfig) == ESP_OK);
+#endif
+  remove(spillFilePath.c_str());
+  PL::HttpClient client(hostname);
+  TEST_ASSERT(client.Initialize() == ESP_OK);
+  // The ring holds three records of 8 bytes, so that the fourth one wraps around its end
+  const size_t spillFileSize = sizeof(SpillFileHeader) + 3 * (spillRecordHeaderSize + 8) + 5;
+
+  {
+    // The server fails every batch, so the records are moved to the spill file
+    PL::HttpUploadQueue queue(client, "/status/503");
+    TEST_ASSERT(queue.SetSpillFile(spillFilePath, spillFileSize) == ESP_OK);
+    TEST_ASSERT(queue.SetBatchLimits(100, 100 / portTICK_PERIOD_MS) == ESP_OK);
+    TEST_ASSERT(queue.SetRetryTime(60000 / portTICK_PERIOD_MS) == ESP_OK);
+    TEST_ASSERT(queue.Enable() == ESP_OK);
+    for (int i = 0; i < 3; i++)
+      TEST_ASSERT(queue.Enqueue("record-" + std::to_string(i), i) == ESP_OK);
+    TickType_t startTime = xTaskGetTickCount();
+    while (queue.GetStatistics().numberOfSpilledRecords < 3 && xTaskGetTickCount() - startTime < readTimeout)
+      vTaskDelay(1);
+    TEST_ASSERT_EQUAL(3, queue.GetStatistics().numberOfSpilledRecords);
+
+    // The file is full: the oldest record is dropped
+    TEST_ASSERT(queue.Enqueue("record-3", 3) == ESP_OK);
+    startTime = xTaskGetTickCount();
+    while (!queue.GetStatistics().numberOfDroppedRecords && xTaskGetTickCount() - startTime < readTimeout)
+      vTaskDelay(1);
+    TEST_ASSERT(queue.Disable() == ESP_OK);
+
+    PL::HttpUploadQueueStatistics statistics = queue.GetStatistics();
+    TEST_ASSERT_EQUAL(0, statistics.numberOfQueuedRecords);
+    TEST_ASSERT_EQUAL(3, statistics.numberOfSpilledRecords);
+    TEST_ASSERT_EQUAL(1, statistics.numberOfDroppedRecords);
+    TEST_ASSERT_EQUAL(0, statistics.numberOfSentRecords);
+  }
+
+  // The records are spilled from the highest priority and keep their priorities in the file
+  std::vector<std::pair<uint8_t, std::string>> records = ReadSpillFile();
+  TEST_ASSERT_EQUAL(3, records.size());
+  TEST_ASSERT(records[0] == std::make_pair((uint8_t)1, std::string("record-1")));
+  TEST_ASSERT(records[1] == std::make_pair((uint8_t)0, std::string("record-0")));
+  TEST_ASSERT(records[2] == std::make_pair((uint8_t)3, std::string("record-3")));
+
+  {
+    // The queue reopening the existing file sends the spilled records first
+    PL::HttpUploadQueue queue(client, "/post");
+    TEST_ASSERT(queue.SetSpillFile(spillFilePath, spillFileSize) == ESP_OK);
+    TEST_ASSERT(queue.SetBatchLimits(100, 100 / portTICK_PERIOD_MS) == ESP_OK);
+    TEST_ASSERT(queue.Enable() == ESP_OK);
+    TickType_t startTime = xTaskGetTickCount();
+    while (queue.GetStatistics().numberOfSentRecords < 3 && xTaskGetTickCount() - startTime < readTimeout)
+      vTaskDelay(1);
+    TEST_ASSERT(queue.Disable() == ESP_OK);
+
+    PL::HttpUploadQueueStatistics statistics = queue.GetStatistics();
+    TEST_ASSERT_EQUAL(0, statistics.numberOfSpilledRecords);
+    TEST_ASSERT_EQUAL(3, statistics.numberOfSentRecords);
+    TEST_ASSERT_EQUAL(1, statistics.numberOfBatches);
+  }
+  TEST_ASSERT(ReadSpillFile().empty());
+
+  remove(spillFilePath.c_str());
+#ifndef CONFIG_IDF_TARGET_LINUX
+  TEST_ASSERT(esp_vfs_spiffs_unregister(NULL) == ESP_OK);
+#endif
 }
\ No newline at end of file
@@ -23,4 +23,7 @@ struct TestTransaction {
 //==============================================================================
 
 void TestHttpClient();
-void TestHttpsClient();
\ No newline at end of file
+void TestHttpsClient();
+void TestHttpAsyncClient();
+void TestHttpUploadQueue();
+void TestHttpUploadQueueSpillFile();
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include "http_load.h"
+#include "http_server.h"
+#include "unity.h"
+
+//==============================================================================
+
+const std::string host = "localhost";
+const size_t numberOfLoadClients = 2;
+const size_t numberOfLoadRequests = 20;
+const float loadRequestRate = 50;
+const TickType_t loadDuration = 1000 / portTICK_PERIOD_MS;
+const std::string loadResponseBody = "Load test body";
+
+//==============================================================================
+
+void TestHttpLatencyHistogram() {
+  PL::HttpLatencyHistogram histogram;
+  TEST_ASSERT_EQUAL(0, histogram.GetPercentile(50));
+  for (size_t i = 0; i < PL::HttpLatencyHistogram::numberOfBuckets; i++) {
+    TEST_ASSERT_EQUAL(i, PL::HttpLatencyHistogram::GetBucketIndex(PL::HttpLatencyHistogram::GetBucketMinValue(i)));
+    TEST_ASSERT_EQUAL(i, PL::HttpLatencyHistogram::GetBucketIndex(PL::HttpLatencyHistogram::GetBucketMaxValue(i)));
+  }
+
+  for (int i = 1; i <= 1000; i++)
+    histogram.Record(i * 1000);
+  TEST_ASSERT_EQUAL(1000, histogram.GetCount());
+  TEST_ASSERT_EQUAL(1000, histogram.GetMin());
+  TEST_ASSERT_EQUAL(1000000, histogram.GetMax());
+  TEST_ASSERT_EQUAL(500500, histogram.GetMean());
+  // A percentile is the maximum value of its bucket: it is not less than the exact one and not more than the bucket width above it
+  for (double percentile : {50.0, 90.0, 99.0}) {
+    int64_t exactValue = percentile * 10000;
+    TEST_ASSERT(histogram.GetPercentile(percentile) >= exactValue && histogram.GetPercentile(percentile) <= exactValue * 33 / 32);
+  }
+  TEST_ASSERT_EQUAL(1000000, histogram.GetPercentile(100));
+
+  PL::HttpLatencyHistogram histogram2;
+  histogram2.Record(1);
+  histogram2.Merge(histogram);
+  TEST_ASSERT_EQUAL(1001, histogram2.GetCount());
+  TEST_ASSERT_EQUAL(1, histogram2.GetMin());
+  histogram2.Reset();
+  TEST_ASSERT_EQUAL(0, histogram2.GetCount());
+}
+
+//==============================================================================
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+
+void TestHttpLoadGenerator() {
+  HttpServer server;
+  PL::HttpLoadGenerator generator(host);
+  PL::HttpLoadStatistics statistics;
+  TEST_ASSERT(server.Enable() == ESP_OK);
+
+  TEST_ASSERT(generator.Run(statistics) == ESP_ERR_INVALID_STATE);
+  TEST_ASSERT(generator.AddRequest({PL::HttpMethod::GET, "/correct", "", 3}) == ESP_OK);
+  TEST_ASSERT(generator.AddRequest({PL::HttpMethod::GET, "/incorrect", "", 1}) == ESP_OK);
+  TEST_ASSERT(generator.AddRequest({PL::HttpMethod::GET, "/correct", "", 0}) == ESP_ERR_INVALID_ARG);
+
+  PL::HttpLoadProfile profile = PL::HttpLoadGenerator::defaultProfile;
+  profile.numberOfClients = numberOfLoadClients;
+  profile.numberOfRequests = numberOfLoadRequests;
+  TEST_ASSERT(generator.SetProfile(profile) == ESP_OK);
+  TEST_ASSERT(generator.Run(statistics) == ESP_OK);
+  TEST_ASSERT_EQUAL(numberOfLoadRequests, statistics.numberOfRequests);
+  TEST_ASSERT_EQUAL(0, statistics.numberOfErrors);
+  TEST_ASSERT(statistics.numberOfClientErrors > 0 && statistics.numberOfClientErrors < numberOfLoadRequests);
+  TEST_ASSERT_EQUAL(numberOfLoadClients, statistics.numberOfConnections);
+  TEST_ASSERT(statistics.medianLatency <= statistics.p99Latency && statistics.p99Latency <= statistics.maxLatency);
+  TEST_ASSERT_EQUAL(numberOfLoadRequests, generator.GetLatencyHistogram().GetCount());
+
+  // The request mix depends on the seed only
+  size_t numberOfClientErrors = statistics.numberOfClientErrors;
+  profile.reuseConnections = false;
+  TEST_ASSERT(generator.SetProfile(profile) == ESP_OK);
+  TEST_ASSERT(generator.Run(statistics) == ESP_OK);
+  TEST_ASSERT_EQUAL(numberOfClientErrors, statistics.numberOfClientErrors);
+  TEST_ASSERT_EQUAL(numberOfLoadRequests, statistics.numberOfConnections);
+
+  profile.mode = PL::HttpLoadMode::openLoop;
+  profile.requestRate = loadRequestRate;
+  profile.numberOfRequests = 0;
+  TEST_ASSERT(generator.SetProfile(profile) == ESP_ERR_INVALID_ARG);
+  profile.duration = loadDuration;
+  TEST_ASSERT(generator.SetProfile(profile) == ESP_OK);
+  TEST_ASSERT(generator.Run(statistics) == ESP_OK);
+  TEST_ASSERT(statistics.numberOfRequests > 0);
+  TEST_ASSERT_EQUAL(0, statistics.numberOfErrors);
+  TEST_ASSERT(statistics.duration >= (int64_t)loadDuration * portTICK_PERIOD_MS * 1000 / 2);
+
+  TEST_ASSERT(server.Disable() == ESP_OK);
+}
+
+#else
+
+const uint16_t loadServerPort = 8080;
+const uint16_t linkEmulatorPort = 8081;
+const uint32_t linkLatency = 10000;
+const uint32_t linkJitter = 2000;
+const float linkLossProbability = 0.2;
+
+//==============================================================================
+
+class HttpLoadServer : public PL::HttpEpollServer {
+protected:
+  esp_err_t HandleRequest(PL::HttpServerTransaction& transaction) override {
+    return transaction.WriteResponse(200, loadResponseBody);
+  }
+};
+
+//==============================================================================
+
+void TestHttpLinkEmulator() {
+  HttpLoadServer server;
+  PL::HttpLinkEmulator emulator(linkEmulatorPort, host, loadServerPort);
+  PL::HttpLoadGenerator generator(host, linkEmulatorPort);
+  PL::HttpLoadStatistics statistics;
+  TEST_ASSERT(server.SetPort(loadServerPort) == ESP_OK);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  TEST_ASSERT(emulator.Enable() == ESP_OK);
+  TEST_ASSERT(generator.AddRequest({PL::HttpMethod::GET, "/", "", 1}) == ESP_OK);
+  PL::HttpLoadProfile loadProfile = PL::HttpLoadGenerator::defaultProfile;
+  loadProfile.numberOfClients = numberOfLoadClients;
+  loadProfile.numberOfRequests = numberOfLoadRequests;
+  TEST_ASSERT(generator.SetProfile(loadProfile) == ESP_OK);
+
+  // A request on an open connection takes a round trip, the first request of a connection takes the handshake round trip as well
+  PL::HttpLinkProfile linkProfile = PL::HttpLinkEmulator::defaultProfile;
+  linkProfile.latency = linkLatency;
+  linkProfile.jitter = linkJitter;
+  TEST_ASSERT(emulator.SetProfile(linkProfile) == ESP_OK);
+  TEST_ASSERT(generator.Run(statistics) == ESP_OK);
+  TEST_ASSERT_EQUAL(numberOfLoadRequests, statistics.numberOfRequests);
+  TEST_ASSERT_EQUAL(0, statistics.numberOfErrors);
+  TEST_ASSERT(statistics.medianLatency >= 2 * linkLatency);
+  TEST_ASSERT(statistics.maxLatency >= 4 * linkLatency);
+  TEST_ASSERT_EQUAL(numberOfLoadClients, emulator.GetStatistics().numberOfConnections);
+
+  // Lost segments are delivered after the retransmission timeout
+  linkProfile.lossProbability = linkLossProbability;
+  TEST_ASSERT(emulator.SetProfile(linkProfile) == ESP_OK);
+  TEST_ASSERT(emulator.ResetStatistics() == ESP_OK);
+  TEST_ASSERT(generator.Run(statistics) == ESP_OK);
+  TEST_ASSERT_EQUAL(0, statistics.numberOfErrors);
+  TEST_ASSERT(emulator.GetStatistics().numberOfLostSegments > 0);
+  TEST_ASSERT(statistics.maxLatency >= linkProfile.retransmissionTimeout);
+
+  // Reset connections fail the requests
+  linkProfile = PL::HttpLinkEmulator::defaultProfile;
+  linkProfile.resetProbability = 1;
+  TEST_ASSERT(emulator.SetProfile(linkProfile) == ESP_OK);
+  TEST_ASSERT(generator.Run(statistics) == ESP_OK);
+  TEST_ASSERT_EQUAL(numberOfLoadRequests, statistics.numberOfErrors);
+  TEST_ASSERT(emulator.GetStatistics().numberOfResets > 0);
+
+  TEST_ASSERT(emulator.Disable() == ESP_OK);
+  TEST_ASSERT(server.Disable() == ESP_OK);
+}
+
+#endif
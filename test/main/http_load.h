@@ -0,0 +1,10 @@
+#include "pl_http.h"
+
+//==============================================================================
+
+void TestHttpLatencyHistogram();
+#ifdef CONFIG_IDF_TARGET_LINUX
+void TestHttpLinkEmulator();
+#else
+void TestHttpLoadGenerator();
+#endif
\ No newline at end of file
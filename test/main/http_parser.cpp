@@ -0,0 +1,254 @@
+#include "http_parser.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include <strings.h>
+#include <vector>
+
+//==============================================================================
+
+const size_t numberOfPerformanceIterations = 1000;
+const size_t receivedPartSize = 64;
+
+// Representative heads: a browser request, a REST API response and a CDN response with many headers
+const std::string requestHead =
+  "GET /api/v1/devices/42/status?fields=temperature,humidity HTTP/1.1\r\n"
+  "Host: device.local\r\n"
+  "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+  "Accept-Language: en-US,en;q=0.9\r\n"
+  "Accept-Encoding: gzip, deflate, br\r\n"
+  "Referer: http://device.local/dashboard\r\n"
+  "Cookie: session=3f2a9c1e7b5d4a8f9e0c1b2a3d4e5f60; theme=dark\r\n"
+  "Cache-Control: max-age=0\r\n"
+  "Connection: keep-alive\r\n"
+  "Content-Length: 0\r\n"
+  "\r\n";
+const std::string apiResponseHead =
+  "HTTP/1.1 200 OK\r\n"
+  "Date: Sun, 18 Oct 2026 12:00:00 GMT\r\n"
+  "Content-Type: application/json\r\n"
+  "Content-Length: 1234\r\n"
+  "Connection: keep-alive\r\n"
+  "Server: nginx/1.24.0\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "Access-Control-Allow-Credentials: true\r\n"
+  "\r\n";
+const std::string cdnResponseHead =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Type: application/octet-stream\r\n"
+  "Content-Length: 524288\r\n"
+  "Connection: keep-alive\r\n"
+  "Last-Modified: Fri, 16 Oct 2026 08:30:00 GMT\r\n"
+  "ETag: \"9a0364b9e99bb480dd25e1f0284c8555\"\r\n"
+  "x-amz-server-side-encryption: AES256\r\n"
+  "x-amz-version-id: 3HL4kqtJlcpXroDTDmJ.rmSpXd3dIbrHY\r\n"
+  "Accept-Ranges: bytes\r\n"
+  "Server: AmazonS3\r\n"
+  "Date: Sun, 18 Oct 2026 12:00:00 GMT\r\n"
+  "Cache-Control: public, max-age=31536000, immutable\r\n"
+  "X-Cache: Hit from cloudfront\r\n"
+  "Via: 1.1 5f2d0c8e1b7a4c3d9e6f0a1b2c3d4e5f.cloudfront.net (CloudFront)\r\n"
+  "X-Amz-Cf-Pop: FRA56-P5\r\n"
+  "X-Amz-Cf-Id: q7cXQJ9nYV0hV3kJ2u4bL5mN6oP7qR8sT9uV0wX1yZ2aB3cD4eF5gH==\r\n"
+  "Age: 86400\r\n"
+  "Vary: Origin, Access-Control-Request-Headers, Access-Control-Request-Method\r\n"
+  "Strict-Transport-Security: max-age=63072000; includeSubDomains; preload\r\n"
+  "\r\n";
+const char* const lookedUpHeaders[] = {"Content-Length", "Connection", "Transfer-Encoding"};
+
+//==============================================================================
+
+typedef std::vector<std::pair<std::string, std::string>> Headers;
+
+//==============================================================================
+
+// The response head handling of HttpAsyncClient before the head parser (still used for the heads that do not fit in its buffer):
+// each line is found with memchr in the data received so far and copied to a string, the header name and value are copied from the line
+// and the headers are looked up with strcasecmp (HttpAsyncClient::ReadLine, HttpAsyncClient::ReadLongResponseHead and HttpAsyncClient::GetResponseHeader).
+static bool ReadHeadLineByLine(const std::string& head, size_t partSize, Headers& headers) {
+  const char* data = head.data();
+  size_t lineStart = 0, searchStart = 0, dataSize = std::min(partSize, head.size());
+  bool startLine = true;
+  std::string line;
+  headers.clear();
+  while (true) {
+    const char* lineEnd = (const char*)memchr(data + searchStart, '\n', dataSize - searchStart);
+    if (!lineEnd) {
+      if (dataSize == head.size())
+        return false;
+      searchStart = dataSize;
+      dataSize = std::min(dataSize + partSize, head.size());
+      continue;
+    }
+    line.assign(data + lineStart, lineEnd > data + lineStart && lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd);
+    lineStart = searchStart = lineEnd + 1 - data;
+    if (startLine) {
+      startLine = false;
+      continue;
+    }
+    if (line.empty())
+      return true;
+    size_t separator = line.find(':');
+    if (separator == std::string::npos)
+      continue;
+    size_t valueStart = line.find_first_not_of(' ', separator + 1);
+    headers.emplace_back(line.substr(0, separator), valueStart == std::string::npos ? "" : line.substr(valueStart));
+  }
+}
+
+//==============================================================================
+
+// The response head handling of HttpAsyncClient with the head parser: the parsed headers are copied from the buffer (HttpAsyncClient::ReadResponseHead)
+static bool ReadHeadWithParser(PL::HttpHeadParser& parser, const std::string& head, size_t partSize, Headers& headers) {
+  parser.Reset();
+  esp_err_t error = ESP_ERR_NOT_FINISHED;
+  for (size_t size = std::min(partSize, head.size()); error == ESP_ERR_NOT_FINISHED; size = std::min(size + partSize, head.size()))
+    error = parser.Parse(head.data(), size);
+  if (error != ESP_OK)
+    return false;
+  headers.clear();
+  for (size_t i = 0; i < parser.GetNumberOfHeaders(); i++)
+    headers.emplace_back(parser.GetHeaderName(i), parser.GetHeaderValue(i));
+  return true;
+}
+
+//==============================================================================
+
+static size_t FindHeaders(const Headers& headers, const std::string** values) {
+  size_t numberOfFoundHeaders = 0;
+  for (size_t i = 0; i < sizeof(lookedUpHeaders) / sizeof(lookedUpHeaders[0]); i++) {
+    values[i] = NULL;
+    for (auto& header : headers) {
+      if (strcasecmp(header.first.c_str(), lookedUpHeaders[i]) == 0) {
+        values[i] = &header.second;
+        numberOfFoundHeaders++;
+        break;
+      }
+    }
+  }
+  return numberOfFoundHeaders;
+}
+
+//==============================================================================
+
+static void TestHeadPerformance(const char* name, PL::HttpHeadParser& parser, const std::string& head) {
+  Headers lineByLineHeaders, parserHeaders;
+  const std::string* lineByLineValues[3];
+  const std::string* parserValues[3];
+
+  // Both paths get the same headers, whether the head is received at once or in parts
+  for (size_t partSize : {head.size(), receivedPartSize}) {
+    TEST_ASSERT(ReadHeadLineByLine(head, partSize, lineByLineHeaders));
+    TEST_ASSERT(ReadHeadWithParser(parser, head, partSize, parserHeaders));
+    TEST_ASSERT(lineByLineHeaders == parserHeaders);
+  }
+  TEST_ASSERT_EQUAL(FindHeaders(lineByLineHeaders, lineByLineValues), FindHeaders(parserHeaders, parserValues));
+  for (size_t i = 0; i < 3; i++)
+    TEST_ASSERT(lineByLineValues[i] ? parserValues[i] && *parserValues[i] == *lineByLineValues[i] : !parserValues[i]);
+
+  int64_t times[4];
+  for (int i = 0; i < 4; i++) {
+    size_t partSize = i % 2 ? receivedPartSize : head.size();
+    int64_t startTime = esp_timer_get_time();
+    for (size_t j = 0; j < numberOfPerformanceIterations; j++) {
+      if (i < 2)
+        ReadHeadLineByLine(head, partSize, lineByLineHeaders);
+      else
+        ReadHeadWithParser(parser, head, partSize, lineByLineHeaders);
+      FindHeaders(lineByLineHeaders, lineByLineValues);
+    }
+    times[i] = esp_timer_get_time() - startTime;
+  }
+
+  printf("%s (%u bytes): line by line %.2f us (%.2f us with %u-byte reads), parser %.2f us (%.2f us with %u-byte reads)\n", name, (unsigned int)head.size(),
+         (double)times[0] / numberOfPerformanceIterations, (double)times[1] / numberOfPerformanceIterations, (unsigned int)receivedPartSize,
+         (double)times[2] / numberOfPerformanceIterations, (double)times[3] / numberOfPerformanceIterations, (unsigned int)receivedPartSize);
+  // The parser does not copy the lines, so it is not slower than the line-by-line path however the head is received
+  TEST_ASSERT(times[2] <= times[0]);
+  TEST_ASSERT(times[3] <= times[1]);
+}
+
+//==============================================================================
+
+void TestHttpRequestParser() {
+  const char request[] = "POST /a?b=c HTTP/1.1\r\nHost: localhost\r\nContent-Length:  9 \r\n\r\nTest body";
+  const size_t headSize = sizeof(request) - 1 - 9;
+  PL::HttpRequestParser parser;
+
+  // The head received in parts
+  TEST_ASSERT(parser.Parse(request, 10) == ESP_ERR_NOT_FINISHED);
+  TEST_ASSERT(parser.Parse(request, headSize - 1) == ESP_ERR_NOT_FINISHED);
+  TEST_ASSERT(parser.Parse(request, sizeof(request) - 1) == ESP_OK);
+  TEST_ASSERT(parser.IsComplete());
+  TEST_ASSERT_EQUAL(headSize, parser.GetHeadSize());
+  TEST_ASSERT(parser.GetMethod() == PL::HttpMethod::POST);
+  TEST_ASSERT(parser.GetTarget() == "/a?b=c");
+  TEST_ASSERT_EQUAL(1, parser.GetMinorVersion());
+  TEST_ASSERT_EQUAL(2, parser.GetNumberOfHeaders());
+  std::string_view value;
+  TEST_ASSERT(parser.FindHeader("content-length", value));
+  TEST_ASSERT(value == "9");
+  TEST_ASSERT(!parser.FindHeader("Content-Type", value));
+
+  parser.Reset();
+  TEST_ASSERT(parser.Parse("BREW / HTTP/1.0\r\n\r\n", 19) == ESP_OK);
+  TEST_ASSERT(parser.GetMethod() == PL::HttpMethod::unknown);
+  TEST_ASSERT(parser.GetMethodName() == "BREW");
+  TEST_ASSERT_EQUAL(0, parser.GetMinorVersion());
+
+  parser.Reset();
+  TEST_ASSERT(parser.Parse("GET / HTTP/1.1\r\nHost : localhost\r\n\r\n", 37) == ESP_ERR_INVALID_ARG);
+  parser.Reset();
+  TEST_ASSERT(parser.Parse("GET /\r\n\r\n", 9) == ESP_ERR_INVALID_ARG);
+
+  // Size limits
+  PL::HttpRequestParser smallParser(64);
+  TEST_ASSERT(smallParser.Parse(requestHead.data(), requestHead.size()) == ESP_ERR_INVALID_SIZE);
+  std::string manyHeaders = "GET / HTTP/1.1\r\n";
+  for (size_t i = 0; i <= PL::HttpRequestParser::maxNumberOfHeaders; i++)
+    manyHeaders += "A: B\r\n";
+  manyHeaders += "\r\n";
+  parser.Reset();
+  TEST_ASSERT(parser.Parse(manyHeaders.data(), manyHeaders.size()) == ESP_ERR_INVALID_SIZE);
+}
+
+//==============================================================================
+
+void TestHttpResponseParser() {
+  PL::HttpResponseParser parser;
+  TEST_ASSERT(parser.Parse(apiResponseHead.data(), apiResponseHead.size()) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, parser.GetStatusCode());
+  TEST_ASSERT(parser.GetReasonPhrase() == "OK");
+  TEST_ASSERT_EQUAL(7, parser.GetNumberOfHeaders());
+  TEST_ASSERT(parser.GetHeaderName(1) == "Content-Type");
+  TEST_ASSERT(parser.GetHeaderValue(1) == "application/json");
+
+  parser.Reset();
+  TEST_ASSERT(parser.Parse("HTTP/1.0 204\r\n\r\n", 16) == ESP_OK);
+  TEST_ASSERT_EQUAL(204, parser.GetStatusCode());
+  TEST_ASSERT(parser.GetReasonPhrase().empty());
+  TEST_ASSERT_EQUAL(0, parser.GetMinorVersion());
+
+  parser.Reset();
+  TEST_ASSERT(parser.Parse("HTTP/1.1 2x0 OK\r\n\r\n", 19) == ESP_ERR_INVALID_ARG);
+  parser.Reset();
+  TEST_ASSERT(parser.Parse("HTTP/2 200 OK\r\n\r\n", 17) == ESP_ERR_INVALID_ARG);
+
+  // Character search crossing the word and vector boundaries
+  const char text[] = "0123456789abcdefghijklmnopqrstuv";
+  for (size_t start = 0; start < 8; start++) {
+    for (size_t i = start; i < sizeof(text) - 1; i++)
+      TEST_ASSERT(PL::HttpHeadParser::FindChar(text + start, text + sizeof(text) - 1, text[i]) == text + i);
+    TEST_ASSERT(!PL::HttpHeadParser::FindChar(text + start, text + sizeof(text) - 1, ':'));
+  }
+}
+
+//==============================================================================
+
+void TestHttpParserPerformance() {
+  PL::HttpRequestParser requestParser;
+  PL::HttpResponseParser responseParser;
+  TestHeadPerformance("Browser request", requestParser, requestHead);
+  TestHeadPerformance("API response", responseParser, apiResponseHead);
+  TestHeadPerformance("CDN response", responseParser, cdnResponseHead);
+}
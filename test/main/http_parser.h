@@ -0,0 +1,7 @@
+#include "pl_http.h"
+
+//==============================================================================
+
+void TestHttpRequestParser();
+void TestHttpResponseParser();
+void TestHttpParserPerformance();
\ No newline at end of file
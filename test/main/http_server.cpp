@@ -1,14 +1,31 @@
 #include "http_server.h"
 #include "esp_crt_bundle.h"
+#include "esp_heap_caps.h"
+#include "esp_tls.h"
 #include "unity.h"
 #include <map>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 //==============================================================================
 
 ushort port = 500;
 const TickType_t readTimeout = 3000 / portTICK_PERIOD_MS;
 const TickType_t writeTimeout = 4000 / portTICK_PERIOD_MS;
+const TickType_t continueTimeout = 1000 / portTICK_PERIOD_MS;
 const size_t maxNumberOfClients = 2;
+const TickType_t idleTimeout = 1000 / portTICK_PERIOD_MS;
+const TickType_t requestTimeout = 500 / portTICK_PERIOD_MS;
+const TickType_t coalescedResponseReuseTime = 1000 / portTICK_PERIOD_MS;
+const TickType_t coalescedResponseDelay = 500 / portTICK_PERIOD_MS;
+const std::string coalescedRequestUri = "/coalesced";
+const std::string coalescedResponseBody = "Coalesced body";
+const size_t payloadBufferSize = 64;
+const std::string payloadEchoUri = "/echo";
+const std::string traceExportUri = "/v1/traces";
+const std::string traceParent = "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+const std::string traceState = "congo=t61rcWkgMzE";
 const std::string host = "localhost";
 
 extern const char certificate[] asm("_binary_cert_pem_start");
@@ -18,14 +35,84 @@ const PL::HttpMethod correctRequestMethod = PL::HttpMethod::GET;
 const PL::HttpMethod incorrectRequestMethod = PL::HttpMethod::POST;
 const std::string correctRequestUri = "/correct";
 const std::string incorrectRequestUri = "/incorrect";
+const std::string proxyRequestUri = "/proxy";
 const std::map<std::string, std::string> requestHeaders = { {"A", "B"}, {"C", "D"} };
 const std::string requestBody = "Test body";
+const std::string corsOrigin = "http://example.com";
+const std::string authorizationHeaderName = "Authorization";
+const std::string authorizationHeaderValue = "Bearer test";
 ushort responseStatusCode;
 size_t responseBodySize;
 static char responseBody[100];
 
 //==============================================================================
 
+static int ConnectRawClient(uint16_t port) {
+  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  timeval timeout = {(time_t)(readTimeout * portTICK_PERIOD_MS / 1000), 0};
+  if (sockfd >= 0 && (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+                      connect(sockfd, (sockaddr*)&address, sizeof(address)) != 0)) {
+    close(sockfd);
+    return -1;
+  }
+  return sockfd;
+}
+
+//==============================================================================
+
+static bool SendRaw(int sockfd, const std::string& data) {
+  return send(sockfd, data.data(), data.size(), 0) == (ssize_t)data.size();
+}
+
+//==============================================================================
+
+// Receives the data until it has the size or the connection is closed
+static std::string ReceiveRaw(int sockfd, size_t size) {
+  std::string data(size, 0);
+  size_t receivedSize = 0;
+  while (receivedSize < size) {
+    ssize_t res = recv(sockfd, data.data() + receivedSize, size - receivedSize, 0);
+    if (res <= 0)
+      break;
+    receivedSize += res;
+  }
+  data.resize(receivedSize);
+  return data;
+}
+
+//==============================================================================
+
+// httpd is not available on the Linux target: the HttpServer tests are run on the chips only
+#ifndef CONFIG_IDF_TARGET_LINUX
+
+static PL::HttpProxy* proxy = NULL;
+static TaskHandle_t serverTask = NULL;
+static TaskHandle_t allocationCountTask = NULL;
+static volatile size_t numberOfAllocations = 0;
+static volatile size_t numberOfHandledRequests = 0;
+
+//==============================================================================
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+
+// The heap calls the hooks for every allocation. Only the allocations of the measured task are counted while the counting is on.
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps) {
+  if (allocationCountTask && xTaskGetCurrentTaskHandle() == allocationCountTask)
+    numberOfAllocations = numberOfAllocations + 1;
+}
+
+//==============================================================================
+
+extern "C" IRAM_ATTR void esp_heap_trace_free_hook(void* ptr) {}
+
+#endif
+
+//==============================================================================
+
 void TestServer(PL::HttpServer& server, PL::HttpClient& client) {
   TEST_ASSERT(client.Initialize() == ESP_OK);
 
@@ -64,13 +151,92 @@ void TestServer(PL::HttpServer& server, PL::HttpClient& client) {
     responseBody[responseBodySize] = 0;
     TEST_ASSERT(requestBody == responseBody); 
 
+    TEST_ASSERT(client.SetContinueTimeout(continueTimeout) == ESP_OK);
+    TEST_ASSERT_EQUAL(continueTimeout, client.GetContinueTimeout());
+    TEST_ASSERT(client.WriteRequest(correctRequestMethod, correctRequestUri, requestBody) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, &responseBodySize) == ESP_OK);
+    TEST_ASSERT_EQUAL(200, responseStatusCode);
+    TEST_ASSERT_EQUAL(requestBody.size(), responseBodySize);
+    TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+    TEST_ASSERT(client.WriteRequest(correctRequestMethod, correctRequestUri, std::string(sizeof(responseBody) + 1, 'A')) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+    TEST_ASSERT_EQUAL(413, responseStatusCode);
+    TEST_ASSERT(client.SetContinueTimeout(0) == ESP_OK);
+
+    TEST_ASSERT_EQUAL(PL::HttpServer::defaultRequestTimeout, server.GetRequestTimeout());
+    TEST_ASSERT(server.SetRequestTimeout(requestTimeout) == ESP_OK);
+    TEST_ASSERT_EQUAL(requestTimeout, server.GetRequestTimeout());
+    TEST_ASSERT(client.WriteRequestHeaders(correctRequestMethod, correctRequestUri, requestBody.size()) == ESP_OK);
+    TEST_ASSERT(client.WriteRequestBody(requestBody.data(), requestBody.size() / 2) == ESP_OK);
+    vTaskDelay(requestTimeout * 2);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+    TEST_ASSERT_EQUAL(408, responseStatusCode);
+    TEST_ASSERT(client.Disconnect() == ESP_OK);
+    TEST_ASSERT(server.SetRequestTimeout(PL::HttpServer::defaultRequestTimeout) == ESP_OK);
+
     TEST_ASSERT(client.WriteRequest(incorrectRequestMethod, correctRequestUri) == ESP_OK);
     TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK); 
     TEST_ASSERT_EQUAL(405, responseStatusCode);
 
+    TEST_ASSERT(server.BeginUpdate() == ESP_OK);
+    TEST_ASSERT(server.SetReadTimeout(readTimeout) == ESP_OK);
+    TEST_ASSERT(server.SetMaxNumberOfClients(maxNumberOfClients) == ESP_OK);
+    TEST_ASSERT(server.EndUpdate() == ESP_OK);
+    TEST_ASSERT_EQUAL(1, server.GetNumberOfConnections());
+
+    TEST_ASSERT(client.WriteRequest(correctRequestMethod, incorrectRequestUri) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+    TEST_ASSERT_EQUAL(404, responseStatusCode);
+
+    PL::HttpSocketOptions socketOptions = server.GetSocketOptions();
+    TEST_ASSERT_EQUAL(PL::HttpServer::defaultSocketOptions.noDelay, socketOptions.noDelay);
+    socketOptions.noDelay = true;
+    TEST_ASSERT(server.SetSocketOptions(socketOptions) == ESP_OK);
+    TEST_ASSERT(server.GetSocketOptions().noDelay);
+    TEST_ASSERT(client.WriteRequest(correctRequestMethod, incorrectRequestUri) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+    TEST_ASSERT_EQUAL(404, responseStatusCode);
+    TEST_ASSERT(server.SetSocketOptions(PL::HttpServer::defaultSocketOptions) == ESP_OK);
+
+    TEST_ASSERT(server.AddCoalescedRoute(incorrectRequestUri, {}, coalescedResponseReuseTime) == ESP_OK);
+    size_t handledRequests = numberOfHandledRequests;
+    for (int i = 0; i < 2; i++) {
+      TEST_ASSERT(client.WriteRequest(correctRequestMethod, incorrectRequestUri) == ESP_OK);
+      TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+      TEST_ASSERT_EQUAL(404, responseStatusCode);
+    }
+    TEST_ASSERT_EQUAL(handledRequests + 1, numberOfHandledRequests);
+    TEST_ASSERT(server.RemoveCoalescedRoute(incorrectRequestUri) == ESP_OK);
+
+    TEST_ASSERT(server.SetClientRateLimit(1, 1) == ESP_OK);
+    TEST_ASSERT(client.WriteRequest(correctRequestMethod, incorrectRequestUri) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+    TEST_ASSERT_EQUAL(404, responseStatusCode);
+    TEST_ASSERT(client.WriteRequest(correctRequestMethod, incorrectRequestUri) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+    TEST_ASSERT_EQUAL(429, responseStatusCode);
+    std::string retryAfter;
+    TEST_ASSERT(client.GetResponseHeader("Retry-After", retryAfter) == ESP_OK);
+    TEST_ASSERT(retryAfter == "1");
+    TEST_ASSERT(server.SetClientRateLimit(0, 0) == ESP_OK);
+
+    TEST_ASSERT_EQUAL(1, server.GetNumberOfConnections());
+    TEST_ASSERT(server.SetIdleTimeout(idleTimeout) == ESP_OK);
+    TEST_ASSERT_EQUAL(idleTimeout, server.GetIdleTimeout());
+    vTaskDelay(idleTimeout * 2);
+    TEST_ASSERT_EQUAL(0, server.GetNumberOfConnections());
+    TEST_ASSERT(server.SetIdleTimeout(PL::HttpServer::defaultIdleTimeout) == ESP_OK);
+    TEST_ASSERT(client.Disconnect() == ESP_OK);
+
+    // The backlog size change restarts the server on the same port
+    TEST_ASSERT_EQUAL(PL::HttpServer::defaultBacklogSize, server.GetBacklogSize());
+    TEST_ASSERT(server.SetBacklogSize(maxNumberOfClients + 1) == ESP_OK);
+    TEST_ASSERT_EQUAL(maxNumberOfClients + 1, server.GetBacklogSize());
     TEST_ASSERT(client.WriteRequest(correctRequestMethod, incorrectRequestUri) == ESP_OK);
     TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
     TEST_ASSERT_EQUAL(404, responseStatusCode);
+    TEST_ASSERT(server.SetBacklogSize(PL::HttpServer::defaultBacklogSize) == ESP_OK);
+    TEST_ASSERT(client.Disconnect() == ESP_OK);
 
     port++;
   }
@@ -86,14 +252,33 @@ esp_err_t HttpServer::HandleRequest(PL::HttpServerTransaction& transaction) {
   char requestBody[100];
   size_t requestBodySize = transaction.GetRequestBodySize();
 
+  serverTask = xTaskGetCurrentTaskHandle();
+  numberOfHandledRequests = numberOfHandledRequests + 1;
   switch (transaction.GetRequestMethod()) {
     case PL::HttpMethod::GET:
+    case PL::HttpMethod::HEAD:
       transaction.GetRequestUri(requestUri);
+      if (proxy && requestUri == proxyRequestUri)
+        return proxy->ForwardRequest(transaction, correctRequestUri);
+      // The identical requests received by the other listeners meanwhile wait for the response
+      if (requestUri == coalescedRequestUri) {
+        vTaskDelay(coalescedResponseDelay);
+        return transaction.WriteResponse(200, coalescedResponseBody.data(), coalescedResponseBody.size());
+      }
       if (requestUri == correctRequestUri) {
         for (auto& header : requestHeaders) {
           if (transaction.GetRequestHeader(header.first, requestHeaderValue) == ESP_OK)
             transaction.SetResponseHeader(header.first, requestHeaderValue);
         }
+        // A missing header leaves the value unchanged
+        requestHeaderValue = "unchanged";
+        if (transaction.GetRequestHeader("Missing", requestHeaderValue) != ESP_ERR_NOT_FOUND || requestHeaderValue != "unchanged")
+          return transaction.WriteResponse(500);
+        // Without free space in the arena the response is sent by httpd
+        if (transaction.GetRequestHeader("Fill-Arena", requestHeaderValue) == ESP_OK) {
+          PL::HttpArena& arena = transaction.GetArena();
+          arena.Allocate(arena.GetSize() - arena.GetUsedSize(), 1);
+        }
         if (requestBodySize <= sizeof(requestBody)) {
           transaction.ReadRequestBody(requestBody, requestBodySize);
           return transaction.WriteResponse(200, requestBody, requestBodySize);
@@ -114,13 +299,733 @@ void TestHttpServer() {
   PL::HttpClient client(host);
   TEST_ASSERT_EQUAL(PL::HttpClient::defaultHttpPort, server.GetPort());
   TestServer(server, client);
+
+  // The proxy listener forwards the request to the main listener of the same server
+  PL::HttpProxy httpProxy(host);
+  TEST_ASSERT(httpProxy.SetPort(server.GetPort()) == ESP_OK);
+  TEST_ASSERT_EQUAL(server.GetPort(), httpProxy.GetPort());
+  TEST_ASSERT(httpProxy.AddForwardedRequestHeader("A") == ESP_OK);
+  TEST_ASSERT(server.AddListener(port) == ESP_OK);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  proxy = &httpProxy;
+  TEST_ASSERT(client.SetPort(port) == ESP_OK);
+  TEST_ASSERT(client.SetRequestHeader("A", "B") == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(correctRequestMethod, proxyRequestUri, requestBody) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  std::string responseHeaderValue;
+  TEST_ASSERT(client.GetResponseHeader("A", responseHeaderValue) == ESP_OK);
+  TEST_ASSERT(responseHeaderValue == "B");
+  TEST_ASSERT(client.ReadResponseBody(responseBody, requestBody.size()) == ESP_OK);
+  TEST_ASSERT(requestBody == std::string(responseBody, requestBody.size()));
+
+  // The client aborts the request in the middle of the body: the upstream connection is closed, so the next request is not desynced
+  TEST_ASSERT(client.WriteRequestHeaders(correctRequestMethod, proxyRequestUri, requestBody.size()) == ESP_OK);
+  TEST_ASSERT(client.WriteRequestBody(requestBody.data(), requestBody.size() / 2) == ESP_OK);
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(correctRequestMethod, proxyRequestUri, requestBody) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.ReadResponseBody(responseBody, requestBody.size()) == ESP_OK);
+  TEST_ASSERT(requestBody == std::string(responseBody, requestBody.size()));
+  proxy = NULL;
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.RemoveListener(port) == ESP_OK);
+
+  // After the first request the following requests on the same connection do not allocate memory in the server task
+  TEST_ASSERT(client.SetPort(server.GetPort()) == ESP_OK);
+  for (int i = 0; i < 3; i++) {
+    if (i == 1) {
+      numberOfAllocations = 0;
+      allocationCountTask = serverTask;
+    }
+    TEST_ASSERT(client.WriteRequest(correctRequestMethod, correctRequestUri, requestBody) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, &responseBodySize) == ESP_OK);
+    TEST_ASSERT_EQUAL(200, responseStatusCode);
+    TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  }
+  allocationCountTask = NULL;
+  TEST_ASSERT_EQUAL(0, numberOfAllocations);
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+
+  // The response head assembled in the arena and the one sent by httpd are the same. The last request of the connection gets "Connection: close".
+  std::string rawRequest = "GET " + correctRequestUri + " HTTP/1.1\r\nA: B\r\nC: D\r\nContent-Length: " + std::to_string(requestBody.size()) + "\r\n";
+  std::string rawResponse = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: " + std::to_string(requestBody.size()) + "\r\nA: B\r\nC: D\r\n";
+  TEST_ASSERT(server.SetMaxNumberOfRequestsPerConnection(3) == ESP_OK);
+  int sockfd = ConnectRawClient(server.GetPort());
+  TEST_ASSERT(sockfd >= 0);
+  TEST_ASSERT(SendRaw(sockfd, rawRequest + "\r\n" + requestBody));
+  TEST_ASSERT(ReceiveRaw(sockfd, rawResponse.size() + 2 + requestBody.size()) == rawResponse + "\r\n" + requestBody);
+  TEST_ASSERT(SendRaw(sockfd, rawRequest + "Fill-Arena: 1\r\n\r\n" + requestBody));
+  TEST_ASSERT(ReceiveRaw(sockfd, rawResponse.size() + 2 + requestBody.size()) == rawResponse + "\r\n" + requestBody);
+  TEST_ASSERT(SendRaw(sockfd, rawRequest + "\r\n" + requestBody));
+  std::string lastResponse = rawResponse + "Connection: close\r\n\r\n" + requestBody;
+  // The connection is closed after the response
+  TEST_ASSERT(ReceiveRaw(sockfd, lastResponse.size() + 1) == lastResponse);
+  close(sockfd);
+  TEST_ASSERT(server.SetMaxNumberOfRequestsPerConnection(PL::HttpServer::defaultMaxNumberOfRequestsPerConnection) == ESP_OK);
+
+  // Fan-in: the requests received by the other listeners while the first one is handled wait for its response.
+  // A response larger than the maximum body size or not complete within the read timeout is not shared: each request is handled separately.
+  const uint16_t coalescingPorts[] = {server.GetPort(), port, (uint16_t)(port + 1)};
+  TEST_ASSERT(server.AddListener(coalescingPorts[1]) == ESP_OK);
+  TEST_ASSERT(server.AddListener(coalescingPorts[2]) == ESP_OK);
+  rawRequest = "GET " + coalescedRequestUri + " HTTP/1.1\r\n\r\n";
+  rawResponse = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: " + std::to_string(coalescedResponseBody.size()) + "\r\n\r\n" +
+                coalescedResponseBody;
+  TickType_t serverReadTimeout = server.GetReadTimeout();
+  const std::pair<size_t, TickType_t> coalescingLimits[] = {{coalescedResponseBody.size(), serverReadTimeout},
+    {coalescedResponseBody.size() - 1, serverReadTimeout}, {coalescedResponseBody.size(), coalescedResponseDelay / 2}};
+  for (auto [maxBodySize, coalescingReadTimeout] : coalescingLimits) {
+    TEST_ASSERT(server.AddCoalescedRoute(coalescedRequestUri, {}, 0, maxBodySize) == ESP_OK);
+    TEST_ASSERT(server.SetReadTimeout(coalescingReadTimeout) == ESP_OK);
+    size_t handledRequests = numberOfHandledRequests;
+    int sockfds[3];
+    for (int i = 0; i < 3; i++) {
+      sockfds[i] = ConnectRawClient(coalescingPorts[i]);
+      TEST_ASSERT(sockfds[i] >= 0);
+      TEST_ASSERT(SendRaw(sockfds[i], rawRequest));
+      // The first request is being handled when the others arrive
+      if (!i)
+        vTaskDelay(coalescedResponseDelay / 5);
+    }
+    for (int i = 0; i < 3; i++) {
+      TEST_ASSERT(ReceiveRaw(sockfds[i], rawResponse.size()) == rawResponse);
+      close(sockfds[i]);
+    }
+    bool shared = maxBodySize >= coalescedResponseBody.size() && coalescingReadTimeout > coalescedResponseDelay;
+    TEST_ASSERT_EQUAL(handledRequests + (shared ? 1 : 3), numberOfHandledRequests);
+  }
+  TEST_ASSERT(server.SetReadTimeout(serverReadTimeout) == ESP_OK);
+  TEST_ASSERT(server.RemoveCoalescedRoute(coalescedRequestUri) == ESP_OK);
+  TEST_ASSERT(server.RemoveListener(coalescingPorts[1]) == ESP_OK);
+  TEST_ASSERT(server.RemoveListener(coalescingPorts[2]) == ESP_OK);
+
+  // The preflight request is answered without calling the request handler
+  TEST_ASSERT(server.AddCorsRoute("/") == ESP_OK);
+  size_t numberOfRequests = numberOfHandledRequests;
+  TEST_ASSERT(client.SetRequestHeader("Origin", corsOrigin) == ESP_OK);
+  TEST_ASSERT(client.SetRequestHeader("Access-Control-Request-Method", "PUT") == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::OPTIONS, correctRequestUri) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  std::string corsHeaderValue;
+  TEST_ASSERT(client.GetResponseHeader("Access-Control-Allow-Origin", corsHeaderValue) == ESP_OK);
+  TEST_ASSERT(corsHeaderValue == "*");
+  TEST_ASSERT(client.GetResponseHeader("Access-Control-Max-Age", corsHeaderValue) == ESP_OK);
+  TEST_ASSERT_EQUAL(PL::HttpServer::defaultCorsPolicy.maxAge, strtoul(corsHeaderValue.c_str(), NULL, 10));
+  TEST_ASSERT_EQUAL(numberOfRequests, numberOfHandledRequests);
+
+  // The preflight requests are subject to the admission control
+  TEST_ASSERT(server.AddRouteRateLimit(correctRequestUri, 1, 1) == ESP_OK);
+  for (int i = 0; i < 2; i++) {
+    TEST_ASSERT(client.WriteRequest(PL::HttpMethod::OPTIONS, correctRequestUri) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+    TEST_ASSERT_EQUAL(i ? 429 : 200, responseStatusCode);
+  }
+  TEST_ASSERT(server.RemoveRouteRateLimit(correctRequestUri) == ESP_OK);
+
+  // The OPTIONS request that is not a preflight request is passed to the request handler
+  TEST_ASSERT(client.DeleteRequestHeader("Access-Control-Request-Method") == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::OPTIONS, correctRequestUri) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(405, responseStatusCode);
+  TEST_ASSERT_EQUAL(numberOfRequests + 1, numberOfHandledRequests);
+
+  // The response to the HEAD request has the CORS headers, but not the body
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::HEAD, correctRequestUri) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.GetResponseHeader("Access-Control-Allow-Origin", corsHeaderValue) == ESP_OK);
+  TEST_ASSERT(corsHeaderValue == "*");
+  TEST_ASSERT(server.RemoveCorsRoute("/") == ESP_OK);
+  TEST_ASSERT(server.RemoveCorsRoute("/") == ESP_ERR_NOT_FOUND);
+
+  // The preflight request outside the CORS routes is passed to the request handler as well
+  TEST_ASSERT(client.SetRequestHeader("Access-Control-Request-Method", "PUT") == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(PL::HttpMethod::OPTIONS, correctRequestUri) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(405, responseStatusCode);
+  TEST_ASSERT(client.DeleteRequestHeader("Access-Control-Request-Method") == ESP_OK);
+  TEST_ASSERT(client.DeleteRequestHeader("Origin") == ESP_OK);
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.Disable() == ESP_OK);
+}
+
+//==============================================================================
+
+// Counts the requests and records the response status code written by the next stages
+class MetricsMiddleware {
+public:
+  size_t numberOfRequests = 0;
+  uint16_t lastStatusCode = 0;
+
+  template <class Next>
+  esp_err_t HandleRequest(PL::HttpServerTransaction& transaction, const Next& next) {
+    Filter filter(transaction, *this);
+    numberOfRequests++;
+    return next(filter);
+  }
+
+private:
+  class Filter : public PL::HttpServerTransactionFilter {
+  public:
+    Filter(PL::HttpServerTransaction& transaction, MetricsMiddleware& middleware) : HttpServerTransactionFilter(transaction), middleware(middleware) {}
+
+    using HttpServerTransactionFilter::WriteResponse;
+    esp_err_t WriteResponse(uint16_t statusCode, const void* body, size_t bodySize) override {
+      middleware.lastStatusCode = statusCode;
+      return transaction.WriteResponse(statusCode, body, bodySize);
+    }
+
+  private:
+    MetricsMiddleware& middleware;
+  };
+};
+
+//==============================================================================
+
+// Rejects the requests without the authorization header
+class AuthMiddleware {
+public:
+  template <class Next>
+  esp_err_t HandleRequest(PL::HttpServerTransaction& transaction, const Next& next) {
+    std::string value;
+    if (transaction.GetRequestHeader(authorizationHeaderName, value) != ESP_OK || value != authorizationHeaderValue)
+      return transaction.WriteResponse(401);
+    return next(transaction);
+  }
+};
+
+//==============================================================================
+
+class HttpMiddlewareServer : public PL::HttpMiddlewareServer<MetricsMiddleware, AuthMiddleware> {
+protected:
+  esp_err_t HandleEndpointRequest(PL::HttpServerTransaction& transaction) override {
+    numberOfHandledRequests = numberOfHandledRequests + 1;
+    return transaction.WriteResponse(200, requestBody);
+  }
+};
+
+//==============================================================================
+
+void TestHttpMiddleware() {
+  HttpMiddlewareServer server;
+  PL::HttpClient client(host);
+  TEST_ASSERT(client.Initialize() == ESP_OK);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  numberOfHandledRequests = 0;
+
+  // The authorization middleware writes the response without calling the handler
+  TEST_ASSERT(client.WriteRequest(correctRequestMethod, correctRequestUri) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(401, responseStatusCode);
+  TEST_ASSERT_EQUAL(0, numberOfHandledRequests);
+  TEST_ASSERT_EQUAL(401, server.GetMiddleware<MetricsMiddleware>().lastStatusCode);
+
+  TEST_ASSERT(client.SetRequestHeader(authorizationHeaderName, authorizationHeaderValue) == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(correctRequestMethod, correctRequestUri) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, &responseBodySize) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  TEST_ASSERT(requestBody == std::string(responseBody, responseBodySize));
+  TEST_ASSERT_EQUAL(1, numberOfHandledRequests);
+  TEST_ASSERT_EQUAL(2, server.GetMiddleware<MetricsMiddleware>().numberOfRequests);
+  TEST_ASSERT_EQUAL(200, server.GetMiddleware<MetricsMiddleware>().lastStatusCode);
+
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.Disable() == ESP_OK);
+}
+
+//==============================================================================
+
+// Sums the integers of the request payload array and responds with a map in the accepted format.
+// The echo URI responds with the integers themselves.
+class HttpPayloadServer : public PL::HttpServer {
+protected:
+  esp_err_t HandleRequest(PL::HttpServerTransaction& transaction) override {
+    PL::HttpPayloadReader reader(transaction, payloadBufferSize);
+    PL::HttpPayloadFormat format;
+    if (reader.GetFormat(format) == ESP_ERR_NOT_SUPPORTED)
+      return transaction.WriteResponse(415);
+    PL::HttpPayloadValue value;
+    std::vector<int64_t> integers;
+    int64_t sum = 0;
+    size_t numberOfValues = 0;
+    esp_err_t error;
+    while ((error = reader.Read(value)) == ESP_OK) {
+      if (value.type == PL::HttpPayloadValueType::integer) {
+        integers.push_back(value.integer);
+        sum += value.integer;
+      }
+      numberOfValues++;
+    }
+    if (error != ESP_ERR_NOT_FOUND)
+      return transaction.WriteResponse(400);
+
+    std::string uri;
+    if (transaction.GetRequestUri(uri) != ESP_OK)
+      return ESP_FAIL;
+    PL::HttpPayloadWriter writer(transaction, payloadBufferSize);
+    if (writer.Begin() != ESP_OK)
+      return ESP_FAIL;
+    if (uri == payloadEchoUri) {
+      // The response is larger than the buffer, so it is sent in chunks
+      if (writer.BeginArray(integers.size()) != ESP_OK)
+        return ESP_FAIL;
+      for (auto integer : integers) {
+        if (writer.WriteInt(integer) != ESP_OK)
+          return ESP_FAIL;
+      }
+      if (writer.EndArray() != ESP_OK)
+        return ESP_FAIL;
+    }
+    else if (writer.BeginMap(2) != ESP_OK || writer.WriteKey("sum") != ESP_OK || writer.WriteInt(sum) != ESP_OK ||
+             writer.WriteKey("values") != ESP_OK || writer.WriteUInt(numberOfValues) != ESP_OK || writer.EndMap() != ESP_OK)
+      return ESP_FAIL;
+    return writer.End();
+  }
+};
+
+//==============================================================================
+
+static std::string ReadChunkedPayload(PL::HttpClient& client, const std::string& accept) {
+  TEST_ASSERT(client.SetRequestHeader("Accept", accept) == ESP_OK);
+  std::string jsonArray = "[";
+  for (int i = 0; i < 100; i++)
+    jsonArray += std::to_string(i) + (i < 99 ? ", " : "]");
+  TEST_ASSERT(client.WriteRequest(incorrectRequestMethod, payloadEchoUri, jsonArray) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  std::string contentType, transferEncoding;
+  TEST_ASSERT(client.GetResponseHeader("Content-Type", contentType) == ESP_OK);
+  TEST_ASSERT(contentType == accept);
+  TEST_ASSERT(client.GetResponseHeader("Transfer-Encoding", transferEncoding) == ESP_OK);
+  TEST_ASSERT(transferEncoding == "chunked");
+  std::string payload;
+  size_t size = 1;
+  while (size) {
+    TEST_ASSERT(client.ReadResponseBody(responseBody, sizeof(responseBody), size) == ESP_OK);
+    payload.append(responseBody, size);
+  }
+  return payload;
+}
+
+//==============================================================================
+
+void TestHttpPayload() {
+  HttpPayloadServer server;
+  PL::HttpClient client(host);
+  TEST_ASSERT(client.Initialize() == ESP_OK);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  std::string contentType;
+
+  // CBOR [1, 2, -3] request, JSON response
+  TEST_ASSERT(client.SetRequestHeader("Content-Type", "application/cbor") == ESP_OK);
+  TEST_ASSERT(client.SetRequestHeader("Accept", "application/json") == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(incorrectRequestMethod, correctRequestUri, std::string("\x83\x01\x02\x22", 4)) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, &responseBodySize) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.GetResponseHeader("Content-Type", contentType) == ESP_OK);
+  TEST_ASSERT(contentType == "application/json");
+  TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  TEST_ASSERT(std::string(responseBody, responseBodySize) == "{\"sum\":0,\"values\":5}");
+
+  // JSON request longer than the buffer, MessagePack response
+  std::string jsonArray = "[";
+  for (int i = 0; i < 100; i++)
+    jsonArray += std::to_string(i) + (i < 99 ? ", " : "]");
+  TEST_ASSERT(client.SetRequestHeader("Content-Type", "application/json") == ESP_OK);
+  TEST_ASSERT(client.SetRequestHeader("Accept", "application/cbor;q=0.5, application/msgpack") == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(incorrectRequestMethod, correctRequestUri, jsonArray) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, &responseBodySize) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.GetResponseHeader("Content-Type", contentType) == ESP_OK);
+  TEST_ASSERT(contentType == "application/msgpack");
+  TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  TEST_ASSERT(std::string(responseBody, responseBodySize) == std::string("\x82\xA3sum\xCD\x13\x56\xA6values\x66", 16));
+
+  // Responses larger than the buffer in each format: 0..99 array
+  std::string jsonEcho = "[", cborEcho = "\x98\x64", messagePackEcho("\xDC\x00\x64", 3);
+  for (int i = 0; i < 100; i++) {
+    jsonEcho += std::to_string(i) + (i < 99 ? "," : "]");
+    if (i >= 24)
+      cborEcho += '\x18';
+    cborEcho += (char)i;
+    messagePackEcho += (char)i;
+  }
+  TEST_ASSERT(ReadChunkedPayload(client, "application/json") == jsonEcho);
+  TEST_ASSERT(ReadChunkedPayload(client, "application/cbor") == cborEcho);
+  TEST_ASSERT(ReadChunkedPayload(client, "application/msgpack") == messagePackEcho);
+
+  // Invalid request payload
+  TEST_ASSERT(client.WriteRequest(incorrectRequestMethod, correctRequestUri, std::string("[1,]")) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(400, responseStatusCode);
+
+  // Unsupported request content type
+  TEST_ASSERT(client.SetRequestHeader("Content-Type", "text/plain") == ESP_OK);
+  TEST_ASSERT(client.WriteRequest(incorrectRequestMethod, correctRequestUri, std::string("[1]")) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(415, responseStatusCode);
+
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.Disable() == ESP_OK);
+}
+
+//==============================================================================
+
+// Responds with the trace headers of the request and stores the exported spans
+class HttpTracingServer : public PL::HttpServer {
+public:
+  std::string exportedSpans;
+
+protected:
+  esp_err_t HandleRequest(PL::HttpServerTransaction& transaction) override {
+    std::string uri, requestTraceParent, requestTraceState;
+    if (transaction.GetRequestUri(uri) != ESP_OK)
+      return ESP_FAIL;
+    if (uri == traceExportUri) {
+      exportedSpans.resize(transaction.GetRequestBodySize());
+      if (transaction.ReadRequestBody(exportedSpans.data(), exportedSpans.size()) != ESP_OK)
+        return ESP_FAIL;
+      return transaction.WriteResponse(200);
+    }
+    transaction.GetRequestHeader("traceparent", requestTraceParent);
+    transaction.GetRequestHeader("tracestate", requestTraceState);
+    return transaction.WriteResponse(requestTraceParent + "\n" + requestTraceState);
+  }
+};
+
+//==============================================================================
+
+void TestHttpTracing() {
+  HttpTracingServer server;
+  PL::HttpClient client(host);
+  PL::HttpClient exportClient(host);
+  PL::HttpTracer serverTracer(exportClient, traceExportUri, 4);
+  PL::HttpTracer clientTracer(exportClient, traceExportUri, 4);
+  TEST_ASSERT(client.Initialize() == ESP_OK);
+  TEST_ASSERT(exportClient.Initialize() == ESP_OK);
+  TEST_ASSERT(server.SetMaxNumberOfClients(maxNumberOfClients) == ESP_OK);
+  TEST_ASSERT(server.SetTracer(&serverTracer) == ESP_OK);
+  TEST_ASSERT(server.GetTracer() == &serverTracer);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+
+  PL::HttpTraceContext context;
+  TEST_ASSERT(PL::HttpTracer::ParseTraceParent(traceParent, context) == ESP_OK);
+  char formattedTraceParent[PL::HttpTracer::traceParentSize + 1];
+  PL::HttpTracer::FormatTraceParent(context, formattedTraceParent);
+  TEST_ASSERT(traceParent == formattedTraceParent);
+  PL::HttpTraceContext invalidContext;
+  TEST_ASSERT(PL::HttpTracer::ParseTraceParent("00-00000000000000000000000000000000-00f067aa0ba902b7-01", invalidContext) != ESP_OK);
+  TEST_ASSERT(PL::HttpTracer::ParseTraceParent("ff-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01", invalidContext) != ESP_OK);
+
+  // The client without the tracer propagates the context of the task as a child span
+  context.state = traceState;
+  TEST_ASSERT(PL::HttpTracer::SetCurrentContext(&context) == NULL);
+  TEST_ASSERT(client.SendRequest(correctRequestMethod, correctRequestUri, responseStatusCode, &responseBodySize) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  std::string response(responseBody, responseBodySize);
+  TEST_ASSERT(response.substr(0, 36) == traceParent.substr(0, 36));
+  TEST_ASSERT(response.substr(36, 16) != traceParent.substr(36, 16));
+  TEST_ASSERT(response.substr(52) == "-01\n" + traceState);
+  PL::HttpSpan spans[4];
+  TEST_ASSERT_EQUAL(1, serverTracer.TakeSpans(spans, 4));
+  TEST_ASSERT(spans[0].kind == PL::HttpSpanKind::server);
+  TEST_ASSERT_EQUAL(200, spans[0].statusCode);
+  TEST_ASSERT(std::string(spans[0].uri) == correctRequestUri);
+  TEST_ASSERT_EQUAL_MEMORY(context.traceId, spans[0].traceId, sizeof(context.traceId));
+  PL::HttpTraceContext clientContext;
+  TEST_ASSERT(PL::HttpTracer::ParseTraceParent(response.substr(0, PL::HttpTracer::traceParentSize), clientContext) == ESP_OK);
+  TEST_ASSERT_EQUAL_MEMORY(clientContext.spanId, spans[0].parentSpanId, sizeof(clientContext.spanId));
+
+  // The client with the tracer records its span. A trace that is not sampled is propagated, but not recorded.
+  TEST_ASSERT(client.SetTracer(&clientTracer) == ESP_OK);
+  TEST_ASSERT(client.SendRequest(correctRequestMethod, correctRequestUri, responseStatusCode, &responseBodySize) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  context.flags = 0;
+  TEST_ASSERT(client.SendRequest(correctRequestMethod, correctRequestUri, responseStatusCode, &responseBodySize) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  TEST_ASSERT(std::string(responseBody, responseBodySize).substr(52, 3) == "-00");
+  TEST_ASSERT(PL::HttpTracer::SetCurrentContext(NULL) == &context);
+  TEST_ASSERT_EQUAL(1, clientTracer.TakeSpans(spans, 4));
+  TEST_ASSERT(spans[0].kind == PL::HttpSpanKind::client);
+  TEST_ASSERT_EQUAL_MEMORY(context.spanId, spans[0].parentSpanId, sizeof(context.spanId));
+  PL::HttpSpan serverSpans[4];
+  TEST_ASSERT_EQUAL(1, serverTracer.TakeSpans(serverSpans, 4));
+  TEST_ASSERT_EQUAL_MEMORY(spans[0].spanId, serverSpans[0].parentSpanId, sizeof(spans[0].spanId));
+
+  // The client with the tracer starts a new trace outside of a traced request. The span buffer drops the spans when it is full.
+  for (int i = 0; i < 5; i++) {
+    TEST_ASSERT(client.SendRequest(correctRequestMethod, correctRequestUri, responseStatusCode, &responseBodySize) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+  }
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+  PL::HttpTracerStatistics statistics = clientTracer.GetStatistics();
+  TEST_ASSERT_EQUAL(5, statistics.numberOfRecordedSpans);
+  TEST_ASSERT_EQUAL(1, statistics.numberOfDroppedSpans);
+
+  // The exporter posts the spans as OTLP/JSON. The exporter requests are not traced, even if the exporter client has the same tracer.
+  TEST_ASSERT(exportClient.SetTracer(&clientTracer) == ESP_OK);
+  TEST_ASSERT(clientTracer.SetBatchLimits(2, 100 / portTICK_PERIOD_MS) == ESP_OK);
+  TEST_ASSERT(clientTracer.Enable() == ESP_OK);
+  TickType_t startTime = xTaskGetTickCount();
+  while (clientTracer.GetStatistics().numberOfExportedSpans < 4 && xTaskGetTickCount() - startTime < readTimeout)
+    vTaskDelay(1);
+  vTaskDelay(200 / portTICK_PERIOD_MS);
+  TEST_ASSERT(clientTracer.Disable() == ESP_OK);
+  TEST_ASSERT(exportClient.GetTracer() == &clientTracer);
+  TEST_ASSERT(exportClient.SetTracer(NULL) == ESP_OK);
+  statistics = clientTracer.GetStatistics();
+  TEST_ASSERT_EQUAL(4, statistics.numberOfExportedSpans);
+  TEST_ASSERT_EQUAL(2, statistics.numberOfBatches);
+  TEST_ASSERT(server.exportedSpans.find("\"resourceSpans\"") != std::string::npos);
+  TEST_ASSERT(server.exportedSpans.find("\"kind\":3") != std::string::npos);
+  TEST_ASSERT(server.exportedSpans.find("\"parentSpanId\"") == std::string::npos);
+
+  TEST_ASSERT(server.SetTracer(NULL) == ESP_OK);
+  TEST_ASSERT(exportClient.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.Disable() == ESP_OK);
+}
+
+#endif
+
+//==============================================================================
+
+void TestHttpArena() {
+  PL::HttpArena arena(64);
+  TEST_ASSERT_EQUAL(64, arena.GetSize());
+  TEST_ASSERT_EQUAL(0, arena.GetUsedSize());
+  void* data1 = arena.Allocate(1);
+  void* data2 = arena.Allocate(8, 8);
+  TEST_ASSERT(data1 && data2);
+  TEST_ASSERT_EQUAL(0, (uintptr_t)data2 % 8);
+  TEST_ASSERT(arena.Contains(data2));
+  TEST_ASSERT(!arena.Allocate(64));
+  arena.Reset();
+  TEST_ASSERT_EQUAL(0, arena.GetUsedSize());
+  TEST_ASSERT(arena.Allocate(64) == data1);
+
+  std::vector<int, PL::HttpArenaAllocator<int>> vector{PL::HttpArenaAllocator<int>(arena)};
+  arena.Reset();
+  vector.resize(4);
+  TEST_ASSERT(arena.Contains(vector.data()));
+  vector.resize(100);
+  TEST_ASSERT(!arena.Contains(vector.data()));
+}
+
+//==============================================================================
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+
+// Sends a request over a new TLS connection resuming the session (NULL: a new session). The session is replaced with the session of the connection.
+static esp_err_t SendTlsRequest(esp_tls_client_session_t*& session) {
+  esp_tls_cfg_t config = {};
+  config.cacert_buf = (const unsigned char*)certificate;
+  config.cacert_bytes = strlen(certificate) + 1;
+  config.timeout_ms = readTimeout * portTICK_PERIOD_MS;
+  config.client_session = session;
+  esp_tls_t* tls = esp_tls_init();
+  if (!tls)
+    return ESP_ERR_NO_MEM;
+
+  std::string request = "GET " + correctRequestUri + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+  std::string statusLine = "HTTP/1.1 200";
+  char response[16];
+  size_t responseSize = 0;
+  esp_err_t error = esp_tls_conn_new_sync(host.c_str(), host.size(), PL::HttpServer::defaultHttpsPort, &config, tls) == 1 &&
+                    esp_tls_conn_write(tls, request.data(), request.size()) == (ssize_t)request.size() ? ESP_OK : ESP_FAIL;
+  while (error == ESP_OK && responseSize < statusLine.size()) {
+    ssize_t res = esp_tls_conn_read(tls, response + responseSize, statusLine.size() - responseSize);
+    if (res > 0)
+      responseSize += res;
+    else
+      error = ESP_FAIL;
+  }
+  if (error == ESP_OK && statusLine.compare(0, std::string::npos, response, responseSize) != 0)
+    error = ESP_ERR_INVALID_RESPONSE;
+  // The session ticket can arrive after the handshake (TLS 1.3), so the session is taken after the response
+  if (error == ESP_OK) {
+    if (session)
+      esp_tls_free_client_session(session);
+    session = esp_tls_get_client_session(tls);
+  }
+  esp_tls_conn_destroy(tls);
+  return error;
 }
 
+#endif
+
 //==============================================================================
 
 void TestHttpsServer() {
   HttpServer server(certificate, privateKey);
   PL::HttpClient client(host, certificate);
   TEST_ASSERT_EQUAL(PL::HttpClient::defaultHttpsPort, server.GetPort());
+  TEST_ASSERT_EQUAL(PL::HttpServer::defaultSessionTickets, server.GetSessionTickets());
+  TEST_ASSERT(server.SetSessionTickets(true) == ESP_OK);
+  TEST_ASSERT(server.GetSessionTickets());
   TestServer(server, client);
-}
\ No newline at end of file
+  TEST_ASSERT(server.GetTlsStatistics().numberOfHandshakes > 0);
+#ifdef CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK
+  TEST_ASSERT(server.GetTlsStatistics().fullHandshakeTime > 0);
+#endif
+  TEST_ASSERT(server.ResetTlsStatistics() == ESP_OK);
+  TEST_ASSERT_EQUAL(0, server.GetTlsStatistics().numberOfHandshakes);
+
+  PL::HttpClient redirectClient(host);
+  TEST_ASSERT(redirectClient.Initialize() == ESP_OK);
+  TEST_ASSERT(redirectClient.SetPort(port) == ESP_OK);
+  TEST_ASSERT(server.AddRedirectListener(port, PL::HttpServer::defaultHttpsPort) == ESP_OK);
+  TEST_ASSERT(server.AddRedirectListener(port, PL::HttpServer::defaultHttpsPort) == ESP_ERR_INVALID_ARG);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+  TEST_ASSERT(redirectClient.WriteRequest(correctRequestMethod, correctRequestUri) == ESP_OK);
+  TEST_ASSERT(redirectClient.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(308, responseStatusCode);
+  std::string location;
+  TEST_ASSERT(redirectClient.GetResponseHeader("Location", location) == ESP_OK);
+  TEST_ASSERT(location == "https://" + host + correctRequestUri);
+  TEST_ASSERT(redirectClient.Disconnect() == ESP_OK);
+  TEST_ASSERT(server.RemoveListener(port) == ESP_OK);
+  TEST_ASSERT(server.RemoveListener(port) == ESP_ERR_NOT_FOUND);
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+  // The client presenting the session ticket of its previous connection is served on the resumed session
+  TEST_ASSERT(server.ResetTlsStatistics() == ESP_OK);
+  esp_tls_client_session_t* session = NULL;
+  for (int i = 0; i < 2; i++) {
+    TEST_ASSERT(SendTlsRequest(session) == ESP_OK);
+    TEST_ASSERT(session);
+  }
+  esp_tls_free_client_session(session);
+  PL::HttpTlsStatistics statistics = server.GetTlsStatistics();
+  TEST_ASSERT_EQUAL(2, statistics.numberOfHandshakes);
+#ifdef CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK
+  // The first handshake is full, the second one resumes its session and skips the key exchange
+  TEST_ASSERT_EQUAL(1, statistics.numberOfResumedHandshakes);
+  TEST_ASSERT(statistics.fullHandshakeTime > 0);
+  TEST_ASSERT(statistics.resumedHandshakeTime > 0);
+  TEST_ASSERT(statistics.resumedHandshakeTime < statistics.fullHandshakeTime);
+#endif
+#endif
+  TEST_ASSERT(server.Disable() == ESP_OK);
+}
+
+#endif
+
+//==============================================================================
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+
+const uint16_t epollServerPort = 8082;
+const TickType_t epollReadTimeout = 2000 / portTICK_PERIOD_MS;
+const std::string continueResponse = "HTTP/1.1 100 Continue\r\n\r\n";
+
+//==============================================================================
+
+// Responds with the request body
+class HttpEpollEchoServer : public PL::HttpEpollServer {
+protected:
+  esp_err_t HandleRequest(PL::HttpServerTransaction& transaction) override {
+    std::string uri;
+    char body[100];
+    size_t bodySize = transaction.GetRequestBodySize();
+    if (transaction.GetRequestUri(uri) != ESP_OK)
+      return ESP_FAIL;
+    if (uri != correctRequestUri)
+      return transaction.WriteResponse(404);
+    if (bodySize > sizeof(body))
+      return transaction.WriteResponse(413);
+    esp_err_t error = transaction.ReadRequestBody(body, bodySize);
+    if (error != ESP_OK)
+      return error;
+    return transaction.WriteResponse(200, body, bodySize);
+  }
+};
+
+//==============================================================================
+
+static std::string GetEpollResponse(uint16_t statusCode, const std::string& body) {
+  return "HTTP/1.1 " + std::to_string(statusCode) + " \r\nContent-Type: text/html\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+//==============================================================================
+
+void TestHttpEpollServer() {
+  HttpEpollEchoServer server;
+  PL::HttpClient client(host);
+  TEST_ASSERT(client.SetPort(epollServerPort) == ESP_OK);
+  TEST_ASSERT(client.Initialize() == ESP_OK);
+  TEST_ASSERT(server.SetPort(epollServerPort) == ESP_OK);
+  // One worker polls all connections, so a request blocked in a handler would block the other requests without the handler threads
+  TEST_ASSERT(server.SetNumberOfWorkers(1) == ESP_OK);
+  TEST_ASSERT_EQUAL(PL::HttpEpollServer::defaultNumberOfHandlers, server.GetNumberOfHandlers());
+  TEST_ASSERT(server.SetReadTimeout(epollReadTimeout) == ESP_OK);
+  TEST_ASSERT(server.Enable() == ESP_OK);
+
+  // Keep-alive: the requests are sent over one connection
+  for (int i = 0; i < 2; i++) {
+    TEST_ASSERT(client.WriteRequest(incorrectRequestMethod, correctRequestUri, requestBody) == ESP_OK);
+    TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, &responseBodySize) == ESP_OK);
+    TEST_ASSERT_EQUAL(200, responseStatusCode);
+    TEST_ASSERT(client.ReadResponseBody(responseBody, responseBodySize) == ESP_OK);
+    TEST_ASSERT(requestBody == std::string(responseBody, responseBodySize));
+  }
+  TEST_ASSERT_EQUAL(1, server.GetNumberOfConnections());
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+
+  // Pipelining: the requests sent together are answered in order
+  int sockfd = ConnectRawClient(epollServerPort);
+  TEST_ASSERT(sockfd >= 0);
+  std::string pipelinedRequests = "POST " + correctRequestUri + " HTTP/1.1\r\nContent-Length: " + std::to_string(requestBody.size()) + "\r\n\r\n" + requestBody +
+                                  "GET " + incorrectRequestUri + " HTTP/1.1\r\n\r\nGET " + correctRequestUri + " HTTP/1.1\r\n\r\n";
+  std::string pipelinedResponses = GetEpollResponse(200, requestBody) + GetEpollResponse(404, "") + GetEpollResponse(200, "");
+  TEST_ASSERT(SendRaw(sockfd, pipelinedRequests));
+  TEST_ASSERT(ReceiveRaw(sockfd, pipelinedResponses.size()) == pipelinedResponses);
+
+  // "Expect: 100-continue": the interim response is sent when the handler reads the body
+  TEST_ASSERT(SendRaw(sockfd, "POST " + correctRequestUri + " HTTP/1.1\r\nContent-Length: " + std::to_string(requestBody.size()) +
+                              "\r\nExpect: 100-continue\r\n\r\n"));
+  TEST_ASSERT(ReceiveRaw(sockfd, continueResponse.size()) == continueResponse);
+  TEST_ASSERT(SendRaw(sockfd, requestBody));
+  TEST_ASSERT(ReceiveRaw(sockfd, GetEpollResponse(200, requestBody).size()) == GetEpollResponse(200, requestBody));
+
+  // A client sending the body slowly does not block the other connections of the worker. Its request is answered with 408 after the read timeout.
+  TEST_ASSERT(SendRaw(sockfd, "POST " + correctRequestUri + " HTTP/1.1\r\nContent-Length: " + std::to_string(requestBody.size()) + "\r\n\r\n"));
+  TickType_t startTime = xTaskGetTickCount();
+  TEST_ASSERT(client.WriteRequest(correctRequestMethod, correctRequestUri) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(200, responseStatusCode);
+  TEST_ASSERT(xTaskGetTickCount() - startTime < epollReadTimeout);
+  TEST_ASSERT(ReceiveRaw(sockfd, 12) == "HTTP/1.1 408");
+  close(sockfd);
+
+  // The request head should be received within the read timeout from its first byte
+  sockfd = ConnectRawClient(epollServerPort);
+  TEST_ASSERT(sockfd >= 0);
+  TEST_ASSERT(SendRaw(sockfd, "GET " + correctRequestUri + " HTTP/1.1\r\n"));
+  TEST_ASSERT(ReceiveRaw(sockfd, 12) == "HTTP/1.1 408");
+  char data;
+  TEST_ASSERT_EQUAL(0, recv(sockfd, &data, 1, 0));
+  close(sockfd);
+
+  // The request timeout limits the body receive below the read timeout
+  TEST_ASSERT_EQUAL(PL::HttpEpollServer::defaultRequestTimeout, server.GetRequestTimeout());
+  TEST_ASSERT(server.SetRequestTimeout(requestTimeout) == ESP_OK);
+  TEST_ASSERT_EQUAL(requestTimeout, server.GetRequestTimeout());
+  startTime = xTaskGetTickCount();
+  TEST_ASSERT(client.WriteRequestHeaders(incorrectRequestMethod, correctRequestUri, requestBody.size()) == ESP_OK);
+  TEST_ASSERT(client.WriteRequestBody(requestBody.data(), requestBody.size() / 2) == ESP_OK);
+  TEST_ASSERT(client.ReadResponseHeaders(responseStatusCode, NULL) == ESP_OK);
+  TEST_ASSERT_EQUAL(408, responseStatusCode);
+  TEST_ASSERT(xTaskGetTickCount() - startTime < epollReadTimeout);
+  TEST_ASSERT(client.Disconnect() == ESP_OK);
+
+  TEST_ASSERT(server.Disable() == ESP_OK);
+}
+
+#endif
@@ -2,6 +2,8 @@
 
 //==============================================================================
 
+#ifndef CONFIG_IDF_TARGET_LINUX
+
 class HttpServer : public PL::HttpServer {
 public:
   using PL::HttpServer::HttpServer;
@@ -10,7 +12,17 @@ protected:
   esp_err_t HandleRequest(PL::HttpServerTransaction& transaction) override;
 };
 
+#endif
+
 //==============================================================================
 
+void TestHttpArena();
+#ifdef CONFIG_IDF_TARGET_LINUX
+void TestHttpEpollServer();
+#else
 void TestHttpServer();
-void TestHttpsServer();
\ No newline at end of file
+void TestHttpsServer();
+void TestHttpMiddleware();
+void TestHttpPayload();
+void TestHttpTracing();
+#endif
\ No newline at end of file
@@ -3,17 +3,23 @@
 #include "esp_netif.h"
 #include "http_client.h"
 #include "http_server.h"
+#include "http_parser.h"
+#include "http_load.h"
 
 //==============================================================================
 
+#ifndef CONFIG_IDF_TARGET_LINUX
 PL::EspWiFiStation wifi;
 const std::string wifiSsid = CONFIG_TEST_WIFI_SSID;
 const std::string wifiPassword = CONFIG_TEST_WIFI_PASSWORD;
+#endif
 
 //==============================================================================
 
 extern "C" void app_main(void) {
   ESP_ERROR_CHECK(esp_event_loop_create_default());
+#ifndef CONFIG_IDF_TARGET_LINUX
+  // The Linux target uses the host network
   ESP_ERROR_CHECK(esp_netif_init());
 
   ESP_ERROR_CHECK(wifi.Initialize());
@@ -24,11 +30,30 @@ extern "C" void app_main(void) {
 
   while (!wifi.GetIpV4Address().u32)  
     vTaskDelay(1);
+#endif
 
   UNITY_BEGIN();
   RUN_TEST(TestHttpClient);
   RUN_TEST(TestHttpsClient);
+  RUN_TEST(TestHttpAsyncClient);
+  RUN_TEST(TestHttpUploadQueue);
+  RUN_TEST(TestHttpUploadQueueSpillFile);
+  RUN_TEST(TestHttpArena);
+  RUN_TEST(TestHttpRequestParser);
+  RUN_TEST(TestHttpResponseParser);
+  RUN_TEST(TestHttpParserPerformance);
+  RUN_TEST(TestHttpLatencyHistogram);
+#ifdef CONFIG_IDF_TARGET_LINUX
+  // httpd is not available on the Linux target: the servers are tested with HttpEpollServer
+  RUN_TEST(TestHttpEpollServer);
+  RUN_TEST(TestHttpLinkEmulator);
+#else
   RUN_TEST(TestHttpServer);
   RUN_TEST(TestHttpsServer);
+  RUN_TEST(TestHttpMiddleware);
+  RUN_TEST(TestHttpPayload);
+  RUN_TEST(TestHttpTracing);
+  RUN_TEST(TestHttpLoadGenerator);
+#endif
   UNITY_END();
 }
\ No newline at end of file